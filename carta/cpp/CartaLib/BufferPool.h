@@ -0,0 +1,145 @@
+/**
+ * Process wide free lists of buffers for the raster image hot path.
+ **/
+
+#pragma once
+
+#include "CartaLib.h"
+#include "MemoryBudget.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <list>
+#include <vector>
+
+namespace Carta
+{
+namespace Lib
+{
+/// \brief Recycles vectors instead of allocating (and zero filling) them again.
+/// \details acquire() hands out a vector of the requested size whose contents are
+/// unspecified. Recycled vectors keep their capacity, so neither the allocator nor the
+/// page faults of fresh memory are involved when they are big enough. release() puts a
+/// vector back for the next request.
+/// At most maxBuffers idle vectors of together maxBytes are kept, the biggest are
+/// dropped first. Idle vectors count towards the MemoryBudget and are the first thing
+/// to go when it runs short.
+template < typename T >
+class BufferPool
+{
+    CLASS_BOILERPLATE( BufferPool );
+
+public:
+
+    typedef std::vector < T > Buffer;
+
+    /// the shared pool of this element type
+    static BufferPool &
+    instance()
+    {
+        static BufferPool * pool = new BufferPool();
+        return * pool;
+    }
+
+    /// \brief returns a vector of count elements
+    /// \details the smallest idle vector that is big enough but not much bigger,
+    /// otherwise a new one
+    Buffer
+    acquire( size_t count )
+    {
+        Buffer buffer;
+        {
+            QMutexLocker locker( & m_mutex );
+            auto best = m_idle.end();
+            for ( auto it = m_idle.begin() ; it != m_idle.end() ; ++it ) {
+                if ( it-> capacity() >= count && it-> capacity() <= 2 * count + minCapacity &&
+                     ( best == m_idle.end() || it-> capacity() < best-> capacity() ) ) {
+                    best = it;
+                }
+            }
+            if ( best != m_idle.end() ) {
+                buffer.swap( * best );
+                m_idle.erase( best );
+                _account( - _bytes( buffer ) );
+            }
+        }
+        buffer.resize( count );
+        return buffer;
+    } // acquire
+
+    /// put a vector back for reuse, the caller must not use it any more
+    void
+    release( Buffer && buffer )
+    {
+        if ( buffer.capacity() == 0 || _bytes( buffer ) > maxBytes ) {
+            return;
+        }
+        QMutexLocker locker( & m_mutex );
+        m_idle.emplace_back();
+        m_idle.back().swap( buffer );
+        _account( _bytes( m_idle.back() ) );
+        if ( m_idle.size() > maxBuffers || m_idleBytes > maxBytes ) {
+            _evict( m_idleBytes - maxBytes, maxBuffers );
+        }
+    }
+
+    /// small requests may use idle vectors of up to this many extra elements
+    static const size_t minCapacity = 64 * 1024;
+
+    /// most idle vectors kept
+    static const size_t maxBuffers = 64;
+
+    /// most bytes kept in idle vectors
+    static const qint64 maxBytes = 512LL * 1024 * 1024;
+
+private:
+
+    BufferPool()
+    {
+        Carta::Lib::MemoryBudget::instance().addReclaimer( "BufferPool", [this] ( qint64 wanted ) {
+                                                               QMutexLocker locker( & m_mutex );
+                                                               return _evict( wanted, m_idle.size() );
+                                                           }
+                                                           );
+    }
+
+    static qint64
+    _bytes( const Buffer & buffer )
+    {
+        return static_cast < qint64 > ( buffer.capacity() * sizeof( T ) );
+    }
+
+    /// record idle bytes, m_mutex must be held
+    void
+    _account( qint64 delta )
+    {
+        m_idleBytes += delta;
+        Carta::Lib::MemoryBudget::instance().account( delta );
+    }
+
+    /// drop the biggest idle vectors until wanted bytes are freed and at most
+    /// keep vectors are left, m_mutex must be held
+    qint64
+    _evict( qint64 wanted, size_t keep )
+    {
+        qint64 freed = 0;
+        while ( ! m_idle.empty() && ( freed < wanted || m_idle.size() > keep ) ) {
+            auto biggest = m_idle.begin();
+            for ( auto it = m_idle.begin() ; it != m_idle.end() ; ++it ) {
+                if ( it-> capacity() > biggest-> capacity() ) {
+                    biggest = it;
+                }
+            }
+            qint64 bytes = _bytes( * biggest );
+            m_idle.erase( biggest );
+            _account( - bytes );
+            freed += bytes;
+        }
+        return freed;
+    }
+
+    QMutex m_mutex;
+    std::list < Buffer > m_idle;
+    qint64 m_idleBytes = 0;
+};
+}
+}
@@ -0,0 +1,56 @@
+/**
+ * Cancellation of computations whose result is no longer wanted.
+ **/
+
+#include "Cancellation.h"
+
+namespace Carta
+{
+namespace Lib
+{
+namespace
+{
+Cancellation::Token &
+_current()
+{
+    thread_local Cancellation::Token token;
+    return token;
+}
+}
+
+Cancellation::Scope::Scope( Token token )
+{
+    m_previous = _current();
+    _current() = token;
+}
+
+Cancellation::Scope::~Scope()
+{
+    _current() = m_previous;
+}
+
+Cancellation::Token
+Cancellation::make()
+{
+    return std::make_shared < std::atomic < bool > > ( false );
+}
+
+Cancellation::Token
+Cancellation::current()
+{
+    return _current();
+}
+
+bool
+Cancellation::isCancelled( const Token & token )
+{
+    return token && token-> load();
+}
+
+bool
+Cancellation::isCancelled()
+{
+    return isCancelled( _current() );
+}
+}
+}
@@ -0,0 +1,64 @@
+/**
+ * Cancellation of computations whose result is no longer wanted.
+ **/
+
+#pragma once
+
+#include "CartaLib.h"
+#include <atomic>
+#include <memory>
+
+namespace Carta
+{
+namespace Lib
+{
+/// \brief Lets long computations give up once a newer request made them useless.
+/// \details The thread answering a request makes the token of the request current with
+/// a Scope. The computations it calls check isCancelled() between chunks of work and
+/// return early, usually nullptr. Workers started by such a computation don't see the
+/// token of their caller, they have to be handed current() and check it themselves.
+class Cancellation
+{
+public:
+
+    /// shared flag of a request, set once it is superseded
+    typedef std::shared_ptr < std::atomic < bool > > Token;
+
+    /// RAII scope making a token current for the calling thread
+    class Scope
+    {
+    public:
+
+        explicit
+        Scope( Token token );
+
+        /// restores the previous token
+        ~Scope();
+
+    private:
+
+        Token m_previous;
+
+        Scope( const Scope & other );
+        Scope &
+        operator= ( const Scope & other );
+    };
+
+    /// a new token that is not cancelled
+    static Token
+    make();
+
+    /// the current token of the calling thread, nullptr if it has none
+    static Token
+    current();
+
+    /// is the token cancelled? false for nullptr
+    static bool
+    isCancelled( const Token & token );
+
+    /// is the current token of the calling thread cancelled?
+    static bool
+    isCancelled();
+};
+}
+}
@@ -47,6 +47,9 @@ SOURCES += \
     Hooks/ProfileResult.cpp \
     IImage.cpp \
     PixelType.cpp \
+    PixelMask.cpp \
+    MemoryBudget.cpp \
+    Cancellation.cpp \
     Slice.cpp \
     AxisInfo.cpp \
     AxisLabelInfo.cpp \
@@ -79,6 +82,10 @@ HEADERS += \
     IPlugin.h \
     IImage.h \
     PixelType.h \
+    PixelMask.h \
+    MemoryBudget.h \
+    BufferPool.h \
+    Cancellation.h \
     Nullable.h \
     Slice.h \
     AxisInfo.h \
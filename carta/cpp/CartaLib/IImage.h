@@ -19,17 +19,23 @@
 
 #pragma once
 
+#include "CartaLib.h"
 #include "PixelType.h"
+#include "PixelMask.h"
 #include "Nullable.h"
 #include "Slice.h"
 #include "ICoordinateFormatter.h"
 #include "IPlotLabelGenerator.h"
 #include "Regions/ICoordSystem.h"
 #include <QObject>
+#include <QMutex>
+#include <QDebug>
+#include <algorithm>
 #include <functional>
 #include <initializer_list>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace Carta
 {
@@ -129,8 +135,8 @@ public:
     getView( const SliceND & sliceInfo ) = 0;
 
     // ===-----------------------------------------------------------------------===
-    // experimental APIs below, not yet finalized and definitely not yet implemented
-    // Probably we'll only implement one of these, not all of them.
+    // block APIs below, all sizes are in bytes and counts in elements. Use these
+    // instead of the per-element forEach() for anything that scans a lot of pixels.
     // ===-----------------------------------------------------------------------===
 
     /// \brief High performance data accessor #1, motivated by unix's read().
@@ -159,7 +165,7 @@ public:
 
     /// yet another high performance accessor... similar to forEach above,
     /// but the supplied function gets called with multiple pixel data
-    /// (however many fit into the buffer)
+    /// (however many fit into the buffer of buffSize bytes)
     ///
     /// I think I like this one the most.
     virtual void
@@ -167,8 +173,171 @@ public:
              std::function < void (const char *, int64_t count) > func,
              char * buff = nullptr,
              Traversal traversal = Traversal::Sequential ) = 0;
+
+    /// \brief Return the pixel mask of this view.
+    /// \return the mask, with bits in the order of a sequential traversal, or nullptr
+    /// if all pixels are valid (the default)
+    virtual PixelMask::SharedPtr
+    pixelMask()
+    {
+        return nullptr;
+    }
+
+    /// \brief Block forEach() that leaves out the pixels masked by pixelMask().
+    /// \details func gets the valid pixels of each block, compacted, fully masked
+    /// blocks are skipped. The default implementation needs the mask of the whole
+    /// view and therefore traverses sequentially if there is one, implementations
+    /// should override it to query the mask piece by piece in the order they read.
+    virtual void
+    forEachValid( int64_t buffSize,
+                  std::function < void (const char *, int64_t count) > func,
+                  Traversal traversal = Traversal::Sequential )
+    {
+        PixelMask::SharedPtr mask = pixelMask();
+        if ( ! mask ) {
+            forEach( buffSize, func, nullptr, traversal );
+            return;
+        }
+
+        // the mask is in sequential order, so the traversal has to be as well
+        int64_t pixelSize = Image::pixelType2size( pixelType() );
+        int64_t first = 0;
+        std::vector < char > scratch;
+        forEach( buffSize, [& func, & mask, & first, & scratch, pixelSize] ( const char * ptr, int64_t count ) {
+            int64_t nValid = mask->countValid( first, count );
+            if ( nValid == count ) {
+                func( ptr, count );
+            }
+            else if ( nValid > 0 ) {
+                scratch.resize( nValid * pixelSize );
+                int64_t n = 0;
+                for ( int64_t i = 0 ; i < count ; i++ ) {
+                    if ( mask->get( first + i ) ) {
+                        std::copy( ptr + i * pixelSize, ptr + ( i + 1 ) * pixelSize, scratch.data() + n * pixelSize );
+                        n++;
+                    }
+                }
+                func( scratch.data(), n );
+            }
+            first += count;
+        }, nullptr, Traversal::Sequential );
+    }
+
+    /// \brief Read a one dimensional line of pixels, e.g. a row, a column or
+    /// any strided part of them.
+    /// \param pos position of the first pixel of the line
+    /// \param axis the axis along which the line runs
+    /// \param count number of pixels to read, -1 means up to the end of the axis
+    /// \param step distance between consecutive pixels along the axis (>= 1)
+    /// \param buff where to store the pixels, has to be large enough for count pixels
+    /// \return number of pixels stored in buff
+    /// \note the default implementation goes through getView() and the block forEach(),
+    /// implementations should override it with a single strided read
+    virtual int64_t
+    readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff )
+    {
+        count = _lineCount( pos, axis, count, step );
+        if ( count <= 0 ) {
+            return 0;
+        }
+
+        SliceND slice;
+        for ( int i = 0 ; i < int( pos.size() ) ; i++ ) {
+            if ( i > 0 ) {
+                slice.next();
+            }
+            if ( i == axis ) {
+                slice.start( pos[i] ).end( pos[i] + ( count - 1 ) * step + 1 ).step( step );
+            }
+            else {
+                slice.start( pos[i] ).end( pos[i] + 1 );
+            }
+        }
+        std::unique_ptr < RawViewInterface > lineView( getView( slice ) );
+        int64_t pixelSize = Image::pixelType2size( pixelType() );
+        int64_t filled = 0;
+        lineView->forEach( count * pixelSize, [buff, pixelSize, & filled] ( const char * ptr, int64_t n ) {
+            std::copy( ptr, ptr + n * pixelSize, buff + filled * pixelSize );
+            filled += n;
+        } );
+        return filled;
+    }
+
+protected:
+
+    /// number of pixels readLine() can actually return for the given request
+    int64_t
+    _lineCount( const VI & pos, int axis, int64_t count, int64_t step )
+    {
+        const VI & viewDims = dims();
+        CARTA_ASSERT( pos.size() == viewDims.size() && 0 <= axis && axis < int( pos.size() ) );
+        CARTA_ASSERT( step >= 1 );
+        int64_t maxCount = ( viewDims[axis] - pos[axis] + step - 1 ) / step;
+        if ( count < 0 || count > maxCount ) {
+            count = maxCount;
+        }
+        return count;
+    }
 };
 
+/// forEachSpan() for a known pixel type T
+template < typename T, class Kernel >
+void
+forEachSpanTyped( RawViewInterface * view, Kernel & kernel, int64_t blockSize,
+                  RawViewInterface::Traversal traversal )
+{
+    auto wrapper = [& kernel] ( const char * ptr, int64_t count )->void
+    {
+        kernel( reinterpret_cast < const T * > ( ptr ), count );
+    };
+    view->forEachValid( blockSize * sizeof( T ), wrapper, traversal );
+}
+
+/// \brief Visit a raw view in blocks of its native pixel type.
+/// \details The pixel type is looked up once per call, after that kernel is invoked
+/// as kernel( const T * data, int64_t count ) for each block, with T being the type the
+/// pixels are stored in (uint8_t, int16_t, int32_t, int64_t, float or double). The
+/// kernel is typically a struct with a templated operator(), so that the inner loop
+/// is compiled for each pixel type, runs over a plain array and no per-pixel
+/// conversion or indirect call is involved.
+///
+/// Pixels masked out by the view's pixelMask() are not passed to the kernel (blocks
+/// are compacted, fully masked blocks skipped, see RawViewInterface::forEachValid()),
+/// so the kernel must not depend on the position of the pixels within a block.
+/// \param view the view to visit
+/// \param kernel the kernel to invoke on each block
+/// \param blockSize maximum number of elements handed out in one call
+/// \param traversal order of traversal
+template < class Kernel >
+void
+forEachSpan( RawViewInterface * view, Kernel & kernel, int64_t blockSize = 64 * 1024,
+             RawViewInterface::Traversal traversal = RawViewInterface::Traversal::Sequential )
+{
+    switch ( view->pixelType() ) {
+    case Image::PixelType::Byte:
+        forEachSpanTyped < uint8_t > ( view, kernel, blockSize, traversal );
+        break;
+    case Image::PixelType::Int16:
+        forEachSpanTyped < int16_t > ( view, kernel, blockSize, traversal );
+        break;
+    case Image::PixelType::Int32:
+        forEachSpanTyped < int32_t > ( view, kernel, blockSize, traversal );
+        break;
+    case Image::PixelType::Int64:
+        forEachSpanTyped < int64_t > ( view, kernel, blockSize, traversal );
+        break;
+    case Image::PixelType::Real32:
+        forEachSpanTyped < float > ( view, kernel, blockSize, traversal );
+        break;
+    case Image::PixelType::Real64:
+        forEachSpanTyped < double > ( view, kernel, blockSize, traversal );
+        break;
+    default:
+        qWarning() << "forEachSpan: unsupported pixel type" << static_cast < int > ( view->pixelType() );
+        break;
+    }
+}
+
 /// Utility class that wraps a raw view into a typed view.
 template < typename Type >
 class TypedView
@@ -179,6 +348,9 @@ public:
 
     typedef std::vector < int > VI;
 
+    /// reasonable number of elements per block for the block forEach
+    static constexpr int64_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
     /// \brief Construct a typed view from raw view.
     /// \details The raw view must exist for the duration of existance of the TypedView.
     /// \param [in] rawView pointer to the raw view
@@ -223,6 +395,107 @@ public:
         m_rawView->forEach( wrapper, traversal );
     }
 
+    /// block version of forEach, func is invoked with contiguous blocks of up to
+    /// blockSize elements, which avoids the per-element indirect call
+    /// \param blockSize maximum number of elements handed out in one call
+    /// \param func function to invoke on each block
+    /// \param traversal order of traversal
+    void
+    forEach(
+        int64_t blockSize,
+        std::function < void (const Type *, int64_t) > func,
+        RawViewInterface::Traversal traversal = RawViewInterface::Traversal::Sequential )
+    {
+        Image::PixelType srcType = m_rawView->pixelType();
+        int64_t srcSize = Image::pixelType2size( srcType );
+
+        // no conversion needed, hand out the raw blocks directly
+        if ( srcType == Image::CType2PixelType < Type >::type ) {
+            auto wrapper = [& func] ( const char * ptr, int64_t count )->void
+            {
+                func( reinterpret_cast < const Type * > ( ptr ), count );
+            };
+            m_rawView->forEach( blockSize * srcSize, wrapper, nullptr, traversal );
+            return;
+        }
+
+        // otherwise convert each block first
+        std::vector < Type > converted( blockSize );
+        auto wrapper = [this, & func, & converted, srcSize] ( const char * ptr, int64_t count )->void
+        {
+            for ( int64_t i = 0 ; i < count ; i++ ) {
+                converted[i] = m_converterFunc( ptr + i * srcSize );
+            }
+            func( converted.data(), count );
+        };
+        m_rawView->forEach( blockSize * srcSize, wrapper, nullptr, traversal );
+    }
+
+    /// same as the block forEach() above, except that pixels masked out by the
+    /// view's pixelMask() are left out (see RawViewInterface::forEachValid())
+    void
+    forEachValid(
+        int64_t blockSize,
+        std::function < void (const Type *, int64_t) > func,
+        RawViewInterface::Traversal traversal = RawViewInterface::Traversal::Sequential )
+    {
+        Image::PixelType srcType = m_rawView->pixelType();
+        int64_t srcSize = Image::pixelType2size( srcType );
+        if ( srcType == Image::CType2PixelType < Type >::type ) {
+            auto wrapper = [& func] ( const char * ptr, int64_t count )->void
+            {
+                func( reinterpret_cast < const Type * > ( ptr ), count );
+            };
+            m_rawView->forEachValid( blockSize * srcSize, wrapper, traversal );
+            return;
+        }
+
+        // the compacted blocks hold at most blockSize pixels as well
+        std::vector < Type > converted( blockSize );
+        auto wrapper = [this, & func, & converted, srcSize] ( const char * ptr, int64_t count )->void
+        {
+            for ( int64_t i = 0 ; i < count ; i++ ) {
+                converted[i] = m_converterFunc( ptr + i * srcSize );
+            }
+            func( converted.data(), count );
+        };
+        m_rawView->forEachValid( blockSize * srcSize, wrapper, traversal );
+    }
+
+    /// read a one dimensional line (row, column, ...) converted to Type, see
+    /// RawViewInterface::readLine()
+    std::vector < Type >
+    readLine( const VI & pos, int axis, int64_t count = - 1, int64_t step = 1 )
+    {
+        Image::PixelType srcType = m_rawView->pixelType();
+        int64_t srcSize = Image::pixelType2size( srcType );
+        std::vector < char > raw( std::max( 1, m_rawView->dims()[axis] ) * srcSize );
+        int64_t n = m_rawView->readLine( pos, axis, count, step, raw.data() );
+
+        std::vector < Type > result( n );
+        if ( srcType == Image::CType2PixelType < Type >::type ) {
+            std::copy( raw.data(), raw.data() + n * srcSize, reinterpret_cast < char * > ( result.data() ) );
+        }
+        else {
+            for ( int64_t i = 0 ; i < n ; i++ ) {
+                result[i] = m_converterFunc( raw.data() + i * srcSize );
+            }
+        }
+        return result;
+    }
+
+    /// visit the underlying data in its native pixel type, bypassing the conversion
+    /// to Type, see NdArray::forEachSpan()
+    template < class Kernel >
+    void
+    forEachSpan(
+        Kernel & kernel,
+        int64_t blockSize = DEFAULT_BLOCK_SIZE,
+        RawViewInterface::Traversal traversal = RawViewInterface::Traversal::Sequential )
+    {
+        NdArray::forEachSpan( m_rawView, kernel, blockSize, traversal );
+    }
+
     ~TypedView()
     {
         if ( m_keepOwnership ) {
@@ -414,6 +687,50 @@ public:
     /// the image
     virtual Image::MetaDataInterface::SharedPtr
     metaData() = 0;
+
+    /// \brief down sampling factors of the precomputed versions of this image
+    /// \return factors (block sizes along the first two axes) for which
+    /// getMipSlice() works, empty if there are none (the default)
+    virtual std::vector < int >
+    mipLevels() const
+    {
+        return { };
+    }
+
+    /// \brief get slice of a precomputed down sampled version of this image
+    /// \param mip the down sampling factor, one of mipLevels()
+    /// \param sliceInfo which slice to get, in the coordinates of the down sampled
+    /// image: its first two dimensions are ceil(dims / mip), pixel (i, j) is the mean
+    /// of the finite pixels of the mip x mip block starting at (i * mip, j * mip)
+    /// \return a new view, or nullptr if there is no such version
+    virtual NdArray::RawViewInterface *
+    getMipSlice( int mip, const SliceND & sliceInfo )
+    {
+        Q_UNUSED( mip );
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    /// \brief can lines along the axis be read without touching every plane?
+    /// \details True if the image stores a copy of its pixels with this axis
+    /// first, which readLine() of its views then uses. Mainly useful for spectral
+    /// profiles. The default is false.
+    virtual bool
+    hasFastLineAccess( int axis ) const
+    {
+        Q_UNUSED( axis );
+        return false;
+    }
+
+    /// \brief lock serializing the reads of this image, nullptr if it needs none
+    /// \details Views take it themselves. Code that uses the image (or objects of
+    /// its library, like coordinate systems) directly has to hold it meanwhile. The
+    /// default is nullptr, QMutexLocker accepts that.
+    virtual QMutex *
+    readLock() const
+    {
+        return nullptr;
+    }
 };
 } // namespace Image
 }
@@ -85,6 +85,10 @@ struct PluginJson {
 
     /// list of depenencies of the plugin
     QStringList depends;
+
+    /// plugins with higher priority get to handle hooks first (default is 0),
+    /// e.g. a specialized image loader can answer before a generic one
+    int priority = 0;
 };
 
 /// plugin interface
@@ -0,0 +1,160 @@
+/**
+ * Process wide accounting of the memory used for image data.
+ **/
+
+#include "MemoryBudget.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace Carta
+{
+namespace Lib
+{
+MemoryBudget::Reservation::Reservation( qint64 bytes )
+{
+    m_ok = MemoryBudget::instance().reserve( bytes );
+    if ( m_ok ) {
+        m_bytes = bytes;
+    }
+}
+
+MemoryBudget::Reservation::Reservation( Reservation && other )
+{
+    m_bytes = other.m_bytes;
+    m_ok = other.m_ok;
+    other.m_bytes = 0;
+    other.m_ok = false;
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    release();
+}
+
+void
+MemoryBudget::Reservation::release()
+{
+    if ( m_bytes > 0 ) {
+        MemoryBudget::instance().release( m_bytes );
+    }
+    m_bytes = 0;
+}
+
+MemoryBudget &
+MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget()
+{ }
+
+void
+MemoryBudget::setMaxBytes( qint64 maxBytes )
+{
+    {
+        QMutexLocker locker( & m_mutex );
+        m_maxBytes = std::max < qint64 > ( 0, maxBytes );
+    }
+    qDebug() << "MemoryBudget set to" << maxBytes / ( 1024 * 1024 ) << "MB";
+}
+
+qint64
+MemoryBudget::maxBytes() const
+{
+    QMutexLocker locker( & m_mutex );
+    return m_maxBytes;
+}
+
+qint64
+MemoryBudget::usedBytes() const
+{
+    QMutexLocker locker( & m_mutex );
+    return m_usedBytes;
+}
+
+bool
+MemoryBudget::reserve( qint64 bytes )
+{
+    if ( bytes <= 0 ) {
+        return true;
+    }
+    qint64 missing = 0;
+    {
+        QMutexLocker locker( & m_mutex );
+        if ( m_maxBytes == 0 || m_usedBytes + bytes <= m_maxBytes ) {
+            m_usedBytes += bytes;
+            return true;
+        }
+        if ( bytes > m_maxBytes ) {
+            qWarning() << "MemoryBudget: request of" << bytes << "bytes exceeds the budget";
+            return false;
+        }
+        missing = m_usedBytes + bytes - m_maxBytes;
+    }
+
+    _reclaim( missing );
+
+    QMutexLocker locker( & m_mutex );
+    if ( m_usedBytes + bytes <= m_maxBytes ) {
+        m_usedBytes += bytes;
+        return true;
+    }
+    qDebug() << "MemoryBudget: could not reserve" << bytes << "bytes, used"
+             << m_usedBytes << "of" << m_maxBytes;
+    return false;
+} // reserve
+
+void
+MemoryBudget::release( qint64 bytes )
+{
+    account( - bytes );
+}
+
+void
+MemoryBudget::account( qint64 delta )
+{
+    QMutexLocker locker( & m_mutex );
+    m_usedBytes += delta;
+    if ( m_usedBytes < 0 ) {
+        qWarning() << "MemoryBudget: released more than was used";
+        m_usedBytes = 0;
+    }
+}
+
+int
+MemoryBudget::addReclaimer( const QString & name, Reclaimer reclaimer )
+{
+    QMutexLocker locker( & m_reclaimMutex );
+    int id = m_nextId++;
+    m_reclaimers[id] = std::make_pair( name, reclaimer );
+    return id;
+}
+
+void
+MemoryBudget::removeReclaimer( int id )
+{
+    QMutexLocker locker( & m_reclaimMutex );
+    m_reclaimers.erase( id );
+}
+
+void
+MemoryBudget::_reclaim( qint64 wanted )
+{
+    // one reclaim at a time, concurrent requests find the memory freed by it
+    QMutexLocker locker( & m_reclaimMutex );
+    for ( auto & entry : m_reclaimers ) {
+        if ( wanted <= 0 ) {
+            break;
+        }
+        qint64 freed = entry.second.second( wanted );
+        if ( freed > 0 ) {
+            qDebug() << "MemoryBudget: reclaimed" << freed << "bytes from" << entry.second.first;
+            wanted -= freed;
+        }
+    }
+}
+}
+}
@@ -0,0 +1,128 @@
+/**
+ * Process wide accounting of the memory used for image data.
+ **/
+
+#pragma once
+
+#include "CartaLib.h"
+#include <QMutex>
+#include <QString>
+#include <functional>
+#include <map>
+
+namespace Carta
+{
+namespace Lib
+{
+/// \brief Process wide memory budget for image data, shared by all sessions.
+/// \details Large allocations are registered here in one of two ways:
+///
+/// - Buffers that are needed to answer a request (plane buffers, percentile scratch,
+///   down sampled copies being built) reserve their size up front with reserve() or a
+///   Reservation. If the budget can't hold them, the caller has to fall back to an
+///   algorithm that needs less memory, or fail the request, instead of allocating.
+/// - Caches report what they hold with account(), which always succeeds, and register
+///   a reclaimer. When a reservation does not fit, reclaimers are asked to free memory
+///   until it does.
+///
+/// A budget of 0 (the default) means unlimited; the usage is still tracked.
+class MemoryBudget
+{
+    CLASS_BOILERPLATE( MemoryBudget );
+
+public:
+
+    /// Frees cached memory, is passed the number of bytes wanted and returns the number
+    /// of bytes actually freed (which the cache also reports with account()). It is
+    /// called without any lock of the budget held, possibly from any thread.
+    typedef std::function < qint64 (qint64 wanted) > Reclaimer;
+
+    /// RAII reservation, released when it goes out of scope.
+    class Reservation
+    {
+    public:
+
+        /// try to reserve bytes, check ok() to see if it worked
+        explicit
+        Reservation( qint64 bytes );
+
+        Reservation( Reservation && other );
+
+        ~Reservation();
+
+        /// is the memory reserved?
+        bool
+        ok() const
+        {
+            return m_ok;
+        }
+
+        /// give the memory back early
+        void
+        release();
+
+    private:
+
+        qint64 m_bytes = 0;
+        bool m_ok = false;
+
+        Reservation( const Reservation & other );
+        Reservation &
+        operator= ( const Reservation & other );
+    };
+
+    /// the shared instance
+    static MemoryBudget &
+    instance();
+
+    /// set the budget, 0 means unlimited
+    void
+    setMaxBytes( qint64 maxBytes );
+
+    qint64
+    maxBytes() const;
+
+    /// bytes reserved and accounted for
+    qint64
+    usedBytes() const;
+
+    /// Reserve memory, reclaiming cached memory if necessary.
+    /// \return false if the budget can't hold it, nothing is reserved then
+    bool
+    reserve( qint64 bytes );
+
+    /// give back memory obtained with reserve()
+    void
+    release( qint64 bytes );
+
+    /// record memory held by a cache (positive) or freed by it (negative)
+    void
+    account( qint64 delta );
+
+    /// register a reclaimer, returns an id for removeReclaimer()
+    int
+    addReclaimer( const QString & name, Reclaimer reclaimer );
+
+    /// unregister a reclaimer, waits if it is running
+    void
+    removeReclaimer( int id );
+
+private:
+
+    MemoryBudget();
+
+    /// ask the reclaimers for the given number of bytes
+    void
+    _reclaim( qint64 wanted );
+
+    mutable QMutex m_mutex;
+    qint64 m_maxBytes = 0;
+    qint64 m_usedBytes = 0;
+
+    /// serializes reclaiming and changes of the reclaimers
+    QMutex m_reclaimMutex;
+    std::map < int, std::pair < QString, Reclaimer > > m_reclaimers;
+    int m_nextId = 0;
+};
+}
+}
@@ -0,0 +1,101 @@
+/**
+ *
+ **/
+
+#include "PixelMask.h"
+
+namespace Carta
+{
+namespace Lib
+{
+namespace NdArray
+{
+namespace
+{
+/// number of set bits
+inline int
+popcount( uint64_t word )
+{
+    return __builtin_popcountll( word );
+}
+
+/// mask with the lowest n bits set, n in [0, 64]
+inline uint64_t
+lowBits( int n )
+{
+    return n >= 64 ? ~ uint64_t( 0 ) : ( uint64_t( 1 ) << n ) - 1;
+}
+}
+
+PixelMask::PixelMask( int64_t nPixels, bool valid )
+{
+    m_size = nPixels;
+    m_words.resize( ( nPixels + 63 ) / 64, valid ? ~ uint64_t( 0 ) : 0 );
+
+    // keep the unused bits of the last word cleared, so that whole words can be
+    // counted
+    if ( valid && nPixels % 64 ) {
+        m_words.back() = lowBits( nPixels % 64 );
+    }
+}
+
+void
+PixelMask::setRange( int64_t first, int64_t count, const bool * valid )
+{
+    CARTA_ASSERT( first >= 0 && first + count <= m_size );
+    for ( int64_t i = 0 ; i < count ; i++ ) {
+        set( first + i, valid[i] );
+    }
+}
+
+int64_t
+PixelMask::countValid( int64_t first, int64_t count ) const
+{
+    CARTA_ASSERT( first >= 0 && count >= 0 && first + count <= m_size );
+    if ( count == 0 ) {
+        return 0;
+    }
+    int64_t last = first + count; // one past the end
+    int64_t w0 = first >> 6;
+    int64_t w1 = ( last - 1 ) >> 6;
+    uint64_t headMask = ~ lowBits( first & 63 );
+    uint64_t tailMask = lowBits( int( ( last - 1 ) & 63 ) + 1 );
+
+    if ( w0 == w1 ) {
+        return popcount( m_words[w0] & headMask & tailMask );
+    }
+    int64_t result = popcount( m_words[w0] & headMask );
+    for ( int64_t w = w0 + 1 ; w < w1 ; w++ ) {
+        result += popcount( m_words[w] );
+    }
+    result += popcount( m_words[w1] & tailMask );
+    return result;
+}
+
+std::vector < PixelMask::Run >
+PixelMask::runs( bool valid ) const
+{
+    std::vector < Run > result;
+    int64_t i = 0;
+    while ( i < m_size ) {
+        // skip whole words that can't contain the start of a run
+        uint64_t word = valid ? m_words[i >> 6] : ~ m_words[i >> 6];
+        if ( ( i & 63 ) == 0 && word == 0 ) {
+            i += 64;
+            continue;
+        }
+        if ( get( i ) != valid ) {
+            i++;
+            continue;
+        }
+        int64_t start = i;
+        while ( i < m_size && get( i ) == valid ) {
+            i++;
+        }
+        result.push_back( { start, i - start } );
+    }
+    return result;
+}
+}
+}
+}
@@ -0,0 +1,113 @@
+/**
+ * Pixel masks of n-dimensional views, packed one bit per pixel.
+ **/
+
+#pragma once
+
+#include "CartaLib.h"
+#include <cstdint>
+#include <vector>
+
+namespace Carta
+{
+namespace Lib
+{
+namespace NdArray
+{
+/// \brief Pixel mask of a view, one bit per pixel.
+/// \details Bits are stored in the same order as the pixels of a sequential traversal
+/// of the view (first axis fastest). A set bit marks a valid pixel, a cleared bit a
+/// masked (blanked) one. Besides single bits the mask answers questions about whole
+/// ranges word by word, so that consumers can skip fully masked blocks without looking
+/// at the pixels, and it can list its runs for sparse masks.
+class PixelMask
+{
+    CLASS_BOILERPLATE( PixelMask );
+
+public:
+
+    /// a range [start, start + length) of pixels with the same mask value
+    struct Run {
+        int64_t start;
+        int64_t length;
+    };
+
+    /// create a mask of nPixels pixels, all valid or all masked
+    PixelMask( int64_t nPixels = 0, bool valid = true );
+
+    /// number of pixels covered by the mask
+    int64_t
+    size() const
+    {
+        return m_size;
+    }
+
+    /// is the pixel with index i valid?
+    bool
+    get( int64_t i ) const
+    {
+        return ( m_words[i >> 6] >> ( i & 63 ) ) & 1;
+    }
+
+    /// mark the pixel with index i as valid or masked
+    void
+    set( int64_t i, bool valid )
+    {
+        uint64_t bit = uint64_t( 1 ) << ( i & 63 );
+        if ( valid ) {
+            m_words[i >> 6] |= bit;
+        }
+        else {
+            m_words[i >> 6] &= ~ bit;
+        }
+    }
+
+    /// set count bits starting at first from an array of booleans (e.g. casacore's
+    /// mask storage)
+    void
+    setRange( int64_t first, int64_t count, const bool * valid );
+
+    /// number of valid pixels in [first, first + count)
+    int64_t
+    countValid( int64_t first, int64_t count ) const;
+
+    /// number of valid pixels in the whole mask
+    int64_t
+    countValid() const
+    {
+        return countValid( 0, m_size );
+    }
+
+    /// are all pixels in [first, first + count) valid?
+    bool
+    allValid( int64_t first, int64_t count ) const
+    {
+        return countValid( first, count ) == count;
+    }
+
+    /// are all pixels in [first, first + count) masked?
+    bool
+    noneValid( int64_t first, int64_t count ) const
+    {
+        return countValid( first, count ) == 0;
+    }
+
+    /// list the runs of valid (or masked) pixels, in increasing order
+    std::vector < Run >
+    runs( bool valid = true ) const;
+
+    /// the packed bits, 64 pixels per word, pixel i is bit (i % 64) of word (i / 64)
+    const std::vector < uint64_t > &
+    words() const
+    {
+        return m_words;
+    }
+
+protected:
+
+    int64_t m_size = 0;
+    std::vector < uint64_t > m_words;
+};
+}
+}
+}
@@ -136,10 +136,11 @@ struct TypedConverters < SrcType, SrcType > {
 };
 
 /// general case
+/// \note the buffer is per thread, views are read from several threads at once
 template <typename SrcType, typename DstType>
 struct TypedConverters {
     static const DstType & cvt( const char * ptr) {
-        static DstType buffer;
+        static thread_local DstType buffer;
         buffer = static_cast<DstType>(* reinterpret_cast<const SrcType *>( ptr));
         return buffer;
     }
@@ -7,6 +7,16 @@
 //QT_END_NAMESPACE
 #include <qmutex.h>
 
+/// Process-wide lock for the casacore calls that are genuinely not thread-safe:
+/// opening tables/images (shared table cache, FITS/MIRIAD openers), coordinate
+/// and measures conversions (static MeasTable/wcslib state) and FITS header
+/// conversion.
+///
+/// Pixel reads do NOT take this lock. Each image opened by the CasaImageLoader
+/// plugin has its own reader lock (see CCImageBase::readMutex()), so independent
+/// images can be read in parallel by different sessions/threads.
+///
+/// \note If both locks are needed, always acquire the per-image reader lock first.
 extern QMutex casa_mutex;
 
 #endif // GLOBALS_H
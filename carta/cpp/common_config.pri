@@ -11,6 +11,7 @@ WCSLIBDIR=../../ThirdParty/wcslib
 CFITSIODIR=../../ThirdParty/cfitsio
 IMAGEANALYSISDIR=../../ThirdParty/imageanalysis
 FLEXANDBISONDIR=../../ThirdParty/flex
+HDF5DIR=../../ThirdParty/hdf5
 
 # don't edit these:
 # relative links are replaced by absolute paths
@@ -21,3 +22,5 @@ WCSLIBDIR=$$absolute_path($${WCSLIBDIR})
 CFITSIODIR=$$absolute_path($${CFITSIODIR})
 IMAGEANALYSISDIR=$$absolute_path($${IMAGEANALYSISDIR})
 FLEXANDBISONDIR=$$absolute_path($${FLEXANDBISONDIR})
+# HDF5DIR is relative to the plugin directories, also where plugins.pro checks it
+HDF5DIR=$$absolute_path($${HDF5DIR}, $$PWD/plugins/Hdf5IdiaLoader)
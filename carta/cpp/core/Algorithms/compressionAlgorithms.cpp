@@ -0,0 +1,284 @@
+/**
+ * Algorithms for encoding raster images without ZFP
+ **/
+
+#include "compressionAlgorithms.h"
+
+#include <cstring>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+namespace
+{
+/// shortest match of the LZ4 format
+const size_t MIN_MATCH = 4;
+
+/// the last bytes of a block are always literals
+const size_t LAST_LITERALS = 5;
+
+/// the last match has to start this many bytes before the end of a block
+const size_t MF_LIMIT = 12;
+
+/// matches reach back at most this far
+const size_t MAX_OFFSET = 65535;
+
+const int HASH_BITS = 14;
+
+uint32_t
+_read32( const uint8_t * p )
+{
+    uint32_t value;
+    std::memcpy( & value, p, sizeof( value ) );
+    return value;
+}
+
+uint32_t
+_hash( uint32_t sequence )
+{
+    return ( sequence * 2654435761U ) >> ( 32 - HASH_BITS );
+}
+
+/// writes the part of a length that does not fit into its token nibble
+uint8_t *
+_writeLength( size_t length, uint8_t * op )
+{
+    for ( ; length >= 255 ; length -= 255 ) {
+        * op++ = 255;
+    }
+    * op++ = static_cast < uint8_t > ( length );
+    return op;
+}
+
+/// writes a sequence: literals, then a match unless matchLength is 0 (the last one)
+uint8_t *
+_writeSequence( const uint8_t * literals, size_t literalLength,
+                size_t offset, size_t matchLength, uint8_t * op )
+{
+    uint8_t * token = op++;
+    * token = static_cast < uint8_t > ( ( literalLength >= 15 ? 15 : literalLength ) << 4 );
+    if ( literalLength >= 15 ) {
+        op = _writeLength( literalLength - 15, op );
+    }
+    std::memcpy( op, literals, literalLength );
+    op += literalLength;
+    if ( matchLength == 0 ) {
+        return op;
+    }
+    * op++ = static_cast < uint8_t > ( offset & 0xff );
+    * op++ = static_cast < uint8_t > ( offset >> 8 );
+    size_t code = matchLength - MIN_MATCH;
+    * token |= static_cast < uint8_t > ( code >= 15 ? 15 : code );
+    if ( code >= 15 ) {
+        op = _writeLength( code - 15, op );
+    }
+    return op;
+}
+
+/// reads the extension of a length whose nibble was 15, false if it runs past end
+bool
+_readLength( const uint8_t * & ip, const uint8_t * end, size_t & length )
+{
+    uint8_t byte;
+    do {
+        if ( ip >= end ) {
+            return false;
+        }
+        byte = * ip++;
+        length += byte;
+    } while ( byte == 255 );
+    return true;
+}
+}
+
+uint16_t
+floatToHalf( float value )
+{
+    uint32_t bits;
+    std::memcpy( & bits, & value, sizeof( bits ) );
+    const uint16_t sign = static_cast < uint16_t > ( ( bits >> 16 ) & 0x8000 );
+    const uint32_t magnitude = bits & 0x7fffffff;
+
+    // NaN, keeping it quiet
+    if ( magnitude > 0x7f800000 ) {
+        return sign | 0x7e00;
+    }
+    // infinite, or too big for a half
+    if ( magnitude >= 0x47800000 ) {
+        return sign | 0x7c00;
+    }
+    // normal half: rebias the exponent from 127 to 15 and round the mantissa
+    if ( magnitude >= 0x38800000 ) {
+        uint32_t half = ( magnitude - 0x38000000 ) >> 13;
+        uint32_t rest = magnitude & 0x1fff;
+        if ( rest > 0x1000 || ( rest == 0x1000 && ( half & 1 ) ) ) {
+            half++;
+        }
+        return sign | static_cast < uint16_t > ( half );
+    }
+    // below half of the smallest subnormal half
+    if ( magnitude < 0x33000000 ) {
+        return sign;
+    }
+    // subnormal half, rounding may carry into the smallest normal
+    const uint32_t mantissa = ( magnitude & 0x7fffff ) | 0x800000;
+    const int shift = 126 - static_cast < int > ( magnitude >> 23 );
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ( ( 1u << shift ) - 1 );
+    uint32_t halfway = 1u << ( shift - 1 );
+    if ( rest > halfway || ( rest == halfway && ( half & 1 ) ) ) {
+        half++;
+    }
+    return sign | static_cast < uint16_t > ( half );
+} // floatToHalf
+
+float
+halfToFloat( uint16_t half )
+{
+    const uint32_t sign = static_cast < uint32_t > ( half & 0x8000 ) << 16;
+    const uint32_t exponent = ( half >> 10 ) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if ( exponent == 0x1f ) {
+        bits = sign | 0x7f800000 | ( mantissa << 13 );
+    }
+    else if ( exponent != 0 ) {
+        bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+    }
+    else if ( mantissa == 0 ) {
+        bits = sign;
+    }
+    else {
+        // subnormal half, normalize it
+        uint32_t e = 113;
+        while ( ! ( mantissa & 0x400 ) ) {
+            mantissa <<= 1;
+            e--;
+        }
+        bits = sign | ( e << 23 ) | ( ( mantissa & 0x3ff ) << 13 );
+    }
+    float value;
+    std::memcpy( & value, & bits, sizeof( value ) );
+    return value;
+} // halfToFloat
+
+void
+shuffleDelta( const float * values, size_t count, uint8_t * out )
+{
+    uint32_t previous = 0;
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        uint32_t bits;
+        std::memcpy( & bits, values + i, sizeof( bits ) );
+        uint32_t delta = bits - previous;
+        previous = bits;
+        out[i] = static_cast < uint8_t > ( delta );
+        out[count + i] = static_cast < uint8_t > ( delta >> 8 );
+        out[2 * count + i] = static_cast < uint8_t > ( delta >> 16 );
+        out[3 * count + i] = static_cast < uint8_t > ( delta >> 24 );
+    }
+}
+
+void
+unshuffleDelta( const uint8_t * in, size_t count, float * values )
+{
+    uint32_t previous = 0;
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        uint32_t delta = static_cast < uint32_t > ( in[i] ) |
+                         static_cast < uint32_t > ( in[count + i] ) << 8 |
+                         static_cast < uint32_t > ( in[2 * count + i] ) << 16 |
+                         static_cast < uint32_t > ( in[3 * count + i] ) << 24;
+        previous += delta;
+        std::memcpy( values + i, & previous, sizeof( previous ) );
+    }
+}
+
+size_t
+lz4CompressBound( size_t size )
+{
+    return size + size / 255 + 16;
+}
+
+size_t
+lz4Compress( const uint8_t * src, size_t size, uint8_t * dst )
+{
+    uint8_t * op = dst;
+    size_t anchor = 0;
+    if ( size >= MF_LIMIT + 1 ) {
+        // last position of a match start, and of a match end
+        const size_t matchStartLimit = size - MF_LIMIT;
+        const size_t matchEndLimit = size - LAST_LITERALS;
+        std::vector < int64_t > table( size_t( 1 ) << HASH_BITS, - 1 );
+        size_t ip = 0;
+        while ( ip <= matchStartLimit ) {
+            const uint32_t sequence = _read32( src + ip );
+            const uint32_t h = _hash( sequence );
+            const int64_t candidate = table[h];
+            table[h] = ip;
+            if ( candidate < 0 || ip - candidate > MAX_OFFSET ||
+                 _read32( src + candidate ) != sequence ) {
+                ip++;
+                continue;
+            }
+            size_t ref = static_cast < size_t > ( candidate );
+            size_t length = MIN_MATCH;
+            while ( ip + length < matchEndLimit && src[ref + length] == src[ip + length] ) {
+                length++;
+            }
+            op = _writeSequence( src + anchor, ip - anchor, ip - ref, length, op );
+            ip += length;
+            anchor = ip;
+        }
+    }
+    op = _writeSequence( src + anchor, size - anchor, 0, 0, op );
+    return op - dst;
+} // lz4Compress
+
+int64_t
+lz4Decompress( const uint8_t * src, size_t size, uint8_t * dst, size_t capacity )
+{
+    const uint8_t * ip = src;
+    const uint8_t * end = src + size;
+    size_t out = 0;
+    while ( ip < end ) {
+        const uint8_t token = * ip++;
+        size_t literalLength = token >> 4;
+        if ( literalLength == 15 && ! _readLength( ip, end, literalLength ) ) {
+            return - 1;
+        }
+        if ( literalLength > static_cast < size_t > ( end - ip ) || literalLength > capacity - out ) {
+            return - 1;
+        }
+        std::memcpy( dst + out, ip, literalLength );
+        ip += literalLength;
+        out += literalLength;
+        if ( ip == end ) {
+            break;
+        }
+        if ( end - ip < 2 ) {
+            return - 1;
+        }
+        size_t offset = ip[0] | ( ip[1] << 8 );
+        ip += 2;
+        size_t matchLength = token & 15;
+        if ( matchLength == 15 && ! _readLength( ip, end, matchLength ) ) {
+            return - 1;
+        }
+        matchLength += MIN_MATCH;
+        if ( offset == 0 || offset > out || matchLength > capacity - out ) {
+            return - 1;
+        }
+        // byte by byte, matches may overlap the bytes they produce
+        for ( size_t i = 0 ; i < matchLength ; i++ ) {
+            dst[out + i] = dst[out - offset + i];
+        }
+        out += matchLength;
+    }
+    return static_cast < int64_t > ( out );
+} // lz4Decompress
+}
+}
+}
@@ -0,0 +1,60 @@
+/**
+ * Algorithms for encoding raster images without ZFP
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+/// \brief IEEE 754 binary16 nearest to a float, ties to even.
+/// \details NaNs stay NaN, values beyond the half range become infinite and values
+/// below it become (signed) zero or subnormal halves.
+uint16_t
+floatToHalf( float value );
+
+/// \brief float value of an IEEE 754 binary16
+float
+halfToFloat( uint16_t half );
+
+/// \brief Prepares floats for a byte oriented compressor.
+/// \details The bit pattern of every value minus that of its predecessor is split into
+/// 4 byte planes: out[k * count + i] is byte k (least significant first) of the
+/// difference of value i. Smooth images turn into long runs of equal high bytes.
+/// \param values count floats
+/// \param out room for 4 * count bytes
+void
+shuffleDelta( const float * values, size_t count, uint8_t * out );
+
+/// \brief undoes shuffleDelta()
+void
+unshuffleDelta( const uint8_t * in, size_t count, float * values );
+
+/// \brief largest size of lz4Compress() output for size bytes of input
+size_t
+lz4CompressBound( size_t size );
+
+/// \brief Compresses bytes into an LZ4 block (the raw block format, without frame).
+/// \details Greedy matching with a hash table of 4 byte sequences, so any LZ4 block
+/// decoder can unpack it.
+/// \param src the bytes to compress
+/// \param size the number of bytes
+/// \param dst room for lz4CompressBound( size ) bytes
+/// \return the size of the block
+size_t
+lz4Compress( const uint8_t * src, size_t size, uint8_t * dst );
+
+/// \brief Decompresses an LZ4 block.
+/// \return the number of bytes written to dst, or -1 if the block is corrupt or does
+/// not fit into capacity bytes
+int64_t
+lz4Decompress( const uint8_t * src, size_t size, uint8_t * dst, size_t capacity );
+}
+}
+}
@@ -0,0 +1,298 @@
+/**
+ * Algorithms for down sampling image planes and preparing them for compression
+ **/
+
+#include "downsampleAlgorithms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if ( defined( __x86_64__ ) || defined( __i386__ ) ) && defined( __GNUC__ )
+#define CARTA_DOWNSAMPLE_X86 1
+#include <immintrin.h>
+#else
+#define CARTA_DOWNSAMPLE_X86 0
+#endif
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+namespace
+{
+/// adds the finite pixels of a row to sums and counts them in counts
+typedef void (* Accumulate)( const float * row, int64_t count, float * sums, float * counts );
+
+void
+_accumulateScalar( const float * row, int64_t count, float * sums, float * counts )
+{
+    for ( int64_t i = 0 ; i < count ; i++ ) {
+        if ( std::isfinite( row[i] ) ) {
+            sums[i] += row[i];
+            counts[i] += 1;
+        }
+    }
+}
+
+/// finds the ends of NaN runs in count values starting at position, the state of the
+/// encoding (nan, runStart, lengths) carries over from one call to the next
+typedef void (* ScanNans)( const float * values, int64_t count, int64_t position,
+                           bool & nan, int64_t & runStart, std::vector < int32_t > & lengths );
+
+inline void
+_endRun( int64_t position, bool & nan, int64_t & runStart, std::vector < int32_t > & lengths )
+{
+    lengths.push_back( static_cast < int32_t > ( position - runStart ) );
+    runStart = position;
+    nan = ! nan;
+}
+
+void
+_scanNansScalar( const float * values, int64_t count, int64_t position,
+                 bool & nan, int64_t & runStart, std::vector < int32_t > & lengths )
+{
+    for ( int64_t i = 0 ; i < count ; i++ ) {
+        if ( std::isnan( values[i] ) != nan ) {
+            _endRun( position + i, nan, runStart, lengths );
+        }
+    }
+}
+
+#if CARTA_DOWNSAMPLE_X86
+
+/// ends the runs at the lanes where the NaN mask (one bit per lane) changes
+inline void
+_scanMask( unsigned mask, int lanes, int64_t position,
+           bool & nan, int64_t & runStart, std::vector < int32_t > & lengths )
+{
+    unsigned changes = ( mask ^ ( ( mask << 1 ) | ( nan ? 1u : 0u ) ) ) & ( ( 1u << lanes ) - 1 );
+    while ( changes ) {
+        _endRun( position + __builtin_ctz( changes ), nan, runStart, lengths );
+        changes &= changes - 1;
+    }
+}
+
+__attribute__( ( target( "sse2" ) ) )
+void
+_scanNansSse2( const float * values, int64_t count, int64_t position,
+               bool & nan, int64_t & runStart, std::vector < int32_t > & lengths )
+{
+    int64_t i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        __m128 v = _mm_loadu_ps( values + i );
+        _scanMask( _mm_movemask_ps( _mm_cmpunord_ps( v, v ) ), 4, position + i, nan, runStart, lengths );
+    }
+    _scanNansScalar( values + i, count - i, position + i, nan, runStart, lengths );
+}
+
+__attribute__( ( target( "avx2" ) ) )
+void
+_scanNansAvx2( const float * values, int64_t count, int64_t position,
+               bool & nan, int64_t & runStart, std::vector < int32_t > & lengths )
+{
+    int64_t i = 0;
+    for ( ; i + 8 <= count ; i += 8 ) {
+        __m256 v = _mm256_loadu_ps( values + i );
+        _scanMask( _mm256_movemask_ps( _mm256_cmp_ps( v, v, _CMP_UNORD_Q ) ), 8, position + i,
+                   nan, runStart, lengths );
+    }
+    _scanNansScalar( values + i, count - i, position + i, nan, runStart, lengths );
+}
+
+// x - x is 0 for finite x and NaN for NaN and infinities, which compare unequal to 0
+
+__attribute__( ( target( "sse2" ) ) )
+void
+_accumulateSse2( const float * row, int64_t count, float * sums, float * counts )
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps( 1.0f );
+    int64_t i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        __m128 values = _mm_loadu_ps( row + i );
+        __m128 finite = _mm_cmpeq_ps( _mm_sub_ps( values, values ), zero );
+        _mm_storeu_ps( sums + i, _mm_add_ps( _mm_loadu_ps( sums + i ), _mm_and_ps( finite, values ) ) );
+        _mm_storeu_ps( counts + i, _mm_add_ps( _mm_loadu_ps( counts + i ), _mm_and_ps( finite, one ) ) );
+    }
+    _accumulateScalar( row + i, count - i, sums + i, counts + i );
+}
+
+__attribute__( ( target( "avx2" ) ) )
+void
+_accumulateAvx2( const float * row, int64_t count, float * sums, float * counts )
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps( 1.0f );
+    int64_t i = 0;
+    for ( ; i + 8 <= count ; i += 8 ) {
+        __m256 values = _mm256_loadu_ps( row + i );
+        __m256 finite = _mm256_cmp_ps( _mm256_sub_ps( values, values ), zero, _CMP_EQ_OQ );
+        _mm256_storeu_ps( sums + i,
+                          _mm256_add_ps( _mm256_loadu_ps( sums + i ), _mm256_and_ps( finite, values ) ) );
+        _mm256_storeu_ps( counts + i,
+                          _mm256_add_ps( _mm256_loadu_ps( counts + i ), _mm256_and_ps( finite, one ) ) );
+    }
+    _accumulateScalar( row + i, count - i, sums + i, counts + i );
+}
+
+#endif // CARTA_DOWNSAMPLE_X86
+
+struct Implementation
+{
+    const char * name;
+    Accumulate accumulate;
+    ScanNans scanNans;
+};
+
+/// the fastest implementation this cpu supports, picked once
+const Implementation &
+_implementation()
+{
+    static const Implementation implementation = [] () -> Implementation {
+#if CARTA_DOWNSAMPLE_X86
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports( "avx2" ) ) {
+            return Implementation { "avx2", _accumulateAvx2, _scanNansAvx2 };
+        }
+        if ( __builtin_cpu_supports( "sse2" ) ) {
+            return Implementation { "sse2", _accumulateSse2, _scanNansSse2 };
+        }
+#endif
+        return Implementation { "scalar", _accumulateScalar, _scanNansScalar };
+    } ();
+    return implementation;
+}
+}
+
+int
+blockMeans( const float * rows, int64_t rowStride, int mip, int nCols,
+            float * scratch, float * out )
+{
+    const int64_t width = static_cast < int64_t > ( nCols ) * mip;
+    float * sums = scratch;
+    float * counts = scratch + width;
+    std::memset( scratch, 0, 2 * width * sizeof( float ) );
+
+    // sum the rows column by column, the rows are contiguous
+    Accumulate accumulate = _implementation().accumulate;
+    for ( int row = 0 ; row < mip ; row++ ) {
+        accumulate( rows + row * rowStride, width, sums, counts );
+    }
+
+    // then the columns of each block
+    int nans = 0;
+    for ( int col = 0 ; col < nCols ; col++ ) {
+        float sum = 0;
+        float count = 0;
+        const int64_t first = static_cast < int64_t > ( col ) * mip;
+        for ( int i = 0 ; i < mip ; i++ ) {
+            sum += sums[first + i];
+            count += counts[first + i];
+        }
+        if ( count < 1 ) {
+            out[col] = std::numeric_limits < float >::quiet_NaN();
+            nans++;
+        }
+        else {
+            out[col] = sum / count;
+        }
+    }
+    return nans;
+} // blockMeans
+
+const char *
+blockMeansImplementation()
+{
+    return _implementation().name;
+}
+
+void
+NanRunEncoder::append( const float * values, int64_t count )
+{
+    _implementation().scanNans( values, count, m_position, m_nan, m_runStart, m_lengths );
+    m_position += count;
+}
+
+void
+NanRunEncoder::appendValid( int64_t count )
+{
+    if ( m_nan && count > 0 ) {
+        _endRun( m_position, m_nan, m_runStart, m_lengths );
+    }
+    m_position += count;
+}
+
+std::vector < int32_t >
+NanRunEncoder::finish()
+{
+    std::vector < int32_t > lengths;
+    lengths.swap( m_lengths );
+    lengths.push_back( static_cast < int32_t > ( m_position - m_runStart ) );
+    m_nan = false;
+    m_runStart = 0;
+    m_position = 0;
+    return lengths;
+}
+
+void
+fillNanBlocks( float * values, int w, int h, const std::vector < int32_t > & runs )
+{
+    // all-NaN and NaN-free images are left alone
+    if ( runs.size() <= 1 || w <= 0 || h <= 0 ) {
+        return;
+    }
+
+    // the bands of 4 rows with NaNs, from the NaN runs (odd indices)
+    std::vector < char > nanBands( ( h + 3 ) / 4, 0 );
+    int64_t position = 0;
+    for ( size_t k = 0 ; k < runs.size() ; k++ ) {
+        if ( k % 2 == 1 && runs[k] > 0 ) {
+            int64_t first = position / w / 4;
+            int64_t last = ( position + runs[k] - 1 ) / w / 4;
+            std::fill( nanBands.begin() + first, nanBands.begin() + last + 1, 1 );
+        }
+        position += runs[k];
+    }
+
+    for ( size_t band = 0 ; band < nanBands.size() ; band++ ) {
+        if ( ! nanBands[band] ) {
+            continue;
+        }
+        const int j = band * 4;
+        const int blockHeight = std::min( 4, h - j );
+        for ( int i = 0 ; i < w ; i += 4 ) {
+            float * block = values + static_cast < int64_t > ( j ) * w + i;
+            const int blockWidth = std::min( 4, w - i );
+            int validCount = 0;
+            float sum = 0;
+            for ( int y = 0 ; y < blockHeight ; y++ ) {
+                for ( int x = 0 ; x < blockWidth ; x++ ) {
+                    float v = block[y * w + x];
+                    if ( ! std::isnan( v ) ) {
+                        validCount++;
+                        sum += v;
+                    }
+                }
+            }
+
+            // only blocks with valid values and NaNs, all-NaN blocks won't affect ZFP compression
+            if ( validCount && validCount != blockWidth * blockHeight ) {
+                float average = sum / validCount;
+                for ( int y = 0 ; y < blockHeight ; y++ ) {
+                    for ( int x = 0 ; x < blockWidth ; x++ ) {
+                        if ( std::isnan( block[y * w + x] ) ) {
+                            block[y * w + x] = average;
+                        }
+                    }
+                }
+            }
+        }
+    }
+} // fillNanBlocks
+}
+}
+}
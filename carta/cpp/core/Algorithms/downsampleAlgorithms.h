@@ -0,0 +1,73 @@
+/**
+ * Algorithms for down sampling image planes and preparing them for compression
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+/// \brief NaN aware means of the mip x mip blocks of one row of blocks.
+/// \details The rows are summed column by column with SIMD instructions (AVX2 or
+/// SSE2, picked at run time on x86, plain C++ elsewhere), then the columns of each
+/// block are added up. Non-finite pixels are left out of the sums and the counts.
+/// \param rows first pixel of the first of mip rows
+/// \param rowStride number of pixels from the start of one row to the next
+/// \param mip size of the blocks
+/// \param nCols number of blocks, each row has to hold nCols * mip pixels
+/// \param scratch space for 2 * nCols * mip floats
+/// \param out the nCols means, NaN for blocks without any finite pixel
+/// \return the number of NaN means, 0 tells the NaN encoding it can skip the row
+int
+blockMeans( const float * rows, int64_t rowStride, int mip, int nCols,
+            float * scratch, float * out );
+
+/// \brief name of the implementation blockMeans() uses on this cpu
+const char *
+blockMeansImplementation();
+
+/// \brief Run length encoding of the NaNs in a sequence of floats.
+/// \details The lengths alternate between runs of other values and runs of NaNs,
+/// starting with other values (so the first length is 0 if the sequence starts with
+/// a NaN). The values are compared 8 (AVX2) or 4 (SSE2) at a time, the bits of the
+/// comparison are only looked at one by one where a run ends.
+class NanRunEncoder
+{
+public:
+
+    /// add count values
+    void
+    append( const float * values, int64_t count );
+
+    /// add count values that are known not to be NaN, without looking at them
+    void
+    appendValid( int64_t count );
+
+    /// the run lengths, the encoder starts over afterwards
+    std::vector < int32_t >
+    finish();
+
+private:
+
+    bool m_nan = false;
+    int64_t m_runStart = 0;
+    int64_t m_position = 0;
+    std::vector < int32_t > m_lengths;
+};
+
+/// \brief Replaces the NaNs of the 4 x 4 blocks (those ZFP compresses) holding other
+/// values as well by the mean of those values.
+/// \details Only the bands of 4 rows that the NaN runs touch are visited.
+/// \param values the w x h image
+/// \param runs the NaN run lengths of the image, from NanRunEncoder
+void
+fillNanBlocks( float * values, int w, int h, const std::vector < int32_t > & runs );
+}
+}
+}
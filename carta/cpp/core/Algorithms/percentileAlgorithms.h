@@ -8,9 +8,13 @@
 #include "CartaLib/IImage.h"
 #include "CartaLib/IntensityUnitConverter.h"
 #include "CartaLib/IPercentileCalculator.h"
+#include "CartaLib/MemoryBudget.h"
 
 #include <QDebug>
+#include <functional>
+#include <list>
 #include <limits>
+#include <map>
 #include <algorithm>
 #include <vector>
 #include <cmath>
@@ -26,6 +30,101 @@ namespace Core
 namespace Algorithms
 {
 
+/// Block kernels for NdArray::forEachSpan(). Their operator() is instantiated for
+/// each native pixel type, so the loops run directly over the stored data instead
+/// of converting every pixel to Scalar first. Masked pixels never reach them.
+namespace Kernels
+{
+/// none of the scans in this file depend on the order of the pixels, so they
+/// let the views pick the fastest one
+constexpr Carta::Lib::NdArray::RawViewInterface::Traversal ANY_ORDER =
+    Carta::Lib::NdArray::RawViewInterface::Traversal::Optimal;
+
+/// collect all finite values
+template < typename Scalar >
+struct CollectFinite {
+    std::vector < Scalar > & values;
+
+    template < typename T >
+    void operator()( const T * vals, int64_t count ) {
+        for ( int64_t i = 0; i < count; i++ ) {
+            if ( std::isfinite( vals[i] ) ) {
+                values.push_back( static_cast < Scalar > ( vals[i] ) );
+            }
+        }
+    }
+};
+
+/// minimum and maximum of the finite values
+template < typename Scalar >
+struct MinMax {
+    Scalar minPixel;
+    Scalar maxPixel;
+
+    MinMax() : minPixel( std::numeric_limits < Scalar >::max() ),
+        maxPixel( std::numeric_limits < Scalar >::lowest() ) {
+    }
+
+    template < typename T >
+    void operator()( const T * vals, int64_t count ) {
+        Scalar lo = minPixel;
+        Scalar hi = maxPixel;
+        for ( int64_t i = 0; i < count; i++ ) {
+            if ( std::isfinite( vals[i] ) ) {
+                Scalar val = static_cast < Scalar > ( vals[i] );
+                lo = std::min( lo, val );
+                hi = std::max( hi, val );
+            }
+        }
+        minPixel = lo;
+        maxPixel = hi;
+    }
+};
+
+/// histogram of the finite values, bins has to have numberOfBins + 1 entries
+struct Histogram {
+    std::vector < uint32_t > & bins;
+    double minIntensity;
+    int numberOfBins;
+    double intensityRange;
+
+    template < typename T >
+    void operator()( const T * vals, int64_t count ) {
+        for ( int64_t i = 0; i < count; i++ ) {
+            if ( std::isfinite( vals[i] ) ) {
+                double val = static_cast < double > ( vals[i] );
+                bins[static_cast < unsigned int > ( round( numberOfBins * ( val - minIntensity ) / intensityRange ) )]++;
+            }
+        }
+    }
+};
+
+/// count the non-NaN values and, for each target intensity, how many of them
+/// are smaller or equal
+template < typename Scalar >
+struct CountBelow {
+    u_int64_t & totalCount;
+    const std::vector < Scalar > & targets;
+    std::vector < u_int64_t > & countBelow;
+
+    template < typename T >
+    void operator()( const T * vals, int64_t count ) {
+        for ( int64_t k = 0; k < count; k++ ) {
+            double val = static_cast < double > ( vals[k] );
+            if ( Q_UNLIKELY( std::isnan( val ) ) ) {
+                continue;
+            }
+            totalCount++;
+            for ( size_t i = 0; i < targets.size(); i++ ) {
+                if ( val <= targets[i] ) {
+                    countBelow[i]++;
+                }
+            }
+        }
+    }
+};
+} // namespace Kernels
+
 template <typename Scalar>
 class PercentilesToPixels : public Carta::Lib::IPercentilesToPixels<Scalar> {
 public:
@@ -37,6 +136,16 @@ public:
         Carta::Lib::IntensityUnitConverter::SharedPtr converter,
         std::vector<double> hertzValues
     ) override;
+
+protected:
+    /// passes blocks of all finite values to the function
+    typedef std::function < void (std::function < void (const Scalar *, int64_t) >) > Scan;
+
+    /// percentiles without holding all values in memory, see below
+    static std::map<double, Scalar> _percentilesStreaming(
+        const std::vector <double> & percentiles,
+        Scan scan
+    );
 };
 
 template <typename Scalar>
@@ -129,8 +238,42 @@ PercentilesToPixels<Scalar>::percentile2pixels(
         qFatal("Cannot find intensities in these units: the conversion is frame-dependent and there is no spectral axis.");
     }
 
+    // all values (converted if necessary) in blocks, for the streaming fallback
+    Scan scan = [&view, spectralIndex, &converter, &hertzValues] ( std::function < void (const Scalar *, int64_t) > func ) {
+        if (converter && converter->frameDependent) {
+            std::vector < Scalar > converted;
+            for (size_t f = 0; f < hertzValues.size(); f++) {
+                double hertzVal = hertzValues[f];
+                Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
+                viewSlice.forEachValid( viewSlice.DEFAULT_BLOCK_SIZE, [&](const double * vals, int64_t count) {
+                    converted.clear();
+                    for ( int64_t i = 0; i < count; i++ ) {
+                        if ( std::isfinite( vals[i] ) ) {
+                            converted.push_back( converter->_frameDependentConvert(vals[i], hertzVal) );
+                        }
+                    }
+                    func( converted.data(), converted.size() );
+                }, Kernels::ANY_ORDER);
+            }
+        } else {
+            view.forEachValid( view.DEFAULT_BLOCK_SIZE, func, Kernels::ANY_ORDER );
+        }
+    };
+
+    // holding all values has to fit into the memory budget, otherwise they are streamed
+    int64_t nPixels = 1;
+    for ( int dim : view.dims() ) {
+        nPixels *= dim;
+    }
+    Carta::Lib::MemoryBudget::Reservation reservation( nPixels * static_cast < int64_t > ( sizeof( Scalar ) ) );
+    if ( ! reservation.ok() ) {
+        qDebug() << "Not enough memory to hold" << nPixels << "values, computing the percentiles in passes";
+        return _percentilesStreaming( percentiles, scan );
+    }
+
     // read in all values from the view into memory so that we can do quickselect on it
     std::vector < Scalar > allValues;
+    allValues.reserve( nPixels );
     double hertzVal;
 
 
@@ -147,20 +290,19 @@ PercentilesToPixels<Scalar>::percentile2pixels(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&allValues, &converter, &hertzVal](const Scalar & val) {
-                if ( std::isfinite( val ) ) {
-                    allValues.push_back( converter->_frameDependentConvert(val, hertzVal) );
+            viewSlice.forEachValid( viewSlice.DEFAULT_BLOCK_SIZE, [&allValues, &converter, &hertzVal](const double * vals, int64_t count) {
+                for ( int64_t i = 0; i < count; i++ ) {
+                    if ( std::isfinite( vals[i] ) ) {
+                        allValues.push_back( converter->_frameDependentConvert(vals[i], hertzVal) );
+                    }
                 }
-            });
+            }, Kernels::ANY_ORDER);
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([& allValues] ( const Scalar & val ) {
-            if ( std::isfinite( val ) ) {
-                allValues.push_back( val );
-            }
-        });
+        Kernels::CollectFinite < Scalar > kernel { allValues };
+        view.forEachSpan( kernel, view.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER );
     }
 
     // indicate bad clip if no finite numbers were found
@@ -192,6 +334,123 @@ PercentilesToPixels<Scalar>::percentile2pixels(
 } // percentile2pixels
 
 
+/// Percentiles in three passes over the data with bounded memory: the first finds the
+/// range and the number of finite values, the second counts them in histogram bins,
+/// the third collects the values of the bins holding the wanted ranks, which are then
+/// selected from those. Used when the memory budget can't hold all values.
+///
+/// \note the result is exact unless a bin is too crowded to collect (e.g. most values
+/// are nearly the same) or the memory budget can't hold it, then the value is
+/// interpolated linearly within the bin. Without finite values the result is empty.
+template < typename Scalar >
+std::map < double, Scalar >
+PercentilesToPixels<Scalar>::_percentilesStreaming(
+    const std::vector < double > & percentiles,
+    Scan scan
+)
+{
+    const int numberOfBins = 1 << 16;
+    const uint64_t maxCollected = 16 * 1024 * 1024;
+
+    Scalar minPixel = std::numeric_limits < Scalar >::max();
+    Scalar maxPixel = std::numeric_limits < Scalar >::lowest();
+    uint64_t total = 0;
+    scan( [&] ( const Scalar * vals, int64_t count ) {
+        for ( int64_t i = 0; i < count; i++ ) {
+            if ( std::isfinite( vals[i] ) ) {
+                minPixel = std::min( minPixel, vals[i] );
+                maxPixel = std::max( maxPixel, vals[i] );
+                total++;
+            }
+        }
+    });
+
+    // no finite numbers, no percentiles
+    if ( total == 0 ) {
+        qWarning() << "No finite values to compute the percentiles of";
+        return std::map < double, Scalar > ();
+    }
+
+    double binWidth = ( static_cast < double > ( maxPixel ) - minPixel ) / numberOfBins;
+    auto binOf = [minPixel, binWidth, numberOfBins] ( Scalar val ) -> int {
+        if ( binWidth <= 0 ) {
+            return 0;
+        }
+        int bin = static_cast < int > ( ( val - minPixel ) / binWidth );
+        return Carta::Lib::clamp < int > ( bin, 0, numberOfBins - 1 );
+    };
+    std::vector < uint64_t > bins( numberOfBins, 0 );
+    scan( [&] ( const Scalar * vals, int64_t count ) {
+        for ( int64_t i = 0; i < count; i++ ) {
+            if ( std::isfinite( vals[i] ) ) {
+                bins[binOf( vals[i] )]++;
+            }
+        }
+    });
+
+    // the bin of each wanted rank, and the rank within it
+    struct Target {
+        int bin;
+        uint64_t offset;
+    };
+    std::map < double, Target > targets;
+    std::map < int, std::vector < Scalar > > collected;
+    std::list < Carta::Lib::MemoryBudget::Reservation > reservations;
+    for ( double q : percentiles ) {
+        // same rank as the in-memory algorithm
+        uint64_t rank = Carta::Lib::clamp < uint64_t > ( total * q, 1, total ) - 1;
+        uint64_t below = 0;
+        int bin = 0;
+        while ( below + bins[bin] <= rank ) {
+            below += bins[bin];
+            bin++;
+        }
+        targets[q] = Target { bin, rank - below };
+        if ( bins[bin] > maxCollected || collected.count( bin ) > 0 ) {
+            continue;
+        }
+        // the bins are collected only while the budget holds them, otherwise interpolated
+        reservations.emplace_back( static_cast < qint64 > ( bins[bin] * sizeof( Scalar ) ) );
+        if ( reservations.back().ok() ) {
+            collected[bin].reserve( bins[bin] );
+        }
+        else {
+            reservations.pop_back();
+        }
+    }
+
+    if ( ! collected.empty() ) {
+        scan( [&] ( const Scalar * vals, int64_t count ) {
+            for ( int64_t i = 0; i < count; i++ ) {
+                if ( std::isfinite( vals[i] ) ) {
+                    auto found = collected.find( binOf( vals[i] ) );
+                    if ( found != collected.end() ) {
+                        found->second.push_back( vals[i] );
+                    }
+                }
+            }
+        });
+    }
+
+    std::map < double, Scalar > result;
+    for ( const auto & target : targets ) {
+        int bin = target.second.bin;
+        uint64_t offset = target.second.offset;
+        auto found = collected.find( bin );
+        if ( found != collected.end() && offset < found->second.size() ) {
+            std::vector < Scalar > & values = found->second;
+            std::nth_element( values.begin(), values.begin() + offset, values.end() );
+            result[target.first] = values[offset];
+        }
+        else {
+            double fraction = ( offset + 0.5 ) / bins[bin];
+            result[target.first] = static_cast < Scalar > ( minPixel + ( bin + fraction ) * binWidth );
+        }
+    }
+    return result;
+} // _percentilesStreaming
+
+
 template < typename Scalar >
 std::vector<double>
 PixelsToPercentiles<Scalar>::pixels2percentiles(
@@ -216,21 +475,7 @@ PixelsToPercentiles<Scalar>::pixels2percentiles(
     std::vector<double> percentiles(intensities.size());
     
     // What we do in the loop doesn't change; how we calculate the target intensities changes
-    auto view_lambda = [&totalCount, &target_intensities, &countBelow](const double& val) {
-        if( Q_UNLIKELY( std::isnan(val))){
-            return;
-        }
-        
-        totalCount++;
-
-        for (size_t i = 0; i < target_intensities.size(); i++) {
-            if( val <= target_intensities[i]){
-                countBelow[i]++;
-            }
-        }
-        
-        return;
-    };
+    Kernels::CountBelow < Scalar > kernel { totalCount, target_intensities, countBelow };
 
     if (converter) {
         // Divide the target intensities by the multiplier
@@ -248,16 +493,16 @@ PixelsToPercentiles<Scalar>::pixels2percentiles(
 
                 Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
                 
-                viewSlice.forEach(view_lambda);
+                viewSlice.forEachSpan(kernel, viewSlice.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER);
             }
 
         } else { // not frame-dependent; calculate the target intensities once; iterate over flat image
             target_intensities = divided_intensities;
-            view.forEach(view_lambda);
+            view.forEachSpan(kernel, view.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER);
         }
     } else { // no conversion; iterate over flat image
         target_intensities = intensities;
-        view.forEach(view_lambda);
+        view.forEachSpan(kernel, view.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER);
     } 
 
     for (size_t i = 0; i < intensities.size(); i++) { // calculate the percentages
@@ -324,23 +569,23 @@ MinMaxPercentiles<Scalar>::percentile2pixels(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&minPixel, &maxPixel, &converter, &hertzVal, &convertedVal] ( const Scalar &val ) {
-                if ( std::isfinite( val ) ) {
-                    convertedVal = converter->_frameDependentConvert(val, hertzVal);
-                    minPixel = std::min(minPixel, convertedVal);
-                    maxPixel = std::max(maxPixel, convertedVal);
+            viewSlice.forEachValid( viewSlice.DEFAULT_BLOCK_SIZE, [&minPixel, &maxPixel, &converter, &hertzVal, &convertedVal] ( const double * vals, int64_t count ) {
+                for ( int64_t i = 0; i < count; i++ ) {
+                    if ( std::isfinite( vals[i] ) ) {
+                        convertedVal = converter->_frameDependentConvert(vals[i], hertzVal);
+                        minPixel = std::min(minPixel, convertedVal);
+                        maxPixel = std::max(maxPixel, convertedVal);
+                    }
                 }
-            });
+            }, Kernels::ANY_ORDER);
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([&minPixel, &maxPixel] ( const Scalar &val ) {
-            if ( std::isfinite( val ) ) {
-                minPixel = std::min(minPixel, val);
-                maxPixel = std::max(maxPixel, val);
-            }
-        });
+        Kernels::MinMax < Scalar > kernel;
+        view.forEachSpan( kernel, view.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER );
+        minPixel = kernel.minPixel;
+        maxPixel = kernel.maxPixel;
     }
 
     //// is there a sufficiently good reason to count the values?
@@ -407,22 +652,20 @@ RegionHistogramData MinMaxPercentiles<Scalar>::pixels2histogram(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange, &converter, &hertzVal] (const Scalar &val) {
-                if (std::isfinite(val)) {
-                    pixelIndex = static_cast<unsigned int>(round(numberOfBins * (converter->_frameDependentConvert(val, hertzVal) - minIntensity) / intensityRange));
-                    bins[pixelIndex]++;
+            viewSlice.forEachValid(viewSlice.DEFAULT_BLOCK_SIZE, [&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange, &converter, &hertzVal] (const double * vals, int64_t count) {
+                for (int64_t i = 0; i < count; i++) {
+                    if (std::isfinite(vals[i])) {
+                        pixelIndex = static_cast<unsigned int>(round(numberOfBins * (converter->_frameDependentConvert(vals[i], hertzVal) - minIntensity) / intensityRange));
+                        bins[pixelIndex]++;
+                    }
                 }
-            });
+            }, Kernels::ANY_ORDER);
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange] (const Scalar &val) {
-            if (std::isfinite(val)) {
-                pixelIndex = static_cast<unsigned int>(round(numberOfBins * (val - minIntensity) / intensityRange));
-                bins[pixelIndex]++;
-            }
-        });
+        Kernels::Histogram kernel { bins, minIntensity, numberOfBins, intensityRange };
+        view.forEachSpan(kernel, view.DEFAULT_BLOCK_SIZE, Kernels::ANY_ORDER);
     }
 
     // total number of finite values
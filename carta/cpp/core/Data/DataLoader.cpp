@@ -11,6 +11,8 @@
 #include "Globals.h"
 #include "IPlatform.h"
 #include "State/UtilState.h"
+#include "ImageHeaderReader.h"
+#include "Data/Image/ImageRegistry.h"
 
 #include <set>
 #include <math.h>
@@ -270,36 +272,45 @@ DataLoader::PBMSharedPtr DataLoader::getFileInfo(CARTA::FileInfoRequest fileInfo
     QString fileFullName = fileDir + "/" + fileName;
 
     QString file = fileFullName.trimmed();
-    auto res = Globals::instance()->pluginManager()->prepare<Carta::Lib::Hooks::LoadAstroImage>(file).first();
-    std::shared_ptr<Carta::Lib::Image::ImageInterface> image;
-    if (!res.isNull()) {
-        image = res.val();
-    } else {
-        QString message = "[File Info] Can not open the image file! (" + file + ")";
-        qWarning() << message;
-        fileInfoResponse->set_success(false);
-        fileInfoResponse->set_message(message.toStdString());
-        return fileInfoResponse;
+
+    // read the header alone if possible, only other formats need to be opened
+    ImageHeaderReader::Header header;
+    if (!ImageHeaderReader::read(file, &header)) {
+        // opened through the registry, so that opening the file next reuses the image
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> image = ImageRegistry::open(file);
+        if (!image) {
+            QString message = "[File Info] Can not open the image file! (" + file + ")";
+            qWarning() << message;
+            fileInfoResponse->set_success(false);
+            fileInfoResponse->set_message(message.toStdString());
+            return fileInfoResponse;
+        }
+        header.fits = (image->getType() == "FITSImage");
+        header.dims = image->dims();
+        header.stokesIndex = Util::getAxisIndex(image, AxisInfo::KnownType::STOKES);
+        FitsHeaderExtractor fhExtractor;
+        fhExtractor.setInput(image);
+        header.cards = fhExtractor.getHeader();
     }
 
     // FileInfo: set name & type
     CARTA::FileInfo* fileInfo = new CARTA::FileInfo();
     fileInfo->set_name(fileInfoRequest.file());
-    if (image->getType() == "FITSImage") {
+    if (header.fits) {
         fileInfo->set_type(CARTA::FileType::FITS);
     } else {
         fileInfo->set_type(CARTA::FileType::CASA);
     }
 
     // FileInfoExtended init: set dimensions, width, height
-    const std::vector<int> dims = image->dims();
+    const std::vector<int> dims = header.dims;
     CARTA::FileInfoExtended* fileInfoExt = new CARTA::FileInfoExtended();
     fileInfoExt->set_dimensions(dims.size());
     fileInfoExt->set_width(dims[0]);
     fileInfoExt->set_height(dims[1]);
 
     // set the stoke axis if it exists
-    int stokeIndicator = Util::getAxisIndex(image, AxisInfo::KnownType::STOKES);
+    int stokeIndicator = header.stokesIndex;
     if (stokeIndicator > 0) { // if stoke axis exists
         if (dims[stokeIndicator] > 0) { // if stoke dimension > 0
             fileInfoExt->set_stokes(dims[stokeIndicator]);
@@ -322,7 +333,7 @@ DataLoader::PBMSharedPtr DataLoader::getFileInfo(CARTA::FileInfoRequest fileInfo
     //                it is broken after updating casacore (_getStatisticInfo())
     // Part 2: generate some customized information
     std::map<QString, QString> infoMap = {};
-    if (false == _genCustomizedInfo(infoMap, image)) {
+    if (false == _genCustomizedInfo(infoMap, FitsHeaderExtractor::toHeaderMap(header.cards))) {
         qDebug() << "[File Info] Generate file information error.";
     }
 
@@ -344,7 +355,7 @@ DataLoader::PBMSharedPtr DataLoader::getFileInfo(CARTA::FileInfoRequest fileInfo
     }
 
     // Part 3: add all fits headers to fileInfoExt
-    if (false == getFitsHeaders(fileInfoExt, image)) {
+    if (false == _addHeaderEntries(fileInfoExt, FitsHeaderExtractor::toHeaderList(header.cards))) {
         qDebug() << "[File Info] Get fits headers error!";
     }
 
@@ -367,8 +378,12 @@ bool DataLoader::getFitsHeaders(CARTA::FileInfoExtended* fileInfoExt,
     // get fits header map using FitsHeaderExtractor
     FitsHeaderExtractor fhExtractor;
     fhExtractor.setInput(image);
-    std::vector<std::vector<QString>> headerList = fhExtractor.getHeaderList();
-    
+    return _addHeaderEntries(fileInfoExt, fhExtractor.getHeaderList());
+}
+
+// Insert {key, value} header entries to fileInfoExt
+bool DataLoader::_addHeaderEntries(CARTA::FileInfoExtended* fileInfoExt,
+                                   const std::vector<std::vector<QString>>& headerList) {
     // traverse whole map to return all entries for frontend to render (AST)
     for (auto iter = headerList.begin(); iter != headerList.end(); iter++) {
         // insert (key, value) to header entry
@@ -386,17 +401,12 @@ bool DataLoader::getFitsHeaders(CARTA::FileInfoExtended* fileInfoExt,
 
 // Generate customized file information for human readiblity by using some fits headers
 bool DataLoader::_genCustomizedInfo(std::map<QString, QString>& infoMap,
-                                 const std::shared_ptr<Carta::Lib::Image::ImageInterface> image) {
+                                    const std::map<QString, QString>& headerMap) {
     // validate parameter
-    if (nullptr == image) {
+    if (headerMap.empty()) {
         return false;
     }
 
-    // get fits header map using FitsHeaderExtractor
-    FitsHeaderExtractor fhExtractor;
-    fhExtractor.setInput(image);
-    std::map<QString, QString> headerMap = fhExtractor.getHeaderMap();
-
     // generate customized info 0~7
     // 0. Generate image dimension info & insert to entry
     if (false == _genImgDimensionInfo(infoMap, headerMap)) {
@@ -133,7 +133,11 @@ private:
 
     // Generate customized file information for human readiblity using some fits headers
     bool _genCustomizedInfo(std::map<QString, QString>& infoMap,
-                         const std::shared_ptr<Carta::Lib::Image::ImageInterface> image);
+                            const std::map<QString, QString>& headerMap);
+
+    // Insert {key, value} header entries to fileInfoExt
+    bool _addHeaderEntries(CARTA::FileInfoExtended* fileInfoExt,
+                           const std::vector<std::vector<QString>>& headerList);
 
     // Generate image dimension info & insert to entry
     bool _genImgDimensionInfo(std::map<QString, QString>& infoMap, const std::map<QString, QString> headerMap);
@@ -99,8 +99,15 @@ FitsHeaderExtractor::getHeader()
     // was this created using CasaImageLoader plugin?
     CCImageBase * base = dynamic_cast < CCImageBase * > ( & * m_cartaImage );
     if ( base ) {
-        casacore::LatticeBase * latticeBase = base-> getCasaImage();
-        if ( latticeBase ) {
+        QStringList cards = base-> getFitsHeaderCards();
+        casacore::LatticeBase * latticeBase = cards.isEmpty() ? base-> getCasaImage() : nullptr;
+        if ( ! cards.isEmpty() ) {
+
+            // images without a casacore image keep their own header cards
+            result = cards;
+            result.append( QString( "END" ).leftJustified( 80, ' ' ) );
+        }
+        else if ( latticeBase ) {
 
             // casacore's fits parser
             result = _CasaFitsConverter( latticeBase );
@@ -119,8 +126,20 @@ std::vector<std::vector<QString>>
 FitsHeaderExtractor::getHeaderList()
 {
     // get whole header as a list of lines
-    const QStringList headerLines = this->getHeader();
+    return toHeaderList(this->getHeader());
+}
 
+// parse header per line & build a (key, value) map
+std::map<QString, QString>
+FitsHeaderExtractor::getHeaderMap()
+{
+    // get whole header as a list of lines
+    return toHeaderMap(this->getHeader());
+}
+
+std::vector<std::vector<QString>>
+FitsHeaderExtractor::toHeaderList(const QStringList& headerLines)
+{
     // create a empty list
     std::vector<std::vector<QString>> headerList = {};
 
@@ -137,13 +156,10 @@ FitsHeaderExtractor::getHeaderList()
 
     return headerList;
 }
-// parse header per line & build a (key, value) map
+
 std::map<QString, QString>
-FitsHeaderExtractor::getHeaderMap()
+FitsHeaderExtractor::toHeaderMap(const QStringList& headerLines)
 {
-    // get whole header as a list of lines
-    const QStringList headerLines = this->getHeader();
-
     // create a empty map
     std::map<QString, QString> headerMap = std::map<QString, QString> ();
 
@@ -33,6 +33,12 @@ public:
     // get header info and return the info with a (key, value) map
     std::map<QString, QString> getHeaderMap();
 
+    // split header lines into an unsorted {key, value} list
+    static std::vector<std::vector<QString>> toHeaderList(const QStringList& headerLines);
+
+    // split header lines into a (key, value) map
+    static std::map<QString, QString> toHeaderMap(const QStringList& headerLines);
+
     /// \return list of errors (if any)
     QStringList getErrors();
 
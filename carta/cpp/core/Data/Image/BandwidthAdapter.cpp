@@ -0,0 +1,222 @@
+#include "Data/Image/BandwidthAdapter.h"
+#include "Data/Image/RasterCodec.h"
+#include "Globals.h"
+#include "MainConfig.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+#include <QtCore/QDebug>
+#include <algorithm>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+/// bytes a measurement needs beyond the socket buffer
+const qint64 MIN_SAMPLE_BYTES = 256 * 1024;
+
+/// weight of a new measurement in the smoothed values
+const double SMOOTHING = 0.3;
+
+void _readSetting( const QJsonObject& json, const QString& key, int* storeLocation ){
+    if ( json.contains( key ) ){
+        QString errorMsg;
+        int val = MainConfig::ParsedInfo::toInt( json[key], errorMsg );
+        if ( errorMsg.isEmpty() && val >= 0 ){
+            *storeLocation = val;
+        }
+        else {
+            qWarning() << "[BandwidthAdapter] Invalid setting" << key << errorMsg;
+        }
+    }
+}
+
+double _smooth( double average, double sample, bool first ){
+    return first ? sample : average + SMOOTHING * ( sample - average );
+}
+
+/// estimated size of an encoded pixel for the codecs of RasterCodec, an upper bound for ZFP precisions
+double _bitsPerPixel( bool isZFP, int quality ){
+    if ( isZFP ){
+        if ( quality > 32 ){
+            return quality - 32;
+        }
+        return quality <= 0 ? 16 : quality;
+    }
+    // half and lossless only if they are enabled, otherwise the floats are sent raw
+    QString codec = RasterCodec::select( false, quality )->name();
+    if ( codec == "half" ){
+        return 16;
+    }
+    return codec == "lossless" ? 24 : 32;
+}
+
+/// the largest send buffer the kernel gives a TCP socket, from tcp_wmem (min default max)
+qint64 _socketBufferBytes( qint64 fallback ){
+    QFile file( "/proc/sys/net/ipv4/tcp_wmem" );
+    if ( ! file.open( QIODevice::ReadOnly ) ){
+        return fallback;
+    }
+    QStringList values = QString( file.readAll() ).split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
+    bool ok = false;
+    qint64 bytes = values.size() == 3 ? values[2].toLongLong( &ok ) : 0;
+    return ok && bytes > 0 ? bytes : fallback;
+}
+
+/// number of pixels of a view down sampled by mip
+double _pixels( const ChannelPrefetcher::RasterView& view, int mip ){
+    qint64 width = ( view.xMax - view.xMin + mip - 1 ) / mip;
+    qint64 height = ( view.yMax - view.yMin + mip - 1 ) / mip;
+    return static_cast<double>( width * height );
+}
+}
+
+BandwidthAdapter::BandwidthAdapter( const Settings& settings ) :
+    m_settings( settings ){
+    m_clock.start();
+}
+
+BandwidthAdapter::Settings BandwidthAdapter::configuredSettings(){
+    Settings settings;
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    _readSetting( json, "adaptiveRasterMilliseconds", &settings.targetMilliseconds );
+    _readSetting( json, "adaptiveRasterMinPrecision", &settings.minPrecision );
+    _readSetting( json, "adaptiveRasterMaxPrecision", &settings.maxPrecision );
+    _readSetting( json, "adaptiveRasterMaxMip", &settings.maxMip );
+    if ( json.contains( "adaptiveRasterRaisePrecision" ) ){
+        QString errorMsg;
+        bool raise = MainConfig::ParsedInfo::toBool( json["adaptiveRasterRaisePrecision"], errorMsg );
+        if ( errorMsg.isEmpty() ){
+            settings.raisePrecision = raise;
+        }
+        else {
+            qWarning() << "[BandwidthAdapter] Invalid setting adaptiveRasterRaisePrecision" << errorMsg;
+        }
+    }
+    settings.socketBufferBytes = _socketBufferBytes( settings.socketBufferBytes );
+    settings.minPrecision = std::max( 1, std::min( settings.minPrecision, 32 ) );
+    settings.maxPrecision = std::max( settings.minPrecision, std::min( settings.maxPrecision, 32 ) );
+    return settings;
+}
+
+bool BandwidthAdapter::isEnabled() const {
+    return m_settings.targetMilliseconds > 0;
+}
+
+void BandwidthAdapter::messageQueued( qint64 bytes ){
+    if ( bytes <= 0 || ! isEnabled() ){
+        return;
+    }
+    QMutexLocker locker( &m_mutex );
+    // a new busy period starts with an empty socket buffer
+    if ( m_unwritten == 0 ){
+        m_busyWritten = 0;
+        m_sampleStart = -1;
+        m_sampleBytes = 0;
+    }
+    m_unwritten += bytes;
+}
+
+void BandwidthAdapter::bytesWritten( qint64 bytes ){
+    QMutexLocker locker( &m_mutex );
+    // the bytes of the frame headers are left over and dropped
+    bytes = std::min( bytes, m_unwritten );
+    if ( bytes <= 0 ){
+        return;
+    }
+    m_unwritten -= bytes;
+    m_busyWritten += bytes;
+    qint64 now = m_clock.elapsed();
+
+    // once a socket buffer's worth is written, the socket takes bytes as fast as the
+    // link drains them
+    if ( m_sampleStart < 0 ){
+        if ( m_busyWritten >= m_settings.socketBufferBytes ){
+            m_sampleStart = now;
+            m_sampleBytes = 0;
+        }
+        return;
+    }
+    m_sampleBytes += bytes;
+    if ( m_sampleBytes >= MIN_SAMPLE_BYTES && now > m_sampleStart ){
+        double seconds = ( now - m_sampleStart ) / 1000.0;
+        m_link.bytesPerSecond = _smooth( m_link.bytesPerSecond, m_sampleBytes / seconds, m_link.samples == 0 );
+        m_link.samples++;
+        m_sampleStart = now;
+        m_sampleBytes = 0;
+    }
+}
+
+void BandwidthAdapter::roundTrip( qint64 milliseconds ){
+    QMutexLocker locker( &m_mutex );
+    m_link.roundTripMilliseconds = _smooth( m_link.roundTripMilliseconds, milliseconds,
+                                            m_link.roundTripMilliseconds <= 0 );
+}
+
+BandwidthAdapter::Link BandwidthAdapter::link() const {
+    QMutexLocker locker( &m_mutex );
+    return m_link;
+}
+
+bool BandwidthAdapter::adapt( ChannelPrefetcher::RasterView& view ) const {
+    Link current = link();
+    if ( ! isEnabled() || current.samples == 0 || view.mip <= 0 ||
+         view.xMax <= view.xMin || view.yMax <= view.yMin ){
+        return false;
+    }
+
+    // the image has to arrive within the target, half a round trip is spent on the way
+    double target = m_settings.targetMilliseconds / 1000.0;
+    double seconds = std::max( target - current.roundTripMilliseconds / 2000.0, target / 4 );
+    double budget = current.bytesPerSecond * seconds * 8;
+
+    ChannelPrefetcher::RasterView adapted = view;
+
+    // raw floats become ZFP when they don't fit, the other codecs were asked for explicitly
+    bool isPrecision = view.isZFP && view.precision >= 1 && view.precision <= 32;
+    bool isRaw = ! view.isZFP && _bitsPerPixel( false, view.precision ) == 32;
+    if ( isRaw && _pixels( view, view.mip ) * 32 > budget ){
+        adapted.isZFP = true;
+        isPrecision = true;
+    }
+
+    // the highest precision that fits up to the requested one (raw floats had none),
+    // lowered ones are even so that the encoding doesn't change with every small
+    // variation of the throughput
+    if ( isPrecision ){
+        int requested = view.isZFP ? view.precision : m_settings.maxPrecision;
+        int ceiling = m_settings.raisePrecision ? std::max( requested, m_settings.maxPrecision ) : requested;
+        double fitting = budget / _pixels( adapted, adapted.mip );
+        if ( fitting >= ceiling ){
+            adapted.precision = ceiling;
+        }
+        else {
+            int precision = static_cast<int>( fitting );
+            precision -= precision % 2;
+            adapted.precision = std::max( precision, std::min( m_settings.minPrecision, ceiling ) );
+        }
+    }
+
+    // coarser down sampling while even that does not fit
+    int maxMip = std::max( m_settings.maxMip, view.mip );
+    while ( adapted.mip < maxMip &&
+            _pixels( adapted, adapted.mip ) * _bitsPerPixel( adapted.isZFP, adapted.precision ) > budget ){
+        adapted.mip++;
+    }
+
+    if ( adapted == view ){
+        return false;
+    }
+    qDebug() << "[BandwidthAdapter] Link" << current.bytesPerSecond / 1024 << "KB/s, round trip"
+             << current.roundTripMilliseconds << "ms: mip" << view.mip << "->" << adapted.mip
+             << ", ZFP" << view.isZFP << "->" << adapted.isZFP
+             << ", quality" << view.precision << "->" << adapted.precision;
+    view = adapted;
+    return true;
+}
+
+}
+}
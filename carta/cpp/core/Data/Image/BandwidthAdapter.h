@@ -0,0 +1,123 @@
+/***
+ * Fits the raster images of a session to the speed of its connection.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "Data/Image/ChannelPrefetcher.h"
+#include <QElapsedTimer>
+#include <QMutex>
+
+namespace Carta {
+namespace Data {
+
+/**
+ * Measures how fast the websocket of a session drains and picks the compression and
+ * down sampling of its raster images, so that one arrives within a target latency.
+ *
+ * The dispatcher reports every message it queues on the socket, the bytes the socket
+ * has written and the round trip times of its pings. The socket reports bytes as
+ * written once the operating system buffers them, so the first bytes of a busy period
+ * (messages queued back to back) only fill that buffer. The throughput is measured
+ * on the bytes written after a socket buffer's worth of them, when the socket can
+ * only take what the link drains; shorter busy periods are not measured.
+ *
+ * The raster image data message reports the mip, compression type and quality that
+ * were used, so the client can follow when they differ from its request.
+ */
+class BandwidthAdapter {
+
+public:
+
+    struct Settings {
+        /// latency a raster image should arrive within, 0 disables the adaptation
+        int targetMilliseconds = 1000;
+        /// the ZFP precision is kept between these
+        int minPrecision = 8;
+        int maxPrecision = 24;
+        /// down sampling is not coarsened beyond this
+        int maxMip = 16;
+        /// the ZFP precision may be raised above the request (up to maxPrecision)
+        bool raisePrecision = false;
+        /// largest send buffer of a socket, the operating system's if it tells
+        qint64 socketBufferBytes = 4 * 1024 * 1024;
+    };
+
+    /// The smoothed measurements of a connection.
+    struct Link {
+        double bytesPerSecond = 0;
+        double roundTripMilliseconds = 0;
+        /// number of throughput measurements
+        int samples = 0;
+    };
+
+    /**
+     * Constructor.
+     * @param settings - target latency and limits of the chosen parameters.
+     */
+    BandwidthAdapter( const Settings& settings );
+
+    /**
+     * Returns the settings from the main configuration file (adaptiveRasterMilliseconds,
+     * adaptiveRasterMinPrecision, adaptiveRasterMaxPrecision, adaptiveRasterMaxMip,
+     * adaptiveRasterRaisePrecision), or the defaults, and the socket buffer size.
+     */
+    static Settings configuredSettings();
+
+    /// Returns true if raster images are adapted to the connection.
+    bool isEnabled() const;
+
+    /**
+     * Records a message handed to the socket.
+     * @param bytes - the size of the message.
+     */
+    void messageQueued( qint64 bytes );
+
+    /**
+     * Records bytes the socket has written.
+     * @param bytes - the number of bytes.
+     */
+    void bytesWritten( qint64 bytes );
+
+    /**
+     * Records the answer to a ping.
+     * @param milliseconds - the time between ping and pong.
+     */
+    void roundTrip( qint64 milliseconds );
+
+    /// Returns the current measurements.
+    Link link() const;
+
+    /**
+     * Changes the compression and down sampling of a raster image request so that the
+     * image is sent within the target latency: the ZFP precision is the highest that
+     * fits up to the requested one (up to maxPrecision if raisePrecision is set, even
+     * if that is more than requested), raw floats are replaced by ZFP and the down
+     * sampling is coarsened when even the lowest precision does not fit. Nothing
+     * changes before the first measurement.
+     * @param view - the image bounds, down sampling and compression settings.
+     * @return - true if the view was changed.
+     */
+    bool adapt( ChannelPrefetcher::RasterView& view ) const;
+
+private:
+
+    Settings m_settings;
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    /// bytes queued and not written yet, the socket is busy while there are any
+    qint64 m_unwritten = 0;
+    /// bytes written in the current busy period
+    qint64 m_busyWritten = 0;
+    /// start of the measurement within the busy period, -1 while the socket buffer fills
+    qint64 m_sampleStart = -1;
+    qint64 m_sampleBytes = 0;
+    Link m_link;
+
+    BandwidthAdapter( const BandwidthAdapter& other );
+    BandwidthAdapter& operator=( const BandwidthAdapter& other );
+};
+
+}
+}
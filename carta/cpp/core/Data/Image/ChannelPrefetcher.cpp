@@ -0,0 +1,336 @@
+#include "Data/Image/ChannelPrefetcher.h"
+#include "Data/Image/DataSource.h"
+#include "Data/Image/RasterEncodePool.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include "CartaLib/MemoryBudget.h"
+#include "CartaLib/Cancellation.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QDebug>
+#include <algorithm>
+#include <cmath>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+/// weight of the newest sample in the smoothed timings
+const double SMOOTHING = 0.3;
+
+/// requests further apart than this start a new stepping sequence
+const qint64 MAX_STEP_INTERVAL_MS = 2000;
+
+double _smooth( double average, double sample ){
+    return average <= 0 ? sample : ( 1 - SMOOTHING ) * average + SMOOTHING * sample;
+}
+
+void _readSetting( const QJsonObject& json, const QString& key, int* storeLocation ){
+    if ( json.contains( key ) ){
+        QString errorMsg;
+        int val = MainConfig::ParsedInfo::toInt( json[key], errorMsg );
+        if ( errorMsg.isEmpty() && val >= 0 ){
+            *storeLocation = val;
+        }
+        else {
+            qWarning() << "[ChannelPrefetcher] Invalid setting" << key << errorMsg;
+        }
+    }
+}
+}
+
+bool ChannelPrefetcher::RasterView::operator==( const RasterView& other ) const {
+    return xMin == other.xMin && xMax == other.xMax && yMin == other.yMin && yMax == other.yMax &&
+           mip == other.mip && stokeFrame == other.stokeFrame &&
+           isZFP == other.isZFP && precision == other.precision && numSubsets == other.numSubsets &&
+           regionId == other.regionId && numberOfBins == other.numberOfBins &&
+           converter == other.converter;
+}
+
+ChannelPrefetcher::ChannelPrefetcher( const Settings& settings ) :
+    m_settings( settings ){
+    m_pool.setMaxThreadCount( std::max( 1, m_settings.threads ) );
+    m_reclaimerId = Carta::Lib::MemoryBudget::instance().addReclaimer(
+            "ChannelPrefetcher", [this]( qint64 wanted ) {
+        return _reclaim( wanted );
+    });
+}
+
+ChannelPrefetcher::Settings ChannelPrefetcher::configuredSettings(){
+    Settings settings;
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    int memoryMB = static_cast<int>( settings.maxBytes / ( 1024 * 1024 ) );
+    _readSetting( json, "channelPrefetchDepth", &settings.depth );
+    _readSetting( json, "channelPrefetchMB", &memoryMB );
+    _readSetting( json, "channelPrefetchThreads", &settings.threads );
+    settings.maxBytes = static_cast<qint64>( memoryMB ) * 1024 * 1024;
+    return settings;
+}
+
+PBMSharedPtr ChannelPrefetcher::getRasterImageData( int fileId, std::shared_ptr<DataSource> dataSource,
+        const RasterView& view, int channel, int frameCount, bool withHistogram ){
+    QMutexLocker locker( &m_mutex );
+    FileState& state = m_files[fileId];
+    _harvest( state );
+
+    // anything prepared for another view is useless now
+    if ( view != state.view ){
+        _clear( state );
+        state.view = view;
+    }
+
+    // follow the direction and speed of the stepping
+    if ( state.lastChannel >= 0 && channel != state.lastChannel ){
+        int delta = channel - state.lastChannel;
+        // an animation wrapping around the end of the cube keeps its direction
+        if ( delta > frameCount / 2 ){
+            delta -= frameCount;
+        }
+        else if ( delta < -frameCount / 2 ){
+            delta += frameCount;
+        }
+        if ( delta != 0 ){
+            state.step = delta;
+        }
+        qint64 elapsed = state.lastRequest.isValid() ? state.lastRequest.elapsed() : -1;
+        if ( elapsed >= 0 && elapsed < MAX_STEP_INTERVAL_MS ){
+            state.intervalMs = _smooth( state.intervalMs, elapsed );
+        }
+        else {
+            state.intervalMs = 0;
+        }
+    }
+    state.lastChannel = channel;
+    state.lastRequest.start();
+
+    // serve the channel, waiting for it if a worker is already on it
+    PBMSharedPtr result = nullptr;
+    auto found = state.entries.find( channel );
+    if ( found != state.entries.end() ){
+        QFuture<Prepared> future = found->second.future;
+        if ( future.isFinished() || future.isRunning() ){
+            locker.unlock();
+            result = future.result().msg;
+            locker.relock();
+            _harvest( state );
+        }
+        // the memory budget may have taken it meanwhile
+        found = state.entries.find( channel );
+        if ( found != state.entries.end() ){
+            _drop( state, found, result != nullptr );
+        }
+    }
+    if ( result ){
+        m_stats.hits++;
+    }
+    else {
+        m_stats.misses++;
+        locker.unlock();
+        Prepared prepared = _prepare( dataSource, fileId, view, channel );
+        locker.relock();
+        state.computeMs = _smooth( state.computeMs, prepared.elapsedMs );
+        result = prepared.msg;
+        if ( result ){
+            state.messageBytes = result->ByteSize();
+        }
+    }
+
+    // forget the channels the client has stepped away from
+    std::vector<int> expected = _predict( state, channel, frameCount );
+    for ( auto it = state.entries.begin(); it != state.entries.end(); ){
+        auto next = std::next( it );
+        if ( std::find( expected.begin(), expected.end(), it->first ) == expected.end() ){
+            _drop( state, it );
+        }
+        it = next;
+    }
+
+    // schedule the expected channels as long as they fit into the budget
+    qint64 scheduledBytes = 0;
+    for ( const auto& entry : state.entries ){
+        if ( entry.second.bytes < 0 ){
+            scheduledBytes += state.messageBytes;
+        }
+    }
+    for ( int next : expected ){
+        if ( state.entries.count( next ) ){
+            continue;
+        }
+        if ( m_stats.bytes + scheduledBytes + state.messageBytes > m_settings.maxBytes ){
+            break;
+        }
+        // speculative work waits while the process is short of memory
+        Carta::Lib::MemoryBudget& budget = Carta::Lib::MemoryBudget::instance();
+        if ( budget.maxBytes() > 0 && budget.usedBytes() + scheduledBytes + state.messageBytes > budget.maxBytes() ){
+            break;
+        }
+        Entry entry;
+        entry.cancelled = std::make_shared<std::atomic<bool> >( false );
+        std::shared_ptr<std::atomic<bool> > cancelled = entry.cancelled;
+        const void* session = RasterEncodePool::currentSession();
+        entry.future = QtConcurrent::run( &m_pool, [dataSource, fileId, view, next, cancelled, session]() -> Prepared {
+            if ( *cancelled ){
+                return Prepared();
+            }
+            // a job dropped while it runs gives up early, its encoding counts for the session
+            Carta::Lib::Cancellation::Scope scope( cancelled );
+            RasterEncodePool::Session encodeSession( session );
+            return _prepare( dataSource, fileId, view, next );
+        });
+        state.entries[next] = entry;
+        scheduledBytes += state.messageBytes;
+    }
+    locker.unlock();
+
+    // a prepared message is handed out only once, so it can take the histogram
+    if ( result && withHistogram ){
+        if ( Carta::Lib::Cancellation::isCancelled( Carta::Lib::Cancellation::current() ) ){
+            return nullptr;
+        }
+        dataSource->_setChannelHistogram( static_cast<CARTA::RasterImageData*>( result.get() ), fileId,
+                                          view.regionId, channel, channel, view.stokeFrame,
+                                          view.numberOfBins, view.converter );
+    }
+    return result;
+}
+
+void ChannelPrefetcher::clear( int fileId ){
+    QMutexLocker locker( &m_mutex );
+    auto found = m_files.find( fileId );
+    if ( found == m_files.end() ){
+        return;
+    }
+    _clear( found->second );
+}
+
+bool ChannelPrefetcher::isPrepared( int fileId, const RasterView& view, int channel ){
+    QMutexLocker locker( &m_mutex );
+    auto found = m_files.find( fileId );
+    if ( found == m_files.end() || found->second.view != view ){
+        return false;
+    }
+    auto entry = found->second.entries.find( channel );
+    return entry != found->second.entries.end() && entry->second.future.isFinished() &&
+           entry->second.future.result().msg != nullptr;
+}
+
+const ChannelPrefetcher::Stats& ChannelPrefetcher::stats() const {
+    return m_stats;
+}
+
+ChannelPrefetcher::Prepared ChannelPrefetcher::_prepare( std::shared_ptr<DataSource> dataSource, int fileId,
+        const RasterView& view, int channel ){
+    Prepared prepared;
+    if ( ! dataSource ){
+        return prepared;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    // the histogram is added by the thread serving the message
+    bool changeFrame = false;
+    prepared.msg = dataSource->_getRasterImageData( fileId, view.xMin, view.xMax, view.yMin, view.yMax, view.mip,
+                                                    channel, channel, view.stokeFrame,
+                                                    view.isZFP, view.precision, view.numSubsets,
+                                                    changeFrame, view.regionId, view.numberOfBins, view.converter );
+    prepared.elapsedMs = timer.elapsed();
+    return prepared;
+}
+
+void ChannelPrefetcher::_clear( FileState& state ){
+    while ( ! state.entries.empty() ){
+        _drop( state, state.entries.begin() );
+    }
+    state.lastChannel = -1;
+    state.intervalMs = 0;
+}
+
+void ChannelPrefetcher::_harvest( FileState& state ){
+    for ( auto& entry : state.entries ){
+        Entry& job = entry.second;
+        if ( job.bytes >= 0 || ! job.future.isFinished() ){
+            continue;
+        }
+        const Prepared& prepared = job.future.result();
+        job.bytes = prepared.msg ? prepared.msg->ByteSize() : 0;
+        m_stats.bytes += job.bytes;
+        Carta::Lib::MemoryBudget::instance().account( job.bytes );
+        if ( prepared.msg ){
+            state.messageBytes = job.bytes;
+            state.computeMs = _smooth( state.computeMs, prepared.elapsedMs );
+        }
+    }
+}
+
+void ChannelPrefetcher::_drop( FileState& state, std::map<int, Entry>::iterator it, bool used ){
+    Entry& job = it->second;
+    *job.cancelled = true;
+    if ( job.bytes > 0 ){
+        m_stats.bytes -= job.bytes;
+        Carta::Lib::MemoryBudget::instance().account( -job.bytes );
+        if ( ! used ){
+            m_stats.wasted++;
+        }
+    }
+    state.entries.erase( it );
+}
+
+std::vector<int> ChannelPrefetcher::_predict( const FileState& state, int channel, int frameCount ) const {
+    std::vector<int> channels;
+    if ( m_settings.depth <= 0 || frameCount <= 1 ){
+        return channels;
+    }
+
+    // Look far enough ahead to hide the preparation time at the current stepping
+    // rate. Slow (manual) stepping only needs the next channel.
+    int depth = 1;
+    if ( state.intervalMs > 0 && state.computeMs > 0 ){
+        depth = static_cast<int>( std::ceil( state.computeMs / state.intervalMs ) ) + 1;
+    }
+    depth = std::min( depth, m_settings.depth );
+
+    for ( int i = 1; i <= depth; i++ ){
+        int next = ( ( channel + i * state.step ) % frameCount + frameCount ) % frameCount;
+        if ( next == channel || std::find( channels.begin(), channels.end(), next ) != channels.end() ){
+            break;
+        }
+        channels.push_back( next );
+    }
+    return channels;
+}
+
+qint64 ChannelPrefetcher::_reclaim( qint64 wanted ){
+    QMutexLocker locker( &m_mutex );
+    qint64 freed = 0;
+    for ( auto& file : m_files ){
+        FileState& state = file.second;
+        _harvest( state );
+        for ( auto it = state.entries.begin(); it != state.entries.end() && freed < wanted; ){
+            auto next = std::next( it );
+            if ( it->second.bytes > 0 ){
+                freed += it->second.bytes;
+                _drop( state, it );
+            }
+            it = next;
+        }
+    }
+    return freed;
+}
+
+ChannelPrefetcher::~ChannelPrefetcher(){
+    Carta::Lib::MemoryBudget::instance().removeReclaimer( m_reclaimerId );
+    QMutexLocker locker( &m_mutex );
+    for ( auto& file : m_files ){
+        for ( auto& entry : file.second.entries ){
+            *entry.second.cancelled = true;
+            if ( entry.second.bytes > 0 ){
+                Carta::Lib::MemoryBudget::instance().account( -entry.second.bytes );
+            }
+        }
+    }
+    locker.unlock();
+    m_pool.waitForDone();
+}
+
+}
+}
@@ -0,0 +1,190 @@
+/***
+ * Prepares the raster image data of the channels a client is about to request
+ * while it is stepping through (or animating) a cube.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IntensityUnitConverter.h"
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QMutex>
+#include <QThreadPool>
+#include <atomic>
+#include <map>
+#include <memory>
+
+typedef std::shared_ptr<google::protobuf::MessageLite> PBMSharedPtr;
+
+namespace Carta {
+namespace Data {
+
+class DataSource;
+
+class ChannelPrefetcher {
+
+public:
+
+    /// Everything that determines a raster image message except its channel.
+    struct RasterView {
+        int xMin = 0;
+        int xMax = 0;
+        int yMin = 0;
+        int yMax = 0;
+        int mip = 0;
+        int stokeFrame = 0;
+        bool isZFP = false;
+        int precision = 0;
+        int numSubsets = 0;
+        int regionId = -1;
+        int numberOfBins = 0;
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
+
+        bool operator==( const RasterView& other ) const;
+        bool operator!=( const RasterView& other ) const {
+            return ! ( *this == other );
+        }
+    };
+
+    struct Settings {
+        /// maximum number of channels prepared ahead of the client, 0 disables prefetching
+        int depth = 4;
+        /// memory budget of all prepared messages of a session
+        qint64 maxBytes = 256 * 1024 * 1024;
+        /// number of background workers
+        int threads = 2;
+    };
+
+    /// Counters for checking how well the prediction works.
+    struct Stats {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        /// prepared channels that were dropped without being requested
+        qint64 wasted = 0;
+        qint64 bytes = 0;
+    };
+
+    /**
+     * Constructor.
+     * @param settings - prefetch depth, memory budget and number of workers.
+     */
+    ChannelPrefetcher( const Settings& settings );
+
+    /**
+     * Returns the settings from the main configuration file (channelPrefetchDepth,
+     * channelPrefetchMB, channelPrefetchThreads), or the defaults.
+     */
+    static Settings configuredSettings();
+
+    /**
+     * Returns the raster image data of a channel. The message comes from the prepared
+     * ones if the channel was predicted, otherwise it is computed right away. Afterwards
+     * the channels that are expected next are scheduled on the workers.
+     *
+     * The workers only read, down sample and encode the pixels. The channel histogram
+     * needs the intensity cache and the plugins, which are not thread safe, so it is
+     * computed by the caller's thread and only for the channel that is served.
+     * @param fileId - the file id of the image.
+     * @param dataSource - the data source of that image.
+     * @param view - the image bounds, down sampling and compression settings.
+     * @param channel - the requested channel.
+     * @param frameCount - the number of channels of the image.
+     * @param withHistogram - whether to add the histogram of the channel to the message.
+     * @return - the raster image data message, or nullptr if the computation was cancelled.
+     */
+    PBMSharedPtr getRasterImageData( int fileId, std::shared_ptr<DataSource> dataSource,
+            const RasterView& view, int channel, int frameCount, bool withHistogram );
+
+    /**
+     * Drops everything prepared for an image, e.g. when the view changed or the
+     * file was closed. Work that is already running is finished but discarded.
+     * @param fileId - the file id of the image.
+     */
+    void clear( int fileId );
+
+    /**
+     * Returns true if the raster image data of a channel is prepared, so it can be
+     * served right away.
+     * @param fileId - the file id of the image.
+     * @param view - the image bounds, down sampling and compression settings.
+     * @param channel - the channel.
+     */
+    bool isPrepared( int fileId, const RasterView& view, int channel );
+
+    /// Returns the hit/miss counters.
+    const Stats& stats() const;
+
+    /// Waits for the workers to finish.
+    ~ChannelPrefetcher();
+
+private:
+
+    /// Result of a prefetch job.
+    struct Prepared {
+        PBMSharedPtr msg = nullptr;
+        qint64 elapsedMs = 0;
+    };
+
+    /// A scheduled or finished prefetch job.
+    struct Entry {
+        QFuture<Prepared> future;
+        std::shared_ptr<std::atomic<bool> > cancelled;
+        /// size of the finished message, -1 until harvested
+        qint64 bytes = -1;
+    };
+
+    /// The stepping state of one image.
+    struct FileState {
+        RasterView view;
+        int lastChannel = -1;
+        /// signed channel step between the last two requests
+        int step = 1;
+        /// smoothed time between two channel requests, 0 if unknown
+        double intervalMs = 0;
+        /// smoothed time to prepare one channel, 0 if unknown
+        double computeMs = 0;
+        /// size of the last prepared message, used to estimate the next ones
+        qint64 messageBytes = 0;
+        QElapsedTimer lastRequest;
+        std::map<int, Entry> entries;
+    };
+
+    /// Computes one raster image message, without histogram.
+    static Prepared _prepare( std::shared_ptr<DataSource> dataSource, int fileId,
+            const RasterView& view, int channel );
+
+    /// Drops everything prepared for an image and restarts its stepping, m_mutex must be held.
+    void _clear( FileState& state );
+
+    /// Accounts for the jobs of an image that have finished since the last call.
+    void _harvest( FileState& state );
+
+    /// Cancels a job and releases its memory; used is set if its message was handed out.
+    void _drop( FileState& state, std::map<int, Entry>::iterator it, bool used = false );
+
+    /// Returns the channels expected after the given one, nearest first.
+    std::vector<int> _predict( const FileState& state, int channel, int frameCount ) const;
+
+    /// Drops finished messages until wanted bytes are freed, for the process wide
+    /// memory budget; called from any thread.
+    qint64 _reclaim( qint64 wanted );
+
+    Settings m_settings;
+    Stats m_stats;
+    std::map<int, FileState> m_files;
+    QThreadPool m_pool;
+
+    /// Guards the states and counters against _reclaim(); not held while waiting for
+    /// a job or computing a message.
+    QMutex m_mutex;
+
+    /// id of the reclaimer registered with the memory budget
+    int m_reclaimerId = -1;
+
+    ChannelPrefetcher( const ChannelPrefetcher& other );
+    ChannelPrefetcher& operator=( const ChannelPrefetcher& other );
+};
+
+}
+}
@@ -85,6 +85,10 @@ std::shared_ptr<Carta::Lib::Image::ImageInterface> Controller::getImage() {
     return m_stack->_getImage();
 }
 
+std::shared_ptr<DataSource> Controller::getDataSource() {
+    return m_stack->_getDataSource();
+}
+
 std::vector<int> Controller::getImageDimensions( ) const {
     std::vector<int> result = m_stack->_getImageDimensions();
     return result;
@@ -73,6 +73,13 @@ public:
 
     std::shared_ptr<Carta::Lib::Image::ImageInterface> getImage();
 
+    /**
+     * Returns the data source of the current image. Unlike the other getters it stays
+     * bound to that image when another file id is set, so it can be used by background
+     * workers (see ChannelPrefetcher).
+     */
+    std::shared_ptr<DataSource> getDataSource();
+
     /**
      * Get the image dimensions.
      */
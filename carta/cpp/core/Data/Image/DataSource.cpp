@@ -4,18 +4,26 @@
 #include "PluginManager.h"
 #include "CartaLib/IImage.h"
 #include "Data/Util.h"
-#include "CartaLib/Hooks/LoadAstroImage.h"
+#include "Data/Image/ImageRegistry.h"
+#include "Data/Image/MipPyramid.h"
+#include "Data/Image/RasterCodec.h"
+#include "Data/Image/RasterEncodePool.h"
+#include "Data/Image/SpectralCompanion.h"
 #include "CartaLib/Hooks/GetPersistentCache.h"
 #include "CartaLib/Hooks/PercentileToPixelHook.h"
 #include "CartaLib/IPCache.h"
+#include "CartaLib/MemoryBudget.h"
+#include "CartaLib/BufferPool.h"
+#include "CartaLib/Cancellation.h"
 #include "../../Algorithms/percentileAlgorithms.h"
+#include "../../Algorithms/downsampleAlgorithms.h"
 #include <QDebug>
 #include <QElapsedTimer>
 #include "CartaLib/UtilCASA.h"
-#include <zfp.h>
 #include <cmath>
-#include <QFuture>
-#include <QtConcurrent>
+#include <algorithm>
+#include <QThread>
+#include <QMutexLocker>
 
 using Carta::Lib::AxisInfo;
 using Carta::Lib::AxisDisplayInfo;
@@ -35,6 +43,7 @@ const int DataSource::INDEX_FRAME_LOW = 3;
 const int DataSource::INDEX_FRAME_HIGH = 4;
 const bool DataSource::IS_MULTITHREAD_ZFP = true;
 const int DataSource::MAX_SUBSETS = 8;
+const int DataSource::MASK_CHUNK_COLUMNS = 512;
 
 DataSource::DataSource() :
     m_image( nullptr ),
@@ -127,8 +136,9 @@ void DataSource::_setCoordinateSystem( Carta::Lib::KnownSkyCS cs ){
 
 std::vector<AxisInfo> DataSource::_getAxisInfos() const {
     std::vector<AxisInfo> Infos;
-    casa_mutex.lock();
 
+    // the formatter belongs to the image, which may be read by other sessions meanwhile
+    QMutexLocker readLocker(m_image ? m_image->readLock() : nullptr);
     int axisCount = m_coordinateFormatter->nAxes();
     for ( int axis = 0 ; axis < axisCount; axis++ ) {
         const AxisInfo & axisInfo = m_coordinateFormatter-> axisInfo( axis );
@@ -137,8 +147,6 @@ std::vector<AxisInfo> DataSource::_getAxisInfos() const {
         }
     }
 
-    casa_mutex.unlock();
-
     return Infos;
 }
 
@@ -546,10 +554,62 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
 
     std::vector<float> imageData; // the image raw data with downsampling
 
+    // rows of imageData that have NaNs, filled in by the down sampling of the raw data
+    // so that the NaN encoding can skip the others
+    std::vector<char> nanRows;
+
+    // the request may be superseded while the rows are read
+    Carta::Lib::Cancellation::Token cancellation = Carta::Lib::Cancellation::current();
+
     // start timer for computing approximate percentiles
     QElapsedTimer timer;
     timer.start();
 
+    if (!_getDownsampledData(xMin, xMax, yMin, yMax, mip, frameLow, frameHigh, stokeFrame, imageData, nanRows)) {
+        return nullptr;
+    }
+    int nx = (xMax - xMin) / mip;
+    int ny = (yMax - yMin) / mip;
+
+    // add the RasterImageData message
+    std::shared_ptr<CARTA::RasterImageData> raster = _makeRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
+                                                                          frameLow, stokeFrame, imageData, nx, ny,
+                                                                          isZFP, precision, numSubsets,
+                                                                          nanRows.empty() ? nullptr : nanRows.data());
+    Carta::Lib::BufferPool<float>::instance().release(std::move(imageData));
+
+    //qDebug() << "number of the raw data sent L=" << imageData.size() << ", WxH=" << nx * ny << ", Difference:" << (nx * ny - imageData.size());
+
+    // end of timer for loading the raw data
+    int elapsedTime = timer.elapsed();
+    if (CARTA_RUNTIME_CHECKS) {
+        qCritical() << "<> Time to get raster image data:" << elapsedTime << "ms";
+    }
+
+    qDebug() << "[DataSource] .......................................................................Done";
+
+    // check if need to calculate the histogram data, unless the request was superseded
+    // meanwhile (changeFrame stays set for the next one)
+    if (changeFrame && Carta::Lib::Cancellation::isCancelled(cancellation)) {
+        return nullptr;
+    }
+    if (changeFrame) {
+        _setChannelHistogram(raster.get(), fileId, regionId, frameLow, frameHigh, stokeFrame,
+                             numberOfBins, converter);
+        // reset the m_changeFrame[fileId] = false; in the NewServerConnector obj
+        changeFrame = false;
+    }
+
+    return raster;
+}
+
+bool DataSource::_getDownsampledData(int xMin, int xMax, int yMin, int yMax, int mip,
+    int frameLow, int frameHigh, int stokeFrame,
+    std::vector<float>& imageData, std::vector<char>& nanRows) const {
+
+    // the request may be superseded while the rows are read, the strips look at it too
+    Carta::Lib::Cancellation::Token cancellation = Carta::Lib::Cancellation::current();
+
     // get the raw data
     Carta::Lib::NdArray::RawViewInterface* view = _getRawDataForStoke(frameLow, frameHigh, stokeFrame);
 
@@ -557,8 +617,8 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
     if (mip <= 0 || abs(mip) > std::min(view->dims()[0], view->dims()[1])) {
         qWarning() << "[DataSource] Downsampling parameter, mip=" << mip
                    << ", which is larger than the image width=" <<  view->dims()[0]
-                   << "or high=" << view->dims()[1] << ". Return nullptr";
-        return nullptr;
+                   << "or high=" << view->dims()[1];
+        return false;
         // [Try] it may be due to the frontend signal problem, reset the mip as 1 to pass, and then resend the next correct signal
         //mip = 1;
     }
@@ -573,27 +633,114 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
     int prepareCols = view->dims()[0]; // get the full width length
     int prepareRows = mip;
     int area = prepareCols * prepareRows;
-    std::vector<float> prepareArea(area);
+    int scratchSize = 2 * nx * mip;
+
+    // the row buffer and the down sampled image have to fit into the memory budget
+    Carta::Lib::MemoryBudget::Reservation reservation((static_cast<qint64>(area) + scratchSize + static_cast<qint64>(nx) * ny) * sizeof(float));
+    if (!reservation.ok()) {
+        qWarning() << "[DataSource] Not enough memory for the raster image data of" << m_fileName;
+        return false;
+    }
 
     int nRows = (yMax - yMin) / mip;
     int nCols = (xMax - xMin) / mip;
-    int nextRowToReadIn = yMin;
 
-    auto updateRows = [&]() -> void {
-        CARTA_ASSERT(nextRowToReadIn < view->dims()[1]); // check if the row index is beyond the length of the image high
+    // recycled buffers, so fast animation doesn't allocate and fault in fresh memory per channel
+    Carta::Lib::BufferPool<float>& floatPool = Carta::Lib::BufferPool<float>::instance();
+    imageData = floatPool.acquire(static_cast<size_t>(nRows) * nCols);
+
+    nanRows.clear();
+
+    // a down sampled copy stored with the image has the means of the same blocks
+    // as long as the bounds are on block boundaries
+    Carta::Lib::NdArray::RawViewInterface* mipView = nullptr;
+    std::vector<int> mipLevels = m_image->mipLevels();
+    if (mip > 1 && xMin % mip == 0 && yMin % mip == 0 &&
+        std::find(mipLevels.begin(), mipLevels.end(), mip) != mipLevels.end()) {
+        SliceND mipSlice = _getFrameSlice(frameLow, frameHigh, stokeFrame);
+        mipSlice.slice(0).start(xMin / mip).end(xMin / mip + nCols);
+        mipSlice.slice(1).start(yMin / mip).end(yMin / mip + nRows);
+        mipView = m_image->getMipSlice(mip, mipSlice);
+    }
+
+    // otherwise zoomed-out views of a single plane come from its mip pyramid; only the
+    // thread of the session uses the disk cache, the database connection belongs to it
+    std::shared_ptr<MipPyramid> pyramid;
+    if (!mipView && mip > 1 && frameLow == frameHigh) {
+        std::shared_ptr<Carta::Lib::IPCache> diskCache = QThread::currentThread() == thread() ? m_diskCache : nullptr;
+        pyramid = MipPyramid::get(m_fileName, frameLow, stokeFrame, mip, xMin, yMin, view, diskCache);
+    }
+
+    // down sample the block row j (mip rows of pixels) into imageData, the rows are read
+    // into prepareArea and summed with the help of scratch
+    auto downsampleRow = [&](int j, std::vector<float>& prepareArea, std::vector<float>& scratch) -> void {
+        int firstRow = yMin + j * mip;
+        CARTA_ASSERT(firstRow < view->dims()[1]); // check if the row index is beyond the length of the image high
 
         SliceND rowSlice;
-        rowSlice.next().start( nextRowToReadIn ).end( nextRowToReadIn + prepareRows );
+        rowSlice.next().start( firstRow ).end( firstRow + prepareRows );
         auto rawRowView = view -> getView( rowSlice );
 
         // make a float view of this raw row view
         Carta::Lib::NdArray::Float fview( rawRowView, true );
 
         int t = 0;
-        fview.forEach( [&] ( const float & val ) {
-            // To improve the performance, the prepareArea also update only one row by computing the module
-            prepareArea[(t++)] = val;
-        });
+        Carta::Lib::NdArray::PixelMask::SharedPtr rowMask = rawRowView->pixelMask();
+        if (rowMask && rowMask->noneValid(0, rowMask->size())) {
+            // fully masked rows, no need to read the pixels at all
+            std::fill(imageData.begin() + static_cast<size_t>(j) * nCols,
+                      imageData.begin() + static_cast<size_t>(j + 1) * nCols, NAN);
+            nanRows[j] = 1;
+            return;
+        }
+        if (rowMask && !rowMask->allValid(0, rowMask->size())) {
+            // only the column chunks with valid pixels are read, the others are masked
+            // completely and get their NaNs below
+            for (int c0 = 0; c0 < prepareCols; c0 += MASK_CHUNK_COLUMNS) {
+                int c1 = std::min(c0 + MASK_CHUNK_COLUMNS, prepareCols);
+                bool anyValid = false;
+                for (int r = 0; r < prepareRows && !anyValid; r++) {
+                    anyValid = !rowMask->noneValid(static_cast<int64_t>(r) * prepareCols + c0, c1 - c0);
+                }
+                if (!anyValid) {
+                    continue;
+                }
+                SliceND chunkSlice;
+                chunkSlice.start(c0).end(c1);
+                Carta::Lib::NdArray::Float chunkView(rawRowView->getView(chunkSlice), true);
+                int64_t width = c1 - c0, row = 0, col = 0;
+                chunkView.forEach(chunkView.DEFAULT_BLOCK_SIZE, [&] (const float * vals, int64_t count) {
+                    while (count > 0) {
+                        int64_t n = std::min(count, width - col);
+                        std::copy(vals, vals + n, prepareArea.begin() + row * prepareCols + c0 + col);
+                        vals += n;
+                        count -= n;
+                        col += n;
+                        if (col == width) {
+                            col = 0;
+                            row++;
+                        }
+                    }
+                });
+            }
+            t = area;
+        }
+        else {
+            fview.forEach( fview.DEFAULT_BLOCK_SIZE, [&] ( const float * vals, int64_t count ) {
+                // copy whole blocks of the rows into the prepareArea
+                int n = std::min( static_cast<int>( count ), area - t );
+                std::copy( vals, vals + n, prepareArea.begin() + t );
+                t += count;
+            });
+        }
+
+        // masked pixels are treated like NaNs from here on (also by the NaN encoding)
+        if (rowMask) {
+            for (const auto & run : rowMask->runs(false)) {
+                int end = std::min(static_cast<int>(run.start + run.length), area);
+                std::fill(prepareArea.begin() + std::min(static_cast<int>(run.start), end), prepareArea.begin() + end, NAN);
+            }
+        }
 
         if (t != area) {
             qDebug() << "The prepared length of the raw data array:" << area
@@ -602,34 +749,79 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
             qFatal("The prepared length of the raw data array is not consistent with the slice cut!!");
         }
 
-        // Calculate the mean of each block (mip X mip)
-        for (int i = 0; i < nCols; i++) {
-            float rawData = 0;
-            int elems = mip * mip;
-            float denominator = elems;
-            for (int e = 0; e < elems; e++) {
-                int row = e / mip;
-                int col = e % mip;
-                int index = ((row * prepareCols) + (col + (xMin + (i * mip))));
-                if (std::isfinite(prepareArea[index])) {
-                    rawData += prepareArea[index];
-                } else {
-                    denominator -= 1;
-                }
-            }
-            // set the NaN type of the pixel as the minimum of the other finite pixel values
-            rawData = (denominator < 1 ? NAN : rawData / denominator);
-            imageData.push_back(rawData);
+        // Calculate the mean of each block (mip X mip), NaN if it has no finite pixels
+        int nans = Carta::Core::Algorithms::blockMeans(prepareArea.data() + xMin, prepareCols, mip, nCols,
+                                                       scratch.data(), imageData.data() + static_cast<size_t>(j) * nCols);
+        nanRows[j] = nans > 0;
+    };
+
+    // down sample the block rows from first to last (exclusive) with their own buffers
+    auto downsampleStrip = [&](int first, int last) -> void {
+        std::vector<float> prepareArea = floatPool.acquire(area);
+        std::vector<float> scratch = floatPool.acquire(scratchSize);
+        for (int j = first; j < last && !Carta::Lib::Cancellation::isCancelled(cancellation); j++) {
+            downsampleRow(j, prepareArea, scratch);
         }
-        nextRowToReadIn += prepareRows;
+        floatPool.release(std::move(prepareArea));
+        floatPool.release(std::move(scratch));
     };
 
-    // scan the raw data for with rows for down sampling
-    for (int j = 0; j < nRows; j++) {
-        updateRows();
+    if (mipView) {
+        qDebug() << "[DataSource] Using the stored mip" << mip;
+        imageData.resize(nRows * nCols);
+        Carta::Lib::NdArray::PixelMask::SharedPtr mipMask = mipView->pixelMask();
+        Carta::Lib::NdArray::Float fview(mipView, true);
+        size_t t = 0;
+        fview.forEach(fview.DEFAULT_BLOCK_SIZE, [&] (const float * vals, int64_t count) {
+            size_t n = std::min(static_cast<size_t>(count), imageData.size() - t);
+            std::copy(vals, vals + n, imageData.begin() + t);
+            t += n;
+        });
+        if (mipMask) {
+            for (const auto & run : mipMask->runs(false)) {
+                size_t end = std::min(static_cast<size_t>(run.start + run.length), imageData.size());
+                std::fill(imageData.begin() + std::min(static_cast<size_t>(run.start), end), imageData.begin() + end, NAN);
+            }
+        }
+    } else if (pyramid && pyramid->downsample(mip, xMin, yMin, nCols, nRows, imageData)) {
+        qDebug() << "[DataSource] Using the mip pyramid for mip" << mip;
+    } else {
+        // scan the raw data in strips of block rows, in parallel if the memory budget
+        // holds a row buffer per strip
+        imageData.resize(static_cast<size_t>(nRows) * nCols);
+        nanRows.assign(nRows, 0);
+        int nStrips = std::max(1, std::min(QThread::idealThreadCount(), nRows));
+        Carta::Lib::MemoryBudget::Reservation stripReservation(
+            static_cast<qint64>(nStrips - 1) * (area + scratchSize) * sizeof(float));
+        if (!stripReservation.ok()) {
+            nStrips = 1;
+        }
+        qDebug() << "[DataSource] Down sampling in" << nStrips << "strips using"
+                 << Carta::Core::Algorithms::blockMeansImplementation();
+        // the strips run on the raster pool in the queue of the session, so they
+        // don't wait behind the global Qt pool, and see the cancellation of the request
+        std::vector<std::function<void()> > strips;
+        for (int i = 0; i < nStrips; i++) {
+            strips.push_back([&downsampleStrip, cancellation, i, nRows, nStrips]() {
+                Carta::Lib::Cancellation::Scope cancellationScope(cancellation);
+                downsampleStrip(i * nRows / nStrips, (i + 1) * nRows / nStrips);
+            });
+        }
+        const void* session = RasterEncodePool::currentSession();
+        RasterEncodePool::instance().run(session ? session : this, strips);
     }
 
-    // add the RasterImageData message
+    if (Carta::Lib::Cancellation::isCancelled(cancellation)) {
+        qDebug() << "[DataSource] The raster image data is not wanted anymore";
+        floatPool.release(std::move(imageData));
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<CARTA::RasterImageData> DataSource::_makeRasterImageData(int fileId, int xMin, int xMax, int yMin, int yMax,
+    int mip, int frameLow, int stokeFrame, std::vector<float>& imageData, int nx, int ny,
+    bool isZFP, int precision, int numSubsets, const char* nanRows) const {
     CARTA::ImageBounds* imgBounds = new CARTA::ImageBounds();
     imgBounds->set_x_min(xMin);
     imgBounds->set_x_max(xMax);
@@ -643,128 +835,151 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
     raster->set_stokes(stokeFrame);
     raster->set_mip(mip);
 
-    if (isZFP) {
-        // use ZFP compression
-        raster->set_compression_type(CARTA::CompressionType::ZFP);
-        raster->set_compression_quality(precision);
-
-        if (IS_MULTITHREAD_ZFP) {
-            // ZFP compression with multi-thread
-            int N = std::min(numSubsets, MAX_SUBSETS); // total number of threads
-            std::vector<size_t> compressedSizes(N);
-            std::vector<std::vector<int32_t> > nanEncodings(N);
-            std::vector<std::vector<char> > compressionBuffers(N);
-            std::vector<int> status(N);
-            std::vector<QFuture<void> > futures;
-
-            for (int i = 0; i < N; i++) {
-                auto &compressionBuffer = compressionBuffers[i];
-                auto &compressedSize = compressedSizes[i];
-
-                QFuture<void> future = QtConcurrent::run(
-                    [&nanEncodings, &imageData, &compressionBuffer, &compressedSize, &status, i,
-                        nx, ny, N, precision, this]() {
-
-                    int subsetRowStart = i * (ny / N);
-                    int subsetRowEnd = (i + 1) * (ny / N);
-
-                    if (i == N - 1) {
-                        subsetRowEnd = ny;
-                    }
-
-                    int subsetElementStart = subsetRowStart * nx;
-
-                    nanEncodings[i] = this->_getNanEncodingsBlock(imageData, subsetElementStart, nx, subsetRowEnd - subsetRowStart);
-                    status[i] = this->_compress(imageData, subsetElementStart, compressionBuffer, compressedSize,
-                                                nx, subsetRowEnd - subsetRowStart, precision);
-                });
-
-                futures.push_back(future);
+    // the codec is chosen by the compression type and quality of the request
+    std::shared_ptr<const RasterCodec> codec = RasterCodec::select(isZFP, precision);
+    raster->set_compression_type(codec->compressionType());
+    raster->set_compression_quality(codec->compressionQuality(precision));
+
+    // the number of subsets follows the image size and the cores, the client's
+    // numSubsets is only an upper bound
+    RasterEncodePool& encodePool = RasterEncodePool::instance();
+    int N = 1;
+    if (IS_MULTITHREAD_ZFP && codec->splitsIntoSubsets()) {
+        N = encodePool.subsetCount(nx, ny, std::min(std::max(numSubsets, 1), MAX_SUBSETS));
+    }
+    bool withNanEncodings = codec->needsNanEncodings();
+    std::vector<size_t> compressedSizes(N);
+    std::vector<std::vector<int32_t> > nanEncodings(N);
+    std::vector<std::vector<char> > compressionBuffers(N);
+    std::vector<int> status(N);
+    std::vector<std::function<void()> > tasks;
+
+    for (int i = 0; i < N; i++) {
+        auto &compressionBuffer = compressionBuffers[i];
+        auto &compressedSize = compressedSizes[i];
+
+        tasks.push_back(
+            [&nanEncodings, &imageData, &compressionBuffer, &compressedSize, &status, &codec, i,
+                nx, ny, N, precision, nanRows, withNanEncodings, this]() {
+
+            int subsetRowStart = i * (ny / N);
+            int subsetRowEnd = (i + 1) * (ny / N);
+
+            if (i == N - 1) {
+                subsetRowEnd = ny;
             }
 
-            // Wait for completed compression threads
-            for (auto future : futures) {
-                // Note that if the future finished BEFORE we call this, it will still work.
-                future.waitForFinished();
-            }
+            int subsetElementStart = subsetRowStart * nx;
 
-            // Complete the message
-            for (int i = 0; i < N; i++) {
-                raster->add_image_data(compressionBuffers[i].data(), compressedSizes[i]);
-                raster->add_nan_encodings((char*) nanEncodings[i].data(), nanEncodings[i].size() * sizeof(int));
+            if (withNanEncodings) {
+                nanEncodings[i] = this->_getNanEncodingsBlock(imageData, subsetElementStart, nx, subsetRowEnd - subsetRowStart,
+                                                              nanRows ? nanRows + subsetRowStart : nullptr);
             }
+            status[i] = codec->encode(imageData.data() + subsetElementStart, nx, subsetRowEnd - subsetRowStart,
+                                      precision, compressionBuffer, compressedSize) ? 0 : 1;
+        });
+    }
 
-            qDebug() << "[DataSource] Apply ZFP compression (status=" << status << ", precision=" << precision
-                     << ", number of subsets=" << N << ", NaN encodings size=" << nanEncodings.size() << ")";
-        } else {
-            // ZFP compression with single thread
-            std::vector<char> compressionBuffer;
-            size_t compressedSize; // use "vector<size_t> compressedSizes(numSubsets);" for multi-thread calculations
-
-            // get NaN type pixel distances of indices
-            std::vector<int32_t> nanEncodings = _getNanEncodingsBlock(imageData, 0, nx, ny);
-
-            // apply ZFP function
-            int status = _compress(imageData, 0, compressionBuffer, compressedSize, nx, ny, precision);
-
-            // use "raster->add_image_data(compressionBuffers[i].data(), compressedSizes[i])" for multi-thread calculations
-            raster->add_image_data(compressionBuffer.data(), compressedSize);
-            raster->add_nan_encodings((char*) nanEncodings.data(), nanEncodings.size() * sizeof(int)); // This item is necessary !!
+    // encode the subsets on the raster encoding pool, queued with the other tasks of the
+    // session; this thread helps until all are done
+    const void* session = RasterEncodePool::currentSession();
+    encodePool.run(session ? session : this, tasks);
 
-            qDebug() << "[DataSource] Apply ZFP compression (status=" << status << ", precision=" << precision
-                     << ", number of subsets= 1" << ", NaN encodings size=" << nanEncodings.size() << ")";
+    // Complete the message
+    for (int i = 0; i < N; i++) {
+        raster->add_image_data(compressionBuffers[i].data(), compressedSizes[i]);
+        if (withNanEncodings) {
+            raster->add_nan_encodings((char*) nanEncodings[i].data(), nanEncodings[i].size() * sizeof(int));
         }
-    } else {
-        // without compression
-        raster->set_compression_type(CARTA::CompressionType::NONE);
-        raster->set_compression_quality(0);
-        raster->add_image_data(imageData.data(), imageData.size() * sizeof(float));
-        qDebug() << "[DataSource] w/o ZFP compression!";
+        Carta::Lib::BufferPool<char>::instance().release(std::move(compressionBuffers[i]));
     }
 
-    //qDebug() << "number of the raw data sent L=" << imageData.size() << ", WxH=" << nx * ny << ", Difference:" << (nx * ny - imageData.size());
+    qDebug() << "[DataSource] Apply" << codec->name() << "encoding (status=" << status << ", quality=" << precision
+             << ", number of subsets=" << N << ", NaN encodings size=" << nanEncodings.size() << ")";
+    RasterEncodePool::Stats encodeStats = encodePool.stats();
+    qDebug() << "[DataSource] Raster encoding queue: waiting=" << encodeStats.queued
+             << ", peak=" << encodeStats.peakQueued << ", sessions=" << encodeStats.sessions
+             << ", run by workers=" << encodeStats.stolen << ", by requests=" << encodeStats.helped;
 
-    // end of timer for loading the raw data
-    int elapsedTime = timer.elapsed();
-    if (CARTA_RUNTIME_CHECKS) {
-        qCritical() << "<> Time to get raster image data:" << elapsedTime << "ms";
-    }
+    return raster;
+}
 
-    qDebug() << "[DataSource] .......................................................................Done";
+PBMSharedPtr DataSource::_getRasterImagePreview(int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
+    int frame, int stokeFrame, bool isZFP, int precision) const {
 
-    // check if need to calculate the histogram data
-    if (changeFrame) {
-        RegionHistogramData result = _getPixels2HistogramData(fileId, regionId, frameLow, frameHigh, stokeFrame,
-                                                              numberOfBins, converter);
-        // check if the calculation result is valid
-        if (result.bins.size() > 0) {
-            // add RegionHistogramData in the RasterImageData message
-            CARTA::RegionHistogramData* region_histogram_data = new CARTA::RegionHistogramData();
-            region_histogram_data->set_file_id(result.fileId);
-            region_histogram_data->set_region_id(result.regionId);
-            region_histogram_data->set_stokes(result.stokeFrame);
-
-            CARTA::Histogram* histogram = region_histogram_data->add_histograms();
-            histogram->set_channel(result.frameLow);
-            histogram->set_num_bins(result.num_bins);
-            histogram->set_bin_width(result.bin_width);
-
-            // the minimum value of pixels is the first bin center
-            histogram->set_first_bin_center(result.first_bin_center);
-
-            // fill in the vector of the histogram data
-            for (auto intensity : result.bins) {
-                histogram->add_bins(intensity);
-            }
-            raster->set_allocated_channel_histogram_data(region_histogram_data);
+    std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(_getRawDataForStoke(frame, frame, stokeFrame));
+    if (!view || mip <= 0) {
+        return nullptr;
+    }
+    xMin = std::max(xMin, 0);
+    yMin = std::max(yMin, 0);
+    xMax = std::min(xMax, static_cast<int>(view->dims()[0]));
+    yMax = std::min(yMax, static_cast<int>(view->dims()[1]));
+    int nx = (xMax - xMin) / mip;
+    int ny = (yMax - yMin) / mip;
+    if (nx <= 0 || ny <= 0) {
+        return nullptr;
+    }
+
+    // one pixel out of every mip x mip block, only every mip-th row is read
+    SliceND sampleSlice;
+    sampleSlice.slice(0).start(xMin).end(xMin + (nx - 1) * mip + 1).step(mip);
+    sampleSlice.slice(1).start(yMin).end(yMin + (ny - 1) * mip + 1).step(mip);
+    std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> sampleView(view->getView(sampleSlice));
+
+    Carta::Lib::BufferPool<float>& floatPool = Carta::Lib::BufferPool<float>::instance();
+    std::vector<float> imageData = floatPool.acquire(static_cast<size_t>(nx) * ny);
+    Carta::Lib::NdArray::Float fview(sampleView.get(), false);
+    size_t t = 0;
+    fview.forEach(fview.DEFAULT_BLOCK_SIZE, [&] (const float * vals, int64_t count) {
+        size_t n = std::min(static_cast<size_t>(count), imageData.size() - t);
+        std::copy(vals, vals + n, imageData.begin() + t);
+        t += n;
+    });
+    Carta::Lib::NdArray::PixelMask::SharedPtr sampleMask = sampleView->pixelMask();
+    if (sampleMask) {
+        for (const auto & run : sampleMask->runs(false)) {
+            size_t end = std::min(static_cast<size_t>(run.start + run.length), imageData.size());
+            std::fill(imageData.begin() + std::min(static_cast<size_t>(run.start), end), imageData.begin() + end, NAN);
         }
-        // reset the m_changeFrame[fileId] = false; in the NewServerConnector obj
-        changeFrame = false;
     }
 
+    qDebug() << "[DataSource] Raster preview with mip" << mip << "and precision" << precision;
+    PBMSharedPtr raster = _makeRasterImageData(fileId, xMin, xMin + nx * mip, yMin, yMin + ny * mip, mip, frame,
+                                               stokeFrame, imageData, nx, ny, isZFP, precision, 1);
+    floatPool.release(std::move(imageData));
     return raster;
 }
 
+void DataSource::_setChannelHistogram(CARTA::RasterImageData* raster, int fileId, int regionId,
+    int frameLow, int frameHigh, int stokeFrame, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
+    RegionHistogramData result = _getPixels2HistogramData(fileId, regionId, frameLow, frameHigh, stokeFrame,
+                                                          numberOfBins, converter);
+    // check if the calculation result is valid
+    if (result.bins.size() > 0) {
+        // add RegionHistogramData in the RasterImageData message
+        CARTA::RegionHistogramData* region_histogram_data = new CARTA::RegionHistogramData();
+        region_histogram_data->set_file_id(result.fileId);
+        region_histogram_data->set_region_id(result.regionId);
+        region_histogram_data->set_stokes(result.stokeFrame);
+
+        CARTA::Histogram* histogram = region_histogram_data->add_histograms();
+        histogram->set_channel(result.frameLow);
+        histogram->set_num_bins(result.num_bins);
+        histogram->set_bin_width(result.bin_width);
+
+        // the minimum value of pixels is the first bin center
+        histogram->set_first_bin_center(result.first_bin_center);
+
+        // fill in the vector of the histogram data
+        for (auto intensity : result.bins) {
+            histogram->add_bins(intensity);
+        }
+        raster->set_allocated_channel_histogram_data(region_histogram_data);
+    }
+}
+
 PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
     int frameLow, int frameHigh, int stokeFrame,
     Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
@@ -842,16 +1057,29 @@ PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
 void DataSource::_getXYProfiles(Carta::Lib::NdArray::Double doubleView, const int imgWidth, const int imgHeight,
     const int x, const int y, std::vector<float> & xProfile, std::vector<float> & yProfile) const {
 
+    // read the whole row/column with one line read each instead of one get() per pixel
+    auto appendProfile = [] (std::vector<float> & profile, const std::vector<double> & line) {
+        profile.reserve(line.size());
+        for (double val : line) {
+            std::isfinite(val) ? profile.push_back((float)val) : profile.push_back(NAN); // replace infinite with NaN
+        }
+    };
+
+    std::vector<int> pos(doubleView.dims().size(), 0);
+
     // get X profile
-    for (int index = 0; index < imgWidth; index++) {
-        float val = (float)doubleView.get({index,y});
-        std::isfinite(val) ? xProfile.push_back(val) : xProfile.push_back(NAN); // replace infinite with NaN
+    if (y >= 0 && y < imgHeight) {
+        pos[1] = y;
+        appendProfile(xProfile, doubleView.readLine(pos, 0));
+        CARTA_ASSERT((int)xProfile.size() == imgWidth);
     }
 
     // get Y profile
-    for (int index = 0; index < imgHeight; index++) {
-        float val = (float)doubleView.get({x,index});
-        std::isfinite(val) ? yProfile.push_back(val) : yProfile.push_back(NAN); // replace infinite with NaN
+    if (x >= 0 && x < imgWidth) {
+        pos[0] = x;
+        pos[1] = 0;
+        appendProfile(yProfile, doubleView.readLine(pos, 1));
+        CARTA_ASSERT((int)yProfile.size() == imgHeight);
     }
 }
 
@@ -879,101 +1107,32 @@ bool DataSource::_addProfile(std::shared_ptr<CARTA::SpatialProfileData> spatialP
 }
 
 // This function is provided by Angus
-int DataSource::_compress(std::vector<float> &array, size_t offset, std::vector<char> &compressionBuffer,
-    size_t &compressedSize, uint32_t nx, uint32_t ny, uint32_t precision) const {
-
-    int status = 0;    /* return value: 0 = success */
-    zfp_type type;     /* array scalar type */
-    zfp_field* field;  /* array meta data */
-    zfp_stream* zfp;   /* compressed stream */
-    size_t bufsize;    /* byte size of compressed buffer */
-    bitstream* stream; /* bit stream to write to or read from */
-
-    type = zfp_type_float;
-    field = zfp_field_2d(array.data() + offset, type, nx, ny);
-
-    /* allocate meta data for a compressed stream */
-    zfp = zfp_stream_open(nullptr);
-
-    /* set compression mode and parameters via one of three functions */
-    zfp_stream_set_precision(zfp, precision);
-
-    /* allocate buffer for compressed data */
-    bufsize = zfp_stream_maximum_size(zfp, field);
-    if (compressionBuffer.size() < bufsize) {
-        compressionBuffer.resize(bufsize);
-    }
-    stream = stream_open(compressionBuffer.data(), bufsize);
-    zfp_stream_set_bit_stream(zfp, stream);
-    zfp_stream_rewind(zfp);
-
-    compressedSize = zfp_compress(zfp, field);
-    if (!compressedSize) {
-        status = 1;
+std::vector<int32_t> DataSource::_getNanEncodingsBlock(std::vector<float>& array, int offset, int w, int h,
+    const char* nanRows) const {
+    // NaN-free strips, as told by the down sampling, need neither encoding nor filling
+    if (nanRows && std::none_of(nanRows, nanRows + h, [](char nan) { return nan; })) {
+        return std::vector<int32_t>(1, w * h);
     }
 
-    /* clean up */
-    zfp_field_free(field);
-    zfp_stream_close(zfp);
-    stream_close(stream);
-
-    return status;
-}
-
-// This function is provided by Angus
-std::vector<int32_t> DataSource::_getNanEncodingsBlock(std::vector<float>& array, int offset, int w, int h) const {
-    // Generate RLE NaN list
-    int length = w * h;
-    int32_t prevIndex = offset;
-    bool prev = false;
-    std::vector<int32_t> encodedArray;
-
-    for (auto i = offset; i < offset + length; i++) {
-        bool current = std::isnan(array[i]);
-        if (current != prev) {
-            encodedArray.push_back(i - prevIndex);
-            prevIndex = i;
-            prev = current;
+    // Generate RLE NaN list, skipping the rows known to be NaN-free
+    Carta::Core::Algorithms::NanRunEncoder encoder;
+    const float* values = array.data() + offset;
+    if (nanRows) {
+        for (int row = 0; row < h; row++) {
+            if (nanRows[row]) {
+                encoder.append(values + static_cast<size_t>(row) * w, w);
+            } else {
+                encoder.appendValid(w);
+            }
         }
+    } else {
+        encoder.append(values, static_cast<int64_t>(w) * h);
     }
-    encodedArray.push_back(offset + length - prevIndex);
-
-    // Skip all-NaN images and NaN-free images
-    if (encodedArray.size() > 1) {
-        // Calculate average of 4x4 blocks (matching blocks used in ZFP), and replace NaNs with block average
-        for (auto i = 0; i < w; i += 4) {
-            for (auto j = 0; j < h; j += 4) {
-                int blockStart = offset + j * w + i;
-                int validCount = 0;
-                float sum = 0;
-                // Limit the block size when at the edges of the image
-                int blockWidth = std::min(4, w - i);
-                int blockHeight = std::min(4, h - j);
-                for (int x = 0; x < blockWidth; x++) {
-                    for (int y = 0; y < blockHeight; y++) {
-                        float v = array[blockStart + (y * w) + x];
-                        if (!std::isnan(v)) {
-                            validCount++;
-                            sum += v;
-                        }
-                    } // end of blockHeight loop
-                } // end of blockWidth loop
-
-                // Only process blocks which have at least one valid value AND at least one NaN. All-NaN blocks won't affect ZFP compression
-                if (validCount && validCount != blockWidth * blockHeight) {
-                    float average = sum / validCount;
-                    for (int x = 0; x < blockWidth; x++) {
-                        for (int y = 0; y < blockHeight; y++) {
-                            float v = array[blockStart + (y * w) + x];
-                            if (std::isnan(v)) {
-                                array[blockStart + (y * w) + x] = average;
-                            }
-                        } // end of blockHeight loop
-                    } // end of blockWidth loop
-                } // check whether if validCount > 0 && validCount != blockWidth * blockHeight
-            } // end of j loop
-        } // end of i loop
-    }
+    std::vector<int32_t> encodedArray = encoder.finish();
+
+    // Replace NaNs with the average of their 4x4 blocks (matching blocks used in ZFP),
+    // all-NaN images and NaN-free images are skipped
+    Carta::Core::Algorithms::fillNanBlocks(array.data() + offset, w, h, encodedArray);
     return encodedArray;
 }
 
@@ -1106,8 +1265,16 @@ int DataSource::_getSpectralIndicator() {
 }
 
 Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int frameStart, int frameEnd, int stokeFrame ) const {
-
     Carta::Lib::NdArray::RawViewInterface* rawData = nullptr;
+    if ( m_image ){
+        rawData = m_image->getDataSlice( _getFrameSlice( frameStart, frameEnd, stokeFrame ) );
+    }
+    return rawData;
+}
+
+SliceND DataSource::_getFrameSlice( int frameStart, int frameEnd, int stokeFrame ) const {
+
+    SliceND frameSlice = SliceND().next();
     int spectralIndex = Util::getAxisIndex( m_image, AxisInfo::KnownType::SPECTRAL );
     int stokeIndex = Util::getAxisIndex( m_image, AxisInfo::KnownType::STOKES );
 
@@ -1119,8 +1286,6 @@ Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int fram
         int imageDim =m_image->dims().size();
         //qDebug() << "++++++++ Dimension of image raw data=" << imageDim;
 
-        SliceND frameSlice = SliceND().next();
-
         for ( int i = 0; i < imageDim; i++ ){
 
             // only deal with the extra dimensions other than x-axis and y-axis
@@ -1178,9 +1343,8 @@ Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int fram
                 slice.step( 1 );
             }
         }
-        rawData = m_image->getDataSlice( frameSlice );
     }
-    return rawData;
+    return frameSlice;
 }
 
 std::vector<int> DataSource::_getStokeIndex( const std::vector<int>& frames ) const {
@@ -1364,16 +1528,17 @@ QString DataSource::_setFileName( const QString& fileName, bool* success ){
     if (file.length() > 0) {
         if ( file != m_fileName ){
             try {
-                auto res = Globals::instance()-> pluginManager()
-                                      -> prepare <Carta::Lib::Hooks::LoadAstroImage>( file )
-                                      .first();
-                if (!res.isNull()){
-                    m_image = res.val();
+                // sessions showing the same file share one open image
+                std::shared_ptr<Carta::Lib::Image::ImageInterface> image = ImageRegistry::open( file );
+                if (image){
+                    m_image = image;
                     m_permuteImage = m_image;
                     std::shared_ptr<CoordinateFormatterInterface> cf(
                         m_image->metaData()->coordinateFormatter()->clone() );
                     m_coordinateFormatter = cf;
                     m_fileName = file;
+                    // start generating the spectral-major copy in the background if needed
+                    m_spectralCompanion = SpectralCompanion::create(m_fileName, m_image);
                     //qDebug() << "[DataSource] m_fileName=" << m_fileName;
                 }
                 else {
@@ -1449,23 +1614,62 @@ PBMSharedPtr DataSource::_getSpectralProfile(int fileId, int x, int y, int stoke
     // TODO: need to check the spectral profile to get the corresponding spectral data
     // now only get 'z' no matter what the spectral profile is specified
 
-    auto result = Globals::instance()->pluginManager()
-        -> prepare <Carta::Lib::Hooks::ProfileHook>(m_image, nullptr/*region info (nullptr is for all region)*/,
-                                                    x, y, m_profileInfo);
-    auto lam = [=] (const Carta::Lib::Hooks::ProfileResult &data) {
-        m_profileResult = data;
-    };
-
-    try {
-        result.forEach(lam);
+    // pair(first, second): first for channel_vals[](skipped), second for spectral profile
+    std::vector< std::pair<double,double> > profileData;
+
+    // every aggregate except these is trivial for a single pixel, so the spectrum can be
+    // read directly from the spectral-major copy once it is complete
+    Carta::Lib::ProfileInfo::AggregateType aggregateType = m_profileInfo.getAggregateType();
+    bool singlePixelValues = aggregateType != Carta::Lib::ProfileInfo::AggregateType::RMS &&
+                             aggregateType != Carta::Lib::ProfileInfo::AggregateType::VARIANCE &&
+                             aggregateType != Carta::Lib::ProfileInfo::AggregateType::FLUX_DENSITY;
+    std::vector<float> spectrum;
+    bool haveSpectrum = false;
+    int spectralIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::SPECTRAL);
+    const std::vector<int>& imageDims = m_image->dims();
+    if (singlePixelValues && spectralIndex >= 0 && m_image->hasFastLineAccess(spectralIndex) &&
+        0 <= x && x < imageDims[0] && 0 <= y && y < imageDims[1]) {
+        // the image keeps a spectral-major copy itself, so the spectrum is a single line read
+        std::vector<int> pos(imageDims.size(), 0);
+        pos[0] = x;
+        pos[1] = y;
+        int stokeIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::STOKES);
+        if (stokeIndex >= 0) {
+            pos[stokeIndex] = std::min(std::max(0, m_profileInfo.getStokesFrame()), imageDims[stokeIndex] - 1);
+        }
+        Carta::Lib::NdArray::Float fview(m_image->getDataSlice(SliceND()), true);
+        spectrum = fview.readLine(pos, spectralIndex);
+        haveSpectrum = true;
     }
-    catch (char*& error) {
-        qDebug() << "[DataSource] ProfileRenderWorker::run: caught error: " << error;
-        m_profileResult.setError( QString(error) );
+    if (!haveSpectrum && m_spectralCompanion && singlePixelValues) {
+        haveSpectrum = m_spectralCompanion->readSpectrum(x, y, std::max(0, m_profileInfo.getStokesFrame()), spectrum);
     }
+    if (haveSpectrum) {
+        for (size_t i = 0; i < spectrum.size(); i++) {
+            profileData.push_back(std::make_pair(static_cast<double>(i), static_cast<double>(spectrum[i])));
+        }
+    } else if (Carta::Lib::Cancellation::isCancelled()) {
+        // the cursor has moved on, reading through the whole cube is not worth it anymore
+        qDebug() << "[DataSource] The spectral profile is not wanted anymore. Return nullptr";
+        return nullptr;
+    } else {
+        auto result = Globals::instance()->pluginManager()
+            -> prepare <Carta::Lib::Hooks::ProfileHook>(m_image, nullptr/*region info (nullptr is for all region)*/,
+                                                        x, y, m_profileInfo);
+        auto lam = [=] (const Carta::Lib::Hooks::ProfileResult &data) {
+            m_profileResult = data;
+        };
 
-    // pair(first, second): first for channel_vals[](skipped), second for spectral profile
-    std::vector< std::pair<double,double> > profileData = m_profileResult.getData();
+        try {
+            result.forEach(lam);
+        }
+        catch (char*& error) {
+            qDebug() << "[DataSource] ProfileRenderWorker::run: caught error: " << error;
+            m_profileResult.setError( QString(error) );
+        }
+
+        profileData = m_profileResult.getData();
+    }
 
     // create spectral profile data & generate protobuf message
     std::shared_ptr<CARTA::SpectralProfileData> spectralProfileData(new CARTA::SpectralProfileData());
@@ -44,6 +44,8 @@ class IPCache;
 
 namespace Data {
 
+class SpectralCompanion;
+
 class DataSource : public QObject {
 
     friend class LayerData;
@@ -51,6 +53,9 @@ class DataSource : public QObject {
     friend class Histogram;
     friend class Profiler;
     friend class Controller;
+    friend class ChannelPrefetcher;
+    friend class RasterTileCache;
+    friend class ProgressiveRaster;
     Q_OBJECT
 
 public:
@@ -246,10 +251,97 @@ private:
         bool &changeFrame, int regionId, int numberOfBins,
         Carta::Lib::IntensityUnitConverter::SharedPtr converter) const;
 
-    int _compress(std::vector<float>& array, size_t offset, std::vector<char>& compressionBuffer,
-            size_t& compressedSize, uint32_t nx, uint32_t ny, uint32_t precision) const;
+    /**
+     * Down samples part of a plane by the means of its mip x mip blocks, from a stored
+     * mip, the mip pyramid or the raw data.
+     * @param xMin - lower bound of the x-pixel-coordinate.
+     * @param xMax - upper bound 0f the x-pixel-coordinate.
+     * @param yMin - lower bound of the y-pixel-coordinate.
+     * @param yMax - upper bound 0f the y-pixel-coordinate.
+     * @param mip - down sampling factor.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param imageData - set to the down sampled pixels, row by row, in a buffer of the
+     *      float BufferPool that the caller gives back.
+     * @param nanRows - set to whether each row of imageData has NaNs, or left empty if unknown.
+     * @return - false if the mip doesn't fit the image, the memory budget can't hold the
+     *      buffers or the request was cancelled.
+     */
+    bool _getDownsampledData(int xMin, int xMax, int yMin, int yMax, int mip,
+        int frameLow, int frameHigh, int stokeFrame,
+        std::vector<float>& imageData, std::vector<char>& nanRows) const;
+
+    /**
+     * Builds a raster image data message from down sampled pixels, encoding them with
+     * the codec the request asks for.
+     * @param fileId - the file id of the image.
+     * @param xMin - lower bound of the x-pixel-coordinate.
+     * @param xMax - upper bound 0f the x-pixel-coordinate.
+     * @param yMin - lower bound of the y-pixel-coordinate.
+     * @param yMax - upper bound 0f the y-pixel-coordinate.
+     * @param mip - down sampling factor.
+     * @param frameLow - the channel.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param imageData - the nx x ny down sampled pixels, NaNs are replaced for compression.
+     * @param nx - the width of the down sampled image.
+     * @param ny - the height of the down sampled image.
+     * @param isZFP - whether ZFP compression was asked for.
+     * @param precision - the compression quality, it picks the RasterCodec together with isZFP.
+     * @param numSubsets - the most row subsets encoded in parallel.
+     * @param nanRows - for each of the ny rows whether it has NaNs, or nullptr if unknown.
+     * @return - the message, without channel histogram.
+     */
+    std::shared_ptr<CARTA::RasterImageData> _makeRasterImageData(int fileId, int xMin, int xMax, int yMin, int yMax,
+        int mip, int frameLow, int stokeFrame, std::vector<float>& imageData, int nx, int ny,
+        bool isZFP, int precision, int numSubsets, const char* nanRows = nullptr) const;
+
+    /**
+     * Returns a quick, coarse raster image of a channel: instead of the means of the
+     * mip x mip blocks it holds one pixel of each block, so only every mip-th row
+     * has to be read.
+     * @param fileId - the file id of the image.
+     * @param xMin - lower bound of the x-pixel-coordinate.
+     * @param xMax - upper bound 0f the x-pixel-coordinate.
+     * @param yMin - lower bound of the y-pixel-coordinate.
+     * @param yMax - upper bound 0f the y-pixel-coordinate.
+     * @param mip - down sampling factor.
+     * @param frame - the channel.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param isZFP - whether to use ZFP compression.
+     * @param precision - the ZFP precision.
+     * @return - the message, without channel histogram, or nullptr.
+     */
+    PBMSharedPtr _getRasterImagePreview(int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
+        int frame, int stokeFrame, bool isZFP, int precision) const;
+
+    /**
+     * Adds the histogram of a channel to a raster image data message.
+     * @param raster - the message.
+     * @param fileId - the file id of the image.
+     * @param regionId - the region id, -1 for the whole image.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param numberOfBins - the number of histogram bins.
+     * @param converter - converts the pixel units or nullptr.
+     */
+    void _setChannelHistogram(CARTA::RasterImageData* raster, int fileId, int regionId,
+        int frameLow, int frameHigh, int stokeFrame, int numberOfBins,
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter) const;
 
-    std::vector<int32_t> _getNanEncodingsBlock(std::vector<float>& array, int offset, int w, int h) const;
+    /**
+     * Returns the run lengths of the NaNs of a w x h part of an image and replaces the
+     * NaNs of partly valid 4 x 4 blocks by the block mean before compression.
+     * @param array - the image.
+     * @param offset - the index of the first pixel of the part.
+     * @param w - the width of the part.
+     * @param h - the height of the part.
+     * @param nanRows - for each of the h rows whether it has NaNs, or nullptr if unknown.
+     * @return - the run lengths, alternating between valid pixels and NaNs.
+     */
+    std::vector<int32_t> _getNanEncodingsBlock(std::vector<float>& array, int offset, int w, int h,
+        const char* nanRows = nullptr) const;
 
     /**
      * Returns a spatial profile data
@@ -351,6 +443,15 @@ private:
      */
     Carta::Lib::NdArray::RawViewInterface* _getRawDataForStoke(int frameLow, int frameHigh, int stokeFrame) const;
 
+    /**
+     * Returns the slice of the image used by _getRawDataForStoke.
+     * @param frameLow the lower bound for the frames or -1 for the whole image.
+     * @param frameHigh the upper bound for the frames or -1 for the whole image.
+     * @param stokeFrame - the index of the stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V).
+     * @return the slice, with the full range on the first two axes.
+     */
+    SliceND _getFrameSlice(int frameLow, int frameHigh, int stokeFrame) const;
+
     /**
      * Returns the raw data for the current view.
      * @param frames - a list of current image frames.
@@ -421,6 +522,9 @@ private:
     // profile calculation result
     Carta::Lib::Hooks::ProfileResult m_profileResult;
 
+    // spectral-major copy of the image for fast spectral profiles (nullptr if there is none)
+    std::shared_ptr<SpectralCompanion> m_spectralCompanion;
+
     /// coordinate formatter
     std::shared_ptr<CoordinateFormatterInterface> m_coordinateFormatter;
 
@@ -441,6 +545,8 @@ private:
     const static bool APPROXIMATION_GET_LOCATION;
     const static bool IS_MULTITHREAD_ZFP;
     const static int MAX_SUBSETS;
+    //Width of the column chunks of masked rows that are only read if they have valid pixels.
+    const static int MASK_CHUNK_COLUMNS;
 
     DataSource(const DataSource& other);
     DataSource& operator=(const DataSource& other);
@@ -0,0 +1,245 @@
+#include "Data/Image/ImageRegistry.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include "PluginManager.h"
+#include "CartaLib/Hooks/LoadAstroImage.h"
+#include "CartaLib/IImage.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTimer>
+#include <QtCore/QDebug>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+
+using Carta::Lib::Image::ImageInterface;
+
+struct Settings {
+    /// how long an image nobody uses stays open
+    int idleMs = 60 * 1000;
+};
+
+const Settings& _settings(){
+    static const Settings settings = [] () -> Settings {
+        Settings result;
+        const QJsonObject& json = Globals::instance()->mainConfig()->json();
+        if ( json.contains( "imageRegistryIdleSeconds" ) ){
+            QString errorMsg;
+            int idleSeconds = MainConfig::ParsedInfo::toInt( json["imageRegistryIdleSeconds"], errorMsg );
+            if ( errorMsg.isEmpty() && idleSeconds >= 0 ){
+                result.idleMs = idleSeconds * 1000;
+            }
+            else {
+                qWarning() << "[ImageRegistry] Invalid setting imageRegistryIdleSeconds" << errorMsg;
+            }
+        }
+        return result;
+    }();
+    return settings;
+}
+
+/// one open file
+struct Entry {
+    /// canonical path of the file
+    QString path;
+    /// held while the image is being loaded
+    QMutex loadMutex;
+    bool loaded = false;
+    /// the image, kept open by the registry
+    std::shared_ptr<ImageInterface> image;
+    /// the pointer handed out to the current users
+    std::weak_ptr<ImageInterface> handle;
+    /// number of handles not released yet
+    int users = 0;
+    /// started when the last user released the image
+    QElapsedTimer idle;
+};
+
+/// open files by path, size and modification time
+QMutex registryMutex;
+std::map<QString, std::shared_ptr<Entry> > registry;
+
+/// closes the entry when it is idle again after the timeout
+void _scheduleSweep(){
+    int idleMs = _settings().idleMs;
+    QCoreApplication* app = QCoreApplication::instance();
+    if ( idleMs == 0 || app == nullptr ){
+        ImageRegistry::sweep();
+    }
+    else {
+        // the timer runs in the main thread, whichever thread released the image
+        QTimer::singleShot( idleMs + 100, app, &ImageRegistry::sweep );
+    }
+}
+
+/// called when the last user of a handle released it
+void _released( const std::weak_ptr<Entry>& weakEntry ){
+    std::shared_ptr<Entry> entry = weakEntry.lock();
+    if ( !entry ){
+        return;
+    }
+    {
+        QMutexLocker locker( &registryMutex );
+        entry->users--;
+        if ( entry->users > 0 ){
+            return;
+        }
+        entry->idle.start();
+    }
+    _scheduleSweep();
+}
+
+/// the pointer shared by the users of a loaded entry, registryMutex must be held
+std::shared_ptr<ImageInterface> _handle( const std::shared_ptr<Entry>& entry ){
+    std::shared_ptr<ImageInterface> handle = entry->handle.lock();
+    if ( !handle ){
+        // the deleter keeps the image alive as long as the handle is used and
+        // tells the registry when it is not any more
+        std::shared_ptr<ImageInterface> image = entry->image;
+        std::weak_ptr<Entry> weakEntry = entry;
+        handle = std::shared_ptr<ImageInterface>( image.get(), [image, weakEntry]( ImageInterface* ){
+            _released( weakEntry );
+        } );
+        entry->handle = handle;
+        entry->users++;
+        entry->idle.invalidate();
+    }
+    return handle;
+}
+
+/// forget an entry whose image could not be loaded, registryMutex must be held
+void _remove( const QString& key, const std::shared_ptr<Entry>& entry ){
+    auto found = registry.find( key );
+    if ( found != registry.end() && found->second == entry ){
+        registry.erase( found );
+    }
+}
+}
+
+std::shared_ptr<Carta::Lib::Image::ImageInterface> ImageRegistry::open( const QString& fileName ){
+    QString path;
+    QString key = versionKey( fileName, &path );
+
+    // images are closed after the locks are released
+    std::vector<std::shared_ptr<ImageInterface> > closed;
+    std::shared_ptr<Entry> entry;
+    {
+        QMutexLocker locker( &registryMutex );
+        auto found = registry.find( key );
+        if ( found != registry.end() ){
+            entry = found->second;
+            if ( entry->loaded ){
+                return _handle( entry );
+            }
+        }
+        else {
+            // the file changed, earlier versions nobody uses can be closed now
+            for ( auto it = registry.begin(); it != registry.end(); ){
+                if ( it->second->path == path && it->second->loaded && it->second->users == 0 ){
+                    closed.push_back( it->second->image );
+                    it = registry.erase( it );
+                }
+                else {
+                    ++it;
+                }
+            }
+            entry = std::make_shared<Entry>();
+            entry->path = path;
+            registry[key] = entry;
+        }
+    }
+
+    // only one thread loads a file, the others wait for it
+    QMutexLocker loadLocker( &entry->loadMutex );
+    {
+        QMutexLocker locker( &registryMutex );
+        if ( entry->loaded ){
+            return _handle( entry );
+        }
+    }
+
+    std::shared_ptr<ImageInterface> image;
+    try {
+        auto res = Globals::instance()-> pluginManager()
+                              -> prepare <Carta::Lib::Hooks::LoadAstroImage>( fileName )
+                              .first();
+        if ( !res.isNull() ){
+            image = res.val();
+        }
+    }
+    catch( std::logic_error& ){
+        QMutexLocker locker( &registryMutex );
+        _remove( key, entry );
+        throw;
+    }
+
+    QMutexLocker locker( &registryMutex );
+    if ( !image ){
+        _remove( key, entry );
+        return nullptr;
+    }
+    entry->image = image;
+    entry->loaded = true;
+    qDebug() << "[ImageRegistry] Opened" << path;
+    return _handle( entry );
+}
+
+QString ImageRegistry::versionKey( const QString& fileName, QString* canonicalPath ){
+    QFileInfo info( fileName );
+    QString path = info.canonicalFilePath();
+    if ( path.isEmpty() ){
+        path = info.absoluteFilePath();
+    }
+    if ( canonicalPath ){
+        *canonicalPath = path;
+    }
+    qint64 size = info.size();
+    QDateTime modified = info.lastModified();
+    if ( info.isDir() ){
+        // casa images are directories, it is the tables in them that change
+        size = 0;
+        QFileInfoList tables = QDir( path ).entryInfoList( QDir::Files | QDir::NoDotAndDotDot );
+        for ( const QFileInfo& table : tables ){
+            size += table.size();
+            if ( table.lastModified() > modified ){
+                modified = table.lastModified();
+            }
+        }
+    }
+    return path + "|" + QString::number( size ) + "|" + QString::number( modified.toMSecsSinceEpoch() );
+}
+
+void ImageRegistry::sweep(){
+    int idleMs = _settings().idleMs;
+    std::vector<std::shared_ptr<ImageInterface> > closed;
+    {
+        QMutexLocker locker( &registryMutex );
+        for ( auto it = registry.begin(); it != registry.end(); ){
+            const Entry& entry = *it->second;
+            if ( entry.loaded && entry.users == 0 && entry.idle.isValid() &&
+                    entry.idle.elapsed() >= idleMs ){
+                qDebug() << "[ImageRegistry] Closed" << entry.path;
+                closed.push_back( entry.image );
+                it = registry.erase( it );
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+}
+
+}
+}
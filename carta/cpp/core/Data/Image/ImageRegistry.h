@@ -0,0 +1,70 @@
+/***
+ * Images opened once per process and shared by everyone who needs them.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include <QString>
+#include <memory>
+
+namespace Carta {
+namespace Lib {
+namespace Image {
+class ImageInterface;
+}
+}
+
+namespace Data {
+
+/**
+ * Process wide registry of open images.
+ *
+ * Loading an image through the LoadAstroImage hook parses its header, builds the
+ * casacore coordinate system and sets up the tile cache of the loader, so opening a
+ * file once for its file information, once per session and once per user of the
+ * same cube is wasteful. Images are therefore opened here, keyed by the canonical
+ * path together with the size and the modification time of the file (a rewritten
+ * file is opened again), and everybody asking for the same file gets the same
+ * image. An image that nobody uses any more is kept for imageRegistryIdleSeconds
+ * (main configuration) so that e.g. the file information request followed by
+ * opening the file costs one open, and closed after that.
+ */
+class ImageRegistry {
+
+public:
+
+    /**
+     * Returns the image of a file, loading it if it is not open yet. Concurrent
+     * requests for a file that is being loaded wait for that load.
+     * @param fileName - the path of the image.
+     * @return - the image, which stays open as long as the pointer is held, or nullptr
+     *      if no plugin could load the file.
+     * @throws std::logic_error - passed on from the loader.
+     */
+    static std::shared_ptr<Carta::Lib::Image::ImageInterface> open( const QString& fileName );
+
+    /**
+     * Returns a key identifying the current version of a file, made of its canonical
+     * path, its size and its modification time. For directories (casa images) the
+     * size and the newest modification time of the files in them are used.
+     * @param fileName - the path of the file.
+     * @param canonicalPath - set to the canonical path if not nullptr.
+     * @return - the key.
+     */
+    static QString versionKey( const QString& fileName, QString* canonicalPath = nullptr );
+
+    /**
+     * Closes the images that have not been used for longer than the idle timeout.
+     */
+    static void sweep();
+
+private:
+
+    ImageRegistry();
+    ImageRegistry( const ImageRegistry& other );
+    ImageRegistry& operator=( const ImageRegistry& other );
+};
+
+}
+}
@@ -0,0 +1,388 @@
+#include "Data/Image/MipPyramid.h"
+#include "Data/Image/ImageRegistry.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include "CartaLib/IImage.h"
+#include "CartaLib/IPCache.h"
+#include "CartaLib/MemoryBudget.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtCore/QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <list>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+
+struct Settings {
+    /// memory budget of the pyramids of all images
+    qint64 maxBytes = 512 * 1024 * 1024;
+    /// store the pyramids in the persistent cache
+    bool persist = false;
+};
+
+const Settings& _settings(){
+    static const Settings settings = [] () -> Settings {
+        Settings result;
+        const QJsonObject& json = Globals::instance()->mainConfig()->json();
+        QString errorMsg;
+        if ( json.contains( "mipPyramidMB" ) ){
+            int memoryMB = MainConfig::ParsedInfo::toInt( json["mipPyramidMB"], errorMsg );
+            if ( errorMsg.isEmpty() && memoryMB >= 0 ){
+                result.maxBytes = static_cast<qint64>( memoryMB ) * 1024 * 1024;
+            }
+            else {
+                qWarning() << "[MipPyramid] Invalid setting mipPyramidMB" << errorMsg;
+            }
+        }
+        if ( json.contains( "mipPyramidPersist" ) ){
+            errorMsg.clear();
+            bool persist = MainConfig::ParsedInfo::toBool( json["mipPyramidPersist"], errorMsg );
+            if ( errorMsg.isEmpty() ){
+                result.persist = persist;
+            }
+            else {
+                qWarning() << "[MipPyramid] Invalid setting mipPyramidPersist" << errorMsg;
+            }
+        }
+        return result;
+    }();
+    return settings;
+}
+
+/// pyramids by plane, the most recently used first
+QMutex registryMutex;
+std::list<std::pair<QString, std::shared_ptr<MipPyramid> > > registry;
+qint64 registryBytes = 0;
+
+/// drop least recently used pyramids until wanted bytes are freed
+qint64 _reclaim( qint64 wanted ){
+    QMutexLocker locker( &registryMutex );
+    qint64 freed = 0;
+    while ( freed < wanted && ! registry.empty() ){
+        freed += registry.back().second->bytes();
+        registry.pop_back();
+    }
+    registryBytes -= freed;
+    Carta::Lib::MemoryBudget::instance().account( -freed );
+    return freed;
+}
+
+/// the pyramids count towards the process wide memory budget
+void _registerReclaimer(){
+    static const int id = Carta::Lib::MemoryBudget::instance().addReclaimer( "MipPyramid", _reclaim );
+    Q_UNUSED( id );
+}
+
+/// memory of one cell of a level, its sum and count
+const qint64 CELL_BYTES = sizeof( double ) + sizeof( quint32 );
+
+/// memory of a pyramid whose first level has the given factor
+qint64 _pyramidBytes( int nx, int ny, int factor ){
+    qint64 bytes = 0;
+    while ( true ){
+        int lnx = ( nx + factor - 1 ) / factor;
+        int lny = ( ny + factor - 1 ) / factor;
+        bytes += CELL_BYTES * static_cast<qint64>( lnx ) * lny;
+        if ( lnx <= 1 && lny <= 1 ){
+            return bytes;
+        }
+        factor *= 2;
+    }
+}
+
+template <typename T>
+void _append( QByteArray& data, const T* values, size_t count ){
+    data.append( reinterpret_cast<const char*>( values ), static_cast<int>( count * sizeof( T ) ) );
+}
+
+template <typename T>
+bool _extract( const QByteArray& data, int& offset, T* values, size_t count ){
+    int size = static_cast<int>( count * sizeof( T ) );
+    if ( offset + size > data.size() ){
+        return false;
+    }
+    memcpy( values, data.constData() + offset, size );
+    offset += size;
+    return true;
+}
+}
+
+MipPyramid::MipPyramid(){
+}
+
+std::shared_ptr<MipPyramid> MipPyramid::get( const QString& fileName, int channel, int stokeFrame,
+        int mip, int xMin, int yMin, Carta::Lib::NdArray::RawViewInterface* view,
+        std::shared_ptr<Carta::Lib::IPCache> diskCache ){
+    const Settings& settings = _settings();
+    if ( settings.maxBytes <= 0 || ! view ){
+        return nullptr;
+    }
+    const std::vector<int>& dims = view->dims();
+    if ( dims.size() < 2 ){
+        return nullptr;
+    }
+    for ( size_t i = 2; i < dims.size(); i++ ){
+        if ( dims[i] != 1 ){
+            return nullptr;
+        }
+    }
+
+    // the version of the file is part of the key, so a changed file is not served
+    // from the pyramid of its previous contents
+    QString key = QString( "%1/%2/%3/mipPyramid" ).arg( ImageRegistry::versionKey( fileName ) )
+                  .arg( channel ).arg( stokeFrame );
+    {
+        QMutexLocker locker( &registryMutex );
+        for ( auto it = registry.begin(); it != registry.end(); ++it ){
+            if ( it->first == key ){
+                registry.splice( registry.begin(), registry, it );
+                return registry.front().second;
+            }
+        }
+    }
+
+    // the first level is as fine as possible while a few planes fit into the budget,
+    // the counts of the coarsest level hold every pixel of the plane
+    int nx = dims[0];
+    int ny = dims[1];
+    if ( static_cast<qint64>( nx ) * ny > std::numeric_limits<quint32>::max() ){
+        return nullptr;
+    }
+    int firstFactor = 2;
+    while ( firstFactor < std::max( nx, ny ) && _pyramidBytes( nx, ny, firstFactor ) > settings.maxBytes / 4 ){
+        firstFactor *= 2;
+    }
+    if ( firstFactor >= std::max( nx, ny ) ){
+        return nullptr;
+    }
+
+    // the factors of all levels are multiples of the first one, if that doesn't fit
+    // the request no level does and the plane would be read for nothing
+    if ( mip % firstFactor != 0 || xMin % firstFactor != 0 || yMin % firstFactor != 0 ){
+        return nullptr;
+    }
+
+    // building it must not push the process over its memory budget, the full
+    // resolution path needs much less
+    _registerReclaimer();
+    qint64 pyramidBytes = _pyramidBytes( nx, ny, firstFactor ) + static_cast<qint64>( nx ) * firstFactor * sizeof( float );
+    Carta::Lib::MemoryBudget::Reservation reservation( pyramidBytes );
+    if ( ! reservation.ok() ){
+        return nullptr;
+    }
+
+    std::shared_ptr<MipPyramid> pyramid( new MipPyramid() );
+    bool persist = settings.persist && diskCache;
+    if ( persist && pyramid->_load( *diskCache, key, nx, ny ) ){
+        qDebug() << "[MipPyramid] Loaded" << key;
+    }
+    else {
+        if ( ! pyramid->_build( view, firstFactor ) ){
+            return nullptr;
+        }
+        if ( persist ){
+            pyramid->_save( *diskCache, key );
+        }
+    }
+
+    QMutexLocker locker( &registryMutex );
+    // another thread may have built the same one meanwhile
+    for ( auto it = registry.begin(); it != registry.end(); ++it ){
+        if ( it->first == key ){
+            return it->second;
+        }
+    }
+    registry.push_front( std::make_pair( key, pyramid ) );
+    registryBytes += pyramid->bytes();
+    qint64 evicted = 0;
+    while ( registryBytes > settings.maxBytes && registry.size() > 1 ){
+        evicted += registry.back().second->bytes();
+        registryBytes -= registry.back().second->bytes();
+        registry.pop_back();
+    }
+    Carta::Lib::MemoryBudget::instance().account( pyramid->bytes() - evicted );
+    return pyramid;
+}
+
+bool MipPyramid::downsample( int mip, int xMin, int yMin, int nCols, int nRows,
+        std::vector<float>& imageData ) const {
+    // the coarsest level whose cells make up the requested blocks
+    for ( auto level = m_levels.rbegin(); level != m_levels.rend(); ++level ){
+        int factor = level->factor;
+        if ( mip % factor != 0 || xMin % factor != 0 || yMin % factor != 0 ){
+            continue;
+        }
+        int cells = mip / factor;
+        int cx0 = xMin / factor;
+        int cy0 = yMin / factor;
+        if ( cx0 + nCols * cells > level->nx || cy0 + nRows * cells > level->ny ){
+            return false;
+        }
+        imageData.resize( static_cast<size_t>( nRows ) * nCols );
+        for ( int j = 0; j < nRows; j++ ){
+            for ( int i = 0; i < nCols; i++ ){
+                double sum = 0;
+                quint64 count = 0;
+                for ( int b = 0; b < cells; b++ ){
+                    size_t index = static_cast<size_t>( cy0 + j * cells + b ) * level->nx + cx0 + i * cells;
+                    for ( int a = 0; a < cells; a++ ){
+                        sum += level->sums[index + a];
+                        count += level->counts[index + a];
+                    }
+                }
+                imageData[static_cast<size_t>( j ) * nCols + i] = count == 0 ? NAN : static_cast<float>( sum / count );
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+qint64 MipPyramid::bytes() const {
+    qint64 result = 0;
+    for ( const Level& level : m_levels ){
+        result += CELL_BYTES * static_cast<qint64>( level.sums.size() );
+    }
+    return result;
+}
+
+bool MipPyramid::_build( Carta::Lib::NdArray::RawViewInterface* view, int firstFactor ){
+    int nx = view->dims()[0];
+    int ny = view->dims()[1];
+    Level level;
+    level.factor = firstFactor;
+    level.nx = ( nx + firstFactor - 1 ) / firstFactor;
+    level.ny = ( ny + firstFactor - 1 ) / firstFactor;
+    level.sums.assign( static_cast<size_t>( level.nx ) * level.ny, 0 );
+    level.counts.assign( level.sums.size(), 0 );
+
+    // one row of cells at a time
+    std::vector<float> band;
+    for ( int row0 = 0; row0 < ny; row0 += firstFactor ){
+        int rows = std::min( firstFactor, ny - row0 );
+        SliceND rowSlice;
+        rowSlice.next().start( row0 ).end( row0 + rows );
+        Carta::Lib::NdArray::RawViewInterface* rowView = view->getView( rowSlice );
+        Carta::Lib::NdArray::PixelMask::SharedPtr mask = rowView->pixelMask();
+        Carta::Lib::NdArray::Float fview( rowView, true );
+        band.resize( static_cast<size_t>( nx ) * rows );
+        size_t t = 0;
+        fview.forEach( fview.DEFAULT_BLOCK_SIZE, [&] ( const float* vals, int64_t count ) {
+            size_t n = std::min( static_cast<size_t>( count ), band.size() - t );
+            std::copy( vals, vals + n, band.begin() + t );
+            t += count;
+        });
+        if ( t != band.size() ){
+            qWarning() << "[MipPyramid] Read" << t << "pixels instead of" << band.size();
+            return false;
+        }
+        if ( mask ){
+            for ( const auto& run : mask->runs( false ) ){
+                size_t end = std::min( static_cast<size_t>( run.start + run.length ), band.size() );
+                std::fill( band.begin() + std::min( static_cast<size_t>( run.start ), end ), band.begin() + end, NAN );
+            }
+        }
+
+        double* sums = level.sums.data() + static_cast<size_t>( row0 / firstFactor ) * level.nx;
+        quint32* counts = level.counts.data() + static_cast<size_t>( row0 / firstFactor ) * level.nx;
+        for ( int r = 0; r < rows; r++ ){
+            const float* pixels = band.data() + static_cast<size_t>( r ) * nx;
+            for ( int x = 0; x < nx; x++ ){
+                if ( std::isfinite( pixels[x] ) ){
+                    sums[x / firstFactor] += pixels[x];
+                    counts[x / firstFactor] += 1;
+                }
+            }
+        }
+    }
+    m_levels.push_back( std::move( level ) );
+
+    while ( m_levels.back().nx > 1 || m_levels.back().ny > 1 ){
+        _addMergedLevel();
+    }
+    return true;
+}
+
+void MipPyramid::_addMergedLevel(){
+    const Level& fine = m_levels.back();
+    Level level;
+    level.factor = fine.factor * 2;
+    level.nx = ( fine.nx + 1 ) / 2;
+    level.ny = ( fine.ny + 1 ) / 2;
+    level.sums.assign( static_cast<size_t>( level.nx ) * level.ny, 0 );
+    level.counts.assign( level.sums.size(), 0 );
+    for ( int y = 0; y < fine.ny; y++ ){
+        size_t fineRow = static_cast<size_t>( y ) * fine.nx;
+        size_t row = static_cast<size_t>( y / 2 ) * level.nx;
+        for ( int x = 0; x < fine.nx; x++ ){
+            level.sums[row + x / 2] += fine.sums[fineRow + x];
+            level.counts[row + x / 2] += fine.counts[fineRow + x];
+        }
+    }
+    m_levels.push_back( std::move( level ) );
+}
+
+bool MipPyramid::_load( Carta::Lib::IPCache& diskCache, const QString& key, int nx, int ny ){
+    QByteArray data, error;
+    if ( ! diskCache.readEntry( key.toUtf8(), data, error ) ){
+        return false;
+    }
+    int offset = 0;
+    qint32 levelCount = 0;
+    if ( ! _extract( data, offset, &levelCount, 1 ) || levelCount < 1 ){
+        return false;
+    }
+    std::vector<Level> levels( levelCount );
+    for ( Level& level : levels ){
+        qint32 header[3];
+        if ( ! _extract( data, offset, header, 3 ) || header[0] < 2 ){
+            return false;
+        }
+        level.factor = header[0];
+        level.nx = header[1];
+        level.ny = header[2];
+        // the key holds the version of the file, so this is only a damaged entry
+        if ( level.nx != ( nx + level.factor - 1 ) / level.factor ||
+             level.ny != ( ny + level.factor - 1 ) / level.factor ){
+            return false;
+        }
+        level.sums.resize( static_cast<size_t>( level.nx ) * level.ny );
+        level.counts.resize( level.sums.size() );
+        if ( ! _extract( data, offset, level.sums.data(), level.sums.size() ) ||
+             ! _extract( data, offset, level.counts.data(), level.counts.size() ) ){
+            return false;
+        }
+    }
+    m_levels = std::move( levels );
+    return true;
+}
+
+void MipPyramid::_save( Carta::Lib::IPCache& diskCache, const QString& key ) const {
+    qint64 size = bytes() + sizeof( qint32 ) * ( 1 + 3 * m_levels.size() );
+    if ( size > std::numeric_limits<int>::max() ){
+        qWarning() << "[MipPyramid] Too large for the persistent cache:" << key;
+        return;
+    }
+    QByteArray data;
+    data.reserve( static_cast<int>( size ) );
+    qint32 levelCount = static_cast<qint32>( m_levels.size() );
+    _append( data, &levelCount, 1 );
+    for ( const Level& level : m_levels ){
+        qint32 header[3] = { level.factor, level.nx, level.ny };
+        _append( data, header, 3 );
+        _append( data, level.sums.data(), level.sums.size() );
+        _append( data, level.counts.data(), level.counts.size() );
+    }
+    diskCache.setEntry( key.toUtf8(), data, QByteArray() );
+}
+
+}
+}
@@ -0,0 +1,107 @@
+/***
+ * Down sampled copies of an image plane kept for zoomed-out raster images.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include <QString>
+#include <memory>
+#include <vector>
+
+namespace Carta {
+namespace Lib {
+class IPCache;
+namespace NdArray {
+class RawViewInterface;
+}
+}
+
+namespace Data {
+
+/**
+ * The mip pyramid of one plane (file, channel, stokes) of an image.
+ *
+ * Every level stores, for each block of factor x factor pixels, the sum (in double
+ * precision) and the number of the finite pixels in it, so that the mean over any
+ * larger aligned block can be computed exactly from a coarser level. The first level is built from the
+ * full resolution plane on the first zoomed-out request, the others by merging 2 x 2
+ * cells of the previous one. Pyramids of all images share a memory budget
+ * (mipPyramidMB in the main configuration) and the least recently used ones are
+ * dropped when it is exceeded. They also count towards the process wide memory
+ * budget, which drops them when it runs short. With mipPyramidPersist they are also
+ * stored in the persistent cache, so later sessions don't have to read the plane again.
+ */
+class MipPyramid {
+
+public:
+
+    /**
+     * Returns the pyramid of a plane, building it if necessary.
+     * @param fileName - the path of the image.
+     * @param channel - the channel of the plane.
+     * @param stokeFrame - the stoke frame of the plane.
+     * @param mip - the down sampling factor of the request.
+     * @param xMin - the first column of the request.
+     * @param yMin - the first row of the request.
+     * @param view - the full plane, read if the pyramid has to be built.
+     * @param diskCache - the persistent cache or nullptr.
+     * @return - the pyramid or nullptr if the view is not a single plane, the plane is
+     *      too small or too large, no level could serve the request, the budget is 0
+     *      or the process is short of memory.
+     */
+    static std::shared_ptr<MipPyramid> get( const QString& fileName, int channel, int stokeFrame,
+            int mip, int xMin, int yMin, Carta::Lib::NdArray::RawViewInterface* view,
+            std::shared_ptr<Carta::Lib::IPCache> diskCache );
+
+    /**
+     * Computes the block means of part of the plane from the coarsest usable level.
+     * @param mip - the down sampling factor.
+     * @param xMin - the first column, a multiple of the level used.
+     * @param yMin - the first row, a multiple of the level used.
+     * @param nCols - the number of blocks per row.
+     * @param nRows - the number of rows of blocks.
+     * @param imageData - filled with nRows x nCols means, NaN for blocks without finite pixels.
+     * @return - false if no level divides mip, xMin and yMin.
+     */
+    bool downsample( int mip, int xMin, int yMin, int nCols, int nRows,
+            std::vector<float>& imageData ) const;
+
+    /**
+     * Returns the memory used by the pyramid.
+     */
+    qint64 bytes() const;
+
+private:
+
+    /// Sums and counts of the finite pixels of the factor x factor blocks of the plane.
+    struct Level {
+        int factor = 0;
+        int nx = 0;
+        int ny = 0;
+        std::vector<double> sums;
+        std::vector<quint32> counts;
+    };
+
+    MipPyramid();
+
+    /// Builds the first level from the plane and the others from it.
+    bool _build( Carta::Lib::NdArray::RawViewInterface* view, int firstFactor );
+
+    /// Adds the level merging 2 x 2 cells of the last one.
+    void _addMergedLevel();
+
+    /// Restores the levels from the persistent cache.
+    bool _load( Carta::Lib::IPCache& diskCache, const QString& key, int nx, int ny );
+
+    /// Stores the levels in the persistent cache.
+    void _save( Carta::Lib::IPCache& diskCache, const QString& key ) const;
+
+    std::vector<Level> m_levels;
+
+    MipPyramid( const MipPyramid& other );
+    MipPyramid& operator=( const MipPyramid& other );
+};
+
+}
+}
@@ -0,0 +1,145 @@
+#include "Data/Image/ProgressiveRaster.h"
+#include "Data/Image/DataSource.h"
+#include "Data/Image/RasterEncodePool.h"
+#include "CartaLib/Cancellation.h"
+#include "Globals.h"
+#include "MainConfig.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QDebug>
+#include <algorithm>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+void _readSetting( const QJsonObject& json, const QString& key, int* storeLocation ){
+    if ( json.contains( key ) ){
+        QString errorMsg;
+        int val = MainConfig::ParsedInfo::toInt( json[key], errorMsg );
+        if ( errorMsg.isEmpty() && val >= 0 ){
+            *storeLocation = val;
+        }
+        else {
+            qWarning() << "[ProgressiveRaster] Invalid setting" << key << errorMsg;
+        }
+    }
+}
+}
+
+ProgressiveRaster::ProgressiveRaster( const Settings& settings ) :
+    m_settings( settings ){
+    m_pool.setMaxThreadCount( std::max( 1, m_settings.threads ) );
+}
+
+ProgressiveRaster::Settings ProgressiveRaster::configuredSettings(){
+    Settings settings;
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    int megaPixels = static_cast<int>( settings.minPixels / ( 1024 * 1024 ) );
+    _readSetting( json, "progressiveRasterMegaPixels", &megaPixels );
+    _readSetting( json, "progressiveRasterPreviewSize", &settings.previewSize );
+    _readSetting( json, "progressiveRasterPreviewPrecision", &settings.previewPrecision );
+    _readSetting( json, "progressiveRasterThreads", &settings.threads );
+    settings.minPixels = static_cast<qint64>( megaPixels ) * 1024 * 1024;
+    return settings;
+}
+
+bool ProgressiveRaster::isProgressive( const ChannelPrefetcher::RasterView& view ) const {
+    if ( m_settings.minPixels <= 0 || m_settings.previewSize <= 0 || view.mip <= 0 ){
+        return false;
+    }
+    qint64 pixels = static_cast<qint64>( view.xMax - view.xMin ) * ( view.yMax - view.yMin );
+    // a view down sampled to the preview size already is as quick as its preview
+    return pixels >= m_settings.minPixels && _previewMip( view ) > view.mip;
+}
+
+int ProgressiveRaster::_previewMip( const ChannelPrefetcher::RasterView& view ) const {
+    // the coarsest power of two multiple of the requested mip within the preview size
+    int mip = view.mip;
+    while ( ( view.xMax - view.xMin ) / mip > m_settings.previewSize ||
+            ( view.yMax - view.yMin ) / mip > m_settings.previewSize ){
+        mip *= 2;
+    }
+    return mip;
+}
+
+PBMSharedPtr ProgressiveRaster::getPreview( int fileId, std::shared_ptr<DataSource> dataSource,
+        const ChannelPrefetcher::RasterView& view, int channel, bool& changeFrame ) const {
+    if ( ! dataSource || view.mip <= 0 ){
+        return nullptr;
+    }
+
+    int mip = _previewMip( view );
+    // other codecs are kept, the client may not decode any but the one it asked for
+    int precision = view.isZFP ? std::min( view.precision, m_settings.previewPrecision ) : view.precision;
+    std::shared_ptr<CARTA::RasterImageData> preview = std::static_pointer_cast<CARTA::RasterImageData>(
+            dataSource->_getRasterImagePreview( fileId, view.xMin, view.xMax, view.yMin, view.yMax, mip,
+                                                channel, view.stokeFrame, view.isZFP, precision ) );
+    if ( preview && changeFrame ){
+        dataSource->_setChannelHistogram( preview.get(), fileId, view.regionId, channel, channel,
+                                          view.stokeFrame, view.numberOfBins, view.converter );
+        changeFrame = false;
+    }
+    return preview;
+}
+
+PBMSharedPtr ProgressiveRaster::getRefinement( int fileId, std::shared_ptr<DataSource> dataSource,
+        const ChannelPrefetcher::RasterView& view, int channel ){
+    if ( ! dataSource ){
+        return nullptr;
+    }
+    bool changeFrame = false;
+    return dataSource->_getRasterImageData( fileId, view.xMin, view.xMax, view.yMin, view.yMax, view.mip,
+                                            channel, channel, view.stokeFrame,
+                                            view.isZFP, view.precision, view.numSubsets,
+                                            changeFrame, view.regionId, view.numberOfBins, view.converter );
+}
+
+void ProgressiveRaster::refine( int fileId, std::function<PBMSharedPtr()> compute,
+        QObject* receiver, std::function<void( PBMSharedPtr )> deliver ){
+    cancel( fileId );
+    Carta::Lib::Cancellation::Token cancelled = Carta::Lib::Cancellation::make();
+    m_cancelled[fileId] = cancelled;
+
+    // the computation sees the cancellation as the token of its worker, and it is
+    // checked again before the delivery
+    const void* session = RasterEncodePool::currentSession();
+    QtConcurrent::run( &m_pool, [compute, receiver, deliver, cancelled, session]() {
+        if ( *cancelled ){
+            return;
+        }
+        Carta::Lib::Cancellation::Scope scope( cancelled );
+        RasterEncodePool::Session encodeSession( session );
+        PBMSharedPtr msg = compute();
+        if ( ! msg || *cancelled ){
+            return;
+        }
+        // checked again in the receiver's thread, where newer requests are handled
+        QTimer::singleShot( 0, receiver, [deliver, cancelled, msg]() {
+            if ( ! *cancelled ){
+                deliver( msg );
+            }
+        });
+    });
+}
+
+void ProgressiveRaster::cancel( int fileId ){
+    auto found = m_cancelled.find( fileId );
+    if ( found != m_cancelled.end() ){
+        *found->second = true;
+        m_cancelled.erase( found );
+    }
+}
+
+ProgressiveRaster::~ProgressiveRaster(){
+    for ( auto& cancelled : m_cancelled ){
+        *cancelled.second = true;
+    }
+    m_pool.waitForDone();
+}
+
+}
+}
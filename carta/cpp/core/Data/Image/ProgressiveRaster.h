@@ -0,0 +1,133 @@
+/***
+ * Sends large raster images coarse-to-fine: a quick preview first, the requested
+ * down sampling and precision afterwards.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "Data/Image/ChannelPrefetcher.h"
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+
+class QObject;
+
+typedef std::shared_ptr<google::protobuf::MessageLite> PBMSharedPtr;
+
+namespace Carta {
+namespace Data {
+
+class DataSource;
+
+/**
+ * Answers raster image requests that have to read many pixels in two steps.
+ *
+ * The preview holds one pixel of every block of a coarser down sampling, so only a
+ * fraction of the rows has to be read, and it is ZFP compressed with a low precision.
+ * The refinement, the message that was asked for, is computed by a worker and handed
+ * back to the thread of the session. A new view or channel cancels the refinement of
+ * the old one: if it has not started it is skipped, otherwise the computation gives up
+ * at its next check of the cancellation or its result is dropped instead of being sent
+ * after the newer image.
+ */
+class ProgressiveRaster {
+
+public:
+
+    struct Settings {
+        /// requests reading fewer pixels are answered in one go, 0 disables the preview
+        qint64 minPixels = 4096LL * 4096;
+        /// largest width and height of the preview in down sampled pixels
+        int previewSize = 256;
+        /// ZFP precision of the preview
+        int previewPrecision = 8;
+        /// number of workers computing refinements
+        int threads = 2;
+    };
+
+    /**
+     * Constructor.
+     * @param settings - preview threshold, size and precision and number of workers.
+     */
+    ProgressiveRaster( const Settings& settings );
+
+    /**
+     * Returns the settings from the main configuration file (progressiveRasterMegaPixels,
+     * progressiveRasterPreviewSize, progressiveRasterPreviewPrecision,
+     * progressiveRasterThreads), or the defaults.
+     */
+    static Settings configuredSettings();
+
+    /**
+     * Returns true if a request is large enough to be sent with a preview first and
+     * the preview would be down sampled more than the request.
+     * @param view - the image bounds, down sampling and compression settings.
+     */
+    bool isProgressive( const ChannelPrefetcher::RasterView& view ) const;
+
+    /**
+     * Returns the preview of a channel.
+     * @param fileId - the file id of the image.
+     * @param dataSource - the data source of that image.
+     * @param view - the requested image bounds, down sampling and compression settings.
+     * @param channel - the channel.
+     * @param changeFrame - if true the histogram of the channel is added to the preview
+     *      and it is set to false.
+     * @return - the raster image data message or nullptr.
+     */
+    PBMSharedPtr getPreview( int fileId, std::shared_ptr<DataSource> dataSource,
+            const ChannelPrefetcher::RasterView& view, int channel, bool& changeFrame ) const;
+
+    /**
+     * Returns the raster image data of a channel at the requested down sampling and
+     * precision, without histogram as that came with the preview.
+     * @param fileId - the file id of the image.
+     * @param dataSource - the data source of that image.
+     * @param view - the image bounds, down sampling and compression settings.
+     * @param channel - the channel.
+     * @return - the raster image data message or nullptr.
+     */
+    static PBMSharedPtr getRefinement( int fileId, std::shared_ptr<DataSource> dataSource,
+            const ChannelPrefetcher::RasterView& view, int channel );
+
+    /**
+     * Computes the refinement of an image on a worker, cancelling the one of the
+     * previous request. The cancellation is the current token of the worker while it
+     * computes (see Carta::Lib::Cancellation).
+     * @param fileId - the file id of the image.
+     * @param compute - computes the refined message, called on a worker.
+     * @param receiver - deliver is called in the thread of this object.
+     * @param deliver - receives the refined message unless it was cancelled meanwhile.
+     */
+    void refine( int fileId, std::function<PBMSharedPtr()> compute,
+            QObject* receiver, std::function<void( PBMSharedPtr )> deliver );
+
+    /**
+     * Cancels the refinement of an image, if any.
+     * @param fileId - the file id of the image.
+     */
+    void cancel( int fileId );
+
+    /// Cancels all refinements and waits for the workers to finish.
+    ~ProgressiveRaster();
+
+private:
+
+    /// the down sampling of the preview of a view
+    int _previewMip( const ChannelPrefetcher::RasterView& view ) const;
+
+    Settings m_settings;
+    QThreadPool m_pool;
+
+    /// cancellation flag of the latest refinement of each image
+    std::map<int, std::shared_ptr<std::atomic<bool> > > m_cancelled;
+
+    ProgressiveRaster( const ProgressiveRaster& other );
+    ProgressiveRaster& operator=( const ProgressiveRaster& other );
+};
+
+}
+}
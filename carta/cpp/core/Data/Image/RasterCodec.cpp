@@ -0,0 +1,289 @@
+#include "Data/Image/RasterCodec.h"
+#include "CartaLib/BufferPool.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include "../../Algorithms/compressionAlgorithms.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtCore/QDebug>
+#include <cmath>
+#include <cstring>
+#include <zfp.h>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+
+/// replaces buffer by a pooled one of at least size bytes, unless it is big enough
+void _reserve( std::vector<char>& buffer, size_t size ){
+    if ( buffer.size() < size ){
+        Carta::Lib::BufferPool<char>& pool = Carta::Lib::BufferPool<char>::instance();
+        pool.release( std::move( buffer ) );
+        buffer = pool.acquire( size );
+    }
+}
+
+/// ZFP state of a worker thread, reused by all the compressions it runs
+struct ZfpContext {
+    zfp_stream* zfp = zfp_stream_open( nullptr );
+    zfp_field* field = zfp_field_alloc();
+    /// bit stream over the output buffer of the last compression
+    bitstream* stream = nullptr;
+    void* streamBuffer = nullptr;
+    size_t streamBytes = 0;
+
+    ~ZfpContext(){
+        if ( stream ){
+            stream_close( stream );
+        }
+        zfp_field_free( field );
+        zfp_stream_close( zfp );
+    }
+};
+
+ZfpContext& _zfpContext(){
+    thread_local ZfpContext context;
+    return context;
+}
+
+/// ZFP in one of its modes, NaNs are replaced before
+class ZfpCodec : public RasterCodec {
+public:
+    enum class Mode { PRECISION, ACCURACY, RATE };
+
+    ZfpCodec( Mode mode ) :
+        m_mode( mode ){
+    }
+
+    QString name() const override {
+        switch ( m_mode ){
+        case Mode::ACCURACY :
+            return "zfp-accuracy";
+        case Mode::RATE :
+            return "zfp-rate";
+        default :
+            return "zfp-precision";
+        }
+    }
+
+    bool accepts( bool isZFP, int quality ) const override {
+        if ( ! isZFP ){
+            return false;
+        }
+        switch ( m_mode ){
+        case Mode::ACCURACY :
+            return quality <= 0;
+        case Mode::RATE :
+            return quality > 32;
+        default :
+            return quality >= 1 && quality <= 32;
+        }
+    }
+
+    CARTA::CompressionType compressionType() const override {
+        return CARTA::CompressionType::ZFP;
+    }
+
+    bool needsNanEncodings() const override {
+        return true;
+    }
+
+    // This function is provided by Angus
+    bool encode( float* values, int w, int h, int quality,
+            std::vector<char>& buffer, size_t& size ) const override {
+        /* the stream and field of this thread are set up for the values */
+        ZfpContext& context = _zfpContext();
+        zfp_field_set_type( context.field, zfp_type_float );
+        zfp_field_set_pointer( context.field, values );
+        zfp_field_set_size_2d( context.field, w, h );
+
+        /* set compression mode and parameters via one of three functions */
+        switch ( m_mode ){
+        case Mode::ACCURACY :
+            zfp_stream_set_accuracy( context.zfp, std::pow( 10.0, quality ) );
+            break;
+        case Mode::RATE :
+            zfp_stream_set_rate( context.zfp, quality - 32, zfp_type_float, 2, 0 );
+            break;
+        default :
+            zfp_stream_set_precision( context.zfp, quality );
+        }
+
+        /* a recycled buffer for compressed data, not zero filled */
+        size_t bufsize = zfp_stream_maximum_size( context.zfp, context.field );
+        _reserve( buffer, bufsize );
+
+        /* the bit stream is kept as long as the output buffer stays the same */
+        if ( ! context.stream || context.streamBuffer != buffer.data() ||
+             context.streamBytes != buffer.size() ){
+            if ( context.stream ){
+                stream_close( context.stream );
+            }
+            context.stream = stream_open( buffer.data(), buffer.size() );
+            context.streamBuffer = buffer.data();
+            context.streamBytes = buffer.size();
+            zfp_stream_set_bit_stream( context.zfp, context.stream );
+        }
+        zfp_stream_rewind( context.zfp );
+
+        size = zfp_compress( context.zfp, context.field );
+        return size != 0;
+    }
+
+private:
+    Mode m_mode;
+};
+
+/// the float pixels as they are, in one piece
+class RawCodec : public RasterCodec {
+public:
+    QString name() const override {
+        return "none";
+    }
+
+    bool accepts( bool isZFP, int /*quality*/ ) const override {
+        return ! isZFP;
+    }
+
+    CARTA::CompressionType compressionType() const override {
+        return CARTA::CompressionType::NONE;
+    }
+
+    int compressionQuality( int /*quality*/ ) const override {
+        return 0;
+    }
+
+    bool splitsIntoSubsets() const override {
+        return false;
+    }
+
+    bool encode( float* values, int w, int h, int /*quality*/,
+            std::vector<char>& buffer, size_t& size ) const override {
+        size = static_cast<size_t>( w ) * h * sizeof( float );
+        _reserve( buffer, size );
+        std::memcpy( buffer.data(), values, size );
+        return true;
+    }
+};
+
+/// IEEE half floats, little endian, NaNs stay NaN
+class HalfCodec : public RasterCodec {
+public:
+    QString name() const override {
+        return "half";
+    }
+
+    bool accepts( bool isZFP, int quality ) const override {
+        return ! isZFP && quality == 16;
+    }
+
+    CARTA::CompressionType compressionType() const override {
+        return CARTA::CompressionType::NONE;
+    }
+
+    bool splitsIntoSubsets() const override {
+        return false;
+    }
+
+    bool encode( float* values, int w, int h, int /*quality*/,
+            std::vector<char>& buffer, size_t& size ) const override {
+        size_t count = static_cast<size_t>( w ) * h;
+        size = count * sizeof( uint16_t );
+        _reserve( buffer, size );
+        char* out = buffer.data();
+        for ( size_t i = 0; i < count; i++ ){
+            uint16_t half = Carta::Core::Algorithms::floatToHalf( values[i] );
+            out[2 * i] = static_cast<char>( half & 0xff );
+            out[2 * i + 1] = static_cast<char>( half >> 8 );
+        }
+        return true;
+    }
+};
+
+/// exact pixels: the byte planes of the differences of their bit patterns in an LZ4 block
+class LosslessCodec : public RasterCodec {
+public:
+    QString name() const override {
+        return "lossless";
+    }
+
+    bool accepts( bool isZFP, int quality ) const override {
+        return ! isZFP && quality == 1;
+    }
+
+    CARTA::CompressionType compressionType() const override {
+        return CARTA::CompressionType::NONE;
+    }
+
+    bool encode( float* values, int w, int h, int /*quality*/,
+            std::vector<char>& buffer, size_t& size ) const override {
+        size_t count = static_cast<size_t>( w ) * h;
+        Carta::Lib::BufferPool<char>& pool = Carta::Lib::BufferPool<char>::instance();
+        std::vector<char> shuffled = pool.acquire( count * sizeof( float ) );
+        uint8_t* planes = reinterpret_cast<uint8_t*>( shuffled.data() );
+        Carta::Core::Algorithms::shuffleDelta( values, count, planes );
+        _reserve( buffer, Carta::Core::Algorithms::lz4CompressBound( shuffled.size() ) );
+        size = Carta::Core::Algorithms::lz4Compress( planes, shuffled.size(),
+                                                     reinterpret_cast<uint8_t*>( buffer.data() ) );
+        pool.release( std::move( shuffled ) );
+        return true;
+    }
+};
+
+QMutex codecsMutex;
+
+/// are the half and lossless codecs enabled in the main configuration?
+bool _extraCodecs(){
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    if ( ! json.contains( "rasterExtraCodecs" ) ){
+        return false;
+    }
+    QString errorMsg;
+    bool enabled = MainConfig::ParsedInfo::toBool( json["rasterExtraCodecs"], errorMsg );
+    if ( ! errorMsg.isEmpty() ){
+        qWarning() << "[RasterCodec] Invalid setting rasterExtraCodecs" << errorMsg;
+        return false;
+    }
+    return enabled;
+}
+
+/// the codecs, asked from the back
+std::vector<std::shared_ptr<const RasterCodec> >& _codecs(){
+    static std::vector<std::shared_ptr<const RasterCodec> > codecs = [] () {
+        std::vector<std::shared_ptr<const RasterCodec> > result = { std::make_shared<RawCodec>() };
+        if ( _extraCodecs() ){
+            result.push_back( std::make_shared<HalfCodec>() );
+            result.push_back( std::make_shared<LosslessCodec>() );
+        }
+        result.push_back( std::make_shared<ZfpCodec>( ZfpCodec::Mode::PRECISION ) );
+        result.push_back( std::make_shared<ZfpCodec>( ZfpCodec::Mode::ACCURACY ) );
+        result.push_back( std::make_shared<ZfpCodec>( ZfpCodec::Mode::RATE ) );
+        return result;
+    }();
+    return codecs;
+}
+}
+
+std::shared_ptr<const RasterCodec> RasterCodec::select( bool isZFP, int quality ){
+    QMutexLocker locker( &codecsMutex );
+    const std::vector<std::shared_ptr<const RasterCodec> >& codecs = _codecs();
+    for ( auto it = codecs.rbegin(); it != codecs.rend(); ++it ){
+        if ( ( *it )->accepts( isZFP, quality ) ){
+            return *it;
+        }
+    }
+    return codecs.front();
+}
+
+void RasterCodec::add( std::shared_ptr<const RasterCodec> codec ){
+    if ( codec ){
+        QMutexLocker locker( &codecsMutex );
+        _codecs().push_back( codec );
+    }
+}
+
+}
+}
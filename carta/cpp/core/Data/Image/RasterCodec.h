@@ -0,0 +1,108 @@
+/***
+ * Encodings of down sampled raster images.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/Proto/raster_image.pb.h"
+#include <QString>
+#include <memory>
+#include <vector>
+
+namespace Carta {
+namespace Data {
+
+/**
+ * Encodes the pixels of down sampled raster images.
+ *
+ * The codec of a request is picked from the compression type and (rounded) quality of
+ * SET_IMAGE_VIEW, as the message has no field of its own for it:
+ *
+ * - ZFP, quality 1 to 32: ZFP with that fixed precision ("zfp-precision").
+ * - ZFP, quality 0 or less: ZFP with the fixed accuracy 10^quality ("zfp-accuracy").
+ * - ZFP, quality above 32: ZFP with the fixed rate of quality - 32 bits per pixel
+ *   ("zfp-rate").
+ * - NONE, quality 16: IEEE half floats ("half"), if rasterExtraCodecs is set in the
+ *   main configuration.
+ * - NONE, quality 1: lossless, the byte planes of the pixel differences in an LZ4
+ *   block ("lossless"), if rasterExtraCodecs is set.
+ * - NONE, any other quality: raw floats ("none").
+ *
+ * Clients asking for NONE expect raw floats whatever the quality, so the half and
+ * lossless codecs have to be enabled for frontends that decode them.
+ *
+ * The raster image data message repeats the compression type and quality, so the
+ * client knows how to decode it. Codecs added with add() are asked before the built-in
+ * ones, so they can take over any of these.
+ */
+class RasterCodec {
+
+public:
+
+    virtual ~RasterCodec() {}
+
+    /// Returns the name of the codec.
+    virtual QString name() const = 0;
+
+    /**
+     * Returns true if the codec handles requests with this compression type and quality.
+     * @param isZFP - true if ZFP was asked for, false for no compression.
+     * @param quality - the compression quality.
+     */
+    virtual bool accepts( bool isZFP, int quality ) const = 0;
+
+    /// Returns the compression type announced in the message.
+    virtual CARTA::CompressionType compressionType() const = 0;
+
+    /**
+     * Returns the compression quality announced in the message.
+     * @param quality - the requested quality.
+     */
+    virtual int compressionQuality( int quality ) const {
+        return quality;
+    }
+
+    /**
+     * Returns true if NaNs have to be run length encoded (as nan encodings of the message)
+     * and replaced before encoding, because the codec can't represent them.
+     */
+    virtual bool needsNanEncodings() const {
+        return false;
+    }
+
+    /// Returns true if the image may be encoded in several subsets of rows in parallel.
+    virtual bool splitsIntoSubsets() const {
+        return true;
+    }
+
+    /**
+     * Encodes part of an image.
+     * @param values - the first of w x h pixels, may be changed.
+     * @param w - the width of the part.
+     * @param h - the height of the part.
+     * @param quality - the requested compression quality.
+     * @param buffer - a pooled buffer that holds the encoding afterwards, it may be
+     *      replaced by a bigger one.
+     * @param size - the size of the encoding.
+     * @return - true on success.
+     */
+    virtual bool encode( float* values, int w, int h, int quality,
+            std::vector<char>& buffer, size_t& size ) const = 0;
+
+    /**
+     * Returns the codec for a request, the raw float one if no other accepts it.
+     * @param isZFP - true if ZFP was asked for, false for no compression.
+     * @param quality - the compression quality.
+     */
+    static std::shared_ptr<const RasterCodec> select( bool isZFP, int quality );
+
+    /**
+     * Adds a codec, it is asked before the ones added earlier.
+     * @param codec - the codec.
+     */
+    static void add( std::shared_ptr<const RasterCodec> codec );
+};
+
+}
+}
@@ -0,0 +1,164 @@
+#include "Data/Image/RasterEncodePool.h"
+#include "Globals.h"
+#include "MainConfig.h"
+
+#include <QThread>
+#include <QtCore/QDebug>
+#include <algorithm>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+void _readSetting( const QJsonObject& json, const QString& key, int* storeLocation ){
+    if ( json.contains( key ) ){
+        QString errorMsg;
+        int val = MainConfig::ParsedInfo::toInt( json[key], errorMsg );
+        if ( errorMsg.isEmpty() && val >= 0 ){
+            *storeLocation = val;
+        }
+        else {
+            qWarning() << "[RasterEncodePool] Invalid setting" << key << errorMsg;
+        }
+    }
+}
+
+const void*& _currentSession(){
+    thread_local const void* session = nullptr;
+    return session;
+}
+}
+
+RasterEncodePool::Session::Session( const void* session ) :
+    m_previous( _currentSession() ){
+    _currentSession() = session;
+}
+
+RasterEncodePool::Session::~Session(){
+    _currentSession() = m_previous;
+}
+
+const void* RasterEncodePool::currentSession(){
+    return _currentSession();
+}
+
+RasterEncodePool& RasterEncodePool::instance(){
+    // never destroyed, the workers run until the process exits
+    static RasterEncodePool* pool = [] () -> RasterEncodePool* {
+        const QJsonObject& json = Globals::instance()->mainConfig()->json();
+        int threads = 0;
+        int subsetPixels = 256 * 256;
+        _readSetting( json, "rasterEncodeThreads", &threads );
+        _readSetting( json, "rasterEncodeSubsetPixels", &subsetPixels );
+        if ( threads == 0 ){
+            threads = QThread::idealThreadCount();
+        }
+        return new RasterEncodePool( std::max( 1, threads ), std::max( 1, subsetPixels ) );
+    }();
+    return *pool;
+}
+
+RasterEncodePool::RasterEncodePool( int threads, int subsetPixels ) :
+    m_subsetPixels( subsetPixels ){
+    m_stats.threads = threads;
+    for ( int i = 0; i < threads; i++ ){
+        m_threads.emplace_back( &RasterEncodePool::_work, this );
+        m_threads.back().detach();
+    }
+}
+
+int RasterEncodePool::subsetCount( int nx, int ny, int maxSubsets ) const {
+    // the submitting thread works on the subsets too
+    qint64 pixels = static_cast<qint64>( nx ) * ny;
+    qint64 count = std::min<qint64>( pixels / m_subsetPixels, static_cast<qint64>( m_threads.size() ) + 1 );
+    // ZFP compresses blocks of 4 x 4 pixels, each subset should hold whole rows of them,
+    // so the boundaries i * ( ny / count ) have to be multiples of 4
+    count = std::min<qint64>( count, ny / 4 );
+    count = std::min<qint64>( count, maxSubsets );
+    while ( count > 1 && ( ny / count ) % 4 != 0 ){
+        count--;
+    }
+    return static_cast<int>( std::max<qint64>( 1, count ) );
+}
+
+void RasterEncodePool::run( const void* session, const std::vector<std::function<void()> >& tasks ){
+    if ( tasks.empty() ){
+        return;
+    }
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    batch->remaining = tasks.size();
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    std::deque<Task>& queue = m_queues[session];
+    for ( const auto& work : tasks ){
+        Task task;
+        task.work = work;
+        task.batch = batch;
+        queue.push_back( task );
+    }
+    m_stats.queued += tasks.size();
+    if ( m_stats.queued > m_stats.peakQueued ){
+        m_stats.peakQueued = m_stats.queued;
+        qDebug() << "[RasterEncodePool] Peak queue depth" << m_stats.peakQueued << "tasks of"
+                 << m_queues.size() << "sessions";
+    }
+    m_stats.sessions = m_queues.size();
+    m_wake.notify_all();
+
+    // help with the tasks of this session from the back, the workers take the front
+    while ( batch->remaining > 0 ){
+        auto found = m_queues.find( session );
+        if ( found == m_queues.end() ){
+            batch->done.wait( lock, [&batch] () { return batch->remaining == 0; } );
+            break;
+        }
+        Task task = found->second.back();
+        found->second.pop_back();
+        if ( found->second.empty() ){
+            m_queues.erase( found );
+        }
+        m_stats.helped++;
+        _runTask( task, lock );
+    }
+}
+
+RasterEncodePool::Stats RasterEncodePool::stats() const {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+void RasterEncodePool::_work(){
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true ){
+        m_wake.wait( lock, [this] () { return ! m_queues.empty(); } );
+
+        // the next session after the one served last
+        auto next = m_queues.upper_bound( m_lastSession );
+        if ( next == m_queues.end() ){
+            next = m_queues.begin();
+        }
+        m_lastSession = next->first;
+        Task task = next->second.front();
+        next->second.pop_front();
+        if ( next->second.empty() ){
+            m_queues.erase( next );
+        }
+        m_stats.stolen++;
+        _runTask( task, lock );
+    }
+}
+
+void RasterEncodePool::_runTask( Task& task, std::unique_lock<std::mutex>& lock ){
+    m_stats.queued--;
+    m_stats.sessions = m_queues.size();
+    lock.unlock();
+    task.work();
+    lock.lock();
+    if ( --task.batch->remaining == 0 ){
+        task.batch->done.notify_all();
+    }
+}
+
+}
+}
@@ -0,0 +1,132 @@
+/***
+ * Worker threads that NaN encode and compress the subsets of raster images for all
+ * sessions.
+ */
+
+#pragma once
+
+#include <QtGlobal>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Carta {
+namespace Data {
+
+/**
+ * A thread pool of its own for encoding raster image subsets, so they don't queue up
+ * behind everything else that runs on the global Qt pool. The strips of the down
+ * sampling and the runs of missing tiles run on it as well; a task may submit a batch
+ * of its own, its thread then helps with the session's tasks until that is done.
+ *
+ * Every session (the connector of a client) has a deque of tasks. The thread that
+ * submitted a batch works through its own deque from the back while it waits, the
+ * workers steal from the front of the deques. Idle workers visit the sessions round robin, so a session with
+ * a big batch can't starve the others. The pool size comes from rasterEncodeThreads in
+ * the main configuration (0: one per core), the size of the subsets from
+ * rasterEncodeSubsetPixels.
+ */
+class RasterEncodePool {
+
+public:
+
+    /// Queue depth and throughput counters.
+    struct Stats {
+        int threads = 0;
+        /// tasks waiting right now, and the most ever
+        int queued = 0;
+        int peakQueued = 0;
+        /// sessions with waiting tasks
+        int sessions = 0;
+        /// tasks run by the workers and by the submitting threads
+        qint64 stolen = 0;
+        qint64 helped = 0;
+    };
+
+    /// RAII scope making a session current for the calling thread, see run().
+    class Session {
+    public:
+        explicit Session( const void* session );
+        /// restores the previous session
+        ~Session();
+    private:
+        const void* m_previous;
+        Session( const Session& other );
+        Session& operator=( const Session& other );
+    };
+
+    /// the pool shared by all sessions
+    static RasterEncodePool& instance();
+
+    /**
+     * Returns the current session of the calling thread, nullptr if it has none. Workers
+     * computing for a session don't see it, they have to be handed it and make it
+     * current themselves.
+     */
+    static const void* currentSession();
+
+    /**
+     * Returns the number of subsets to split an image into, from its size and the
+     * number of workers. The subsets start at multiples of ny / count rows, as the
+     * clients expect, and the count is chosen so that these are whole rows of ZFP blocks.
+     * @param nx - the width of the image.
+     * @param ny - the height of the image.
+     * @param maxSubsets - the most subsets the client accepts.
+     */
+    int subsetCount( int nx, int ny, int maxSubsets ) const;
+
+    /**
+     * Runs tasks and returns once all of them have finished. The calling thread runs
+     * tasks of the session as well.
+     * @param session - identifies the session the tasks belong to, usually currentSession().
+     * @param tasks - the tasks.
+     */
+    void run( const void* session, const std::vector<std::function<void()> >& tasks );
+
+    /// Returns a snapshot of the counters.
+    Stats stats() const;
+
+private:
+
+    /// Tasks submitted together, the submitter waits for all of them.
+    struct Batch {
+        int remaining = 0;
+        std::condition_variable done;
+    };
+
+    struct Task {
+        std::function<void()> work;
+        std::shared_ptr<Batch> batch;
+    };
+
+    RasterEncodePool( int threads, int subsetPixels );
+
+    /// The loop of a worker.
+    void _work();
+
+    /// Runs a task taken from a queue and reports it done, m_mutex is held on entry
+    /// and on return.
+    void _runTask( Task& task, std::unique_lock<std::mutex>& lock );
+
+    int m_subsetPixels;
+    std::vector<std::thread> m_threads;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    /// the waiting tasks of each session, only sessions with tasks are present
+    std::map<const void*, std::deque<Task> > m_queues;
+    /// the session a worker took a task from last, for the round robin
+    const void* m_lastSession = nullptr;
+    Stats m_stats;
+
+    RasterEncodePool( const RasterEncodePool& other );
+    RasterEncodePool& operator=( const RasterEncodePool& other );
+};
+
+}
+}
@@ -0,0 +1,266 @@
+#include "Data/Image/RasterTileCache.h"
+#include "Data/Image/DataSource.h"
+#include "Data/Image/RasterEncodePool.h"
+#include "Data/Image/ImageRegistry.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include "CartaLib/BufferPool.h"
+#include "CartaLib/Cancellation.h"
+#include "CartaLib/IImage.h"
+#include "CartaLib/MemoryBudget.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtCore/QDebug>
+#include <algorithm>
+#include <list>
+#include <map>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+
+struct Settings {
+    /// tile size in down sampled pixels, 0 sends whole views
+    int tileSize = 0;
+    /// memory budget of the compressed tiles of all images
+    qint64 maxBytes = 256 * 1024 * 1024;
+};
+
+const Settings& _settings(){
+    static const Settings settings = [] () -> Settings {
+        Settings result;
+        const QJsonObject& json = Globals::instance()->mainConfig()->json();
+        QString errorMsg;
+        if ( json.contains( "rasterTileSize" ) ){
+            int tileSize = MainConfig::ParsedInfo::toInt( json["rasterTileSize"], errorMsg );
+            if ( errorMsg.isEmpty() && tileSize >= 0 ){
+                result.tileSize = tileSize;
+            }
+            else {
+                qWarning() << "[RasterTileCache] Invalid setting rasterTileSize" << errorMsg;
+            }
+        }
+        if ( json.contains( "rasterTileCacheMB" ) ){
+            errorMsg.clear();
+            int memoryMB = MainConfig::ParsedInfo::toInt( json["rasterTileCacheMB"], errorMsg );
+            if ( errorMsg.isEmpty() && memoryMB >= 0 ){
+                result.maxBytes = static_cast<qint64>( memoryMB ) * 1024 * 1024;
+            }
+            else {
+                qWarning() << "[RasterTileCache] Invalid setting rasterTileCacheMB" << errorMsg;
+            }
+        }
+        return result;
+    }();
+    return settings;
+}
+
+typedef std::shared_ptr<const CARTA::RasterImageData> TilePtr;
+typedef std::list<std::pair<QString, TilePtr> > TileList;
+
+/// compressed tiles, the most recently used first
+QMutex cacheMutex;
+TileList tiles;
+std::map<QString, TileList::iterator> tileIndex;
+qint64 cacheBytes = 0;
+
+/// drop least recently used tiles until wanted bytes are freed, cacheMutex must be held
+qint64 _evict( qint64 wanted ){
+    qint64 freed = 0;
+    while ( freed < wanted && ! tiles.empty() ){
+        freed += tiles.back().second->ByteSize();
+        tileIndex.erase( tiles.back().first );
+        tiles.pop_back();
+    }
+    cacheBytes -= freed;
+    Carta::Lib::MemoryBudget::instance().account( -freed );
+    return freed;
+}
+
+qint64 _reclaim( qint64 wanted ){
+    QMutexLocker locker( &cacheMutex );
+    return _evict( wanted );
+}
+
+/// the tiles count towards the process wide memory budget
+void _registerReclaimer(){
+    static const int id = Carta::Lib::MemoryBudget::instance().addReclaimer( "RasterTileCache", _reclaim );
+    Q_UNUSED( id );
+}
+
+TilePtr _find( const QString& key ){
+    QMutexLocker locker( &cacheMutex );
+    auto found = tileIndex.find( key );
+    if ( found == tileIndex.end() ){
+        return nullptr;
+    }
+    tiles.splice( tiles.begin(), tiles, found->second );
+    return found->second->second;
+}
+
+void _insert( const QString& key, const TilePtr& tile ){
+    qint64 bytes = tile->ByteSize();
+    QMutexLocker locker( &cacheMutex );
+    if ( bytes > _settings().maxBytes || tileIndex.count( key ) > 0 ){
+        return;
+    }
+    tiles.emplace_front( key, tile );
+    tileIndex[key] = tiles.begin();
+    cacheBytes += bytes;
+    Carta::Lib::MemoryBudget::instance().account( bytes );
+    if ( cacheBytes > _settings().maxBytes ){
+        _evict( cacheBytes - _settings().maxBytes );
+    }
+}
+}
+
+bool RasterTileCache::TileView::operator==( const TileView& other ) const {
+    return mip == other.mip && channel == other.channel && stokeFrame == other.stokeFrame &&
+           isZFP == other.isZFP && precision == other.precision;
+}
+
+int RasterTileCache::tileSize(){
+    return _settings().tileSize;
+}
+
+std::vector<RasterTileCache::TileIndex> RasterTileCache::tilesCovering( int xMin, int xMax,
+        int yMin, int yMax, int mip, int width, int height ){
+    std::vector<TileIndex> result;
+    int size = tileSize();
+    if ( size <= 0 || mip <= 0 ){
+        return result;
+    }
+    // tiles whose last columns hold less than a down sampled pixel are empty
+    int span = size * mip;
+    xMin = std::max( xMin, 0 );
+    yMin = std::max( yMin, 0 );
+    xMax = std::min( xMax, width - width % mip );
+    yMax = std::min( yMax, height - height % mip );
+    for ( int y = yMin / span; y * span < yMax; y++ ){
+        for ( int x = xMin / span; x * span < xMax; x++ ){
+            TileIndex tile;
+            tile.x = x;
+            tile.y = y;
+            result.push_back( tile );
+        }
+    }
+    return result;
+}
+
+std::vector<std::pair<RasterTileCache::TileIndex, PBMSharedPtr> > RasterTileCache::getTiles( int fileId,
+        std::shared_ptr<DataSource> dataSource, const TileView& view, const std::vector<TileIndex>& tileIndices,
+        bool& changeFrame, int numberOfBins ){
+    std::vector<std::pair<TileIndex, PBMSharedPtr> > result;
+    int size = tileSize();
+    if ( !dataSource || size <= 0 || tileIndices.empty() ){
+        return result;
+    }
+    std::shared_ptr<Carta::Lib::Image::ImageInterface> image = dataSource->_getImage();
+    if ( !image || image->dims().size() < 2 ){
+        return result;
+    }
+    _registerReclaimer();
+    const int width = image->dims()[0];
+    const int height = image->dims()[1];
+    const int span = size * view.mip;
+    const QString prefix = ImageRegistry::versionKey( dataSource->_getFileName() ) + "/" +
+            QString( "%1/%2/%3/%4/%5/%6" ).arg( size ).arg( view.mip ).arg( view.channel )
+            .arg( view.stokeFrame ).arg( view.isZFP ).arg( view.precision );
+    auto keyOf = [&prefix] ( const TileIndex& tile ) -> QString {
+        return prefix + QString( "/%1/%2" ).arg( tile.x ).arg( tile.y );
+    };
+
+    // cached tiles, the others by their position
+    int count = tileIndices.size();
+    std::vector<TilePtr> found( count );
+    std::map<TileIndex, int> missing;
+    for ( int i = 0; i < count; i++ ){
+        found[i] = _find( keyOf( tileIndices[i] ) );
+        if ( !found[i] ){
+            missing[tileIndices[i]] = i;
+        }
+    }
+
+    // the missing tiles next to each other in a row of tiles are down sampled together,
+    // so their rows are read once, and then split and encoded; the runs are computed
+    // in parallel on the raster pool, and are dropped once a newer view supersedes this one
+    std::vector<std::vector<std::pair<TileIndex, int> > > runs;
+    for ( const auto& tile : missing ){
+        if ( runs.empty() || runs.back().back().first.y != tile.first.y ||
+             runs.back().back().first.x + 1 != tile.first.x ){
+            runs.emplace_back();
+        }
+        runs.back().push_back( tile );
+    }
+    std::vector<std::function<void()> > tasks;
+    const void* session = RasterEncodePool::currentSession();
+    Carta::Lib::Cancellation::Token cancellation = Carta::Lib::Cancellation::current();
+    for ( const auto& run : runs ){
+        tasks.push_back( [&found, &dataSource, &view, &keyOf, &run, span, width, height, session, cancellation] () {
+            if ( Carta::Lib::Cancellation::isCancelled( cancellation ) ){
+                return;
+            }
+            RasterEncodePool::Session encodeSession( session );
+            Carta::Lib::Cancellation::Scope cancellationScope( cancellation );
+            int xMin = run.front().first.x * span;
+            int xMax = std::min( ( run.back().first.x + 1 ) * span, width );
+            int yMin = run.front().first.y * span;
+            int yMax = std::min( yMin + span, height );
+            std::vector<float> imageData;
+            std::vector<char> nanRows;
+            if ( !dataSource->_getDownsampledData( xMin, xMax, yMin, yMax, view.mip, view.channel, view.channel,
+                                                   view.stokeFrame, imageData, nanRows ) ){
+                return;
+            }
+            Carta::Lib::BufferPool<float>& floatPool = Carta::Lib::BufferPool<float>::instance();
+            int nx = ( xMax - xMin ) / view.mip;
+            int ny = ( yMax - yMin ) / view.mip;
+            for ( const auto& tile : run ){
+                if ( Carta::Lib::Cancellation::isCancelled( cancellation ) ){
+                    break;
+                }
+                int tileXMin = tile.first.x * span;
+                int tileXMax = std::min( tileXMin + span, width );
+                int tileNx = ( tileXMax - tileXMin ) / view.mip;
+                int column = ( tileXMin - xMin ) / view.mip;
+                std::vector<float> tileData = floatPool.acquire( static_cast<size_t>( tileNx ) * ny );
+                for ( int j = 0; j < ny; j++ ){
+                    const float* row = imageData.data() + static_cast<size_t>( j ) * nx + column;
+                    std::copy( row, row + tileNx, tileData.begin() + static_cast<size_t>( j ) * tileNx );
+                }
+                // a row of the run without NaNs has none in any of its tiles
+                TilePtr raster = dataSource->_makeRasterImageData( 0, tileXMin, tileXMax, yMin, yMax, view.mip,
+                        view.channel, view.stokeFrame, tileData, tileNx, ny, view.isZFP, view.precision, 1,
+                        nanRows.empty() ? nullptr : nanRows.data() );
+                floatPool.release( std::move( tileData ) );
+                _insert( keyOf( tile.first ), raster );
+                found[tile.second] = raster;
+            }
+            floatPool.release( std::move( imageData ) );
+        });
+    }
+    RasterEncodePool::instance().run( session ? session : dataSource.get(), tasks );
+    qDebug() << "[RasterTileCache]" << count - static_cast<int>( missing.size() ) << "of" << count
+             << "tiles cached, the others computed in" << runs.size() << "runs";
+
+    for ( int i = 0; i < count; i++ ){
+        if ( !found[i] ){
+            continue;
+        }
+        std::shared_ptr<CARTA::RasterImageData> raster( new CARTA::RasterImageData( *found[i] ) );
+        raster->set_file_id( fileId );
+        if ( changeFrame ){
+            dataSource->_setChannelHistogram( raster.get(), fileId, -1, view.channel, view.channel,
+                    view.stokeFrame, numberOfBins, nullptr );
+            changeFrame = false;
+        }
+        result.push_back( std::make_pair( tileIndices[i], raster ) );
+    }
+    return result;
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/***
+ * Fixed-size tiles of down sampled, compressed raster image data.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include <QString>
+#include <memory>
+#include <utility>
+#include <vector>
+
+typedef std::shared_ptr<google::protobuf::MessageLite> PBMSharedPtr;
+
+namespace Carta {
+namespace Data {
+
+class DataSource;
+
+/**
+ * Splits raster images into tiles that are computed, cached and sent on their own.
+ *
+ * Every down sampled plane (mip, channel, stokes) is cut into tiles of tileSize x
+ * tileSize down sampled pixels on a fixed grid. A tile is down sampled, NaN encoded and
+ * compressed independently and sent as a raster image data message whose image
+ * bounds are those of the tile. When the view is panned, only the tiles that came
+ * into view have to be computed and sent. The compressed tiles of all images are
+ * kept in one cache (rasterTileCacheMB in the main configuration) that counts
+ * towards the process wide memory budget, so sessions showing the same file share
+ * them. Tiled raster data is enabled with rasterTileSize, as the client has to put
+ * the tiles together.
+ */
+class RasterTileCache {
+
+public:
+
+    /// The position of a tile on the grid of its plane.
+    struct TileIndex {
+        int x = 0;
+        int y = 0;
+
+        bool operator<( const TileIndex& other ) const {
+            return y < other.y || ( y == other.y && x < other.x );
+        }
+    };
+
+    /// Everything that determines the tiles of a plane.
+    struct TileView {
+        int mip = 1;
+        int channel = 0;
+        int stokeFrame = 0;
+        bool isZFP = false;
+        int precision = 0;
+
+        bool operator==( const TileView& other ) const;
+        bool operator!=( const TileView& other ) const {
+            return ! ( *this == other );
+        }
+    };
+
+    /**
+     * Returns the tile size in down sampled pixels, 0 if tiled raster data is disabled.
+     */
+    static int tileSize();
+
+    /**
+     * Returns the tiles that cover part of an image.
+     * @param xMin - lower bound of the x-pixel-coordinate.
+     * @param xMax - upper bound of the x-pixel-coordinate.
+     * @param yMin - lower bound of the y-pixel-coordinate.
+     * @param yMax - upper bound of the y-pixel-coordinate.
+     * @param mip - down sampling factor.
+     * @param width - the width of the image.
+     * @param height - the height of the image.
+     * @return - the tiles with at least one down sampled pixel.
+     */
+    static std::vector<TileIndex> tilesCovering( int xMin, int xMax, int yMin, int yMax, int mip,
+            int width, int height );
+
+    /**
+     * Returns the raster image data messages of some tiles, from the cache or computed
+     * and cached. The missing tiles next to each other in a row of tiles are down
+     * sampled together, each such run in parallel.
+     * @param fileId - the file id of the image.
+     * @param dataSource - the data source of the image.
+     * @param view - the plane, down sampling and compression of the tiles.
+     * @param tiles - the tiles.
+     * @param changeFrame - if true the histogram of the channel is added to the first
+     *      message and it is set to false.
+     * @param numberOfBins - the number of bins of the histogram.
+     * @return - the tiles that could be computed, with their messages.
+     */
+    static std::vector<std::pair<TileIndex, PBMSharedPtr> > getTiles( int fileId,
+            std::shared_ptr<DataSource> dataSource, const TileView& view, const std::vector<TileIndex>& tiles,
+            bool& changeFrame, int numberOfBins );
+
+private:
+
+    RasterTileCache();
+    RasterTileCache( const RasterTileCache& other );
+    RasterTileCache& operator=( const RasterTileCache& other );
+};
+
+}
+}
@@ -0,0 +1,404 @@
+#include "Data/Image/SpectralCompanion.h"
+#include "Data/Util.h"
+#include "CartaLib/IImage.h"
+#include "CartaLib/AxisInfo.h"
+#include "CartaLib/MemoryBudget.h"
+#include "Globals.h"
+#include "MainConfig.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStorageInfo>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <utime.h>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+/// images with fewer channels read their profiles fast enough without a companion
+const int MIN_CHANNELS = 64;
+
+/// memory used for one band of rows (or of a part of a row) while generating
+const qint64 BAND_BYTES = 64 * 1024 * 1024;
+
+/// memory used for one read from the image while generating
+const qint64 READ_BYTES = 16 * 1024 * 1024;
+
+/// default size of all companion files together
+const int DEFAULT_MAX_MB = 20 * 1024;
+
+const char SUFFIX[] = ".spc";
+
+const char MAGIC[8] = { 'C', 'A', 'R', 'T', 'A', 'S', 'P', 'C' };
+const qint32 VERSION = 1;
+const qint32 BYTE_ORDER_MARK = 0x01020304;
+
+/// the file starts with this header, the float data follows in native byte order
+struct Header {
+    char magic[8];
+    qint32 version;
+    qint32 byteOrder;
+    qint32 nx;
+    qint32 ny;
+    qint32 nz;
+    qint32 nStokes;
+};
+static_assert( sizeof( Header ) == 32, "unexpected padding of the companion header" );
+
+/// companions of the images open in any session, by file path
+QMutex registryMutex;
+std::map<QString, std::weak_ptr<SpectralCompanion> > registry;
+
+/// Companions are generated one at a time on their own thread, so that they neither
+/// compete for the disk nor hold up the global pool used for compression. The pool
+/// is never deleted, which would wait for a running generation at exit.
+QThreadPool* _generatorPool(){
+    static QThreadPool* pool = nullptr;
+    if ( ! pool ){
+        pool = new QThreadPool();
+        pool->setMaxThreadCount( 1 );
+    }
+    return pool;
+}
+}
+
+qint64 SpectralCompanion::Geometry::dataBytes() const {
+    return static_cast<qint64>( nx ) * ny * nz * nStokes * sizeof( float );
+}
+
+SpectralCompanion::SpectralCompanion( const QString& path, const Geometry& geometry ) :
+    m_path( path ),
+    m_geometry( geometry ),
+    m_ready( false ){
+}
+
+std::shared_ptr<SpectralCompanion> SpectralCompanion::create( const QString& fileName,
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> image ){
+    if ( ! image ){
+        return nullptr;
+    }
+
+    // only x, y, the spectral and the stokes axis may have more than one pixel
+    Geometry geometry;
+    geometry.dims = image->dims();
+    geometry.spectralIndex = Util::getAxisIndex( image, Carta::Lib::AxisInfo::KnownType::SPECTRAL );
+    geometry.stokesIndex = Util::getAxisIndex( image, Carta::Lib::AxisInfo::KnownType::STOKES );
+    if ( geometry.spectralIndex < 2 || geometry.dims[geometry.spectralIndex] < MIN_CHANNELS ){
+        return nullptr;
+    }
+    // images that keep their own spectral-major copy don't need another one
+    if ( image->hasFastLineAccess( geometry.spectralIndex ) ){
+        return nullptr;
+    }
+    for ( int i = 2; i < static_cast<int>( geometry.dims.size() ); i++ ){
+        if ( i != geometry.spectralIndex && i != geometry.stokesIndex && geometry.dims[i] != 1 ){
+            return nullptr;
+        }
+    }
+    geometry.nx = geometry.dims[0];
+    geometry.ny = geometry.dims[1];
+    geometry.nz = geometry.dims[geometry.spectralIndex];
+    geometry.nStokes = geometry.stokesIndex >= 0 ? geometry.dims[geometry.stokesIndex] : 1;
+
+    QString directory = _directory();
+    if ( directory.isEmpty() ){
+        return nullptr;
+    }
+
+    // the name is made of a hash of the path and one of the version of the image file,
+    // so a changed file gets a new companion and the old ones can be found
+    QFileInfo fileInfo( fileName );
+    QString fileHash = QCryptographicHash::hash( fileInfo.canonicalFilePath().toUtf8(),
+                                                 QCryptographicHash::Sha1 ).toHex();
+    QString version = QString::number( fileInfo.size() ) + "|" +
+                      QString::number( fileInfo.lastModified().toMSecsSinceEpoch() );
+    QString versionHash = QCryptographicHash::hash( version.toUtf8(), QCryptographicHash::Sha1 ).toHex().left( 16 );
+    QString path = directory + "/" + fileHash + "-" + versionHash + SUFFIX;
+
+    QMutexLocker locker( &registryMutex );
+    auto found = registry.find( path );
+    if ( found != registry.end() && ! found->second.expired() ){
+        return found->second.lock();
+    }
+    std::shared_ptr<SpectralCompanion> companion( new SpectralCompanion( path, geometry ) );
+    if ( companion->_open() ){
+        qDebug() << "[SpectralCompanion] Using" << path << "for" << fileName;
+        // the modification time marks the last use for the eviction
+        utime( QFile::encodeName( path ).constData(), nullptr );
+        registry[path] = companion;
+        return companion;
+    }
+
+    // the companions of earlier versions of the image are of no use any more, and the
+    // least recently used ones make room for the new one
+    QDir().mkpath( directory );
+    _removeVersions( directory, fileHash, path );
+    if ( ! _makeRoom( directory, geometry.dataBytes() ) ){
+        qWarning() << "[SpectralCompanion] The companion of" << fileName << "does not fit into the cache";
+        return nullptr;
+    }
+    QStorageInfo storage( directory );
+    if ( storage.bytesAvailable() < geometry.dataBytes() + geometry.dataBytes() / 10 ){
+        qWarning() << "[SpectralCompanion] Not enough disk space in" << directory << "for" << fileName;
+        return nullptr;
+    }
+    qDebug() << "[SpectralCompanion] Generating" << path << "for" << fileName;
+    registry[path] = companion;
+    std::weak_ptr<SpectralCompanion> weak( companion );
+    QtConcurrent::run( _generatorPool(), [weak, image, path, geometry]() {
+        _generate( weak, image, path, geometry );
+    });
+    return companion;
+}
+
+bool SpectralCompanion::isReady() const {
+    return m_ready.load();
+}
+
+bool SpectralCompanion::readSpectrum( int x, int y, int stokeFrame, std::vector<float>& spectrum ) const {
+    if ( ! isReady() ){
+        return false;
+    }
+    const Geometry& g = m_geometry;
+    if ( x < 0 || x >= g.nx || y < 0 || y >= g.ny || stokeFrame < 0 || stokeFrame >= g.nStokes ){
+        return false;
+    }
+    qint64 offset = ( ( static_cast<qint64>( stokeFrame ) * g.ny + y ) * g.nx + x ) * g.nz;
+    spectrum.assign( m_data + offset, m_data + offset + g.nz );
+    return true;
+}
+
+bool SpectralCompanion::_open(){
+    m_file.setFileName( m_path );
+    if ( ! m_file.exists() || ! m_file.open( QIODevice::ReadOnly ) ){
+        return false;
+    }
+    const Geometry& g = m_geometry;
+    Header header;
+    bool valid = m_file.size() == static_cast<qint64>( sizeof( Header ) ) + g.dataBytes() &&
+                 m_file.read( reinterpret_cast<char*>( &header ), sizeof( Header ) ) == sizeof( Header ) &&
+                 std::memcmp( header.magic, MAGIC, sizeof( MAGIC ) ) == 0 &&
+                 header.version == VERSION && header.byteOrder == BYTE_ORDER_MARK &&
+                 header.nx == g.nx && header.ny == g.ny && header.nz == g.nz && header.nStokes == g.nStokes;
+    uchar* mapped = valid ? m_file.map( 0, m_file.size() ) : nullptr;
+    if ( ! mapped ){
+        qDebug() << "[SpectralCompanion] Ignoring stale companion" << m_path;
+        m_file.close();
+        return false;
+    }
+    m_data = reinterpret_cast<const float*>( mapped + sizeof( Header ) );
+    m_ready = true;
+    return true;
+}
+
+void SpectralCompanion::_generate( std::weak_ptr<SpectralCompanion> companion,
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> image,
+        const QString& path, const Geometry& geometry ){
+    const Geometry& g = geometry;
+
+    // written to a temporary file that only replaces the real one when complete,
+    // so other sessions never see half a companion
+    QSaveFile file( path );
+    if ( ! file.open( QIODevice::WriteOnly ) ){
+        qWarning() << "[SpectralCompanion] Could not write" << path << file.errorString();
+        return;
+    }
+    Header header;
+    std::memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.nx = g.nx;
+    header.ny = g.ny;
+    header.nz = g.nz;
+    header.nStokes = g.nStokes;
+    file.write( reinterpret_cast<const char*>( &header ), sizeof( Header ) );
+
+    // transpose a band of rows at a time, reading a group of channels at once; if a
+    // single row of spectra is too large, the rows are split into bands of columns,
+    // which are just as contiguous in the file
+    qint64 pixelSpectrumBytes = static_cast<qint64>( g.nz ) * sizeof( float );
+    qint64 spectrumBytes = g.nx * pixelSpectrumBytes;
+    int bandRows = static_cast<int>( std::max<qint64>( 1, std::min<qint64>( g.ny, BAND_BYTES / spectrumBytes ) ) );
+    int bandCols = spectrumBytes <= BAND_BYTES ? g.nx :
+                   static_cast<int>( std::max<qint64>( 1, BAND_BYTES / pixelSpectrumBytes ) );
+    qint64 planeBytes = static_cast<qint64>( bandCols ) * bandRows * sizeof( float );
+    int channelGroup = static_cast<int>( std::max<qint64>( 1, std::min<qint64>( g.nz, READ_BYTES / planeBytes ) ) );
+    qint64 bandBytes = planeBytes * g.nz;
+    Carta::Lib::MemoryBudget::Reservation reservation( bandBytes );
+    if ( ! reservation.ok() ){
+        qWarning() << "[SpectralCompanion] No memory for a band of" << bandBytes << "bytes, not generating" << path;
+        file.cancelWriting();
+        return;
+    }
+    std::vector<float> band( static_cast<size_t>( bandCols ) * bandRows * g.nz );
+
+    for ( int stoke = 0; stoke < g.nStokes; stoke++ ){
+        for ( int y0 = 0; y0 < g.ny; y0 += bandRows ){
+            int rows = std::min( bandRows, g.ny - y0 );
+            for ( int x0 = 0; x0 < g.nx; x0 += bandCols ){
+                int cols = std::min( bandCols, g.nx - x0 );
+                for ( int z0 = 0; z0 < g.nz; z0 += channelGroup ){
+                    if ( companion.expired() ){
+                        qDebug() << "[SpectralCompanion] Image closed, discarding" << path;
+                        file.cancelWriting();
+                        return;
+                    }
+                    int channels = std::min( channelGroup, g.nz - z0 );
+
+                    SliceND slice;
+                    for ( int i = 0; i < static_cast<int>( g.dims.size() ); i++ ){
+                        if ( i == 0 ){
+                            slice.slice( i ).start( x0 ).end( x0 + cols );
+                        }
+                        else if ( i == 1 ){
+                            slice.slice( i ).start( y0 ).end( y0 + rows );
+                        }
+                        else if ( i == g.spectralIndex ){
+                            slice.slice( i ).start( z0 ).end( z0 + channels );
+                        }
+                        else if ( i == g.stokesIndex ){
+                            slice.slice( i ).start( stoke ).end( stoke + 1 );
+                        }
+                        else {
+                            slice.slice( i ).start( 0 ).end( 1 );
+                        }
+                    }
+                    Carta::Lib::NdArray::RawViewInterface* rawView = image->getDataSlice( slice );
+                    if ( ! rawView ){
+                        qWarning() << "[SpectralCompanion] Could not read" << path;
+                        file.cancelWriting();
+                        return;
+                    }
+                    Carta::Lib::NdArray::PixelMask::SharedPtr mask = rawView->pixelMask();
+                    Carta::Lib::NdArray::Float view( rawView, true );
+
+                    // the view is ordered (channel, row, x) since the spectral axis comes
+                    // after y, the band is ordered (row, x, channel)
+                    auto bandIndex = [&] ( qint64 index ) -> size_t {
+                        qint64 x = index % cols;
+                        qint64 row = ( index / cols ) % rows;
+                        qint64 z = index / ( static_cast<qint64>( cols ) * rows );
+                        return static_cast<size_t>( ( row * cols + x ) * g.nz + z0 + z );
+                    };
+                    qint64 index = 0;
+                    view.forEach( view.DEFAULT_BLOCK_SIZE, [&] ( const float* vals, int64_t count ) {
+                        for ( int64_t k = 0; k < count; k++ ){
+                            band[bandIndex( index + k )] = vals[k];
+                        }
+                        index += count;
+                    });
+                    if ( mask ){
+                        for ( const auto& run : mask->runs( false ) ){
+                            for ( int64_t k = run.start; k < run.start + run.length; k++ ){
+                                band[bandIndex( k )] = NAN;
+                            }
+                        }
+                    }
+                }
+                // either whole rows or a part of a single row, contiguous in the file
+                file.write( reinterpret_cast<const char*>( band.data() ),
+                            static_cast<qint64>( rows ) * cols * pixelSpectrumBytes );
+            }
+        }
+    }
+
+    if ( ! file.commit() ){
+        qWarning() << "[SpectralCompanion] Could not write" << path << file.errorString();
+        return;
+    }
+    qDebug() << "[SpectralCompanion] Finished" << path;
+
+    // start using it if anybody still needs it
+    std::shared_ptr<SpectralCompanion> self = companion.lock();
+    if ( self ){
+        QMutexLocker locker( &registryMutex );
+        self->_open();
+    }
+}
+
+QString SpectralCompanion::_directory(){
+    QString directory;
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    if ( json.contains( "spectralCompanionDir" ) ){
+        directory = json["spectralCompanionDir"].toString();
+    }
+    directory.replace( "$(HOME)", QDir::homePath() );
+    return directory.trimmed();
+}
+
+qint64 SpectralCompanion::_maxBytes(){
+    int maxMB = DEFAULT_MAX_MB;
+    const QJsonObject& json = Globals::instance()->mainConfig()->json();
+    if ( json.contains( "spectralCompanionMB" ) ){
+        QString errorMsg;
+        int val = MainConfig::ParsedInfo::toInt( json["spectralCompanionMB"], errorMsg );
+        if ( errorMsg.isEmpty() && val >= 0 ){
+            maxMB = val;
+        }
+        else {
+            qWarning() << "[SpectralCompanion] Invalid setting spectralCompanionMB" << errorMsg;
+        }
+    }
+    return static_cast<qint64>( maxMB ) * 1024 * 1024;
+}
+
+void SpectralCompanion::_removeVersions( const QString& directory, const QString& fileHash,
+        const QString& keep ){
+    QFileInfoList files = QDir( directory ).entryInfoList( QStringList( fileHash + "-*" + SUFFIX ), QDir::Files );
+    for ( const QFileInfo& file : files ){
+        // a session may still read a mapped one, the mapping outlives the file name
+        if ( file.absoluteFilePath() != keep && QFile::remove( file.absoluteFilePath() ) ){
+            qDebug() << "[SpectralCompanion] Removed the outdated" << file.absoluteFilePath();
+        }
+    }
+}
+
+bool SpectralCompanion::_makeRoom( const QString& directory, qint64 bytes ){
+    qint64 maxBytes = _maxBytes();
+    if ( bytes > maxBytes ){
+        return false;
+    }
+    QFileInfoList files = QDir( directory ).entryInfoList( QStringList( QString( "*" ) + SUFFIX ),
+                                                           QDir::Files, QDir::Time | QDir::Reversed );
+    qint64 used = 0;
+    for ( const QFileInfo& file : files ){
+        used += file.size();
+    }
+    // least recently used first, the ones open in a session are kept
+    for ( const QFileInfo& file : files ){
+        if ( used + bytes <= maxBytes ){
+            break;
+        }
+        auto found = registry.find( file.absoluteFilePath() );
+        if ( found != registry.end() && ! found->second.expired() ){
+            continue;
+        }
+        if ( QFile::remove( file.absoluteFilePath() ) ){
+            qDebug() << "[SpectralCompanion] Evicted" << file.absoluteFilePath();
+            used -= file.size();
+        }
+    }
+    return used + bytes <= maxBytes;
+}
+
+SpectralCompanion::~SpectralCompanion(){
+    QMutexLocker locker( &registryMutex );
+    auto found = registry.find( m_path );
+    if ( found != registry.end() && found->second.expired() ){
+        registry.erase( found );
+    }
+}
+
+}
+}
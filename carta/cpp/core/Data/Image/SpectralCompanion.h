@@ -0,0 +1,119 @@
+/***
+ * On-disk copy of a cube stored spectral axis first, for fast spectral profiles.
+ */
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Carta {
+namespace Lib {
+namespace Image {
+class ImageInterface;
+}
+}
+
+namespace Data {
+
+/**
+ * A companion file of a cube in which the spectrum of every pixel is contiguous.
+ *
+ * Images are stored plane by plane, so reading one spectrum touches every channel
+ * plane on disk. The companion keeps the same pixels ordered (stokes, y, x, channel)
+ * so a cursor profile is a single contiguous read. It is generated once in the
+ * background, band by band of rows, into a cache directory and reused by later
+ * sessions as long as the image file is unchanged. Masked pixels are stored as NaN.
+ *
+ * Companions are only made when the main configuration names the directory
+ * (spectralCompanionDir). The files in it are kept below spectralCompanionMB by
+ * removing the least recently used ones, and the companions of earlier versions of
+ * an image are removed when a new one is generated.
+ */
+class SpectralCompanion {
+
+public:
+
+    /**
+     * Returns the companion of an image. An existing companion file is opened, or one
+     * is generated in the background. Sessions showing the same image share it.
+     * @param fileName - the path of the image.
+     * @param image - the image.
+     * @return - the companion or nullptr if the image has too few channels, has more
+     *      than one plane on other axes, already has fast access along the spectral
+     *      axis, the cache is disabled or the companion does not fit into it.
+     */
+    static std::shared_ptr<SpectralCompanion> create( const QString& fileName,
+            std::shared_ptr<Carta::Lib::Image::ImageInterface> image );
+
+    /**
+     * Returns true once the companion file is complete and can be read.
+     */
+    bool isReady() const;
+
+    /**
+     * Reads the spectrum of one pixel.
+     * @param x - the x-pixel-coordinate.
+     * @param y - the y-pixel-coordinate.
+     * @param stokeFrame - the stoke frame, 0 if the image has no stoke axis.
+     * @param spectrum - filled with one value per channel.
+     * @return - false if the companion is not ready yet or the pixel is outside the image.
+     */
+    bool readSpectrum( int x, int y, int stokeFrame, std::vector<float>& spectrum ) const;
+
+    ~SpectralCompanion();
+
+private:
+
+    /// Size of the cube, nz is the length of the spectral axis.
+    struct Geometry {
+        std::vector<int> dims;
+        int spectralIndex = -1;
+        int stokesIndex = -1;
+        int nx = 0;
+        int ny = 0;
+        int nz = 0;
+        int nStokes = 1;
+
+        qint64 dataBytes() const;
+    };
+
+    SpectralCompanion( const QString& path, const Geometry& geometry );
+
+    /// Maps a complete companion file; returns false if it is missing or stale.
+    bool _open();
+
+    /// Writes the companion file, stops early when the companion is no longer used.
+    static void _generate( std::weak_ptr<SpectralCompanion> companion,
+            std::shared_ptr<Carta::Lib::Image::ImageInterface> image,
+            const QString& path, const Geometry& geometry );
+
+    /// The cache directory from the main configuration, empty if disabled.
+    static QString _directory();
+
+    /// The size limit of all companion files from the main configuration.
+    static qint64 _maxBytes();
+
+    /// Removes the companions of an image file except the given one.
+    static void _removeVersions( const QString& directory, const QString& fileHash, const QString& keep );
+
+    /// Removes the least recently used companions that are not open until the given
+    /// number of bytes fits below the size limit; registryMutex must be held.
+    static bool _makeRoom( const QString& directory, qint64 bytes );
+
+    QString m_path;
+    Geometry m_geometry;
+    QFile m_file;
+    const float* m_data = nullptr;
+    std::atomic<bool> m_ready;
+
+    SpectralCompanion( const SpectralCompanion& other );
+    SpectralCompanion& operator=( const SpectralCompanion& other );
+};
+
+}
+}
@@ -0,0 +1,288 @@
+#include "Data/ImageHeaderReader.h"
+#include "Data/FitsHeaderExtractor.h"
+#include "Data/Image/ImageRegistry.h"
+#include "CartaLib/UtilCASA.h"
+
+#include <casacore/casa/Containers/Record.h>
+#include <casacore/casa/Exceptions/Error.h>
+#include <casacore/coordinates/Coordinates/CoordinateSystem.h>
+#include <casacore/fits/FITS/fits.h>
+#include <casacore/fits/FITS/FITSKeywordUtil.h>
+#include <casacore/images/Images/ImageInfo.h>
+#include <casacore/tables/Tables/ArrayColumn.h>
+#include <casacore/tables/Tables/Table.h>
+#include <casacore/tables/Tables/TableRecord.h>
+
+#include <QCache>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtCore/QDebug>
+#include <QRegExp>
+#include <algorithm>
+#include <memory>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+
+/// size of a FITS block and of a header card
+const int FITS_BLOCK = 2880;
+const int FITS_CARD = 80;
+
+/// primary headers longer than this are not worth parsing here
+const int MAX_HEADER_BLOCKS = 1000;
+
+/// headers by version of the file
+QMutex cacheMutex;
+QCache<QString, ImageHeaderReader::Header> cache( 1000 );
+
+/// value of a card, empty for cards without a value or with a syntax error
+QString _value( const QString& card ){
+    try {
+        return FitsLine( card ).value();
+    }
+    catch ( ... ){
+        return QString();
+    }
+}
+
+/// casacore writes PC001002 style keywords, FITS-WCS readers expect PC1_2
+QString _fixPcCard( const QString& card ){
+    QString key = card.left( 8 ).trimmed();
+    if ( !key.contains( QRegExp( "PC[0-9]{2}_[0-9]{2}" ) ) ){
+        return card;
+    }
+    QString newKey = QString( "PC%1_%2" ).arg( key.at( 3 ) ).arg( key.at( 6 ) );
+    QString value = _value( card );
+    return FitsLine::getline( newKey, value );
+}
+
+/// index of the axis whose CTYPE is STOKES, -1 if there is none
+int _stokesIndex( const QStringList& cards, int naxis ){
+    for ( const QString& card : cards ){
+        QString key = card.left( 8 ).trimmed();
+        if ( key.startsWith( "CTYPE" ) && _value( card ).toUpper().startsWith( "STOKES" ) ){
+            bool ok = false;
+            int axis = key.mid( 5 ).toInt( &ok );
+            if ( ok && 1 <= axis && axis <= naxis ){
+                return axis - 1;
+            }
+        }
+    }
+    return -1;
+}
+}
+
+bool ImageHeaderReader::read( const QString& fileName, Header* header ){
+    QString key = ImageRegistry::versionKey( fileName );
+    {
+        QMutexLocker locker( &cacheMutex );
+        Header* cached = cache.object( key );
+        if ( cached ){
+            *header = *cached;
+            return true;
+        }
+    }
+
+    Header result;
+    bool valid = QFileInfo( fileName ).isDir() ? _readCasa( fileName, &result )
+                                               : _readFits( fileName, &result );
+    if ( !valid ){
+        return false;
+    }
+
+    QMutexLocker locker( &cacheMutex );
+    cache.insert( key, new Header( result ) );
+    *header = result;
+    return true;
+}
+
+bool ImageHeaderReader::_readFits( const QString& fileName, Header* header ){
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly ) ){
+        return false;
+    }
+
+    // cards of the primary header, up to END
+    QStringList cards;
+    bool ended = false;
+    for ( int blockIndex = 0; blockIndex < MAX_HEADER_BLOCKS && !ended; blockIndex++ ){
+        QByteArray block = file.read( FITS_BLOCK );
+        if ( block.size() != FITS_BLOCK ){
+            return false;
+        }
+        for ( int offset = 0; offset < FITS_BLOCK; offset += FITS_CARD ){
+            QString card = QString::fromLatin1( block.constData() + offset, FITS_CARD );
+            if ( blockIndex == 0 && offset == 0 &&
+                    ( !card.startsWith( "SIMPLE  =" ) || _value( card ) != "T" ) ){
+                // not FITS, or compressed
+                return false;
+            }
+            QString key = card.left( 8 ).trimmed();
+            if ( key == "END" ){
+                ended = true;
+                break;
+            }
+            cards.append( card );
+        }
+    }
+    if ( !ended ){
+        return false;
+    }
+
+    // the axes, images in extensions are left to the loaders
+    int naxis = 0;
+    std::vector<int> dims;
+    for ( const QString& card : cards ){
+        QString key = card.left( 8 ).trimmed();
+        if ( key == "NAXIS" ){
+            naxis = _value( card ).toInt();
+            dims.assign( std::max( naxis, 0 ), 0 );
+        }
+        else if ( key.startsWith( "NAXIS" ) ){
+            bool ok = false;
+            int axis = key.mid( 5 ).toInt( &ok );
+            if ( ok && 1 <= axis && axis <= naxis ){
+                dims[axis - 1] = _value( card ).toInt();
+            }
+        }
+    }
+    if ( naxis < 2 ){
+        return false;
+    }
+    for ( int dim : dims ){
+        if ( dim <= 0 ){
+            return false;
+        }
+    }
+
+    header->fits = true;
+    header->dims = dims;
+    header->stokesIndex = _stokesIndex( cards, naxis );
+    // the same cards the file information shows for headers made by casacore,
+    // without the ones it could not parse
+    for ( const QString& card : cards ){
+        QString key = card.left( 8 ).trimmed();
+        if ( key.isEmpty() || key == "HISTORY" || key == "COMMENT" || key == "ORIGIN" ){
+            continue;
+        }
+        try {
+            FitsLine line( card );
+            header->cards.append( card );
+        }
+        catch ( ... ){
+            qDebug() << "[ImageHeaderReader] Skipped card" << card.trimmed() << "in" << fileName;
+        }
+    }
+    header->cards.append( QString( "END" ).leftJustified( FITS_CARD, ' ' ) );
+    return true;
+}
+
+bool ImageHeaderReader::_readCasa( const QString& fileName, Header* header ){
+    if ( !QFileInfo( QDir( fileName ).filePath( "table.dat" ) ).exists() ){
+        return false;
+    }
+
+    QMutexLocker locker( &casa_mutex );
+    try {
+        // only the table and its keywords are read, not the pixels
+        casacore::Table table( fileName.toStdString(), casacore::Table::Old );
+        const casacore::TableDesc& desc = table.tableDesc();
+        if ( !desc.isColumn( "map" ) || desc.columnDesc( "map" ).dataType() != casacore::TpFloat ||
+                table.nrow() < 1 ){
+            return false;
+        }
+        const casacore::TableRecord& keywords = table.keywordSet();
+        if ( !keywords.isDefined( "coords" ) ){
+            return false;
+        }
+        casacore::IPosition shape = casacore::ROArrayColumn<casacore::Float>( table, "map" ).shape( 0 );
+        std::unique_ptr<casacore::CoordinateSystem> coords(
+                casacore::CoordinateSystem::restore( keywords, "coords" ) );
+        if ( !coords || coords->nPixelAxes() != shape.nelements() || shape.nelements() < 2 ){
+            return false;
+        }
+
+        // the header the file information got from casacore's image to FITS conversion
+        casacore::Record coordRecord;
+        casacore::IPosition fitsShape = shape;
+        if ( !coords->toFITSHeader( coordRecord, fitsShape, true, 'c', true, true, false ) ){
+            return false;
+        }
+        casacore::Vector<casacore::Int> naxis( fitsShape.nelements() );
+        for ( size_t i = 0; i < fitsShape.nelements(); i++ ){
+            naxis[i] = fitsShape[i];
+        }
+        casacore::Record fitsRecord;
+        fitsRecord.define( "bitpix", -32 );
+        fitsRecord.define( "naxis", naxis );
+        casacore::String error;
+        if ( keywords.isDefined( "imageinfo" ) ){
+            casacore::ImageInfo info;
+            if ( info.fromRecord( error, keywords.asRecord( "imageinfo" ) ) ){
+                info.toFITS( error, fitsRecord );
+            }
+        }
+        if ( keywords.isDefined( "units" ) ){
+            fitsRecord.define( "bunit", keywords.asString( "units" ) );
+        }
+        fitsRecord.merge( coordRecord, casacore::RecordInterface::SkipDuplicates );
+
+        casacore::FitsKeywordList keywordList = casacore::FITSKeywordUtil::makeKeywordList();
+        if ( !casacore::FITSKeywordUtil::addKeywords( keywordList, fitsRecord ) ){
+            return false;
+        }
+        keywordList.end();
+
+        // the translator fills buffers of 2880 bytes
+        casacore::FitsKeyCardTranslator translator;
+        QByteArray buffer( FITS_BLOCK, ' ' );
+        QStringList cards;
+        bool ended = false;
+        keywordList.first();
+        keywordList.next();
+        while ( !ended ){
+            bool more = translator.build( buffer.data(), keywordList );
+            for ( int offset = 0; offset < FITS_BLOCK; offset += FITS_CARD ){
+                QString card = QString::fromLatin1( buffer.constData() + offset, FITS_CARD );
+                QString key = card.left( 8 ).trimmed();
+                if ( key == "END" ){
+                    ended = true;
+                    break;
+                }
+                if ( !key.isEmpty() && key != "HISTORY" && key != "COMMENT" && key != "ORIGIN" ){
+                    cards.append( _fixPcCard( card ) );
+                }
+            }
+            if ( !more ){
+                break;
+            }
+        }
+        cards.append( QString( "END" ).leftJustified( FITS_CARD, ' ' ) );
+
+        header->fits = false;
+        header->dims.clear();
+        for ( size_t i = 0; i < shape.nelements(); i++ ){
+            header->dims.push_back( shape[i] );
+        }
+        header->stokesIndex = -1;
+        int stokesCoord = coords->findCoordinate( casacore::Coordinate::STOKES );
+        if ( stokesCoord >= 0 ){
+            header->stokesIndex = coords->pixelAxes( stokesCoord )[0];
+        }
+        header->cards = cards;
+    }
+    catch ( const casacore::AipsError& err ){
+        qDebug() << "[ImageHeaderReader] Could not read" << fileName << err.getMesg().c_str();
+        return false;
+    }
+    return true;
+}
+
+}
+}
@@ -0,0 +1,64 @@
+/***
+ * Reads the header of an image file without loading the image.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+namespace Carta {
+
+namespace Data {
+
+/**
+ * Lightweight metadata reader for the file information of the file browser.
+ *
+ * Opening an image through a loader plugin builds its coordinate system and data
+ * access, which is wasted work when the user is only clicking through a directory.
+ * This reads the primary header blocks of FITS files and the keywords of the table
+ * of casa images (without opening the pixel lattice) instead. Results are cached by
+ * the version of the file (path, size and modification time), so asking again for
+ * an unchanged file doesn't touch the disk beyond a stat.
+ */
+class ImageHeaderReader {
+
+public:
+
+    /// What is known about an image from its header alone.
+    struct Header {
+        /// true for FITS files, false for casa images
+        bool fits = false;
+        /// length of every axis, in the order of the file
+        std::vector<int> dims;
+        /// index of the stokes axis, -1 if there is none
+        int stokesIndex = -1;
+        /// the header cards, 80 characters each, ending with END
+        QStringList cards;
+    };
+
+    /**
+     * Reads the header of an image.
+     * @param fileName - the path of the image.
+     * @param header - filled with the header.
+     * @return - false if the file is not a FITS file with an image in its primary
+     *      header unit or a casa paged image, the caller has to load the image then.
+     */
+    static bool read( const QString& fileName, Header* header );
+
+private:
+
+    /// Parses the primary header of a FITS file.
+    static bool _readFits( const QString& fileName, Header* header );
+
+    /// Reads the keywords of the table of a casa image.
+    static bool _readCasa( const QString& fileName, Header* header );
+
+    ImageHeaderReader();
+    ImageHeaderReader( const ImageHeaderReader& other );
+    ImageHeaderReader& operator=( const ImageHeaderReader& other );
+};
+
+}
+}
@@ -19,6 +19,7 @@
 #include <QJsonParseError>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <algorithm>
 
 namespace Internal
 {
@@ -213,6 +214,15 @@ PluginManager::loadPlugins()
             }
             qDebug() << "Plugin initialized";
         }
+
+        // plugins with higher priority handle hooks first, otherwise keep
+        // the loading order
+        for ( auto & entry : m_hook2plugin ) {
+            std::stable_sort( entry.second.begin(), entry.second.end(),
+                              [] ( const PluginInfo * a, const PluginInfo * b ) {
+                                  return a-> json.priority > b-> json.priority;
+                              } );
+        }
     }
 } // loadPlugins
 
@@ -333,6 +343,7 @@ PluginManager::parsePluginDir( const QString & dirName )
         info.json.description = json["description"].toString();
     }
     info.json.about = json["about"].toString();
+    info.json.priority = json["priority"].toInt( 0 );
     if ( ! json["depends"].isArray() ) {
         info.errors << "...'depends' must be an array of strings in plugin.json";
         info.errors << QJsonDocument( json ).toJson();
@@ -32,11 +32,23 @@ HEADERS += \
     Data/Image/Layer.h \
     Data/Image/LayerData.h \
     Data/Image/DataSource.h \
+    Data/Image/BandwidthAdapter.h \
+    Data/Image/ChannelPrefetcher.h \
+    Data/Image/ImageRegistry.h \
+    Data/Image/MipPyramid.h \
+    Data/Image/RasterTileCache.h \
+    Data/Image/ProgressiveRaster.h \
+    Data/Image/RasterEncodePool.h \
+    Data/Image/RasterCodec.h \
+    Data/Image/SpectralCompanion.h \
     Data/Util.h \
     Data/ViewManager.h \
     Data/ViewPlugins.h \
     Data/FitsHeaderExtractor.h \
+    Data/ImageHeaderReader.h \
     Algorithms/percentileAlgorithms.h \
+    Algorithms/downsampleAlgorithms.h \
+    Algorithms/compressionAlgorithms.h \
     coreMain.h
 
 SOURCES += \
@@ -57,6 +69,15 @@ SOURCES += \
     Data/Image/LayerGroup.cpp \
     Data/Image/Stack.cpp \
     Data/Image/DataSource.cpp \
+    Data/Image/BandwidthAdapter.cpp \
+    Data/Image/ChannelPrefetcher.cpp \
+    Data/Image/ImageRegistry.cpp \
+    Data/Image/MipPyramid.cpp \
+    Data/Image/RasterTileCache.cpp \
+    Data/Image/ProgressiveRaster.cpp \
+    Data/Image/RasterEncodePool.cpp \
+    Data/Image/RasterCodec.cpp \
+    Data/Image/SpectralCompanion.cpp \
     Data/DataLoader.cpp \
     Data/Error/ErrorReport.cpp \
     Data/Error/ErrorManager.cpp \
@@ -64,7 +85,10 @@ SOURCES += \
     Data/ViewManager.cpp \
     Data/ViewPlugins.cpp \
     Data/FitsHeaderExtractor.cpp \
+    Data/ImageHeaderReader.cpp \
     Algorithms/percentileAlgorithms.cpp \
+    Algorithms/downsampleAlgorithms.cpp \
+    Algorithms/compressionAlgorithms.cpp \
     coreMain.cpp
 
 #message( "common            PWD=$$PWD")
@@ -13,6 +13,7 @@
 #include "core/Globals.h"
 #include <QDebug>
 #include "CartaLib/Hooks/Initialize.h"
+#include "CartaLib/MemoryBudget.h"
 #include <QDir>
 #include <QTime>
 
@@ -107,6 +108,18 @@ coreMainCPP( QString platformString, int argc, char * * argv )
     QString configFilePath = cmdLineInfo.configFilePath();
     MainConfig::ParsedInfo mainConfig = MainConfig::parse( configFilePath );
     globals.setMainConfig( & mainConfig );
+
+    // memory budget for image data shared by all sessions, 0 means unlimited
+    if ( mainConfig.json().contains( "memoryBudgetMB" ) ) {
+        QString errorMsg;
+        int memoryMB = MainConfig::ParsedInfo::toInt( mainConfig.json()["memoryBudgetMB"], errorMsg );
+        if ( errorMsg.isEmpty() && memoryMB >= 0 ) {
+            Carta::Lib::MemoryBudget::instance().setMaxBytes( static_cast < qint64 > ( memoryMB ) * 1024 * 1024 );
+        }
+        else {
+            qWarning() << "Invalid memoryBudgetMB" << errorMsg;
+        }
+    }
     qDebug() << "plugin directories:\n - " + mainConfig.pluginDirectories().join( "\n - " );
 
     // initialize plugin manager
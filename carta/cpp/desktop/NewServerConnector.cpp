@@ -18,10 +18,26 @@
 NewServerConnector::NewServerConnector()
 {
     m_callbackNextId = 0;
+    m_prefetcher.reset(new Carta::Data::ChannelPrefetcher(Carta::Data::ChannelPrefetcher::configuredSettings()));
+    m_progressive.reset(new Carta::Data::ProgressiveRaster(Carta::Data::ProgressiveRaster::configuredSettings()));
+    m_bandwidth = std::make_shared<Carta::Data::BandwidthAdapter>(Carta::Data::BandwidthAdapter::configuredSettings());
+    m_coalescer = std::make_shared<RequestCoalescer>();
 }
 
 NewServerConnector::~NewServerConnector()
 {
+    // the refinements may still use the prefetcher
+    m_progressive.reset();
+}
+
+std::shared_ptr<Carta::Data::BandwidthAdapter> NewServerConnector::bandwidthAdapter() const
+{
+    return m_bandwidth;
+}
+
+std::shared_ptr<RequestCoalescer> NewServerConnector::requestCoalescer() const
+{
+    return m_coalescer;
 }
 
 void NewServerConnector::initialize(const InitializeCallback & cb)
@@ -148,6 +164,10 @@ void NewServerConnector::onBinaryMessageSignalSlot(const char *message, size_t l
         closeFile.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
         int closeFileId = closeFile.file_id();
         qDebug() << "[NewServerConnector] Close the file id=" << closeFileId;
+        m_progressive->cancel(closeFileId);
+        m_prefetcher->clear(closeFileId);
+        m_sentTiles.erase(closeFileId);
+        m_sentTileView.erase(closeFileId);
 
     } else {
         // Insert non-global object id
@@ -286,25 +306,48 @@ void NewServerConnector::openFileSignalSlot(uint32_t eventId, QString fileDir, Q
 
     // set image changed is true
     m_changeFrame[fileId] = true;
+
+    // the file id may have been used by another image before
+    m_progressive->cancel(fileId);
+    m_prefetcher->clear(fileId);
+    m_sentTiles.erase(fileId);
+    m_sentTileView.erase(fileId);
 }
 
 void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
     bool isZFP, int precision, int numSubsets) {
     QString respName = "RASTER_IMAGE_DATA";
 
+    // skip the view if a newer one is queued, and give up computing it once one arrives
+    Carta::Lib::Cancellation::Token cancellation = m_coalescer->take("SET_IMAGE_VIEW", fileId);
+    if (!cancellation) {
+        return;
+    }
+    Carta::Lib::Cancellation::Scope cancellationScope(cancellation);
+
+    // the raster encoding of this session shares the encoding pool fairly with the others
+    Carta::Data::RasterEncodePool::Session encodeSession(this);
+
     // check if the boundaries are valid
     if (xMin > xMax || yMin > yMax) {
         qWarning() << "[NewServerConnector] Invalid image bound [xMin, xMax, yMin, yMax]: [" << xMin << ", " << xMax << ", " << yMin << ", " << yMax << "]";
         return;
     }
 
+    // a repetition of a view that was cancelled is not ignored
+    bool interrupted = m_interrupted.erase(std::make_pair(QString("SET_IMAGE_VIEW"), fileId)) > 0;
+
     // check if need to reset image bounds
     if (xMin != m_imageBounds[fileId][0] || xMax != m_imageBounds[fileId][1] ||
         yMin != m_imageBounds[fileId][2] || yMax != m_imageBounds[fileId][3] ||
         mip != m_imageBounds[fileId][4]) {
         // update image viewer bounds with respect to the fileId
         m_imageBounds[fileId] = {xMin, xMax, yMin, yMax, mip};
-    } else { // Frontend image viewer signal is repeated, just ignore the signal
+
+        // channels prepared for the old bounds are useless now, and so is the refinement of the old view
+        m_progressive->cancel(fileId);
+        m_prefetcher->clear(fileId);
+    } else if (!interrupted) { // Frontend image viewer signal is repeated, just ignore the signal
         return;
     }
 
@@ -314,6 +357,12 @@ void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, in
         m_ZFPSet[fileId] = {precision, numSubsets};
     }
 
+    // only the tiles that came into view are sent in tiled mode
+    if (Carta::Data::RasterTileCache::tileSize() > 0) {
+        _sendRasterTiles(eventId, fileId);
+        return;
+    }
+
     // get the controller
     Carta::Data::Controller* controller = _getController();
 
@@ -331,24 +380,129 @@ void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, in
     // do not include unit converter for pixel values
     Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
 
+    // large views are sent as a quick preview first, then at the requested mip and precision
+    Carta::Data::ChannelPrefetcher::RasterView rasterView;
+    rasterView.xMin = xMin;
+    rasterView.xMax = xMax;
+    rasterView.yMin = yMin;
+    rasterView.yMax = yMax;
+    rasterView.mip = mip;
+    rasterView.stokeFrame = stokeFrame;
+    rasterView.isZFP = isZFP;
+    rasterView.precision = precision;
+    rasterView.numSubsets = numSubsets;
+    rasterView.regionId = regionId;
+    rasterView.numberOfBins = numberOfBins;
+    rasterView.converter = converter;
+
+    // the precision, codec and mip that fit the connection, the message reports the ones used
+    m_bandwidth->adapt(rasterView);
+
+    std::shared_ptr<Carta::Data::DataSource> dataSource = controller->getDataSource();
+    if (dataSource && m_progressive->isProgressive(rasterView)) {
+        PBMSharedPtr preview = m_progressive->getPreview(fileId, dataSource, rasterView, frameLow, m_changeFrame[fileId]);
+        if (preview) {
+            sendSerializedMessage(respName, eventId, preview);
+            m_progressive->refine(fileId, [dataSource, rasterView, fileId, frameLow]() {
+                return Carta::Data::ProgressiveRaster::getRefinement(fileId, dataSource, rasterView, frameLow);
+            }, this, [this, respName, eventId](PBMSharedPtr raster) {
+                sendSerializedMessage(respName, eventId, raster);
+            });
+            return;
+        }
+    }
+
     // get the down sampling raster image raw data
-    PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
+    PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, rasterView.mip,
                                                          frameLow, frameHigh, stokeFrame,
-                                                         isZFP, precision, numSubsets,
+                                                         rasterView.isZFP, rasterView.precision, numSubsets,
                                                          m_changeFrame[fileId], regionId, numberOfBins, converter);
 
+    // the newer view is answered instead
+    if (!raster && Carta::Lib::Cancellation::isCancelled(cancellation)) {
+        m_interrupted.insert(std::make_pair(QString("SET_IMAGE_VIEW"), fileId));
+        return;
+    }
+
     // send the serialized message to the frontend
     sendSerializedMessage(respName, eventId, raster);
 }
 
+void NewServerConnector::_sendRasterTiles(uint32_t eventId, int fileId) {
+    QString respName = "RASTER_IMAGE_DATA";
+
+    // get the controller
+    Carta::Data::Controller* controller = _getController();
+
+    // set the file id as the private parameter in the Stack object
+    controller->setFileId(fileId);
+
+    std::shared_ptr<Carta::Data::DataSource> dataSource = controller->getDataSource();
+    std::vector<int> dims = controller->getImageDimensions();
+    if (!dataSource || dims.size() < 2) {
+        qWarning() << "[NewServerConnector] No image for the raster tiles of fileId=" << fileId;
+        return;
+    }
+
+    Carta::Data::RasterTileCache::TileView view;
+    view.mip = m_imageBounds[fileId][4];
+    view.channel = m_currentChannel[fileId][0];
+    view.stokeFrame = m_currentChannel[fileId][1];
+    view.isZFP = m_isZFP[fileId];
+    view.precision = m_ZFPSet[fileId][0];
+
+    // the frontend replaces its tiles when the plane or the compression changes
+    auto sentView = m_sentTileView.find(fileId);
+    if (sentView == m_sentTileView.end() || sentView->second != view) {
+        m_sentTileView[fileId] = view;
+        m_sentTiles[fileId].clear();
+    }
+
+    std::vector<Carta::Data::RasterTileCache::TileIndex> newTiles;
+    std::set<Carta::Data::RasterTileCache::TileIndex>& sentTiles = m_sentTiles[fileId];
+    for (const auto& tile : Carta::Data::RasterTileCache::tilesCovering(m_imageBounds[fileId][0], m_imageBounds[fileId][1],
+                                                                       m_imageBounds[fileId][2], m_imageBounds[fileId][3],
+                                                                       view.mip, dims[0], dims[1])) {
+        if (sentTiles.count(tile) == 0) {
+            newTiles.push_back(tile);
+        }
+    }
+    qDebug() << "[NewServerConnector] Send" << newTiles.size() << "raster tiles, fileId=" << fileId;
+
+    // only the tiles that were computed count as sent, the others are tried again with
+    // the next view
+    auto rasters = Carta::Data::RasterTileCache::getTiles(fileId, dataSource, view, newTiles,
+                                                          m_changeFrame[fileId], numberOfBins);
+    for (const auto& raster : rasters) {
+        sentTiles.insert(raster.first);
+        sendSerializedMessage(respName, eventId, raster.second);
+    }
+}
+
 void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int fileId, int channel, int stoke) {
     QString respName = "RASTER_IMAGE_DATA";
 
+    // skip the channel if a newer one is queued, and give up computing it once one arrives
+    Carta::Lib::Cancellation::Token cancellation = m_coalescer->take("SET_IMAGE_CHANNELS", fileId);
+    if (!cancellation) {
+        return;
+    }
+    Carta::Lib::Cancellation::Scope cancellationScope(cancellation);
+
+    // the raster encoding of this session shares the encoding pool fairly with the others
+    Carta::Data::RasterEncodePool::Session encodeSession(this);
+
+    // a repetition of a channel that was cancelled is not ignored
+    bool interrupted = m_interrupted.erase(std::make_pair(QString("SET_IMAGE_CHANNELS"), fileId)) > 0;
+
     if (m_currentChannel[fileId][0] != channel || m_currentChannel[fileId][1] != stoke) {
         //qDebug() << "[NewServerConnector] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
         // update the current channel and stoke
         m_currentChannel[fileId] = {channel, stoke};
-    } else {
+
+        // the refinement of the previous channel must not overwrite this one
+        m_progressive->cancel(fileId);
+    } else if (!interrupted) {
         //qDebug() << "[NewServerConnector] Internal signal is repeated!! Don't know the reason yet, just ignore the signal!!";
         return;
     }
@@ -357,6 +511,14 @@ void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int file
     //m_calHistRange[fileId] = {0, m_lastFrame[fileId], 0};
     //m_calHistRange[fileId] = {channel, channel, stoke};
 
+    // the tiles of the new channel, with its histogram, in tiled mode
+    if (Carta::Data::RasterTileCache::tileSize() > 0) {
+        m_changeFrame[fileId] = true;
+        _sendRasterTiles(eventId, fileId);
+        m_changeFrame[fileId] = false;
+        return;
+    }
+
     // get the controller
     Carta::Data::Controller* controller = _getController();
 
@@ -365,7 +527,6 @@ void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int file
 
     // set the current channel
     int frameLow = m_currentChannel[fileId][0];
-    int frameHigh = frameLow;
     int stokeFrame = m_currentChannel[fileId][1];
 
     // If the histograms correspond to the entire current 2D image, the region ID has a value of -1.
@@ -388,11 +549,56 @@ void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int file
     int precision = m_ZFPSet[fileId][0];
     int numSubsets = m_ZFPSet[fileId][1];
 
-    // use image bounds with respect to the fileID and get the down sampling raster image raw data
-    PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
-                                                         frameLow, frameHigh, stokeFrame,
-                                                         isZFP, precision, numSubsets,
-                                                         m_changeFrame[fileId], regionId, numberOfBins, converter);
+    Carta::Data::ChannelPrefetcher::RasterView rasterView;
+    rasterView.xMin = xMin;
+    rasterView.xMax = xMax;
+    rasterView.yMin = yMin;
+    rasterView.yMax = yMax;
+    rasterView.mip = mip;
+    rasterView.stokeFrame = stokeFrame;
+    rasterView.isZFP = isZFP;
+    rasterView.precision = precision;
+    rasterView.numSubsets = numSubsets;
+    rasterView.regionId = regionId;
+    rasterView.numberOfBins = numberOfBins;
+    rasterView.converter = converter;
+
+    // the precision, codec and mip that fit the connection, the message reports the ones used
+    m_bandwidth->adapt(rasterView);
+
+    // a large channel that is not prepared yet is sent as a quick preview first, the
+    // prefetcher computes the refinement and keeps track of the stepping meanwhile
+    std::shared_ptr<Carta::Data::DataSource> dataSource = controller->getDataSource();
+    int frameCount = m_lastFrame[fileId] + 1;
+    if (dataSource && m_progressive->isProgressive(rasterView) &&
+        !m_prefetcher->isPrepared(fileId, rasterView, frameLow)) {
+        PBMSharedPtr preview = m_progressive->getPreview(fileId, dataSource, rasterView, frameLow, m_changeFrame[fileId]);
+        if (preview) {
+            sendSerializedMessage(respName, eventId, preview);
+            Carta::Data::ChannelPrefetcher* prefetcher = m_prefetcher.get();
+            m_progressive->refine(fileId, [prefetcher, dataSource, rasterView, fileId, frameLow, frameCount]() {
+                // the histogram came with the preview, and the worker must not compute it
+                return prefetcher->getRasterImageData(fileId, dataSource, rasterView, frameLow, frameCount, false);
+            }, this, [this, respName, eventId](PBMSharedPtr raster) {
+                sendSerializedMessage(respName, eventId, raster);
+            });
+            return;
+        }
+    }
+
+    // use image bounds with respect to the fileID and get the down sampling raster image raw data,
+    // served from the prefetched channels if this step was predicted (the histogram is added here)
+    PBMSharedPtr raster = m_prefetcher->getRasterImageData(fileId, dataSource, rasterView,
+                                                           frameLow, frameCount, m_changeFrame[fileId]);
+    if (raster) {
+        m_changeFrame[fileId] = false;
+    }
+
+    // the newer channel is answered instead
+    if (!raster && Carta::Lib::Cancellation::isCancelled(cancellation)) {
+        m_interrupted.insert(std::make_pair(QString("SET_IMAGE_CHANNELS"), fileId));
+        return;
+    }
 
     // send the serialized message to the frontend
     sendSerializedMessage(respName, eventId, raster);
@@ -401,6 +607,13 @@ void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int file
 void NewServerConnector::setCursorSignalSlot(uint32_t eventId, int fileId, CARTA::Point point, CARTA::SetSpatialRequirements setSpatialReqs) {
     qDebug() << "[NewServerConnector] set cursor file id=" << fileId;
 
+    // only the latest cursor position matters
+    Carta::Lib::Cancellation::Token cancellation = m_coalescer->take("SET_CURSOR", fileId);
+    if (!cancellation) {
+        return;
+    }
+    Carta::Lib::Cancellation::Scope cancellationScope(cancellation);
+
     // Part 1: Caculate spatial profile data
     // get the controller
     Carta::Data::Controller* controller = _getController();
@@ -432,6 +645,9 @@ void NewServerConnector::setCursorSignalSlot(uint32_t eventId, int fileId, CARTA
     if(0 <= spectralIndicator && 1 < dims[spectralIndicator]) {
         // get spectral profile
         pbMsg = controller->getSpectralProfile(fileId, x, y, stokeFrame);
+        if (!pbMsg && Carta::Lib::Cancellation::isCancelled(cancellation)) {
+            return;
+        }
 
         // send the serialized message to the frontend
         sendSerializedMessage("SPECTRAL_PROFILE_DATA", eventId, pbMsg);
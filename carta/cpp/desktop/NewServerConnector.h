@@ -8,6 +8,7 @@
 #include <QObject>
 #include <QList>
 #include <QByteArray>
+#include <set>
 
 #include "CartaLib/IPercentileCalculator.h"
 
@@ -20,6 +21,12 @@
 #include "core/Data/ViewManager.h"
 #include "core/Data/Image/Controller.h"
 #include "core/Data/Image/DataSource.h"
+#include "core/Data/Image/BandwidthAdapter.h"
+#include "core/Data/Image/ChannelPrefetcher.h"
+#include "core/Data/Image/ProgressiveRaster.h"
+#include "core/Data/Image/RasterEncodePool.h"
+#include "core/Data/Image/RasterTileCache.h"
+#include "RequestCoalescer.h"
 
 #include "CartaLib/Proto/open_file.pb.h"
 #include "CartaLib/Proto/set_image_view.pb.h"
@@ -59,6 +66,12 @@ public:
     Viewer viewer;
     QThread *selfThread; //not really use now, may take effect later
 
+    /// the measurements of the connection, fed by the session dispatcher
+    std::shared_ptr<Carta::Data::BandwidthAdapter> bandwidthAdapter() const;
+
+    /// the queued requests that newer ones make useless, reported by the session dispatcher
+    std::shared_ptr<RequestCoalescer> requestCoalescer() const;
+
 public slots:
 
     void startViewerSlot(const QString & sessionID);
@@ -127,6 +140,9 @@ protected:
 
     Carta::Data::Controller* _getController();
 
+    /// send the tiles of the current view the frontend doesn't have yet (tiled raster data)
+    void _sendRasterTiles(uint32_t eventId, int fileId);
+
 private:
 
     std::map<int, std::vector<int> > m_imageBounds; // m_imageBounds[fileId] = {x_min, x_max, y_min, y_max, mip}
@@ -136,7 +152,14 @@ private:
     //std::map<int, std::vector<int> > m_calHistRange; // m_calHistRange[fileId] = {frameLow, frameHigh, stokeFrame}
     std::map<int, int> m_lastFrame; // m_lastFrame[fileId] = lastFrame (for the spectral axis)
     std::map<int, bool> m_changeFrame;
+    std::unique_ptr<Carta::Data::ChannelPrefetcher> m_prefetcher; // prepares the next channels while stepping through a cube
+    std::unique_ptr<Carta::Data::ProgressiveRaster> m_progressive; // previews and refinements of large raster images, may use m_prefetcher
+    std::shared_ptr<Carta::Data::BandwidthAdapter> m_bandwidth; // fits the raster images to the speed of the connection
+    std::shared_ptr<RequestCoalescer> m_coalescer; // skips and cancels superseded view, channel and cursor requests
+    std::set<std::pair<QString, int> > m_interrupted; // {eventName, fileId} of requests cancelled before they were answered
     const int numberOfBins = 10000; // define number of bins for calculating pixels to histogram data
+    std::map<int, Carta::Data::RasterTileCache::TileView> m_sentTileView; // the plane of the tiles sent for each fileId
+    std::map<int, std::set<Carta::Data::RasterTileCache::TileIndex> > m_sentTiles; // tiles the frontend has of that plane
 };
 
 
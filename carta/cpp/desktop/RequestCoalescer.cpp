@@ -0,0 +1,39 @@
+/**
+ *
+ **/
+
+#include "RequestCoalescer.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+void RequestCoalescer::queued(const QString & eventName, int fileId) {
+    QMutexLocker locker(&m_mutex);
+    Entry& entry = m_entries[std::make_pair(eventName, fileId)];
+    entry.pending++;
+    // the request being answered, if any, is outdated now
+    if (entry.running) {
+        entry.running->store(true);
+    }
+}
+
+Carta::Lib::Cancellation::Token RequestCoalescer::take(const QString & eventName, int fileId) {
+    QMutexLocker locker(&m_mutex);
+    Entry& entry = m_entries[std::make_pair(eventName, fileId)];
+    if (entry.pending > 0) {
+        entry.pending--;
+    }
+    if (entry.pending > 0) {
+        m_skipped++;
+        qDebug() << "[RequestCoalescer] Skip" << eventName << "of fileId=" << fileId << "," << entry.pending
+                 << "newer queued," << m_skipped << "skipped in total";
+        return nullptr;
+    }
+    entry.running = Carta::Lib::Cancellation::make();
+    return entry.running;
+}
+
+int RequestCoalescer::skipped() const {
+    QMutexLocker locker(&m_mutex);
+    return m_skipped;
+}
@@ -0,0 +1,63 @@
+/**
+ *
+ **/
+
+#ifndef REQUEST_COALESCER_H
+#define REQUEST_COALESCER_H
+
+#include <QMutex>
+#include <QString>
+#include <map>
+#include <utility>
+
+#include "CartaLib/Cancellation.h"
+
+/**
+ * Drops the requests of a session that a newer one of the same kind makes useless.
+ *
+ * The dispatcher reports every coalesced request (e.g. SET_IMAGE_VIEW) before it queues
+ * it on the session thread, and the session thread takes it when it starts working on
+ * it. Only the newest queued request of each event name and file id is answered, the
+ * older ones are skipped, and a newer request cancels the token of the one that is
+ * being computed. Queued signals of a session are delivered in order, so counting them
+ * is enough to know which one is the newest.
+ */
+class RequestCoalescer
+{
+public:
+
+    /**
+     * Records a request handed to the session thread and cancels the one of the same
+     * kind that is being answered.
+     * @param eventName - the name of the event.
+     * @param fileId - the file id of the image.
+     */
+    void queued(const QString & eventName, int fileId);
+
+    /**
+     * Takes a request off the queue on the session thread.
+     * @param eventName - the name of the event.
+     * @param fileId - the file id of the image.
+     * @return - the cancellation token of the request, nullptr if a newer request of the
+     *      same kind is queued and this one should be skipped.
+     */
+    Carta::Lib::Cancellation::Token take(const QString & eventName, int fileId);
+
+    /// Returns the number of requests skipped so far.
+    int skipped() const;
+
+private:
+
+    struct Entry {
+        /// requests queued but not taken yet
+        int pending = 0;
+        /// token of the request taken last
+        Carta::Lib::Cancellation::Token running;
+    };
+
+    mutable QMutex m_mutex;
+    std::map<std::pair<QString, int>, Entry> m_entries;
+    int m_skipped = 0;
+};
+
+#endif // REQUEST_COALESCER_H
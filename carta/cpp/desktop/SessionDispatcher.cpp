@@ -27,6 +27,12 @@
 
 #include "Globals.h"
 #include "core/CmdLine.h"
+#include "CartaLib/BufferPool.h"
+
+namespace {
+/// milliseconds between the pings of a connection
+const int PING_INTERVAL = 5000;
+}
 
 void SessionDispatcher::startWebSocket(){
 
@@ -48,10 +54,16 @@ void SessionDispatcher::startWebSocket(){
     }
 
     connect(m_pWebSocketServer, &QWebSocketServer::newConnection, this, &SessionDispatcher::onNewConnection);
+
+    // the round trip times, the throughput is measured while sending
+    m_pingTimer = new QTimer(this);
+    connect(m_pingTimer, &QTimer::timeout, this, &SessionDispatcher::pingSessions);
+    m_pingTimer->start(PING_INTERVAL);
 }
 
 SessionDispatcher::SessionDispatcher() {
     m_pWebSocketServer = nullptr;
+    m_pingTimer = nullptr;
 }
 
 SessionDispatcher::~SessionDispatcher() {
@@ -130,6 +142,18 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             setConnectorInMap(sessionID, connector);
         }
 
+        // a websocket is registered once, its measurements go to the session it serves
+        if (sessionList.find(ws) == sessionList.end() && connector->bandwidthAdapter()->isEnabled()) {
+            std::shared_ptr<Carta::Data::BandwidthAdapter> bandwidth = connector->bandwidthAdapter();
+            connect(ws, &QWebSocket::bytesWritten, ws, [bandwidth](qint64 bytes) {
+                bandwidth->bytesWritten(bytes);
+            });
+            connect(ws, &QWebSocket::pong, ws, [bandwidth](quint64 elapsedTime, const QByteArray &) {
+                bandwidth->roundTrip(elapsedTime);
+            });
+            ws->ping();
+        }
+
         sessionList[ws] = connector;
 
         if (!sessionExisting) {
@@ -230,7 +254,10 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             // convert the std::vector<char> to QByteArray
             char* tmpMessage = &tmpResult[0];
             QByteArray result = QByteArray::fromRawData(tmpMessage, requiredSize);
+            connector->bandwidthAdapter()->messageQueued(requiredSize);
             ws->sendBinaryMessage(result);
+            // the websocket has copied the frames, the buffer can be reused
+            Carta::Lib::BufferPool<char>::instance().release(std::move(tmpResult));
             qDebug() << "[SessionDispatcher] Send event:" << respName<< ", Id=" << eventId << ", length=" << requiredSize << QTime::currentTime().toString();
         }
 
@@ -286,6 +313,8 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             int precision = lround(viewSetting.compression_quality());
             bool isZFP = (viewSetting.compression_type() == CARTA::CompressionType::ZFP) ? true : false;
 
+            // an older view of the image still queued is skipped, one being computed cancelled
+            connector->requestCoalescer()->queued(eventName, fileId);
             emit connector->setImageViewSignal(eventId, fileId, xMin, xMax, yMin, yMax, mip, isZFP, precision, numSubsets);
 
         } else if (eventName == "SET_IMAGE_CHANNELS") {
@@ -296,6 +325,7 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             int channel = setImageChannels.channel();
             int stoke = setImageChannels.stokes();
             qDebug() << "[SessionDispatcher] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
+            connector->requestCoalescer()->queued(eventName, fileId);
             emit connector->imageChannelUpdateSignal(eventId, fileId, channel, stoke);
 
         } else if (eventName == "SET_CURSOR") {
@@ -306,6 +336,7 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             CARTA::Point point = setCursor.point();
             CARTA::SetSpatialRequirements spatialReqs = setCursor.spatial_requirements();
             qDebug() << "[SessionDispatcher] Set cursor fileId=" << fileId << ", point=(" << point.x() << ", " << point.y() << ")";
+            connector->requestCoalescer()->queued(eventName, fileId);
             emit connector->setCursorSignal(eventId, fileId, point, spatialReqs);
 
         } else if (eventName == "SET_SPATIAL_REQUIREMENTS") {
@@ -381,7 +412,10 @@ void SessionDispatcher::forwardBinaryMessageResult(QString respName, uint32_t ev
             // convert the std::vector<char> to QByteArray
             char* tmpMessage = &message[0];
             QByteArray result = QByteArray::fromRawData(tmpMessage, requiredSize);
+            connector->bandwidthAdapter()->messageQueued(requiredSize);
             ws->sendBinaryMessage(result);
+            // the websocket has copied the frames, the buffer can be reused
+            Carta::Lib::BufferPool<char>::instance().release(std::move(message));
             qDebug() << "[SessionDispatcher] Send event: Name=" << respName << ", Id=" << eventId << ", length=" << requiredSize << ", Time=" << QTime::currentTime().toString();
         }
     } else {
@@ -389,6 +423,15 @@ void SessionDispatcher::forwardBinaryMessageResult(QString respName, uint32_t ev
     }
 }
 
+void SessionDispatcher::pingSessions() {
+    for (const auto& session : sessionList) {
+        if (session.second && session.second->bandwidthAdapter()->isEnabled() &&
+            session.first->state() == QAbstractSocket::ConnectedState) {
+            session.first->ping();
+        }
+    }
+}
+
 IConnector* SessionDispatcher::getConnectorInMap(const QString & sessionID) {
     mutex.lock();
     auto iter = clientList.find(sessionID);
@@ -411,12 +454,10 @@ void SessionDispatcher::setConnectorInMap(const QString & sessionID, IConnector
 
 std::vector<char> SessionDispatcher::_serializeToArray(QString respName, uint32_t eventId, PBMSharedPtr msg, bool &success, size_t &requiredSize) {
     success = false;
-    std::vector<char> result;
     size_t messageLength = msg->ByteSize();
     requiredSize = EVENT_NAME_LENGTH + EVENT_ID_LENGTH + messageLength;
-    if (result.size() < requiredSize) {
-        result.resize(requiredSize);
-    }
+    // a recycled buffer, handed back to the pool once the message is sent
+    std::vector<char> result = Carta::Lib::BufferPool<char>::instance().acquire(requiredSize);
     memset(result.data(), 0, EVENT_NAME_LENGTH);
     memcpy(result.data(), respName.toStdString().c_str(), std::min<size_t>(respName.length(), EVENT_NAME_LENGTH));
     memcpy(result.data() + EVENT_NAME_LENGTH, &eventId, EVENT_ID_LENGTH);
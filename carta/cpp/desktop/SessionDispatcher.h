@@ -15,6 +15,7 @@
 #include "QtWebSockets/qwebsocket.h"
 
 QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
+QT_FORWARD_DECLARE_CLASS(QTimer)
 
 QT_FORWARD_DECLARE_CLASS(WebSocketClientWrapper)
 QT_FORWARD_DECLARE_CLASS(QWebChannel)
@@ -56,6 +57,7 @@ private:
 
     QMutex mutex;
     QWebSocketServer *m_pWebSocketServer;
+    QTimer *m_pingTimer; // measures the round trip times of the connections
     // prevent being accessed by other to avoid thread-safety problem
     std::map<QWebSocket*, NewServerConnector*> sessionList;
 
@@ -68,6 +70,7 @@ private slots:
     void onBinaryMessage(QByteArray qByteMessage);
     void forwardTextMessageResult(QString);
     void forwardBinaryMessageResult(QString respName, uint32_t eventId, PBMSharedPtr protoMsg);
+    void pingSessions();
 };
 
 
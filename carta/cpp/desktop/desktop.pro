@@ -9,13 +9,15 @@ HEADERS += \
     DesktopPlatform.h \
     NewServerConnector.h \
     SessionDispatcher.h \
-    NewServerConnector.h
+    NewServerConnector.h \
+    RequestCoalescer.h
 
 SOURCES += \
     DesktopPlatform.cpp \
     desktopMain.cpp \
     NewServerConnector.cpp \
-    SessionDispatcher.cpp
+    SessionDispatcher.cpp \
+    RequestCoalescer.cpp
 
 #INCLUDEPATH += ../../../ThirdParty/rapidjson/include
 INCLUDEPATH += ../core
@@ -9,11 +9,14 @@
 #include "CartaLib/AxisInfo.h"
 #include "CCRawView.h"
 #include "CCMetaDataInterface.h"
+#include "CCTileCache.h"
 #include "casacore/images/Images/ImageInterface.h"
-#include "casacore/images/Images/ImageUtilities.h"
-#include "casacore/images/Images/TempImage.h"
+#include "casacore/images/Images/FITSImage.h"
 
 #include <QDebug>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QStringList>
 #include <memory>
 #include <set>
 
@@ -44,9 +47,38 @@ public:
 
     virtual casacore::ImageInfo getImageInfo() const = 0;
 
+    /// Returns the FITS header cards of images that are not backed by a casacore
+    /// image (without END), empty by default.
+    virtual QStringList
+    getFitsHeaderCards() const
+    {
+        return QStringList();
+    }
+
 //    virtual casacore::ImageInterface<casacore::Float> * getCasaIIfloat() = 0;
 
+    /// Returns the reader lock of this image.
+    ///
+    /// casacore lattices keep per-object state (tile cache, cursor, file
+    /// position), so accesses to the same image have to be serialized, but
+    /// different images can be read concurrently. Anyone touching the pixels of
+    /// getCasaImage() directly must hold this lock. If the global casa_mutex is
+    /// needed as well, this lock has to be acquired first.
+    QMutex &
+    readMutex() const
+    {
+        return m_readMutex;
+    }
+
+    virtual QMutex *
+    readLock() const override
+    {
+        return & m_readMutex;
+    }
 
+private:
+
+    mutable QMutex m_readMutex { QMutex::Recursive };
 };
 
 /// implementation of the ImageInterface that the casacore image loader plugin
@@ -90,33 +122,36 @@ public:
             }
         }
 
+        // nothing to do for the identity permutation
+        bool isIdentity = true;
+        for ( int i = 0; i < indexCount; i++ ){
+            if ( indices[i] != i ){
+                isIdentity = false;
+                break;
+            }
+        }
+        if ( isIdentity ){
+            return this->shared_from_this();
+        }
+
         //Convert to a CASA data type.
         casacore::Vector<int> newOrder( indexCount );
         for ( int i = 0; i < indexCount; i++ ){
             newOrder[i] = indices[i];
         }
         //Change the order of the axes in the coordinate system
-        casacore::CoordinateSystem coordSys = m_casaII->coordinates();
-        coordSys.transpose( newOrder, newOrder );
-        casacore::IPosition oldShape = m_casaII->shape();
-        casacore::IPosition newShape( indexCount );
-        for ( int i = 0; i < indexCount; i++ ){
-            newShape[i] = oldShape[newOrder[i]];
-        }
-
-        //Make a new image and copy the data into it.
-        casacore::ImageInterface<PType>* newImage = new casacore::TempImage<PType>(casacore::TiledShape( newShape), coordSys);
-        casacore::Array<PType> dataCopy = m_casaII->get();
-        newImage->put( reorderArray( dataCopy, newOrder ));
-        if ( m_casaII->hasPixelMask()){
-            std::unique_ptr<casacore::Lattice<casacore::Bool> > maskLattice( m_casaII->pixelMask().clone());
-            casacore::Array<casacore::Bool> maskCopy = maskLattice->get();
-            dynamic_cast< casacore::TempImage<PType> *>(newImage)->attachMask( casacore::ArrayLattice<casacore::Bool>(reorderArray( maskCopy, newOrder )));
-        }
+        casa_mutex.lock();
+        std::shared_ptr<casacore::CoordinateSystem> coordSys(
+                    new casacore::CoordinateSystem( m_casaII->coordinates() ) );
+        coordSys->transpose( newOrder, newOrder );
+        casa_mutex.unlock();
 
-        //Finish the copy and create a CARTA image with permuted axes.
-        casacore::ImageUtilities::copyMiscellaneous( *newImage, *m_casaII );
-        std::shared_ptr<Carta::Lib::Image::ImageInterface> permuteImage =  create( newImage);
+        //Create a lazy view with permuted axes, the pixels are not copied but
+        //read from this image on demand.
+        auto meta = std::make_shared < CCMetaDataInterface > (
+                    m_meta->title( Carta::Lib::TextFormat::Html ), coordSys );
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> permuteImage =
+                std::make_shared < CCPermutedImage < PType > > ( this->shared_from_this(), indices, meta );
         return permuteImage;
     }
 
@@ -129,7 +164,7 @@ public:
     virtual bool
     hasMask() const override
     {
-        return false;
+        return m_hasMask;
     }
 
     virtual bool
@@ -165,12 +200,14 @@ public:
         return new CCRawView < PType > ( this, sliceInfo );
     }
 
-    /// \todo implement this
+    /// the mask is available as a bitmap through RawViewInterface::pixelMask()
+    /// of the data slice
     virtual Carta::Lib::NdArray::Byte *
     getMaskSlice( const SliceND & sliceInfo) override
     {
         Q_UNUSED( sliceInfo );
-        qFatal( "not implemented" );
+        qWarning() << "CCImage: use the pixel mask of the data slice";
+        return nullptr;
     }
 
     /// \todo implement this
@@ -196,20 +233,27 @@ public:
 
         // create an image interface instance and populate it with various
         // values from casacore::ImageInterface
+        // the casaImage is not shared with anyone yet, so only the parts that
+        // touch non-thread-safe casacore state need the global lock
         CCImage::SharedPtr img = std::make_shared < CCImage < PType > > ();
-        casa_mutex.lock();
 
         img-> m_pixelType = Carta::Lib::Image::CType2PixelType < PType >::type;
         img-> m_dims      = casaImage-> shape().asStdVector();
         img-> m_casaII    = casaImage;
         img-> m_unit      = Carta::Lib::Unit( casaImage-> units().getName().c_str() );
         img-> m_type      = casaImage->imageType().c_str();
+        // the mask casacore makes for FITS files only marks the NaNs (and blanks, which
+        // are read as NaNs), reading it would just double the I/O
+        img-> m_hasMask   = casaImage->isMasked() &&
+                            ! dynamic_cast < casacore::FITSImage * > ( casaImage );
 
         // get title and escape html characters in case there are any
         QString htmlTitle = casaImage->imageInfo().objectName().c_str();
         htmlTitle = htmlTitle.toHtmlEscaped();
 
-        // make our own copy of the coordinate system using 'clone'
+        // make our own copy of the coordinate system using 'clone', cloning
+        // the measures frames is not thread safe
+        casa_mutex.lock();
         std::shared_ptr<casacore::CoordinateSystem> casaCS(
                     static_cast<casacore::CoordinateSystem *> (casaImage->coordinates().clone()));
         casa_mutex.unlock();
@@ -217,6 +261,15 @@ public:
         // construct a meta data instance
         img-> m_meta = std::make_shared < CCMetaDataInterface > ( htmlTitle, casaCS );
 
+        // tiles of images backed by a file can be shared through the tile cache,
+        // the modification time makes sure we never serve stale tiles
+        QFileInfo fileInfo( QString( casaImage-> name( false ).c_str() ) );
+        if ( fileInfo.exists() ) {
+            img-> m_tileKeyPrefix = QString( "%1|%2" )
+                                    .arg( fileInfo.canonicalFilePath() )
+                                    .arg( fileInfo.lastModified().toMSecsSinceEpoch() );
+        }
+
         /// \todo remove this test code
        /* casacore::Record rec;
         if( ! casaCS-> save( rec, "")) {
@@ -274,16 +327,165 @@ protected:
     /// cached unit
     Carta::Lib::Unit m_unit;
 
+    /// does the image have a pixel mask
+    bool m_hasMask = false;
+
     /// meta data pointer
     CCMetaDataInterface::SharedPtr m_meta;
 
     QString m_type;
 
+    /// path and modification time of the file, empty if the image can't use
+    /// the tile cache (e.g. temporary images)
+    QString m_tileKeyPrefix;
+
+    /// boxes with fewer pixels than this only use tiles that are already cached
+    static constexpr int64_t SMALL_READ_PIXELS = 4096;
+
+    /// Read a box of pixels into dst (in casacore order, i.e. first axis fastest).
+    ///
+    /// Boxes within a single plane are assembled from the shared tile cache,
+    /// anything else (multi-plane boxes, strides) is read directly, so that
+    /// large scans don't flush the cache.
+    void
+    _readBox( const casacore::IPosition & start,
+              const casacore::IPosition & shape,
+              const casacore::IPosition & stride,
+              PType * dst )
+    {
+        int nDims = shape.size();
+        bool useTiles = nDims >= 2 && ! m_tileKeyPrefix.isEmpty()
+                        && CCTileCache::instance().isEnabled();
+        for ( int i = 0 ; useTiles && i < nDims ; i++ ) {
+            if ( stride( i ) != 1 || ( i >= 2 && shape( i ) != 1 ) ) {
+                useTiles = false;
+            }
+        }
+
+        if ( ! useTiles ) {
+            _readDirect( start, shape, stride, dst );
+            return;
+        }
+
+        const int tileSize = CCTileCache::TILE_SIZE;
+        int64_t x0 = start( 0 ), y0 = start( 1 );
+        int64_t nx = shape( 0 ), ny = shape( 1 );
+
+        // a few pixels (e.g. the cursor value) come from a cached tile if there is
+        // one, but are not worth loading a whole tile for
+        if ( nx * ny < SMALL_READ_PIXELS && x0 / tileSize == ( x0 + nx - 1 ) / tileSize
+             && y0 / tileSize == ( y0 + ny - 1 ) / tileSize ) {
+            int64_t tx = x0 / tileSize, ty = y0 / tileSize;
+            CCTileCache::TileSharedPtr tile = CCTileCache::instance().find( _tileKey( start, tx, ty ) );
+            if ( ! tile ) {
+                _readDirect( start, shape, stride, dst );
+                return;
+            }
+            const PType * tileData = reinterpret_cast < const PType * > ( tile-> data() );
+            int64_t tileWidth = std::min < int64_t > ( tileSize, m_dims[0] - tx * tileSize );
+            for ( int64_t y = 0 ; y < ny ; y++ ) {
+                const PType * src = tileData + ( y0 + y - ty * tileSize ) * tileWidth + ( x0 - tx * tileSize );
+                std::copy( src, src + nx, dst + y * nx );
+            }
+            return;
+        }
+        for ( int64_t ty = y0 / tileSize ; ty <= ( y0 + ny - 1 ) / tileSize ; ty++ ) {
+            for ( int64_t tx = x0 / tileSize ; tx <= ( x0 + nx - 1 ) / tileSize ; tx++ ) {
+                CCTileCache::TileSharedPtr tile = _getTile( start, tx, ty );
+                const PType * tileData = reinterpret_cast < const PType * > ( tile-> data() );
+                int64_t tileX0 = tx * tileSize, tileY0 = ty * tileSize;
+                int64_t tileWidth = std::min < int64_t > ( tileSize, m_dims[0] - tileX0 );
+
+                // copy the overlap of the tile and the box, row by row
+                int64_t ox0 = std::max( x0, tileX0 );
+                int64_t ox1 = std::min( x0 + nx, tileX0 + tileWidth );
+                int64_t oy0 = std::max( y0, tileY0 );
+                int64_t oy1 = std::min( y0 + ny, tileY0 + tileSize );
+                for ( int64_t y = oy0 ; y < oy1 ; y++ ) {
+                    const PType * src = tileData + ( y - tileY0 ) * tileWidth + ( ox0 - tileX0 );
+                    std::copy( src, src + ( ox1 - ox0 ), dst + ( y - y0 ) * nx + ( ox0 - x0 ) );
+                }
+            }
+        }
+    } // _readBox
+
+    /// Read a box of pixels into dst with a single getSlice(), bypassing the tile
+    /// cache.
+    void
+    _readDirect( const casacore::IPosition & start,
+                 const casacore::IPosition & shape,
+                 const casacore::IPosition & stride,
+                 PType * dst )
+    {
+        casacore::Array < PType > box;
+        {
+            QMutexLocker readLocker( & readMutex() );
+            m_casaII-> getSlice( box, casacore::Slicer( start, shape, stride ) );
+        }
+        bool deleteIt;
+        const PType * src = box.getStorage( deleteIt );
+        std::copy( src, src + box.nelements(), dst );
+        box.freeStorage( src, deleteIt );
+    }
+
+    /// key of the tile (tx,ty) of the plane containing 'planePos' in the tile cache
+    QString
+    _tileKey( const casacore::IPosition & planePos, int64_t tx, int64_t ty ) const
+    {
+        QString key = m_tileKeyPrefix;
+        for ( int i = 2 ; i < int( planePos.size() ) ; i++ ) {
+            key += QString( "|%1" ).arg( planePos( i ) );
+        }
+        key += QString( "|%1,%2" ).arg( tx ).arg( ty );
+        return key;
+    }
+
+    /// get the tile (tx,ty) of the plane containing 'planePos' from the cache,
+    /// reading it from the image on a miss
+    CCTileCache::TileSharedPtr
+    _getTile( const casacore::IPosition & planePos, int64_t tx, int64_t ty )
+    {
+        int nDims = planePos.size();
+        QString key = _tileKey( planePos, tx, ty );
+
+        CCTileCache & cache = CCTileCache::instance();
+        CCTileCache::TileSharedPtr tile = cache.find( key );
+        if ( tile ) {
+            return tile;
+        }
+
+        const int tileSize = CCTileCache::TILE_SIZE;
+        casacore::IPosition start( planePos ), shape( nDims, 1 );
+        start( 0 ) = tx * tileSize;
+        start( 1 ) = ty * tileSize;
+        shape( 0 ) = std::min < int64_t > ( tileSize, m_dims[0] - start( 0 ) );
+        shape( 1 ) = std::min < int64_t > ( tileSize, m_dims[1] - start( 1 ) );
+
+        casacore::Array < PType > box;
+        {
+            QMutexLocker readLocker( & readMutex() );
+            m_casaII-> getSlice( box, casacore::Slicer( start, shape ) );
+        }
+        bool deleteIt;
+        const PType * src = box.getStorage( deleteIt );
+        const char * bytes = reinterpret_cast < const char * > ( src );
+        std::shared_ptr < CCTileCache::Tile > newTile = std::make_shared < CCTileCache::Tile > (
+            bytes, bytes + box.nelements() * sizeof( PType ) );
+        box.freeStorage( src, deleteIt );
+
+        cache.insert( key, newTile );
+        return newTile;
+    } // _getTile
+
     /// we want CCRawView to access our internals...
     /// \todo maybe we just need a public accessor, no? I don't like friends :) (Pavol)
     friend class CCRawView < PType >;
+    friend class CCPermutedRawView < PType >;
 };
 
 /// helper to convert carta's image to casacore image interface
 casacore::ImageInterface<casacore::Float> *
 cartaII2casaII_float( std::shared_ptr<Carta::Lib::Image::ImageInterface> ii) ;
+
+// permuted views need the complete definition of CCImage
+#include "CCPermutedImage.h"
@@ -0,0 +1,805 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IImage.h"
+#include "CartaLib/MemoryBudget.h"
+#include "CCMetaDataInterface.h"
+#include <casacore/casa/Arrays/IPosition.h>
+#include <casacore/casa/Arrays/Slicer.h>
+#include <casacore/images/Images/ImageUtilities.h>
+#include <casacore/images/Images/TempImage.h>
+#include <casacore/lattices/Lattices/TempLattice.h>
+
+#include <QDebug>
+#include <QMutex>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+template < typename PType >
+class CCImage;
+
+template < typename PType >
+class CCPermutedImage;
+
+/// Raw view into a CCPermutedImage.
+///
+/// Nothing is copied up front: the view maps its slice back onto the original
+/// image and reads one 'plane' (the first two permuted axes, for the rest the
+/// indices are fixed) at a time with a single getSlice(), transposing it on the
+/// fly. The memory used is therefore bounded by the size of one plane of the
+/// view, not by the size of the image.
+///
+/// \warning same limitations as CCRawView, i.e. no negative steps and no
+/// index slices
+template < typename PType >
+class CCPermutedRawView
+    : public Carta::Lib::NdArray::RawViewInterface
+{
+public:
+
+    /// \param image permuted image, we don't assume ownership.
+    /// It has to remain valid for the duration of existance of this instance.
+    /// \param sliceInfo slice in the permuted coordinates
+    CCPermutedRawView( CCPermutedImage < PType > * image, const SliceND & sliceInfo );
+
+    virtual PixelType
+    pixelType() override
+    {
+        return m_image->pixelType();
+    }
+
+    virtual const VI &
+    dims() override
+    {
+        return m_viewDims;
+    }
+
+    virtual const char *
+    get( const VI & pos ) override;
+
+    virtual void
+    forEach( std::function < void (const char *) > func, Traversal traversal ) override;
+
+    /// the position of the pixel passed to the forEach() callback, or of the pixel
+    /// the next stateful read() starts at
+    virtual const VI &
+    currentPos() override
+    {
+        return m_currentPos;
+    }
+
+    virtual RawViewInterface *
+    getView( const SliceND & sliceInfo ) override
+    {
+        SliceND::ApplyResult ar = sliceInfo.apply( dims() );
+        SliceND::ApplyResult newAr = SliceND::ApplyResult::combine( m_appliedSlice, ar );
+        return new CCPermutedRawView( m_image, newAr );
+    }
+
+    virtual int64_t
+    read( int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override
+    {
+        Q_UNUSED( traversal );
+        int64_t bytes = _readPixels( m_readPos, buffSize, buff );
+        _setReadPos( m_readPos + bytes / sizeof( PType ) );
+        return bytes;
+    }
+
+    virtual void
+    seek( int64_t ind ) override
+    {
+        CARTA_ASSERT( ind >= 0 );
+        _setReadPos( ind );
+    }
+
+    virtual int64_t
+    read( int64_t chunk, int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override
+    {
+        Q_UNUSED( traversal );
+        if ( chunk < 0 ) {
+            return 0;
+        }
+        return _readPixels( chunk * int64_t( buffSize / sizeof( PType ) ), buffSize, buff );
+    }
+
+    virtual void
+    forEach(
+        int64_t buffSize,
+        std::function < void (const char *, int64_t count) > func,
+        char * buff = nullptr,
+        Traversal traversal = Traversal::Sequential ) override;
+
+    /// the line is read from the original image with one strided getSlice(),
+    /// no transposing needed
+    virtual int64_t
+    readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff ) override;
+
+    /// the mask of the original image, transposed
+    virtual Carta::Lib::NdArray::PixelMask::SharedPtr
+    pixelMask() override;
+
+    /// the optimal traversal is that of the original image, and so is its mask
+    virtual void
+    forEachValid( int64_t buffSize,
+                  std::function < void (const char *, int64_t count) > func,
+                  Traversal traversal = Traversal::Sequential ) override
+    {
+        if ( traversal != Traversal::Optimal || _planeSize() * _nPlanes() == 0 ) {
+            RawViewInterface::forEachValid( buffSize, func, traversal );
+            return;
+        }
+        CCRawView < PType > parentView( & m_image-> parent(), _parentSlice() );
+        parentView.forEachValid( buffSize, func, traversal );
+    }
+
+protected:
+
+    /// slice of the original image covering the pixels of this view
+    SliceND
+    _parentSlice() const;
+
+    CCPermutedRawView( CCPermutedImage < PType > * image, const SliceND::ApplyResult & applyResult );
+
+    /// shared by both constructors
+    void
+    _init();
+
+    /// move the stateful read() to the pixel with the given index, and currentPos() with it
+    void
+    _setReadPos( int64_t index );
+
+    /// read buffSize bytes worth of pixels starting at pixel index first,
+    /// returns the number of bytes read
+    int64_t
+    _readPixels( int64_t first, int64_t buffSize, char * buff );
+
+    /// number of pixels in one plane of this view
+    int64_t
+    _planeSize() const;
+
+    /// number of planes in this view
+    int64_t
+    _nPlanes() const;
+
+    /// read the plane with the given index from the original image, transposed
+    /// into the order of this view
+    void
+    _readPlane( int64_t plane, std::vector < PType > & out );
+
+    CCPermutedImage < PType > * m_image = nullptr; // we don't own this!
+    SliceND::ApplyResult m_appliedSlice;
+    VI m_viewDims;
+
+    // number of leading axes that make up one plane
+    int m_planeAxes = 0;
+
+    // buffer for get()
+    PType m_buff;
+
+    // position of the next stateful read()
+    int64_t m_readPos = 0;
+
+    // returned by currentPos()
+    VI m_currentPos;
+
+    // mask of this view, computed on first use
+    Carta::Lib::NdArray::PixelMask::SharedPtr m_mask;
+};
+
+/// Image with permuted axes that shares the pixels of the original CCImage.
+///
+/// Axis i of this image is axis order[i] of the original image. It is a
+/// CCImageBase, so code that needs a casacore image (spectral profiles, regions,
+/// header export) gets one from getCasaImage(). That one is a transposed copy
+/// made plane by plane on the first call, the views of this image never use it.
+/// The part of the copy kept in memory counts towards the MemoryBudget, the rest
+/// is paged to disk by casacore.
+template < typename PType >
+class CCPermutedImage
+    : public CCImageBase
+{
+    CLASS_BOILERPLATE( CCPermutedImage );
+
+public:
+
+    /// \param parent original image, we keep it alive
+    /// \param order permutation, axis i of this image is axis order[i] of parent
+    /// \param meta meta data with the transposed coordinate system
+    CCPermutedImage( std::shared_ptr < CCImage < PType > > parent,
+                     const std::vector < int > & order,
+                     CCMetaDataInterface::SharedPtr meta )
+        : m_parent( parent ), m_order( order ), m_meta( meta )
+    {
+        const auto & parentDims = m_parent-> dims();
+        for ( int axis : m_order ) {
+            m_dims.push_back( parentDims[axis] );
+        }
+    }
+
+    virtual const Carta::Lib::Unit &
+    getPixelUnit() const override
+    {
+        return m_parent-> getPixelUnit();
+    }
+
+    virtual const QString &
+    getType() const override
+    {
+        return m_parent-> getType();
+    }
+
+    /// permutations are composed, so we never end up with a view of a view
+    virtual std::shared_ptr < Carta::Lib::Image::ImageInterface >
+    getPermuted( const std::vector < int > & indices ) override
+    {
+        CARTA_ASSERT( indices.size() == m_order.size() );
+        std::vector < int > composed( indices.size() );
+        for ( size_t i = 0 ; i < indices.size() ; i++ ) {
+            composed[i] = m_order[indices[i]];
+        }
+        return m_parent-> getPermuted( composed );
+    }
+
+    virtual const std::vector < int > &
+    dims() const override
+    {
+        return m_dims;
+    }
+
+    virtual bool
+    hasMask() const override
+    {
+        return m_parent-> hasMask();
+    }
+
+    virtual bool
+    hasBeam() const override
+    {
+        return m_parent-> hasBeam();
+    }
+
+    virtual bool
+    hasErrorsInfo() const override
+    {
+        return false;
+    }
+
+    virtual Carta::Lib::Image::PixelType
+    pixelType() const override
+    {
+        return m_parent-> pixelType();
+    }
+
+    /// there are no errors, see hasErrorsInfo()
+    virtual Carta::Lib::Image::PixelType
+    errorType() const override
+    {
+        return Carta::Lib::Image::PixelType::Other;
+    }
+
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getDataSlice( const SliceND & sliceInfo ) override
+    {
+        return new CCPermutedRawView < PType > ( this, sliceInfo );
+    }
+
+    /// the mask is available as a bitmap through RawViewInterface::pixelMask()
+    /// of the data slice
+    virtual Carta::Lib::NdArray::Byte *
+    getMaskSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        qWarning() << "CCPermutedImage: use the pixel mask of the data slice";
+        return nullptr;
+    }
+
+    /// there are no errors, see hasErrorsInfo()
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getErrorSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    virtual Carta::Lib::Image::MetaDataInterface::SharedPtr
+    metaData() override
+    {
+        return m_meta;
+    }
+
+    /// the transposed copy, made on the first call (the callers hold readMutex()
+    /// while they use it, so that is where it is made as well), or nullptr if the
+    /// memory budget can't hold it
+    virtual casacore::LatticeBase *
+    getCasaImage() override
+    {
+        QMutexLocker readLocker( & readMutex() );
+        if ( ! m_casaII ) {
+            m_casaII = _makeCasaImage();
+        }
+        return m_casaII.get();
+    }
+
+    virtual casacore::ImageInfo
+    getImageInfo() const override
+    {
+        return m_parent-> getImageInfo();
+    }
+
+    /// the original image
+    CCImage < PType > &
+    parent()
+    {
+        return * m_parent;
+    }
+
+    /// axis i of this image is axis order()[i] of the parent
+    const std::vector < int > &
+    order() const
+    {
+        return m_order;
+    }
+
+protected:
+
+    /// megabytes of the transposed copy (and as much of its mask) kept in memory
+    static constexpr double CASA_COPY_MEMORY_MB = 256;
+
+    /// copy the pixels and the mask plane by plane into a TempImage with the permuted
+    /// axes, the memory it holds is reserved in m_casaReservation
+    std::unique_ptr < casacore::TempImage < PType > >
+    _makeCasaImage();
+
+    std::shared_ptr < CCImage < PType > > m_parent;
+    std::vector < int > m_order;
+    std::vector < int > m_dims;
+    CCMetaDataInterface::SharedPtr m_meta;
+
+    /// transposed copy for getCasaImage(), null until it is asked for
+    std::unique_ptr < casacore::TempImage < PType > > m_casaII;
+
+    /// the memory held by m_casaII
+    std::unique_ptr < Carta::Lib::MemoryBudget::Reservation > m_casaReservation;
+};
+
+template < typename PType >
+std::unique_ptr < casacore::TempImage < PType > >
+CCPermutedImage < PType >::_makeCasaImage()
+{
+    int nDims = m_dims.size();
+    casacore::IPosition shape( nDims );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        shape( i ) = m_dims[i];
+    }
+    int64_t nPixels = shape.product();
+    int64_t planePixels = nDims > 0 ? int64_t( m_dims[0] ) * ( nDims > 1 ? m_dims[1] : 1 ) : 1;
+    int64_t nPlanes = planePixels > 0 ? nPixels / planePixels : 0;
+    casacore::IPosition planeShape( shape );
+    for ( int i = 2 ; i < nDims ; i++ ) {
+        planeShape( i ) = 1;
+    }
+    bool hasMask = m_parent-> hasMask();
+
+    // what casacore keeps in memory of the copy and its mask, and the plane buffers
+    const int64_t memoryBytes = int64_t( CASA_COPY_MEMORY_MB * 1024 * 1024 );
+    int64_t bytes = std::min( nPixels * int64_t( sizeof( PType ) ), memoryBytes ) +
+                    planePixels * int64_t( sizeof( PType ) );
+    if ( hasMask ) {
+        bytes += std::min( nPixels * int64_t( sizeof( casacore::Bool ) ), memoryBytes ) +
+                 planePixels * int64_t( sizeof( casacore::Bool ) );
+    }
+    std::unique_ptr < Carta::Lib::MemoryBudget::Reservation > reservation(
+        new Carta::Lib::MemoryBudget::Reservation( bytes ) );
+    if ( ! reservation-> ok() ) {
+        qWarning() << "CCPermutedImage: no memory for the casacore copy of" << bytes << "bytes";
+        return nullptr;
+    }
+
+    std::unique_ptr < casacore::TempImage < PType > > image;
+    try {
+        // copying the coordinate system copies measures frames, which is not thread safe
+        std::unique_ptr < casacore::CoordinateSystem > coordSys;
+        {
+            QMutexLocker casaLocker( & casa_mutex );
+            coordSys.reset( new casacore::CoordinateSystem( * m_meta-> getCoordinateSystem() ) );
+        }
+        image.reset( new casacore::TempImage < PType > ( casacore::TiledShape( shape ), * coordSys,
+                                                         CASA_COPY_MEMORY_MB ) );
+        std::unique_ptr < casacore::TempLattice < casacore::Bool > > mask;
+        if ( hasMask ) {
+            mask.reset( new casacore::TempLattice < casacore::Bool > ( casacore::TiledShape( shape ),
+                                                                       CASA_COPY_MEMORY_MB ) );
+        }
+        casacore::Array < PType > pixels( planeShape );
+        casacore::Array < casacore::Bool > valid( hasMask ? planeShape : casacore::IPosition( nDims, 0 ) );
+
+        for ( int64_t plane = 0 ; plane < nPlanes ; plane++ ) {
+            // the position of the plane on the other axes
+            casacore::IPosition start( nDims, 0 );
+            SliceND slice;
+            int64_t rest = plane;
+            for ( int i = 2 ; i < nDims ; i++ ) {
+                start( i ) = rest % m_dims[i];
+                rest /= m_dims[i];
+                slice.slice( i ).start( start( i ) ).end( start( i ) + 1 );
+            }
+
+            // the view reads the plane from the original image, transposed
+            CCPermutedRawView < PType > view( this, slice );
+            int64_t planeBytes = planePixels * sizeof( PType );
+            if ( view.read( planeBytes, reinterpret_cast < char * > ( pixels.data() ) ) != planeBytes ) {
+                qWarning() << "CCPermutedImage: reading the pixels for the casacore copy failed";
+                return nullptr;
+            }
+            image-> putSlice( pixels, start );
+
+            if ( mask ) {
+                Carta::Lib::NdArray::PixelMask::SharedPtr planeMask = view.pixelMask();
+                if ( ! planeMask ) {
+                    qWarning() << "CCPermutedImage: reading the mask for the casacore copy failed";
+                    return nullptr;
+                }
+                casacore::Bool * flags = valid.data();
+                for ( int64_t i = 0 ; i < planePixels ; i++ ) {
+                    flags[i] = planeMask-> get( i );
+                }
+                mask-> putSlice( valid, start );
+            }
+        }
+        if ( mask ) {
+            image-> attachMask( * mask );
+        }
+
+        auto parentImage = dynamic_cast < casacore::ImageInterface < PType > * > ( m_parent-> getCasaImage() );
+        if ( parentImage ) {
+            QMutexLocker parentLocker( & m_parent-> readMutex() );
+            QMutexLocker casaLocker( & casa_mutex );
+            casacore::ImageUtilities::copyMiscellaneous( * image, * parentImage );
+        }
+    }
+    catch ( const casacore::AipsError & err ) {
+        qWarning() << "CCPermutedImage: no casacore copy of the image" << err.getMesg().c_str();
+        return nullptr;
+    }
+    m_casaReservation = std::move( reservation );
+    return image;
+} // _makeCasaImage
+
+template < typename PType >
+CCPermutedRawView < PType >::CCPermutedRawView( CCPermutedImage < PType > * image,
+                                                const SliceND & sliceInfo )
+{
+    m_image = image;
+    m_appliedSlice = sliceInfo.apply( m_image-> dims() );
+    _init();
+}
+
+template < typename PType >
+CCPermutedRawView < PType >::CCPermutedRawView( CCPermutedImage < PType > * image,
+                                                const SliceND::ApplyResult & applyResult )
+{
+    m_image = image;
+    m_appliedSlice = applyResult;
+    _init();
+}
+
+template < typename PType >
+void
+CCPermutedRawView < PType >::_init()
+{
+    for ( auto & x : m_appliedSlice.dims() ) {
+        m_viewDims.push_back( x.count );
+    }
+    m_planeAxes = std::min( 2, int( m_viewDims.size() ) );
+    m_currentPos.assign( m_viewDims.size(), 0 );
+}
+
+template < typename PType >
+void
+CCPermutedRawView < PType >::_setReadPos( int64_t index )
+{
+    m_readPos = index;
+    for ( size_t i = 0 ; i < m_viewDims.size() ; i++ ) {
+        if ( m_viewDims[i] > 0 ) {
+            m_currentPos[i] = index % m_viewDims[i];
+            index /= m_viewDims[i];
+        }
+    }
+}
+
+template < typename PType >
+int64_t
+CCPermutedRawView < PType >::_planeSize() const
+{
+    int64_t n = 1;
+    for ( int i = 0 ; i < m_planeAxes ; i++ ) {
+        n *= m_viewDims[i];
+    }
+    return n;
+}
+
+template < typename PType >
+int64_t
+CCPermutedRawView < PType >::_nPlanes() const
+{
+    int64_t n = 1;
+    for ( size_t i = m_planeAxes ; i < m_viewDims.size() ; i++ ) {
+        n *= m_viewDims[i];
+    }
+    return n;
+}
+
+template < typename PType >
+const char *
+CCPermutedRawView < PType >::get( const Carta::Lib::NdArray::RawViewInterface::VI & pos )
+{
+    const auto & order = m_image-> order();
+    casacore::IPosition parentPos( order.size(), 0 );
+    for ( size_t i = 0 ; i < order.size() ; i++ ) {
+        int p = i < pos.size() ? pos[i] : 0;
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        parentPos( order[i] ) = slice1d.start + p * slice1d.step;
+    }
+
+    casacore::IPosition ones( order.size(), 1 );
+    m_image-> parent()._readBox( parentPos, ones, ones, & m_buff );
+    return reinterpret_cast < const char * > ( & m_buff );
+}
+
+template < typename PType >
+SliceND
+CCPermutedRawView < PType >::_parentSlice() const
+{
+    const auto & order = m_image-> order();
+    SliceND parentSlice;
+    for ( size_t i = 0 ; i < order.size() ; i++ ) {
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        parentSlice.slice( order[i] )
+            .start( slice1d.start )
+            .end( slice1d.start + ( slice1d.count - 1 ) * slice1d.step + 1 )
+            .step( slice1d.step );
+    }
+    return parentSlice;
+}
+
+template < typename PType >
+Carta::Lib::NdArray::PixelMask::SharedPtr
+CCPermutedRawView < PType >::pixelMask()
+{
+    if ( m_mask || ! m_image-> hasMask() || _planeSize() * _nPlanes() == 0 ) {
+        return m_mask;
+    }
+
+    // get the mask of the same pixels in the original image, and transpose it
+    CCRawView < PType > parentView( & m_image-> parent(), _parentSlice() );
+    Carta::Lib::NdArray::PixelMask::SharedPtr parentMask = parentView.pixelMask();
+    if ( ! parentMask ) {
+        return nullptr;
+    }
+
+    const auto & order = m_image-> order();
+    int nDims = order.size();
+    std::vector < int64_t > parentStrides( nDims, 1 ), strides( nDims );
+    for ( int a = 1 ; a < nDims ; a++ ) {
+        parentStrides[a] = parentStrides[a - 1] * parentView.dims()[a - 1];
+    }
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        strides[i] = parentStrides[order[i]];
+    }
+
+    int64_t nPixels = parentMask-> size();
+    auto mask = std::make_shared < Carta::Lib::NdArray::PixelMask > ( nPixels );
+    VI pos( nDims, 0 );
+    int64_t parentIndex = 0;
+    for ( int64_t i = 0 ; i < nPixels ; i++ ) {
+        mask-> set( i, parentMask-> get( parentIndex ) );
+
+        // advance to the next pixel of this view
+        for ( int d = 0 ; d < nDims ; d++ ) {
+            parentIndex += strides[d];
+            if ( ++ pos[d] < m_viewDims[d] ) {
+                break;
+            }
+            parentIndex -= strides[d] * pos[d];
+            pos[d] = 0;
+        }
+    }
+    m_mask = mask;
+    return m_mask;
+} // pixelMask
+
+template < typename PType >
+int64_t
+CCPermutedRawView < PType >::readLine( const VI & pos, int axis, int64_t count, int64_t step,
+                                       char * buff )
+{
+    count = _lineCount( pos, axis, count, step );
+    if ( count <= 0 ) {
+        return 0;
+    }
+
+    const auto & order = m_image-> order();
+    int nDims = order.size();
+    casacore::IPosition start( nDims ), shape( nDims, 1 ), stride( nDims, 1 );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        start( order[i] ) = slice1d.start + pos[i] * slice1d.step;
+    }
+    shape( order[axis] ) = count;
+    stride( order[axis] ) = step * m_appliedSlice.dims()[axis].step;
+
+    m_image-> parent()._readDirect( start, shape, stride, reinterpret_cast < PType * > ( buff ) );
+    return count;
+} // readLine
+
+template < typename PType >
+void
+CCPermutedRawView < PType >::_readPlane( int64_t plane, std::vector < PType > & out )
+{
+    const auto & order = m_image-> order();
+    int nDims = order.size();
+
+    // box in the original image: the plane axes span their whole slice,
+    // the other axes are fixed at the index of this plane
+    casacore::IPosition start( nDims ), shape( nDims ), stride( nDims );
+    int64_t rest = plane;
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        int parentAxis = order[i];
+        stride( parentAxis ) = slice1d.step;
+        if ( i < m_planeAxes ) {
+            start( parentAxis ) = slice1d.start;
+            shape( parentAxis ) = m_viewDims[i];
+        }
+        else {
+            int64_t pos = rest % m_viewDims[i];
+            rest /= m_viewDims[i];
+            start( parentAxis ) = slice1d.start + pos * slice1d.step;
+            shape( parentAxis ) = 1;
+        }
+    }
+
+    std::vector < PType > box( shape.product() );
+    m_image-> parent()._readBox( start, shape, stride, box.data() );
+
+    // strides of the box (first axis fastest) for the two plane axes
+    std::vector < int64_t > boxStrides( nDims, 1 );
+    for ( int p = 1 ; p < nDims ; p++ ) {
+        boxStrides[p] = boxStrides[p - 1] * shape( p - 1 );
+    }
+    int64_t nx = m_planeAxes > 0 ? m_viewDims[0] : 1;
+    int64_t ny = m_planeAxes > 1 ? m_viewDims[1] : 1;
+    int64_t sx = m_planeAxes > 0 ? boxStrides[order[0]] : 0;
+    int64_t sy = m_planeAxes > 1 ? boxStrides[order[1]] : 0;
+
+    // transpose the box into our order
+    const PType * src = box.data();
+    out.resize( nx * ny );
+    PType * dst = out.data();
+    for ( int64_t y = 0 ; y < ny ; y++ ) {
+        const PType * row = src + y * sy;
+        for ( int64_t x = 0 ; x < nx ; x++ ) {
+            * dst++ = row[x * sx];
+        }
+    }
+} // _readPlane
+
+template < typename PType >
+void
+CCPermutedRawView < PType >::forEach(
+    int64_t buffSize,
+    std::function < void (const char *, int64_t count) > func,
+    char * buff,
+    Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    // the order does not matter, so scan the same pixels of the original image
+    // in its own optimal order instead of transposing plane by plane
+    if ( traversal == Traversal::Optimal ) {
+        if ( _planeSize() * _nPlanes() == 0 ) {
+            return;
+        }
+        CCRawView < PType > parentView( & m_image-> parent(), _parentSlice() );
+        parentView.forEach( buffSize, func, buff, traversal );
+        return;
+    }
+
+    int64_t buffCount = buffSize / sizeof( PType );
+    if ( buffCount < 1 ) {
+        qWarning() << "CCPermutedRawView::forEach buffer too small" << buffSize;
+        return;
+    }
+    std::vector < PType > ownBuffer;
+    PType * dst = reinterpret_cast < PType * > ( buff );
+    if ( dst == nullptr ) {
+        ownBuffer.resize( buffCount );
+        dst = ownBuffer.data();
+    }
+
+    std::vector < PType > plane;
+    int64_t filled = 0;
+    int64_t nPlanes = _nPlanes();
+    for ( int64_t p = 0 ; p < nPlanes ; p++ ) {
+        _readPlane( p, plane );
+        const PType * ptr = plane.data();
+        int64_t remaining = plane.size();
+        while ( remaining > 0 ) {
+            int64_t n = std::min( remaining, buffCount - filled );
+            std::copy( ptr, ptr + n, dst + filled );
+            filled += n;
+            ptr += n;
+            remaining -= n;
+            if ( filled == buffCount ) {
+                func( reinterpret_cast < const char * > ( dst ), filled );
+                filled = 0;
+            }
+        }
+    }
+    if ( filled > 0 ) {
+        func( reinterpret_cast < const char * > ( dst ), filled );
+    }
+} // forEach
+
+template < typename PType >
+void
+CCPermutedRawView < PType >::forEach(
+    std::function < void (const char *) > func,
+    Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    std::vector < PType > plane;
+    int64_t nPlanes = _nPlanes();
+    int nDims = m_viewDims.size();
+    std::fill( m_currentPos.begin(), m_currentPos.end(), 0 );
+    for ( int64_t p = 0 ; p < nPlanes ; p++ ) {
+        _readPlane( p, plane );
+        for ( const auto & val : plane ) {
+            func( reinterpret_cast < const char * > ( & val ) );
+
+            // advance currentPos() to the next pixel, the first axis fastest
+            for ( int d = 0 ; d < nDims ; d++ ) {
+                if ( ++ m_currentPos[d] < m_viewDims[d] ) {
+                    break;
+                }
+                m_currentPos[d] = 0;
+            }
+        }
+    }
+}
+
+template < typename PType >
+int64_t
+CCPermutedRawView < PType >::_readPixels( int64_t first, int64_t buffSize, char * buff )
+{
+    CARTA_ASSERT( buff != nullptr );
+
+    int64_t buffCount = buffSize / sizeof( PType );
+    int64_t planeSize = _planeSize();
+    int64_t nPixels = planeSize * _nPlanes();
+    if ( buffCount < 1 || first < 0 || first >= nPixels ) {
+        return 0;
+    }
+    int64_t count = std::min( buffCount, nPixels - first );
+
+    // copy the overlapping part of every plane in the range
+    PType * dst = reinterpret_cast < PType * > ( buff );
+    std::vector < PType > plane;
+    int64_t pos = first;
+    int64_t end = first + count;
+    while ( pos < end ) {
+        int64_t p = pos / planeSize;
+        int64_t offset = pos - p * planeSize;
+        int64_t n = std::min( planeSize - offset, end - pos );
+        _readPlane( p, plane );
+        std::copy( plane.begin() + offset, plane.begin() + offset + n, dst );
+        dst += n;
+        pos += n;
+    }
+    return count * sizeof( PType );
+} // _readPixels
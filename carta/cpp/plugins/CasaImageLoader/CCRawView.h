@@ -5,12 +5,16 @@
 #pragma once
 
 #include "CartaLib/IImage.h"
+#include "CartaLib/MemoryBudget.h"
+#include <casacore/casa/Arrays/ArrayLogical.h>
 #include <casacore/lattices/Lattices/LatticeStepper.h>
 #include <casacore/lattices/Lattices/LatticeIterator.h>
 #include <casacore/casa/Arrays/IPosition.h>
+#include <casacore/casa/Arrays/Slicer.h>
 #include <algorithm>
 
-#include "CartaLib/UtilCASA.h"
+#include <QDebug>
+#include <QMutex>
 
 template < typename PType >
 class CCImage;
@@ -68,53 +72,60 @@ public:
         return new CCRawView( m_ccimage, newAr);
     }
 
+    /// sequential read, continues where the previous read() finished
+    /// \note buffSize is in bytes, only whole pixels are returned
     virtual int64_t
     read( int64_t buffSize, char * buff,
-          Traversal traversal = Traversal::Sequential ) override
-    {
-        Q_UNUSED( buffSize);
-        Q_UNUSED( buff);
-        Q_UNUSED( traversal);
-        qFatal( "not implemented");
-    }
+          Traversal traversal = Traversal::Sequential ) override;
 
+    /// reset the position for the next read(), ind is a pixel index
     virtual void
-    seek(int64_t ind) override
+    seek( int64_t ind ) override
     {
-        Q_UNUSED( ind);
-        qFatal( "not implemented");
+        CARTA_ASSERT( ind >= 0 );
+        m_readPos = ind;
     }
 
     /// another high performance accessor to data
     /// motivated by unix read() but stateless (i.e. one needs to supply the
     /// chunk number)
+    ///
+    /// Chunk i contains pixels [i*n, (i+1)*n) of the view in casacore order (first
+    /// axis fastest), where n = buffSize / sizeof(PType). Each chunk is extracted
+    /// with at most ndim getSlice() calls.
     virtual int64_t
     read( int64_t chunk, int64_t buffSize, char * buff,
-          Traversal traversal = Traversal::Sequential ) override
-    {
-        Q_UNUSED( chunk );
-        Q_UNUSED( buffSize );
-        Q_UNUSED( buff );
-        Q_UNUSED( traversal );
-        qFatal( "not implemented" );
-    }
+          Traversal traversal = Traversal::Sequential ) override;
 
     /// yet another high performance accessor... similar to forEach above,
     /// but this time the supplied function gets called with whatever number
     /// elements that fit into the buffer
+    ///
+    /// \note buffSize is in bytes, if buff is nullptr an internal buffer is used
     virtual void
     forEach(
         int64_t buffSize,
         std::function < void (const char *, int64_t count) > func,
         char * buff = nullptr,
-        Traversal traversal = Traversal::Sequential ) override
-    {
-        Q_UNUSED( buffSize );
-        Q_UNUSED( func );
-        Q_UNUSED( buff );
-        Q_UNUSED( traversal );
-        qFatal( "not implemented" );
-    }
+        Traversal traversal = Traversal::Sequential ) override;
+
+    /// the whole line is extracted with one strided getSlice()
+    virtual int64_t
+    readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff ) override;
+
+    /// the image's mask for this view, read once (one getMaskSlice() per plane)
+    /// and then kept, its bytes are reserved in the memory budget, nullptr if the
+    /// budget can't hold it
+    virtual Carta::Lib::NdArray::PixelMask::SharedPtr
+    pixelMask() override;
+
+    /// Scans that don't need the sequential order, or go through more than one
+    /// plane, query the mask cursor by cursor (i.e. tile by tile for the optimal
+    /// traversal), the pixels of fully masked cursors are not read at all.
+    virtual void
+    forEachValid( int64_t buffSize,
+                  std::function < void (const char *, int64_t count) > func,
+                  Traversal traversal = Traversal::Sequential ) override;
 
 protected:
 
@@ -131,6 +142,36 @@ protected:
 
     // minicache to make get() a little bit faster
     VI m_destPos;
+
+    // position (pixel index) of the next stateful read()
+    int64_t m_readPos = 0;
+
+    // mask of this view, computed on first use
+    Carta::Lib::NdArray::PixelMask::SharedPtr m_mask;
+
+    // the memory of m_mask in the memory budget
+    std::unique_ptr < Carta::Lib::MemoryBudget::Reservation > m_maskReservation;
+
+    /// number of planes (first two axes) in this view
+    int64_t
+    _nPlanes() const;
+
+    /// total number of pixels in the view
+    int64_t
+    _nPixels() const;
+
+    /// stepper over the view's subsection of the image
+    ///
+    /// For sequential traversal the cursor covers full x/y planes and at most 16
+    /// of them along the third axis, so the cursors come out in c-order. Otherwise
+    /// the cursor follows the image's tile layout (niceCursorShape()), so every
+    /// tile is read from disk only once.
+    casacore::LatticeStepper
+    _makeStepper( Traversal traversal ) const;
+
+    /// copy count pixels of the view, starting at pixel index first, into dst
+    void
+    _readRange( int64_t first, int64_t count, PType * dst );
 };
 
 // public constructor
@@ -198,27 +239,357 @@ CCRawView < PType >::get( const Carta::Lib::NdArray::RawViewInterface::VI & pos
                        + p * m_appliedSlice.dims()[i].step;
     }
 
-    casa_mutex.lock();
-
-    // casacore::ImageInterface::operator() returns the result by value
-    // so in order to return reference (to satisfy our API) we need to store this
-    // in a buffer first...
-    m_buff = m_ccimage-> m_casaII->
-                 operator() ( m_destPos );
-    casa_mutex.unlock();
+    // read the pixel through the image, which serves it from the tile cache
+    // if possible, in order to return a reference (to satisfy our API) we need
+    // to store it in a buffer first...
+    casacore::IPosition start( m_destPos.size() );
+    for ( size_t i = 0 ; i < m_destPos.size() ; i++ ) {
+        start( i ) = m_destPos[i];
+    }
+    casacore::IPosition ones( m_destPos.size(), 1 );
+    m_ccimage-> _readBox( start, ones, ones, & m_buff );
 
     return reinterpret_cast < const char * > ( & m_buff );
 } // get
 
+template < typename PType >
+int64_t
+CCRawView < PType >::readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff )
+{
+    count = _lineCount( pos, axis, count, step );
+    if ( count <= 0 ) {
+        return 0;
+    }
+
+    // translate the line to image coordinates
+    int nDims = m_viewDims.size();
+    casacore::IPosition start( nDims ), shape( nDims, 1 ), stride( nDims, 1 );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        start( i ) = slice1d.start + pos[i] * slice1d.step;
+    }
+    shape( axis ) = count;
+    stride( axis ) = step * m_appliedSlice.dims()[axis].step;
+
+    m_ccimage-> _readDirect( start, shape, stride, reinterpret_cast < PType * > ( buff ) );
+    return count;
+} // readLine
+
+template < typename PType >
+Carta::Lib::NdArray::PixelMask::SharedPtr
+CCRawView < PType >::pixelMask()
+{
+    int64_t nPixels = _nPixels();
+    if ( m_mask || ! m_ccimage-> hasMask() || nPixels == 0 ) {
+        return m_mask;
+    }
+
+    // read the mask plane by plane, so that we never hold more than one plane
+    // of casacore booleans
+    int nDims = m_viewDims.size();
+    int planeAxes = std::min( 2, nDims );
+    int64_t planeSize = 1;
+    for ( int i = 0 ; i < planeAxes ; i++ ) {
+        planeSize *= m_viewDims[i];
+    }
+    int64_t nPlanes = nPixels / planeSize;
+
+    // the bits of the mask, and the booleans of one plane while it is read
+    m_maskReservation.reset( new Carta::Lib::MemoryBudget::Reservation(
+                                 ( nPixels + 7 ) / 8 + planeSize * sizeof( casacore::Bool ) ) );
+    if ( ! m_maskReservation-> ok() ) {
+        // the callers skip the pixels that are not finite instead
+        qWarning() << "CCRawView: the mask of" << nPixels << "pixels exceeds the memory budget";
+        m_maskReservation.reset();
+        return nullptr;
+    }
+
+    auto mask = std::make_shared < Carta::Lib::NdArray::PixelMask > ( nPixels );
+    casacore::IPosition start( nDims ), shape( nDims ), stride( nDims );
+    for ( int64_t p = 0 ; p < nPlanes ; p++ ) {
+        int64_t rest = p;
+        for ( int i = 0 ; i < nDims ; i++ ) {
+            const auto & slice1d = m_appliedSlice.dims()[i];
+            stride( i ) = slice1d.step;
+            if ( i < planeAxes ) {
+                start( i ) = slice1d.start;
+                shape( i ) = m_viewDims[i];
+            }
+            else {
+                start( i ) = slice1d.start + ( rest % m_viewDims[i] ) * slice1d.step;
+                shape( i ) = 1;
+                rest /= m_viewDims[i];
+            }
+        }
+
+        casacore::Array < casacore::Bool > box;
+        {
+            QMutexLocker readLocker( & m_ccimage-> readMutex() );
+            m_ccimage-> m_casaII-> getMaskSlice( box, casacore::Slicer( start, shape, stride ) );
+        }
+        bool deleteIt;
+        const casacore::Bool * src = box.getStorage( deleteIt );
+        mask-> setRange( p * planeSize, planeSize, src );
+        box.freeStorage( src, deleteIt );
+    }
+
+    m_mask = mask;
+    return m_mask;
+} // pixelMask
+
+template < typename PType >
+void
+CCRawView < PType >::forEachValid(
+    int64_t buffSize,
+    std::function < void (const char *, int64_t count) > func,
+    Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    // the mask of a single plane is cheap to combine with its sequential reads
+    // through the tile cache
+    if ( ! m_ccimage-> hasMask() || ( _nPlanes() == 1 && traversal == Traversal::Sequential ) ) {
+        RawViewInterface::forEachValid( buffSize, func, traversal );
+        return;
+    }
+
+    int64_t buffCount = buffSize / sizeof( PType );
+    if ( buffCount < 1 || _nPixels() == 0 ) {
+        return;
+    }
+
+    auto casaII = m_ccimage-> m_casaII;
+    casacore::LatticeStepper stepper = _makeStepper( traversal );
+    Carta::Lib::MemoryBudget::Reservation maskReservation(
+        stepper.cursorShape().product() * sizeof( casacore::Bool ) );
+    if ( ! maskReservation.ok() ) {
+        // the kernels still skip the pixels that are not finite
+        qWarning() << "CCRawView: the mask of a cursor exceeds the memory budget, it is ignored";
+        forEach( buffSize, func, nullptr, traversal );
+        return;
+    }
+    casacore::IPosition stride( m_viewDims.size() );
+    for ( size_t i = 0 ; i < m_viewDims.size() ; i++ ) {
+        stride( i ) = m_appliedSlice.dims()[i].step;
+    }
+
+    // valid pixels are collected in the buffer, which is handed out whenever it is full
+    std::vector < PType > buffer( buffCount );
+    int64_t filled = 0;
+    auto append = [&] ( const PType * ptr, int64_t n ) {
+        while ( n > 0 ) {
+            int64_t k = std::min( n, buffCount - filled );
+            std::copy( ptr, ptr + k, buffer.data() + filled );
+            filled += k;
+            ptr += k;
+            n -= k;
+            if ( filled == buffCount ) {
+                func( reinterpret_cast < const char * > ( buffer.data() ), filled );
+                filled = 0;
+            }
+        }
+    };
+
+    // the image is not locked while func() runs
+    casacore::Array < casacore::Bool > cursorMask;
+    QMutexLocker readLocker( & m_ccimage-> readMutex() );
+    casacore::RO_LatticeIterator < PType > iterator( * casaII, stepper );
+    for ( iterator.reset() ; ! iterator.atEnd() ; iterator++ ) {
+        casaII-> getMaskSlice( cursorMask, casacore::Slicer( iterator.position(), iterator.cursorShape(), stride ) );
+        if ( ! casacore::anyTrue( cursorMask ) ) {
+            continue;
+        }
+        bool allValid = casacore::allTrue( cursorMask );
+        const casacore::Array < PType > & cursor = iterator.cursor();
+        readLocker.unlock();
+
+        bool deleteIt, deleteMask;
+        const PType * src = cursor.getStorage( deleteIt );
+        int64_t count = cursor.nelements();
+        if ( allValid ) {
+            append( src, count );
+        }
+        else {
+            // the runs of valid pixels
+            const casacore::Bool * valid = cursorMask.getStorage( deleteMask );
+            for ( int64_t i = 0 ; i < count ; ) {
+                int64_t start = i;
+                while ( i < count && valid[i] ) {
+                    i++;
+                }
+                append( src + start, i - start );
+                while ( i < count && ! valid[i] ) {
+                    i++;
+                }
+            }
+            cursorMask.freeStorage( valid, deleteMask );
+        }
+        cursor.freeStorage( src, deleteIt );
+
+        readLocker.relock();
+    }
+    readLocker.unlock();
+
+    if ( filled > 0 ) {
+        func( reinterpret_cast < const char * > ( buffer.data() ), filled );
+    }
+} // forEachValid
+
 template < typename PType >
 void
 CCRawView < PType >::forEach(
     std::function < void (const char *) > func,
     Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
 {
-    if ( traversal != Carta::Lib::NdArray::RawViewInterface::Traversal::Sequential ) {
-        qFatal( "sorry, not implemented yet" );
+    // go through the block version, so we share its cache/iterator logic
+    auto wrapper = [& func] ( const char * ptr, int64_t count ) {
+        const PType * vals = reinterpret_cast < const PType * > ( ptr );
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            func( reinterpret_cast < const char * > ( vals + i ) );
+        }
+    };
+    forEach( 64 * 1024 * sizeof( PType ), wrapper, nullptr, traversal );
+} // forEach
+
+template < typename PType >
+void
+CCRawView < PType >::forEach(
+    int64_t buffSize,
+    std::function < void (const char *, int64_t count) > func,
+    char * buff,
+    Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    int64_t buffCount = buffSize / sizeof( PType );
+    if ( buffCount < 1 ) {
+        qWarning() << "CCRawView::forEach buffer too small" << buffSize;
+        return;
+    }
+
+    // use our own buffer if the caller did not supply one
+    std::vector < PType > ownBuffer;
+    PType * dst = reinterpret_cast < PType * > ( buff );
+    if ( dst == nullptr ) {
+        ownBuffer.resize( buffCount );
+        dst = ownBuffer.data();
+    }
+
+    // sequential views of a single plane are read in chunks through the image's
+    // tile cache
+    if ( _nPlanes() == 1 && traversal == Traversal::Sequential ) {
+        int64_t nPixels = _nPixels();
+        for ( int64_t first = 0 ; first < nPixels ; first += buffCount ) {
+            int64_t count = std::min( buffCount, nPixels - first );
+            _readRange( first, count, dst );
+            func( reinterpret_cast < const char * > ( dst ), count );
+        }
+        return;
+    }
+
+    // bigger scans and optimal traversals bypass the tile cache and use a
+    // lattice iterator
+    auto casaII = m_ccimage-> m_casaII;
+    casacore::LatticeStepper stepper = _makeStepper( traversal );
+
+    // fill the buffer cursor by cursor, and hand it out whenever it is full,
+    // the image is not locked while func() runs
+    int64_t filled = 0;
+    QMutexLocker readLocker( & m_ccimage-> readMutex() );
+    casacore::RO_LatticeIterator < PType > iterator( * casaII, stepper );
+
+    for ( iterator.reset() ; ! iterator.atEnd() ; ) {
+        const casacore::Array < PType > & cursor = iterator.cursor();
+        readLocker.unlock();
+
+        bool deleteIt;
+        const PType * src = cursor.getStorage( deleteIt );
+        int64_t remaining = cursor.nelements();
+        const PType * ptr = src;
+        while ( remaining > 0 ) {
+            int64_t n = std::min( remaining, buffCount - filled );
+            std::copy( ptr, ptr + n, dst + filled );
+            filled += n;
+            ptr += n;
+            remaining -= n;
+            if ( filled == buffCount ) {
+                func( reinterpret_cast < const char * > ( dst ), filled );
+                filled = 0;
+            }
+        }
+        cursor.freeStorage( src, deleteIt );
+
+        readLocker.relock();
+        iterator++;
+    }
+    readLocker.unlock();
+
+    // whatever is left over
+    if ( filled > 0 ) {
+        func( reinterpret_cast < const char * > ( dst ), filled );
+    }
+} // forEach
+
+template < typename PType >
+int64_t
+CCRawView < PType >::read( int64_t chunk, int64_t buffSize, char * buff,
+                           Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    CARTA_ASSERT( buff != nullptr );
+
+    int64_t buffCount = buffSize / sizeof( PType );
+    int64_t nPixels = _nPixels();
+    if ( chunk < 0 || buffCount < 1 || chunk * buffCount >= nPixels ) {
+        return 0;
     }
+    int64_t first = chunk * buffCount;
+    int64_t count = std::min( buffCount, nPixels - first );
+    _readRange( first, count, reinterpret_cast < PType * > ( buff ) );
+    return count * sizeof( PType );
+}
+
+template < typename PType >
+int64_t
+CCRawView < PType >::read( int64_t buffSize, char * buff,
+                           Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    CARTA_ASSERT( buff != nullptr );
+
+    int64_t buffCount = buffSize / sizeof( PType );
+    int64_t nPixels = _nPixels();
+    if ( buffCount < 1 || m_readPos >= nPixels ) {
+        return 0;
+    }
+    int64_t count = std::min( buffCount, nPixels - m_readPos );
+    _readRange( m_readPos, count, reinterpret_cast < PType * > ( buff ) );
+    m_readPos += count;
+    return count * sizeof( PType );
+}
+
+template < typename PType >
+int64_t
+CCRawView < PType >::_nPixels() const
+{
+    int64_t n = 1;
+    for ( auto d : m_viewDims ) {
+        n *= d;
+    }
+    return n;
+}
+
+template < typename PType >
+int64_t
+CCRawView < PType >::_nPlanes() const
+{
+    int64_t n = 1;
+    for ( size_t i = 2 ; i < m_viewDims.size() ; i++ ) {
+        n *= m_viewDims[i];
+    }
+    return n;
+}
+
+template < typename PType >
+casacore::LatticeStepper
+CCRawView < PType >::_makeStepper( Traversal traversal ) const
+{
     auto casaII     = m_ccimage-> m_casaII;
     int imgDims     = casaII-> ndim();
     auto imageShape = casaII-> shape();
@@ -227,15 +598,22 @@ CCRawView < PType >::forEach(
 
     // set the cursor shape to load partial file at each step
     casacore::IPosition cursorShape( imgDims );
-    auto shapeVec = imageShape.asVector();
-    for(auto i=0; i<imgDims; i++){
-        // Restrict the maximum size in one dim to 16
-        // (The number is given arbitarily. Maybe it can be changed in the future)
-        cursorShape(i) = std::min( shapeVec(i), 16);
-        if ( i == 0 || i == 1 ){
-            // The first two dims are used as the dims of qimage in ImageRenderService
-            // To keep the rendering working, the sizes of the two dims cannot be changed so far.
-            cursorShape(i) = shapeVec(i);
+    if ( traversal == Traversal::Optimal ) {
+        // the order does not matter, so walk the image tile by tile
+        cursorShape = casaII-> niceCursorShape();
+    }
+    else {
+        auto shapeVec = imageShape.asVector();
+        for(auto i=0; i<imgDims; i++){
+            // Restrict the size of the third dim to 16 and of the rest to 1, so
+            // that the cursors are visited in c-order
+            // (The number is given arbitarily. Maybe it can be changed in the future)
+            cursorShape(i) = i == 2 ? std::min( shapeVec(i), 16) : 1;
+            if ( i == 0 || i == 1 ){
+                // The first two dims are used as the dims of qimage in ImageRenderService
+                // To keep the rendering working, the sizes of the two dims cannot be changed so far.
+                cursorShape(i) = shapeVec(i);
+            }
         }
     }
 
@@ -250,18 +628,64 @@ CCRawView < PType >::forEach(
         inc( i ) = slice1d.step;
     }
     stepper.subSection( blc, trc, inc );
+    return stepper;
+}
 
-    casa_mutex.lock();
-    casacore::RO_LatticeIterator < PType > iterator( * casaII, stepper );
+template < typename PType >
+void
+CCRawView < PType >::_readRange( int64_t first, int64_t count, PType * dst )
+{
+    int nDims = m_viewDims.size();
 
-    for ( iterator.reset() ; ! iterator.atEnd() ; iterator++ ) {
-        const auto & cursor = iterator.cursor();
-        for ( const auto & val : cursor ) {
-            func( reinterpret_cast < const char * > ( & val ) );
+    // strides of the view in pixels, first axis is the fastest
+    std::vector < int64_t > strides( nDims + 1, 1 );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        strides[i + 1] = strides[i] * m_viewDims[i];
+    }
+
+    casacore::IPosition start( nDims ), shape( nDims ), stride( nDims );
+
+    // split the linear range into boxes, each box is the biggest block starting
+    // at 'first' that is aligned to the lower axes, so we end up with at most
+    // 2*ndim boxes (partial lines, full lines, partial planes, ...)
+    while ( count > 0 ) {
+        // find the highest axis 'level' such that all axes below it start at 0
+        // and the rest of the range covers at least one full sub-block
+        int level = 0;
+        while ( level < nDims - 1
+                && first % strides[level + 1] == 0
+                && count >= strides[level + 1] ) {
+            level++;
+        }
+
+        int64_t posAtLevel = ( first / strides[level] ) % m_viewDims[level];
+        int64_t units = std::min( count / strides[level],
+                                  int64_t( m_viewDims[level] ) - posAtLevel );
+
+        for ( int i = 0 ; i < nDims ; i++ ) {
+            const auto & slice1d = m_appliedSlice.dims()[i];
+            int64_t pos = ( first / strides[i] ) % m_viewDims[i];
+            start( i ) = slice1d.start + pos * slice1d.step;
+            stride( i ) = slice1d.step;
+            if ( i < level ) {
+                shape( i ) = m_viewDims[i];
+            }
+            else if ( i == level ) {
+                shape( i ) = units;
+            }
+            else {
+                shape( i ) = 1;
+            }
         }
+
+        m_ccimage-> _readBox( start, shape, stride, dst );
+
+        int64_t n = shape.product();
+        dst += n;
+        first += n;
+        count -= n;
     }
-    casa_mutex.unlock();
-} // forEach
+} // _readRange
 
 template < typename PType >
 const Carta::Lib::NdArray::RawViewInterface::VI &
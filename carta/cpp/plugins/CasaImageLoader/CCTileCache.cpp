@@ -0,0 +1,134 @@
+/**
+ *
+ **/
+
+#include "CCTileCache.h"
+#include "CartaLib/MemoryBudget.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+/// cost of a tile in the QCache, in kilobytes (rounded up)
+int
+tileCost( const CCTileCache::Tile & tile )
+{
+    return static_cast < int > ( ( tile.size() + 1023 ) / 1024 );
+}
+}
+
+CCTileCache &
+CCTileCache::instance()
+{
+    static CCTileCache cache;
+    return cache;
+}
+
+CCTileCache::CCTileCache()
+{
+    // disabled until configured
+    m_cache.setMaxCost( 0 );
+    m_reclaimerId = Carta::Lib::MemoryBudget::instance().addReclaimer(
+        "CCTileCache", [this] ( qint64 wanted ) {
+            return _reclaim( wanted );
+        } );
+}
+
+CCTileCache::~CCTileCache()
+{
+    Carta::Lib::MemoryBudget::instance().removeReclaimer( m_reclaimerId );
+}
+
+void
+CCTileCache::setMaxBytes( qint64 maxBytes )
+{
+    QMutexLocker locker( & m_mutex );
+    if ( maxBytes < 0 ) {
+        maxBytes = 0;
+    }
+    int before = m_cache.count();
+    m_cache.setMaxCost( static_cast < int > ( maxBytes / 1024 ) );
+    m_stats.evictions += before - m_cache.count();
+    m_stats.maxBytes = maxBytes;
+    _account();
+    qDebug() << "CCTileCache budget set to" << maxBytes / ( 1024 * 1024 ) << "MB";
+}
+
+bool
+CCTileCache::isEnabled() const
+{
+    QMutexLocker locker( & m_mutex );
+    return m_cache.maxCost() > 0;
+}
+
+CCTileCache::TileSharedPtr
+CCTileCache::find( const QString & key )
+{
+    QMutexLocker locker( & m_mutex );
+    TileSharedPtr * tile = m_cache.object( key );
+    if ( tile == nullptr ) {
+        m_stats.misses++;
+        return nullptr;
+    }
+    m_stats.hits++;
+    return * tile;
+}
+
+void
+CCTileCache::insert( const QString & key, TileSharedPtr tile )
+{
+    if ( ! tile ) {
+        return;
+    }
+    QMutexLocker locker( & m_mutex );
+
+    // replacing a tile is not an eviction
+    int before = m_cache.count() - ( m_cache.contains( key ) ? 1 : 0 );
+    bool inserted = m_cache.insert( key, new TileSharedPtr( tile ), tileCost( * tile ) );
+    int after = m_cache.count();
+    m_stats.evictions += before + ( inserted ? 1 : 0 ) - after;
+    _account();
+}
+
+void
+CCTileCache::clear()
+{
+    QMutexLocker locker( & m_mutex );
+    m_cache.clear();
+    _account();
+}
+
+CCTileCache::Stats
+CCTileCache::stats() const
+{
+    QMutexLocker locker( & m_mutex );
+    Stats result = m_stats;
+    result.usedBytes = static_cast < qint64 > ( m_cache.totalCost() ) * 1024;
+    result.nTiles = m_cache.count();
+    return result;
+}
+
+qint64
+CCTileCache::_reclaim( qint64 wanted )
+{
+    QMutexLocker locker( & m_mutex );
+    qint64 before = m_accountedBytes;
+
+    // shrinking the budget evicts the least recently used tiles
+    int maxCost = m_cache.maxCost();
+    int count = m_cache.count();
+    qint64 keepKB = std::max < qint64 > ( 0, m_cache.totalCost() - ( wanted + 1023 ) / 1024 );
+    m_cache.setMaxCost( static_cast < int > ( keepKB ) );
+    m_cache.setMaxCost( maxCost );
+    m_stats.evictions += count - m_cache.count();
+
+    _account();
+    return before - m_accountedBytes;
+}
+
+void
+CCTileCache::_account()
+{
+    qint64 used = static_cast < qint64 > ( m_cache.totalCost() ) * 1024;
+    Carta::Lib::MemoryBudget::instance().account( used - m_accountedBytes );
+    m_accountedBytes = used;
+}
@@ -0,0 +1,106 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <memory>
+#include <vector>
+
+/// Process wide, byte bounded LRU cache of decoded image tiles.
+///
+/// All images opened by the CasaImageLoader plugin share this cache, so when
+/// several sessions look at the same file they only pay the I/O once. A tile is
+/// a TILE_SIZE x TILE_SIZE block of one plane (i.e. the first two axes, with
+/// fixed channel/stokes/... indices), stored in the native pixel type.
+///
+/// The tiles count towards the process wide Carta::Lib::MemoryBudget, which evicts
+/// tiles when it runs short.
+///
+/// Keys are built by the images, see CCImage::_tileKey(), and consist of the
+/// file path, its modification time, the indices of the plane and the tile.
+/// Reads of a few pixels that miss the cache don't load their tile, see
+/// CCImage::_readBox().
+class CCTileCache
+{
+    CLASS_BOILERPLATE( CCTileCache );
+
+public:
+
+    typedef std::vector < char > Tile;
+    typedef std::shared_ptr < const Tile > TileSharedPtr;
+
+    /// width and height of the tiles in pixels
+    static constexpr int TILE_SIZE = 512;
+
+    /// counters reported by stats()
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 evictions = 0;
+        qint64 usedBytes = 0;
+        qint64 maxBytes = 0;
+        int nTiles = 0;
+    };
+
+    /// the shared instance
+    static CCTileCache &
+    instance();
+
+    /// set the memory budget, 0 disables the cache
+    void
+    setMaxBytes( qint64 maxBytes );
+
+    /// is the cache enabled (i.e. the budget is not 0)
+    bool
+    isEnabled() const;
+
+    /// return the tile stored under the key, or nullptr on a miss
+    TileSharedPtr
+    find( const QString & key );
+
+    /// store a tile, least recently used tiles are evicted to stay within the budget
+    void
+    insert( const QString & key, TileSharedPtr tile );
+
+    /// remove all tiles
+    void
+    clear();
+
+    /// snapshot of the counters
+    Stats
+    stats() const;
+
+    ~CCTileCache();
+
+private:
+
+    CCTileCache();
+
+    /// evict least recently used tiles until wanted bytes are freed, for the
+    /// process wide memory budget
+    qint64
+    _reclaim( qint64 wanted );
+
+    /// report the change of the used memory since the last call to the memory budget,
+    /// must be called with m_mutex held
+    void
+    _account();
+
+    mutable QMutex m_mutex;
+
+    /// QCache costs are ints, so we count in kilobytes
+    QCache < QString, TileSharedPtr > m_cache;
+
+    Stats m_stats;
+
+    /// bytes reported to the memory budget
+    qint64 m_accountedBytes = 0;
+
+    /// id of the reclaimer registered with the memory budget
+    int m_reclaimerId = - 1;
+};
@@ -1,5 +1,6 @@
 #include "CasaImageLoader.h"
 #include "CCImage.h"
+#include "CCTileCache.h"
 #include "CartaLib/Hooks/Initialize.h"
 #include "CartaLib/Hooks/LoadAstroImage.h"
 #include <QDebug>
@@ -18,6 +19,8 @@
 #include <cstdint>
 #include "CartaLib/UtilCASA.h"
 
+const int CasaImageLoader::DEFAULT_TILE_CACHE_MB = 512;
+
 CasaImageLoader::CasaImageLoader(QObject *parent) :
     QObject(parent)
 {
@@ -46,6 +49,16 @@ bool CasaImageLoader::handleHook(BaseHook & hookData)
     return false;
 }
 
+void CasaImageLoader::initialize( const IPlugin::InitInfo & initInfo )
+{
+    // memory budget of the shared tile cache, 0 disables it
+    qint64 tileCacheMB = DEFAULT_TILE_CACHE_MB;
+    if ( initInfo.json.contains( "tileCacheMB" ) ) {
+        tileCacheMB = initInfo.json.value( "tileCacheMB" ).toInt( DEFAULT_TILE_CACHE_MB );
+    }
+    CCTileCache::instance().setMaxBytes( tileCacheMB * 1024 * 1024 );
+}
+
 std::vector<HookId> CasaImageLoader::getInitialHookList()
 {
     return {
@@ -18,6 +18,7 @@ public:
     CasaImageLoader(QObject *parent = 0);
     virtual bool handleHook(BaseHook & hookData) override;
     virtual std::vector<HookId> getInitialHookList() override;
+    virtual void initialize( const InitInfo & initInfo ) override;
     virtual ~CasaImageLoader();
 
 
@@ -26,6 +27,9 @@ public:
 
 private:
 
+    /// tile cache budget used when config.json does not specify one
+    static const int DEFAULT_TILE_CACHE_MB;
+
     Carta::Lib::Image::ImageInterface::SharedPtr loadImage(const QString & fname);
     QMutex mutex;
 };
@@ -12,6 +12,7 @@ SOURCES += \
     CCImage.cpp \
     CCMetaDataInterface.cpp \
     CCRawView.cpp \
+    CCTileCache.cpp \
     CCCoordinateFormatter.cpp
 
 HEADERS += \
@@ -19,6 +20,8 @@ HEADERS += \
     CCImage.h \
     CCMetaDataInterface.h \
     CCRawView.h \
+    CCPermutedImage.h \
+    CCTileCache.h \
     CCCoordinateFormatter.h
 
 casacoreLIBS += -L$${CASACOREDIR}/lib
@@ -0,0 +1,125 @@
+/**
+ * Copying big-endian FITS data into native (little-endian) buffers.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace FitsByteSwap
+{
+/// swap the bytes of a single element of size N (2, 4 or 8)
+template < int N >
+inline void
+swapOne( const char * src, char * dst );
+
+template < >
+inline void
+swapOne < 2 > ( const char * src, char * dst )
+{
+    uint16_t v;
+    std::memcpy( & v, src, 2 );
+    v = __builtin_bswap16( v );
+    std::memcpy( dst, & v, 2 );
+}
+
+template < >
+inline void
+swapOne < 4 > ( const char * src, char * dst )
+{
+    uint32_t v;
+    std::memcpy( & v, src, 4 );
+    v = __builtin_bswap32( v );
+    std::memcpy( dst, & v, 4 );
+}
+
+template < >
+inline void
+swapOne < 8 > ( const char * src, char * dst )
+{
+    uint64_t v;
+    std::memcpy( & v, src, 8 );
+    v = __builtin_bswap64( v );
+    std::memcpy( dst, & v, 8 );
+}
+
+#ifdef __SSE2__
+/// swap the bytes of each 16 bit word of a 128 bit register
+inline __m128i
+swap16( __m128i v )
+{
+    return _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+}
+
+/// swap 16 bytes worth of elements of size N (SSE2 only, no SSSE3 needed)
+template < int N >
+inline __m128i
+swapVector( __m128i v );
+
+template < >
+inline __m128i
+swapVector < 2 > ( __m128i v )
+{
+    return swap16( v );
+}
+
+template < >
+inline __m128i
+swapVector < 4 > ( __m128i v )
+{
+    v = swap16( v );
+    v = _mm_shufflelo_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    return _mm_shufflehi_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+}
+
+template < >
+inline __m128i
+swapVector < 8 > ( __m128i v )
+{
+    v = swap16( v );
+    v = _mm_shufflelo_epi16( v, _MM_SHUFFLE( 0, 1, 2, 3 ) );
+    return _mm_shufflehi_epi16( v, _MM_SHUFFLE( 0, 1, 2, 3 ) );
+}
+#endif
+
+/// copy count contiguous elements of size N from src to dst, swapping the
+/// byte order of every element
+template < int N >
+inline void
+swapCopy( const char * src, char * dst, int64_t count )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    // 16 bytes at a time, unaligned loads/stores since the mmapped data
+    // starts at arbitrary 2880 byte block boundaries
+    const int64_t perVector = 16 / N;
+    for ( ; i + perVector <= count ; i += perVector ) {
+        __m128i v = _mm_loadu_si128( reinterpret_cast < const __m128i * > ( src + i * N ) );
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( dst + i * N ), swapVector < N > ( v ) );
+    }
+#endif
+    for ( ; i < count ; i++ ) {
+        swapOne < N > ( src + i * N, dst + i * N );
+    }
+}
+
+/// copy count elements of size N that are 'stride' elements apart in src into
+/// contiguous dst, swapping the byte order of every element
+template < int N >
+inline void
+swapGather( const char * src, int64_t stride, char * dst, int64_t count )
+{
+    if ( stride == 1 ) {
+        swapCopy < N > ( src, dst, count );
+        return;
+    }
+    for ( int64_t i = 0 ; i < count ; i++ ) {
+        swapOne < N > ( src + i * stride * N, dst + i * N );
+    }
+}
+}
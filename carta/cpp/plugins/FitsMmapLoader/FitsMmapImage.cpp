@@ -0,0 +1,322 @@
+#include "FitsMmapImage.h"
+#include "CartaLib/UtilCASA.h"
+#include <casacore/casa/Containers/Record.h>
+#include <casacore/casa/Exceptions/Error.h>
+#include <casacore/coordinates/Coordinates/FITSCoordinateUtil.h>
+#include <casacore/images/Images/FITSImage.h>
+#include <QDebug>
+#include <QMap>
+#include <QMutexLocker>
+#include <set>
+
+namespace
+{
+/// FITS files are made of blocks of this many bytes
+const qint64 FITS_BLOCK = 2880;
+
+/// each header card has this many characters
+const int FITS_CARD = 80;
+
+/// Read the header of the primary HDU, one card per entry (without END).
+/// Returns false if this is not a FITS file or the header is truncated.
+bool
+readHeader( QFile & file, QStringList & cards, qint64 & headerBytes )
+{
+    headerBytes = 0;
+    while ( true ) {
+        QByteArray block = file.read( FITS_BLOCK );
+        if ( block.size() != FITS_BLOCK ) {
+            return false;
+        }
+        headerBytes += FITS_BLOCK;
+        if ( headerBytes == FITS_BLOCK && ! block.startsWith( "SIMPLE  =" ) ) {
+            return false;
+        }
+        for ( int i = 0 ; i < FITS_BLOCK ; i += FITS_CARD ) {
+            QString card = QString::fromLatin1( block.constData() + i, FITS_CARD );
+            if ( card.left( 8 ).trimmed() == "END" ) {
+                return true;
+            }
+            cards.append( card );
+        }
+    }
+}
+
+/// Returns the value of a header card, with the comment and (for strings) the
+/// quotes removed. Cards without a value return a null string.
+QString
+cardValue( const QString & card )
+{
+    if ( card.mid( 8, 2 ) != "= " ) {
+        return QString();
+    }
+    QString value = card.mid( 10 ).trimmed();
+    if ( value.startsWith( '\'' ) ) {
+        // quoted string, '' stands for a single quote
+        QString result;
+        for ( int i = 1 ; i < value.size() ; i++ ) {
+            if ( value[i] == '\'' ) {
+                if ( i + 1 < value.size() && value[i + 1] == '\'' ) {
+                    result += '\'';
+                    i++;
+                    continue;
+                }
+                break;
+            }
+            result += value[i];
+        }
+        return result.trimmed();
+    }
+    int slash = value.indexOf( '/' );
+    if ( slash >= 0 ) {
+        value = value.left( slash );
+    }
+    return value.trimmed();
+}
+}
+
+FitsMmapImage::Shared::~Shared()
+{ }
+
+FitsMmapImage::SharedPtr
+FitsMmapImage::create( const QString & fname )
+{
+    auto file = std::make_shared < FitsMmapFile > ( fname );
+    if ( ! file-> file.open( QIODevice::ReadOnly ) ) {
+        return nullptr;
+    }
+
+    QStringList cards;
+    qint64 headerBytes = 0;
+    if ( ! readHeader( file-> file, cards, headerBytes ) ) {
+        return nullptr;
+    }
+
+    // first occurrence of each keyword wins
+    QMap < QString, QString > keywords;
+    for ( const QString & card : cards ) {
+        QString key = card.left( 8 ).trimmed();
+        if ( ! key.isEmpty() && ! keywords.contains( key ) ) {
+            keywords[key] = cardValue( card );
+        }
+    }
+
+    // anything we can't read directly is left to casacore
+    if ( keywords.value( "SIMPLE" ) != "T" || keywords.value( "GROUPS" ) == "T" ) {
+        qDebug() << "FitsMmapImage: not a simple FITS image" << fname;
+        return nullptr;
+    }
+    Carta::Lib::Image::PixelType pixelType;
+    int bitpix = keywords.value( "BITPIX" ).toInt();
+    switch ( bitpix ) {
+    case - 32:
+        pixelType = Carta::Lib::Image::PixelType::Real32;
+        break;
+    case - 64:
+        pixelType = Carta::Lib::Image::PixelType::Real64;
+        break;
+    case 16:
+        pixelType = Carta::Lib::Image::PixelType::Int16;
+        break;
+    case 32:
+        pixelType = Carta::Lib::Image::PixelType::Int32;
+        break;
+    default:
+        qDebug() << "FitsMmapImage: unsupported BITPIX" << bitpix;
+        return nullptr;
+    }
+    if ( ( keywords.contains( "BSCALE" ) && keywords.value( "BSCALE" ).toDouble() != 1.0 ) ||
+         ( keywords.contains( "BZERO" ) && keywords.value( "BZERO" ).toDouble() != 0.0 ) ||
+         keywords.contains( "BLANK" ) ) {
+        qDebug() << "FitsMmapImage: scaled or blanked data not supported";
+        return nullptr;
+    }
+
+    // the data unit has to be in the primary HDU
+    int naxis = keywords.value( "NAXIS" ).toInt();
+    if ( naxis < 2 ) {
+        qDebug() << "FitsMmapImage: no image in the primary HDU";
+        return nullptr;
+    }
+    std::vector < int > dims;
+    int64_t nPixels = 1;
+    for ( int i = 1 ; i <= naxis ; i++ ) {
+        int n = keywords.value( QString( "NAXIS%1" ).arg( i ) ).toInt();
+        if ( n < 1 ) {
+            return nullptr;
+        }
+        dims.push_back( n );
+        nPixels *= n;
+    }
+    int64_t dataBytes = nPixels * ( std::abs( bitpix ) / 8 );
+    if ( file-> file.size() < headerBytes + dataBytes ) {
+        qWarning() << "FitsMmapImage: truncated file" << fname;
+        return nullptr;
+    }
+
+    // coordinate system from the header cards, the same way casacore's
+    // FITSImage does it
+    std::shared_ptr < casacore::CoordinateSystem > casaCS;
+    casa_mutex.lock();
+    try {
+        casacore::Vector < casacore::String > header( cards.size() );
+        for ( int i = 0 ; i < cards.size() ; i++ ) {
+            header[i] = cards[i].toStdString();
+        }
+        casacore::IPosition shape( naxis );
+        for ( int i = 0 ; i < naxis ; i++ ) {
+            shape[i] = dims[i];
+        }
+        casacore::Int stokesFITSValue = 1;
+        casacore::Record headerRec;
+        casaCS = std::make_shared < casacore::CoordinateSystem > ();
+        casacore::FITSCoordinateUtil fcu;
+        if ( ! fcu.fromFITSHeader( stokesFITSValue, * casaCS, headerRec, header, shape, 0 ) ||
+             int( casaCS-> nPixelAxes() ) != naxis ) {
+            casaCS = nullptr;
+        }
+    }
+    catch ( const casacore::AipsError & err ) {
+        qDebug() << "FitsMmapImage: coordinate system failed" << err.getMesg().c_str();
+        casaCS = nullptr;
+    }
+    casa_mutex.unlock();
+    if ( ! casaCS ) {
+        return nullptr;
+    }
+
+    file-> mapped = file-> file.map( headerBytes, dataBytes );
+    if ( ! file-> mapped ) {
+        qWarning() << "FitsMmapImage: could not map" << fname << file-> file.errorString();
+        return nullptr;
+    }
+
+    FitsMmapImage::SharedPtr img = std::make_shared < FitsMmapImage > ();
+    img-> m_shared = std::make_shared < Shared > ();
+    img-> m_shared-> file = file;
+    img-> m_shared-> pixelType = pixelType;
+    img-> m_shared-> hasBeam = keywords.contains( "BMAJ" );
+    QString unit = keywords.value( "BUNIT" );
+    if ( unit.toUpper() == "JY/BEAM" ) {
+        unit = "Jy/beam";
+    }
+    img-> m_shared-> unit = Carta::Lib::Unit( unit );
+
+    // FITS stores the first axis fastest
+    img-> m_dims = dims;
+    int64_t stride = 1;
+    for ( int i = 0 ; i < naxis ; i++ ) {
+        img-> m_strides.push_back( stride );
+        stride *= dims[i];
+    }
+
+    QString htmlTitle = keywords.value( "OBJECT" ).toHtmlEscaped();
+    img-> m_meta = std::make_shared < CCMetaDataInterface > ( htmlTitle, casaCS );
+
+    qDebug() << "FitsMmapImage: mapped" << fname << "BITPIX" << bitpix;
+    return img;
+} // create
+
+std::shared_ptr < Carta::Lib::Image::ImageInterface >
+FitsMmapImage::getPermuted( const std::vector < int > & indices )
+{
+    int indexCount = indices.size();
+    CARTA_ASSERT( int( m_dims.size() ) == indexCount );
+    std::set < int > usedIndices;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        CARTA_ASSERT( 0 <= indices[i] && indices[i] < indexCount );
+        CARTA_ASSERT( usedIndices.count( indices[i] ) == 0 );
+        usedIndices.insert( indices[i] );
+    }
+
+    // nothing to do for the identity permutation
+    bool isIdentity = true;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        if ( indices[i] != i ) {
+            isIdentity = false;
+            break;
+        }
+    }
+    if ( isIdentity ) {
+        return shared_from_this();
+    }
+
+    // change the order of the axes in the coordinate system
+    casacore::Vector < int > newOrder( indexCount );
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        newOrder[i] = indices[i];
+    }
+    casa_mutex.lock();
+    std::shared_ptr < casacore::CoordinateSystem > coordSys(
+        new casacore::CoordinateSystem( * m_meta-> getCoordinateSystem() ) );
+    coordSys-> transpose( newOrder, newOrder );
+    casa_mutex.unlock();
+
+    // permuting only reorders the strides, the data is not touched
+    FitsMmapImage::SharedPtr img = std::make_shared < FitsMmapImage > ();
+    img-> m_shared = m_shared;
+    img-> m_isPermuted = true;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        img-> m_dims.push_back( m_dims[indices[i]] );
+        img-> m_strides.push_back( m_strides[indices[i]] );
+    }
+    img-> m_meta = std::make_shared < CCMetaDataInterface > (
+        m_meta-> title( Carta::Lib::TextFormat::Html ), coordSys );
+    return img;
+} // getPermuted
+
+Carta::Lib::NdArray::RawViewInterface *
+FitsMmapImage::getDataSlice( const SliceND & sliceInfo )
+{
+    const auto & file = m_shared-> file;
+    switch ( m_shared-> pixelType ) {
+    case Carta::Lib::Image::PixelType::Real32:
+        return new FitsMmapRawView < float > ( file, m_shared-> pixelType, 0, m_strides, m_dims, sliceInfo );
+    case Carta::Lib::Image::PixelType::Real64:
+        return new FitsMmapRawView < double > ( file, m_shared-> pixelType, 0, m_strides, m_dims, sliceInfo );
+    case Carta::Lib::Image::PixelType::Int16:
+        return new FitsMmapRawView < int16_t > ( file, m_shared-> pixelType, 0, m_strides, m_dims, sliceInfo );
+    case Carta::Lib::Image::PixelType::Int32:
+        return new FitsMmapRawView < int32_t > ( file, m_shared-> pixelType, 0, m_strides, m_dims, sliceInfo );
+    default:
+        qFatal( "FitsMmapImage: unexpected pixel type" );
+    }
+    return nullptr;
+}
+
+casacore::FITSImage *
+FitsMmapImage::_casaImage() const
+{
+    if ( ! m_shared-> casaImage ) {
+        try {
+            m_shared-> casaImage.reset(
+                new casacore::FITSImage( m_shared-> file-> file.fileName().toStdString() ) );
+        }
+        catch ( const casacore::AipsError & err ) {
+            qWarning() << "FitsMmapImage: casacore could not open"
+                       << m_shared-> file-> file.fileName() << err.getMesg().c_str();
+        }
+    }
+    return m_shared-> casaImage.get();
+}
+
+casacore::LatticeBase *
+FitsMmapImage::getCasaImage()
+{
+    if ( m_isPermuted ) {
+        return nullptr;
+    }
+    QMutexLocker locker( & casa_mutex );
+    return _casaImage();
+}
+
+casacore::ImageInfo
+FitsMmapImage::getImageInfo() const
+{
+    QMutexLocker locker( & casa_mutex );
+    casacore::FITSImage * casaImage = _casaImage();
+    if ( ! casaImage ) {
+        return casacore::ImageInfo();
+    }
+    return casaImage-> imageInfo();
+}
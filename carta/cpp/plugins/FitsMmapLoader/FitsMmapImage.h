@@ -0,0 +1,165 @@
+/**
+ * Image interface backed by a memory mapped FITS file.
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IImage.h"
+#include "FitsMmapRawView.h"
+#include "plugins/CasaImageLoader/CCImage.h"
+#include "plugins/CasaImageLoader/CCMetaDataInterface.h"
+
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+namespace casacore
+{
+class FITSImage;
+}
+
+/// Image interface that reads the primary data unit of a FITS file directly from
+/// a memory mapping, without going through casacore.
+///
+/// Only simple files are handled here (see create()), everything else is left to
+/// the CasaImageLoader plugin. casacore is still used for the coordinate system,
+/// and a casacore::FITSImage is opened lazily for the code that needs the real
+/// casacore image (header export, spectral profiles). It is a CCImageBase so that
+/// such code can find it.
+class FitsMmapImage
+    : public CCImageBase
+      , public std::enable_shared_from_this < FitsMmapImage >
+{
+    CLASS_BOILERPLATE( FitsMmapImage );
+
+public:
+
+    /// Try to open the file. Returns nullptr if the file is not a FITS file, or if
+    /// it uses features this class does not support.
+    static FitsMmapImage::SharedPtr
+    create( const QString & fname );
+
+    virtual const Carta::Lib::Unit &
+    getPixelUnit() const override
+    {
+        return m_shared-> unit;
+    }
+
+    virtual const QString &
+    getType() const override
+    {
+        return m_type;
+    }
+
+    virtual std::shared_ptr < Carta::Lib::Image::ImageInterface >
+    getPermuted( const std::vector < int > & indices ) override;
+
+    virtual const std::vector < int > &
+    dims() const override
+    {
+        return m_dims;
+    }
+
+    virtual bool
+    hasMask() const override
+    {
+        return false;
+    }
+
+    virtual bool
+    hasBeam() const override
+    {
+        return m_shared-> hasBeam;
+    }
+
+    virtual bool
+    hasErrorsInfo() const override
+    {
+        return false;
+    }
+
+    virtual Carta::Lib::Image::PixelType
+    pixelType() const override
+    {
+        return m_shared-> pixelType;
+    }
+
+    /// there are no errors, see hasErrorsInfo()
+    virtual Carta::Lib::Image::PixelType
+    errorType() const override
+    {
+        return Carta::Lib::Image::PixelType::Other;
+    }
+
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getDataSlice( const SliceND & sliceInfo ) override;
+
+    /// there is no mask, see hasMask()
+    virtual Carta::Lib::NdArray::Byte *
+    getMaskSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    /// there are no errors, see hasErrorsInfo()
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getErrorSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    virtual Carta::Lib::Image::MetaDataInterface::SharedPtr
+    metaData() override
+    {
+        return m_meta;
+    }
+
+    /// opens the file with casacore on first use, returns nullptr for permuted
+    /// images since their axes no longer match the file
+    virtual casacore::LatticeBase *
+    getCasaImage() override;
+
+    virtual casacore::ImageInfo
+    getImageInfo() const override;
+
+    /// do not use this, use create() instead
+    FitsMmapImage() { }
+
+protected:
+
+    /// state shared between an image and its permuted versions
+    struct Shared
+    {
+        FitsMmapFile::SharedPtr file;
+        Carta::Lib::Image::PixelType pixelType;
+        Carta::Lib::Unit unit;
+        bool hasBeam = false;
+
+        /// lazily opened casacore image, guarded by casa_mutex
+        std::unique_ptr < casacore::FITSImage > casaImage;
+
+        ~Shared();
+    };
+
+    /// make sure the casacore image is open, must be called with casa_mutex held
+    casacore::FITSImage *
+    _casaImage() const;
+
+    std::shared_ptr < Shared > m_shared;
+
+    /// dimensions of this (possibly permuted) image
+    std::vector < int > m_dims;
+
+    /// element strides of the axes of this image in the file
+    std::vector < int64_t > m_strides;
+
+    /// true if the axes are not in file order
+    bool m_isPermuted = false;
+
+    CCMetaDataInterface::SharedPtr m_meta;
+    QString m_type = "FITSImage";
+};
@@ -0,0 +1,42 @@
+#include "FitsMmapLoader.h"
+#include "FitsMmapImage.h"
+#include "CartaLib/Hooks/LoadAstroImage.h"
+#include <QDebug>
+#include <QFileInfo>
+
+FitsMmapLoader::FitsMmapLoader(QObject *parent) :
+    QObject(parent)
+{
+}
+
+bool FitsMmapLoader::handleHook(BaseHook & hookData)
+{
+    if(hookData.is<Carta::Lib::Hooks::LoadAstroImage>()) {
+        Carta::Lib::Hooks::LoadAstroImage & hook
+                = static_cast<Carta::Lib::Hooks::LoadAstroImage &>(hookData);
+        auto fname = hook.paramsPtr->fileName;
+
+        // casa images are directories, leave those (and anything else that is
+        // not a plain file) to the other loaders
+        if( ! QFileInfo( fname).isFile()) {
+            return false;
+        }
+        hook.result = FitsMmapImage::create( fname);
+        // returning false lets the next loader (casacore) try the file
+        return hook.result != nullptr;
+    }
+
+    qWarning() << "Sorry, FitsMmapLoader doesn't know how to handle this hook";
+    return false;
+}
+
+std::vector<HookId> FitsMmapLoader::getInitialHookList()
+{
+    return {
+        Carta::Lib::Hooks::LoadAstroImage::staticId
+    };
+}
+
+FitsMmapLoader::~FitsMmapLoader()
+{
+}
@@ -0,0 +1,22 @@
+/// This plugin reads simple FITS images directly from a memory mapping, anything
+/// it can't handle is left to the CasaImageLoader plugin.
+
+#pragma once
+
+#include "CartaLib/IPlugin.h"
+#include <QObject>
+#include <QString>
+
+class FitsMmapLoader : public QObject, public IPlugin
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID "org.cartaviewer.IPlugin")
+    Q_INTERFACES( IPlugin)
+
+public:
+
+    FitsMmapLoader(QObject *parent = 0);
+    virtual bool handleHook(BaseHook & hookData) override;
+    virtual std::vector<HookId> getInitialHookList() override;
+    virtual ~FitsMmapLoader();
+};
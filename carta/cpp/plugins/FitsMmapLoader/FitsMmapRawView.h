@@ -0,0 +1,299 @@
+/**
+ * Raw view into a memory mapped FITS data unit.
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IImage.h"
+#include "FitsByteSwap.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/// The primary data unit of a FITS file mapped into memory. Shared by the image,
+/// all its permuted versions and all raw views, so the mapping stays alive for
+/// as long as anyone can read from it.
+struct FitsMmapFile
+{
+    CLASS_BOILERPLATE( FitsMmapFile );
+
+    FitsMmapFile( const QString & path ) : file( path ) { }
+
+    ~FitsMmapFile()
+    {
+        if ( mapped ) {
+            file.unmap( mapped );
+        }
+    }
+
+    QFile file;
+
+    /// start of the mapping, i.e. of the first pixel
+    uchar * mapped = nullptr;
+
+    /// start of the first pixel
+    const char *
+    data() const
+    {
+        return reinterpret_cast < const char * > ( mapped );
+    }
+};
+
+/// Raw view into a FitsMmapFile.
+///
+/// A view is just an element offset plus a stride and a count for each of its
+/// axes, so slicing and permuting never touch the data. Reading copies runs
+/// along the first axis of the view out of the mapping, swapping the bytes
+/// (big-endian on disk) as it goes.
+template < typename PType >
+class FitsMmapRawView
+    : public Carta::Lib::NdArray::RawViewInterface
+{
+public:
+
+    /// \param file the mapped file
+    /// \param pixelType pixel type of the file
+    /// \param offset element offset of the origin of the parent
+    /// \param strides element strides of the axes of the parent
+    /// \param dims dimensions of the parent
+    /// \param sliceInfo which part of the parent to view
+    FitsMmapRawView( FitsMmapFile::SharedPtr file,
+                     PixelType pixelType,
+                     int64_t offset,
+                     const std::vector < int64_t > & strides,
+                     const VI & dims,
+                     const SliceND & sliceInfo )
+    {
+        m_file = file;
+        m_pixelType = pixelType;
+        m_offset = offset;
+        SliceND::ApplyResult ar = sliceInfo.apply( dims );
+        for ( size_t i = 0 ; i < dims.size() ; i++ ) {
+            const auto & slice1d = ar.dims()[i];
+            m_offset += slice1d.start * strides[i];
+            m_strides.push_back( strides[i] * slice1d.step );
+            m_viewDims.push_back( slice1d.count );
+        }
+        m_pos.resize( m_viewDims.size(), 0 );
+        m_currentPos.resize( m_viewDims.size(), 0 );
+    }
+
+    virtual PixelType
+    pixelType() override
+    {
+        return m_pixelType;
+    }
+
+    virtual const VI &
+    dims() override
+    {
+        return m_viewDims;
+    }
+
+    virtual const char *
+    get( const VI & pos ) override
+    {
+        int64_t ind = m_offset;
+        for ( size_t i = 0 ; i < pos.size() ; i++ ) {
+            ind += pos[i] * m_strides[i];
+        }
+        FitsByteSwap::swapOne < sizeof( PType ) > (
+            m_file-> data() + ind * sizeof( PType ),
+            reinterpret_cast < char * > ( & m_buff ) );
+        return reinterpret_cast < const char * > ( & m_buff );
+    }
+
+    virtual void
+    forEach( std::function < void (const char *) > func, Traversal traversal ) override
+    {
+        // the pixels come in sequential order, the position advances like an odometer
+        m_currentPos.assign( m_viewDims.size(), 0 );
+        auto wrapper = [this, & func] ( const char * ptr, int64_t count ) {
+            const PType * vals = reinterpret_cast < const PType * > ( ptr );
+            for ( int64_t i = 0 ; i < count ; i++ ) {
+                func( reinterpret_cast < const char * > ( vals + i ) );
+                for ( size_t d = 0 ; d < m_currentPos.size() ; d++ ) {
+                    if ( ++ m_currentPos[d] < m_viewDims[d] ) {
+                        break;
+                    }
+                    m_currentPos[d] = 0;
+                }
+            }
+        };
+        forEach( 64 * 1024 * sizeof( PType ), wrapper, nullptr, traversal );
+    }
+
+    /// the position of the pixel passed to the callback of the per pixel forEach()
+    virtual const VI &
+    currentPos() override
+    {
+        return m_currentPos;
+    }
+
+    virtual RawViewInterface *
+    getView( const SliceND & sliceInfo ) override
+    {
+        return new FitsMmapRawView( m_file, m_pixelType, m_offset, m_strides, m_viewDims, sliceInfo );
+    }
+
+    virtual int64_t
+    read( int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override
+    {
+        Q_UNUSED( traversal );
+        CARTA_ASSERT( buff != nullptr );
+        int64_t count = std::min( int64_t( buffSize / sizeof( PType ) ), _nPixels() - m_readPos );
+        if ( count <= 0 ) {
+            return 0;
+        }
+        _readRange( m_readPos, count, reinterpret_cast < PType * > ( buff ) );
+        m_readPos += count;
+        return count * sizeof( PType );
+    }
+
+    virtual void
+    seek( int64_t ind ) override
+    {
+        CARTA_ASSERT( ind >= 0 );
+        m_readPos = ind;
+    }
+
+    virtual int64_t
+    read( int64_t chunk, int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override
+    {
+        Q_UNUSED( traversal );
+        CARTA_ASSERT( buff != nullptr );
+        int64_t buffCount = buffSize / sizeof( PType );
+        int64_t first = chunk * buffCount;
+        int64_t count = std::min( buffCount, _nPixels() - first );
+        if ( chunk < 0 || count <= 0 ) {
+            return 0;
+        }
+        _readRange( first, count, reinterpret_cast < PType * > ( buff ) );
+        return count * sizeof( PType );
+    }
+
+    virtual void
+    forEach( int64_t buffSize,
+             std::function < void (const char *, int64_t count) > func,
+             char * buff = nullptr,
+             Traversal traversal = Traversal::Sequential ) override
+    {
+        // the mapping is random access, sequential order is as good as any
+        Q_UNUSED( traversal );
+
+        int64_t buffCount = buffSize / sizeof( PType );
+        if ( buffCount < 1 ) {
+            qWarning() << "FitsMmapRawView::forEach buffer too small" << buffSize;
+            return;
+        }
+        std::vector < PType > ownBuffer;
+        PType * dst = reinterpret_cast < PType * > ( buff );
+        if ( dst == nullptr ) {
+            ownBuffer.resize( buffCount );
+            dst = ownBuffer.data();
+        }
+
+        int64_t nPixels = _nPixels();
+        for ( int64_t first = 0 ; first < nPixels ; first += buffCount ) {
+            int64_t count = std::min( buffCount, nPixels - first );
+            _readRange( first, count, dst );
+            func( reinterpret_cast < const char * > ( dst ), count );
+        }
+    }
+
+    virtual int64_t
+    readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff ) override
+    {
+        count = _lineCount( pos, axis, count, step );
+        if ( count <= 0 ) {
+            return 0;
+        }
+        int64_t ind = m_offset;
+        for ( size_t i = 0 ; i < pos.size() ; i++ ) {
+            ind += pos[i] * m_strides[i];
+        }
+        FitsByteSwap::swapGather < sizeof( PType ) > (
+            m_file-> data() + ind * sizeof( PType ), m_strides[axis] * step, buff, count );
+        return count;
+    }
+
+protected:
+
+    /// total number of pixels in this view
+    int64_t
+    _nPixels() const
+    {
+        if ( m_viewDims.empty() ) {
+            return 0;
+        }
+        int64_t n = 1;
+        for ( auto d : m_viewDims ) {
+            n *= d;
+        }
+        return n;
+    }
+
+    /// copy count pixels starting at (c-order, first axis fastest) index first
+    /// into dst, one run along the first axis at a time
+    void
+    _readRange( int64_t first, int64_t count, PType * dst )
+    {
+        int nDims = m_viewDims.size();
+        for ( int i = 0 ; i < nDims ; i++ ) {
+            m_pos[i] = first % m_viewDims[i];
+            first /= m_viewDims[i];
+        }
+        const char * data = m_file-> data();
+        char * out = reinterpret_cast < char * > ( dst );
+        while ( count > 0 ) {
+            int64_t run = std::min( int64_t( m_viewDims[0] - m_pos[0] ), count );
+            int64_t ind = m_offset;
+            for ( int i = 0 ; i < nDims ; i++ ) {
+                ind += m_pos[i] * m_strides[i];
+            }
+            FitsByteSwap::swapGather < sizeof( PType ) > (
+                data + ind * sizeof( PType ), m_strides[0], out, run );
+            out += run * sizeof( PType );
+            count -= run;
+
+            // advance to the start of the next run
+            m_pos[0] = 0;
+            for ( int i = 1 ; i < nDims ; i++ ) {
+                if ( ++ m_pos[i] < m_viewDims[i] ) {
+                    break;
+                }
+                m_pos[i] = 0;
+            }
+        }
+    }
+
+    FitsMmapFile::SharedPtr m_file;
+    PixelType m_pixelType;
+
+    /// element offset of the origin of this view
+    int64_t m_offset = 0;
+
+    /// element strides of the axes of this view
+    std::vector < int64_t > m_strides;
+
+    VI m_viewDims;
+
+    /// scratch position used by _readRange()
+    VI m_pos;
+
+    /// position of the next read()
+    int64_t m_readPos = 0;
+
+    /// position of the current pixel of the per pixel forEach()
+    VI m_currentPos;
+
+    /// buffer for get()
+    PType m_buff;
+};
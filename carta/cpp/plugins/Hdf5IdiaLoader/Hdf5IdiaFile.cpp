@@ -0,0 +1,346 @@
+#include "Hdf5IdiaFile.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace
+{
+/// chunk cache of the full resolution dataset, enough for a row of chunks of
+/// typical images
+const size_t MIN_CHUNK_CACHE = 4 * 1024 * 1024;
+const size_t MAX_CHUNK_CACHE = 256 * 1024 * 1024;
+
+/// Open a dataset and look up its shape. Returns an id of -1 if the dataset does
+/// not exist or does not hold floats.
+Hdf5IdiaDataset
+openDataset( hid_t group, const char * name, hid_t accessList = H5P_DEFAULT )
+{
+    Hdf5IdiaDataset result;
+    if ( H5Lexists( group, name, H5P_DEFAULT ) <= 0 ) {
+        return result;
+    }
+    hid_t id = H5Dopen2( group, name, accessList );
+    if ( id < 0 ) {
+        return result;
+    }
+
+    hid_t type = H5Dget_type( id );
+    bool isFloat = H5Tget_class( type ) == H5T_FLOAT && H5Tget_size( type ) == 4;
+    H5Tclose( type );
+    if ( ! isFloat ) {
+        qWarning() << "Hdf5IdiaFile: dataset" << name << "does not hold 32 bit floats";
+        H5Dclose( id );
+        return result;
+    }
+
+    hid_t space = H5Dget_space( id );
+    int rank = H5Sget_simple_extent_ndims( space );
+    std::vector < hsize_t > dims( std::max( rank, 0 ) );
+    H5Sget_simple_extent_dims( space, dims.data(), nullptr );
+    H5Sclose( space );
+
+    hid_t createList = H5Dget_create_plist( id );
+    std::vector < hsize_t > chunk;
+    if ( H5Pget_layout( createList ) == H5D_CHUNKED ) {
+        chunk.resize( rank );
+        H5Pget_chunk( createList, rank, chunk.data() );
+    }
+    H5Pclose( createList );
+
+    // HDF5 lists the slowest axis first
+    result.id = id;
+    result.dims.assign( dims.rbegin(), dims.rend() );
+    result.chunk.assign( chunk.rbegin(), chunk.rend() );
+    return result;
+}
+
+void
+closeDataset( Hdf5IdiaDataset & dataset )
+{
+    if ( dataset.id >= 0 ) {
+        H5Dclose( dataset.id );
+        dataset.id = - 1;
+    }
+}
+
+/// Write a value the way it would appear in a FITS card. Values that were
+/// stored as strings but look like numbers or logicals stay unquoted, since
+/// older converters stored every keyword as a string.
+QString
+cardValue( const QString & value, bool isString )
+{
+    if ( ! isString || value == "T" || value == "F" ) {
+        return value;
+    }
+    bool isNumber = false;
+    value.toDouble( & isNumber );
+    if ( isNumber ) {
+        return value;
+    }
+    QString quoted = value;
+    quoted.replace( "'", "''" );
+    return "'" + quoted + "'";
+}
+
+/// turn each scalar attribute of the group into a header card
+herr_t
+collectCard( hid_t location, const char * name, const H5A_info_t * info, void * data )
+{
+    Q_UNUSED( info );
+    QStringList * cards = static_cast < QStringList * > ( data );
+    QString key = QString::fromLatin1( name ).trimmed();
+    if ( key.isEmpty() || key.size() > 8 || key == "END" ) {
+        return 0;
+    }
+
+    hid_t attr = H5Aopen( location, name, H5P_DEFAULT );
+    if ( attr < 0 ) {
+        return 0;
+    }
+    hid_t type = H5Aget_type( attr );
+    QString value;
+    bool isString = false;
+    bool valid = true;
+    switch ( H5Tget_class( type ) ) {
+    case H5T_STRING:
+    {
+        isString = true;
+        if ( H5Tis_variable_str( type ) > 0 ) {
+            char * str = nullptr;
+            hid_t memType = H5Tcopy( H5T_C_S1 );
+            H5Tset_size( memType, H5T_VARIABLE );
+            valid = H5Aread( attr, memType, & str ) >= 0 && str;
+            if ( valid ) {
+                value = QString::fromLatin1( str );
+                H5free_memory( str );
+            }
+            H5Tclose( memType );
+        }
+        else {
+            std::vector < char > str( H5Tget_size( type ) + 1, 0 );
+            valid = H5Aread( attr, type, str.data() ) >= 0;
+            value = QString::fromLatin1( str.data() );
+        }
+        value = value.trimmed();
+        break;
+    }
+    case H5T_INTEGER:
+    {
+        long long number = 0;
+        valid = H5Aread( attr, H5T_NATIVE_LLONG, & number ) >= 0;
+        value = QString::number( number );
+        break;
+    }
+    case H5T_FLOAT:
+    {
+        double number = 0;
+        valid = H5Aread( attr, H5T_NATIVE_DOUBLE, & number ) >= 0;
+        value = QString::number( number, 'g', 17 );
+        break;
+    }
+    default:
+        valid = false;
+    }
+    H5Tclose( type );
+    H5Aclose( attr );
+
+    if ( valid ) {
+        QString card = key.leftJustified( 8, ' ' ) + "= " + cardValue( value, isString );
+        cards-> append( card.leftJustified( 80, ' ', true ) );
+    }
+    return 0;
+} // collectCard
+}
+
+QMutex &
+hdf5Mutex()
+{
+    static QMutex mutex;
+    return mutex;
+}
+
+Hdf5IdiaFile::~Hdf5IdiaFile()
+{
+    // open() closes the ids of a file it gives up on itself, while it holds the lock
+    if ( file < 0 ) {
+        return;
+    }
+    QMutexLocker locker( & hdf5Mutex() );
+    _close();
+}
+
+void
+Hdf5IdiaFile::_close()
+{
+    closeDataset( data );
+    closeDataset( swizzled );
+    for ( auto & mip : mips ) {
+        closeDataset( mip.second );
+    }
+    mips.clear();
+    if ( group >= 0 ) {
+        H5Gclose( group );
+        group = - 1;
+    }
+    if ( file >= 0 ) {
+        H5Fclose( file );
+        file = - 1;
+    }
+}
+
+Hdf5IdiaFile::SharedPtr
+Hdf5IdiaFile::open( const QString & fname )
+{
+    QMutexLocker locker( & hdf5Mutex() );
+    QByteArray path = fname.toLocal8Bit();
+
+    // probing files is expected to fail, keep HDF5 quiet about it
+    H5Eset_auto2( H5E_DEFAULT, nullptr, nullptr );
+    if ( H5Fis_hdf5( path.constData() ) <= 0 ) {
+        return nullptr;
+    }
+
+    // the destructor would wait for the lock held here, so the failures close the ids first
+    Hdf5IdiaFile::SharedPtr result = std::make_shared < Hdf5IdiaFile > ();
+    auto fail = [&result] () -> Hdf5IdiaFile::SharedPtr {
+        result-> _close();
+        return nullptr;
+    };
+    result-> file = H5Fopen( path.constData(), H5F_ACC_RDONLY, H5P_DEFAULT );
+    if ( result-> file < 0 || H5Lexists( result-> file, "0", H5P_DEFAULT ) <= 0 ) {
+        return fail();
+    }
+    result-> group = H5Gopen2( result-> file, "0", H5P_DEFAULT );
+    if ( result-> group < 0 ) {
+        return fail();
+    }
+    result-> data = openDataset( result-> group, "DATA" );
+    if ( result-> data.id < 0 || result-> data.dims.size() < 2 ) {
+        qDebug() << "Hdf5IdiaFile: no image in" << fname;
+        return fail();
+    }
+
+    // reopen the cube with a chunk cache that holds a row of chunks, so that
+    // reading a plane band by band decompresses every chunk only once
+    if ( ! result-> data.chunk.empty() ) {
+        const auto & dims = result-> data.dims;
+        const auto & chunk = result-> data.chunk;
+        size_t chunkBytes = sizeof( float );
+        for ( int c : chunk ) {
+            chunkBytes *= c;
+        }
+        size_t chunksPerRow = ( dims[0] + chunk[0] - 1 ) / chunk[0];
+        size_t cacheBytes = std::min( MAX_CHUNK_CACHE, std::max( MIN_CHUNK_CACHE, chunkBytes * chunksPerRow ) );
+        size_t slots = std::max < size_t > ( 521, 10 * ( cacheBytes / chunkBytes ) + 1 );
+        hid_t accessList = H5Pcreate( H5P_DATASET_ACCESS );
+        H5Pset_chunk_cache( accessList, slots, cacheBytes, 1.0 );
+        closeDataset( result-> data );
+        result-> data = openDataset( result-> group, "DATA", accessList );
+        H5Pclose( accessList );
+        if ( result-> data.id < 0 ) {
+            return fail();
+        }
+    }
+    const auto & dims = result-> data.dims;
+
+    // the spectral-axis-first copy, only used if it matches the cube
+    if ( dims.size() == 3 || dims.size() == 4 ) {
+        const char * name = dims.size() == 3 ? "SwizzledData/ZYX" : "SwizzledData/ZYXW";
+        result-> swizzled = openDataset( result-> group, name );
+        if ( result-> swizzled.id >= 0 ) {
+            const auto & sdims = result-> swizzled.dims;
+            bool matches = sdims.size() == dims.size() &&
+                           sdims[0] == dims[2] && sdims[1] == dims[1] && sdims[2] == dims[0] &&
+                           ( dims.size() == 3 || sdims[3] == dims[3] );
+            if ( ! matches ) {
+                qWarning() << "Hdf5IdiaFile: ignoring swizzled data of unexpected shape in" << fname;
+                closeDataset( result-> swizzled );
+            }
+        }
+    }
+
+    // down sampled copies, skipping any of unexpected shape
+    if ( H5Lexists( result-> group, "MipMaps", H5P_DEFAULT ) > 0 &&
+         H5Lexists( result-> group, "MipMaps/DATA", H5P_DEFAULT ) > 0 ) {
+        hid_t mipGroup = H5Gopen2( result-> group, "MipMaps/DATA", H5P_DEFAULT );
+        H5G_info_t groupInfo;
+        if ( mipGroup >= 0 && H5Gget_info( mipGroup, & groupInfo ) >= 0 ) {
+            for ( hsize_t i = 0 ; i < groupInfo.nlinks ; i++ ) {
+                char name[256];
+                if ( H5Lget_name_by_idx( mipGroup, ".", H5_INDEX_NAME, H5_ITER_INC, i,
+                                         name, sizeof( name ), H5P_DEFAULT ) < 0 ) {
+                    continue;
+                }
+                QString mipName = QString::fromLatin1( name );
+                bool ok = false;
+                int mip = mipName.startsWith( "DATA_XY_" ) ? mipName.mid( 8 ).toInt( & ok ) : 0;
+                if ( ! ok || mip < 2 ) {
+                    continue;
+                }
+                Hdf5IdiaDataset dataset = openDataset( mipGroup, name );
+                if ( dataset.id < 0 ) {
+                    continue;
+                }
+                bool matches = dataset.dims.size() == dims.size() &&
+                               dataset.dims[0] == ( dims[0] + mip - 1 ) / mip &&
+                               dataset.dims[1] == ( dims[1] + mip - 1 ) / mip;
+                for ( size_t k = 2 ; matches && k < dims.size() ; k++ ) {
+                    matches = dataset.dims[k] == dims[k];
+                }
+                if ( matches ) {
+                    result-> mips[mip] = dataset;
+                }
+                else {
+                    qWarning() << "Hdf5IdiaFile: ignoring mipmap" << mipName << "of unexpected shape";
+                    closeDataset( dataset );
+                }
+            }
+        }
+        if ( mipGroup >= 0 ) {
+            H5Gclose( mipGroup );
+        }
+    }
+
+    hsize_t index = 0;
+    H5Aiterate2( result-> group, H5_INDEX_CRT_ORDER, H5_ITER_INC, & index, collectCard, & result-> cards );
+    if ( result-> cards.isEmpty() ) {
+        // attributes are not always tracked in creation order
+        index = 0;
+        H5Aiterate2( result-> group, H5_INDEX_NAME, H5_ITER_INC, & index, collectCard, & result-> cards );
+    }
+
+    qDebug() << "Hdf5IdiaFile: opened" << fname << "with" << result-> mips.size() << "mipmaps"
+             << ( result-> swizzled.id >= 0 ? "and swizzled data" : "" );
+    return result;
+} // open
+
+bool
+Hdf5IdiaFile::readBlock( const Hdf5IdiaDataset & dataset,
+                         const std::vector < int > & start,
+                         const std::vector < int > & count,
+                         const std::vector < int > & stride,
+                         float * dst )
+{
+    int rank = dataset.dims.size();
+    CARTA_ASSERT( int( start.size() ) == rank && int( count.size() ) == rank && int( stride.size() ) == rank );
+
+    // HDF5 lists the slowest axis first
+    std::vector < hsize_t > hStart( rank ), hCount( rank ), hStride( rank );
+    for ( int i = 0 ; i < rank ; i++ ) {
+        hStart[rank - 1 - i] = start[i];
+        hCount[rank - 1 - i] = count[i];
+        hStride[rank - 1 - i] = stride[i];
+    }
+
+    hid_t fileSpace = H5Dget_space( dataset.id );
+    hid_t memSpace = H5Screate_simple( rank, hCount.data(), nullptr );
+    bool ok = H5Sselect_hyperslab( fileSpace, H5S_SELECT_SET, hStart.data(), hStride.data(),
+                                   hCount.data(), nullptr ) >= 0 &&
+              H5Dread( dataset.id, H5T_NATIVE_FLOAT, memSpace, fileSpace, H5P_DEFAULT, dst ) >= 0;
+    H5Sclose( memSpace );
+    H5Sclose( fileSpace );
+    if ( ! ok ) {
+        qWarning() << "Hdf5IdiaFile: reading a block failed";
+    }
+    return ok;
+}
@@ -0,0 +1,86 @@
+/**
+ * An open HDF5 file in the IDIA image schema.
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+
+#include <hdf5.h>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <map>
+#include <vector>
+
+/// The HDF5 library is usually built without thread safety, so every HDF5 call of
+/// this plugin has to hold this lock.
+QMutex &
+hdf5Mutex();
+
+/// A dataset of an IDIA file, with its shape and chunking in FITS axis order
+/// (first axis fastest), i.e. the reverse of the HDF5 order.
+struct Hdf5IdiaDataset
+{
+    hid_t id = - 1;
+    std::vector < int > dims;
+
+    /// chunk dimensions, empty for contiguous datasets
+    std::vector < int > chunk;
+};
+
+/// HDF5 ids of an open IDIA file, closed when the last image or view using them
+/// goes away.
+///
+/// The schema keeps the image in the group "0": the cube in "DATA", down sampled
+/// copies in "MipMaps/DATA/DATA_XY_<mip>" and a copy with the spectral axis first
+/// in "SwizzledData/ZYX" (or "ZYXW" with a stokes axis). The header cards are the
+/// attributes of the group.
+struct Hdf5IdiaFile
+{
+    CLASS_BOILERPLATE( Hdf5IdiaFile );
+
+    ~Hdf5IdiaFile();
+
+    /// \brief Open an IDIA file.
+    /// \return nullptr if the file is not HDF5, does not follow the schema or does
+    /// not hold 32 bit float data
+    static Hdf5IdiaFile::SharedPtr
+    open( const QString & fname );
+
+    /// \brief Read a block of a dataset as floats.
+    /// \param dataset the dataset to read from
+    /// \param start first pixel, one entry per axis in FITS order
+    /// \param count number of pixels per axis
+    /// \param stride distance between the pixels per axis
+    /// \param dst where to store the pixels, first axis fastest
+    /// \return false on errors
+    /// \note must be called with hdf5Mutex() held
+    static bool
+    readBlock( const Hdf5IdiaDataset & dataset,
+               const std::vector < int > & start,
+               const std::vector < int > & count,
+               const std::vector < int > & stride,
+               float * dst );
+
+    hid_t file = - 1;
+    hid_t group = - 1;
+
+    /// the full resolution cube
+    Hdf5IdiaDataset data;
+
+    /// the cube with the spectral axis (FITS axis 2) first, id -1 if there is none
+    Hdf5IdiaDataset swizzled;
+
+    /// down sampled copies of the cube by mip
+    std::map < int, Hdf5IdiaDataset > mips;
+
+    /// the header cards built from the attributes of the group, without END
+    QStringList cards;
+
+private:
+
+    /// close all ids and set them to -1, hdf5Mutex() must be held
+    void
+    _close();
+};
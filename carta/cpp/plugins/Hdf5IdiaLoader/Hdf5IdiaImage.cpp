@@ -0,0 +1,319 @@
+#include "Hdf5IdiaImage.h"
+#include "Hdf5IdiaRawView.h"
+#include "CartaLib/UtilCASA.h"
+#include <casacore/casa/Containers/Record.h>
+#include <casacore/casa/Exceptions/Error.h>
+#include <casacore/casa/Quanta/Quantum.h>
+#include <casacore/casa/Quanta/UnitVal.h>
+#include <casacore/coordinates/Coordinates/FITSCoordinateUtil.h>
+#include <casacore/lattices/Lattices/TempLattice.h>
+#include <casacore/scimath/Mathematics/GaussianBeam.h>
+#include <QDebug>
+#include <QMap>
+#include <QMutexLocker>
+#include <cmath>
+#include <set>
+
+namespace
+{
+/// memory (MB) a temporary casacore copy may use, larger ones are kept on disk
+const double CASA_COPY_MEMORY_MB = 256;
+
+/// Returns the value of a header card, with the comment and (for strings) the
+/// quotes removed. Cards without a value return a null string.
+QString
+cardValue( const QString & card )
+{
+    if ( card.mid( 8, 2 ) != "= " ) {
+        return QString();
+    }
+    QString value = card.mid( 10 ).trimmed();
+    if ( value.startsWith( '\'' ) ) {
+        // quoted string, '' stands for a single quote
+        QString result;
+        for ( int i = 1 ; i < value.size() ; i++ ) {
+            if ( value[i] == '\'' ) {
+                if ( i + 1 < value.size() && value[i + 1] == '\'' ) {
+                    result += '\'';
+                    i++;
+                    continue;
+                }
+                break;
+            }
+            result += value[i];
+        }
+        return result.trimmed();
+    }
+    int slash = value.indexOf( '/' );
+    if ( slash >= 0 ) {
+        value = value.left( slash );
+    }
+    return value.trimmed();
+}
+}
+
+Hdf5IdiaImage::SharedPtr
+Hdf5IdiaImage::create( const QString & fname )
+{
+    Hdf5IdiaFile::SharedPtr file = Hdf5IdiaFile::open( fname );
+    if ( ! file ) {
+        return nullptr;
+    }
+    const std::vector < int > & dims = file-> data.dims;
+    int naxis = dims.size();
+
+    // first occurrence of each keyword wins
+    QMap < QString, QString > keywords;
+    for ( const QString & card : file-> cards ) {
+        QString key = card.left( 8 ).trimmed();
+        if ( ! key.isEmpty() && ! keywords.contains( key ) ) {
+            keywords[key] = cardValue( card );
+        }
+    }
+
+    // coordinate system from the header cards, the same way casacore's
+    // FITSImage does it
+    std::shared_ptr < casacore::CoordinateSystem > casaCS;
+    casa_mutex.lock();
+    try {
+        casacore::Vector < casacore::String > header( file-> cards.size() );
+        for ( int i = 0 ; i < file-> cards.size() ; i++ ) {
+            header[i] = file-> cards[i].toStdString();
+        }
+        casacore::IPosition shape( naxis );
+        for ( int i = 0 ; i < naxis ; i++ ) {
+            shape[i] = dims[i];
+        }
+        casacore::Int stokesFITSValue = 1;
+        casacore::Record headerRec;
+        casaCS = std::make_shared < casacore::CoordinateSystem > ();
+        casacore::FITSCoordinateUtil fcu;
+        if ( ! fcu.fromFITSHeader( stokesFITSValue, * casaCS, headerRec, header, shape, 0 ) ||
+             int( casaCS-> nPixelAxes() ) != naxis ) {
+            casaCS = nullptr;
+        }
+    }
+    catch ( const casacore::AipsError & err ) {
+        qDebug() << "Hdf5IdiaImage: coordinate system failed" << err.getMesg().c_str();
+        casaCS = nullptr;
+    }
+    casa_mutex.unlock();
+    if ( ! casaCS ) {
+        qWarning() << "Hdf5IdiaImage: no usable coordinate system in" << fname;
+        return nullptr;
+    }
+
+    Hdf5IdiaImage::SharedPtr img = std::make_shared < Hdf5IdiaImage > ();
+    img-> m_shared = std::make_shared < Shared > ();
+    img-> m_shared-> file = file;
+    if ( keywords.contains( "BMAJ" ) && keywords.contains( "BMIN" ) ) {
+        img-> m_shared-> hasBeam = true;
+        img-> m_shared-> bmaj = keywords.value( "BMAJ" ).toDouble();
+        img-> m_shared-> bmin = keywords.value( "BMIN" ).toDouble();
+        img-> m_shared-> bpa = keywords.value( "BPA" ).toDouble();
+    }
+    QString unit = keywords.value( "BUNIT" );
+    if ( unit.toUpper() == "JY/BEAM" ) {
+        unit = "Jy/beam";
+    }
+    img-> m_shared-> unit = Carta::Lib::Unit( unit );
+
+    img-> m_dims = dims;
+    for ( int i = 0 ; i < naxis ; i++ ) {
+        img-> m_order.push_back( i );
+    }
+
+    QString htmlTitle = keywords.value( "OBJECT" ).toHtmlEscaped();
+    img-> m_meta = std::make_shared < CCMetaDataInterface > ( htmlTitle, casaCS );
+    return img;
+} // create
+
+std::shared_ptr < Carta::Lib::Image::ImageInterface >
+Hdf5IdiaImage::getPermuted( const std::vector < int > & indices )
+{
+    int indexCount = indices.size();
+    CARTA_ASSERT( int( m_dims.size() ) == indexCount );
+    std::set < int > usedIndices;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        CARTA_ASSERT( 0 <= indices[i] && indices[i] < indexCount );
+        CARTA_ASSERT( usedIndices.count( indices[i] ) == 0 );
+        usedIndices.insert( indices[i] );
+    }
+
+    // nothing to do for the identity permutation
+    bool isIdentity = true;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        if ( indices[i] != i ) {
+            isIdentity = false;
+            break;
+        }
+    }
+    if ( isIdentity ) {
+        return shared_from_this();
+    }
+
+    // change the order of the axes in the coordinate system
+    casacore::Vector < int > newOrder( indexCount );
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        newOrder[i] = indices[i];
+    }
+    casa_mutex.lock();
+    std::shared_ptr < casacore::CoordinateSystem > coordSys(
+        new casacore::CoordinateSystem( * m_meta-> getCoordinateSystem() ) );
+    coordSys-> transpose( newOrder, newOrder );
+    casa_mutex.unlock();
+
+    // permuting only changes which file axis each axis reads
+    Hdf5IdiaImage::SharedPtr img = std::make_shared < Hdf5IdiaImage > ();
+    img-> m_shared = m_shared;
+    for ( int i = 0 ; i < indexCount ; i++ ) {
+        img-> m_dims.push_back( m_dims[indices[i]] );
+        img-> m_order.push_back( m_order[indices[i]] );
+    }
+    img-> m_meta = std::make_shared < CCMetaDataInterface > (
+        m_meta-> title( Carta::Lib::TextFormat::Html ), coordSys );
+    return img;
+} // getPermuted
+
+Carta::Lib::NdArray::RawViewInterface *
+Hdf5IdiaImage::getDataSlice( const SliceND & sliceInfo )
+{
+    const Hdf5IdiaFile::SharedPtr & file = m_shared-> file;
+    return new Hdf5IdiaRawView( file, & file-> data, m_order, sliceInfo );
+}
+
+std::vector < int >
+Hdf5IdiaImage::mipLevels() const
+{
+    // the mips are only down sampled along the first two file axes
+    std::vector < int > result;
+    if ( m_order.size() < 2 || m_order[0] != 0 || m_order[1] != 1 ) {
+        return result;
+    }
+    for ( const auto & mip : m_shared-> file-> mips ) {
+        result.push_back( mip.first );
+    }
+    return result;
+}
+
+Carta::Lib::NdArray::RawViewInterface *
+Hdf5IdiaImage::getMipSlice( int mip, const SliceND & sliceInfo )
+{
+    const Hdf5IdiaFile::SharedPtr & file = m_shared-> file;
+    auto found = file-> mips.find( mip );
+    if ( found == file-> mips.end() || m_order.size() < 2 || m_order[0] != 0 || m_order[1] != 1 ) {
+        return nullptr;
+    }
+    return new Hdf5IdiaRawView( file, & found-> second, m_order, sliceInfo );
+}
+
+bool
+Hdf5IdiaImage::hasFastLineAccess( int axis ) const
+{
+    return m_shared-> file-> swizzled.id >= 0 &&
+           0 <= axis && axis < int( m_order.size() ) && m_order[axis] == 2;
+}
+
+casacore::ImageInfo
+Hdf5IdiaImage::getImageInfo() const
+{
+    QMutexLocker locker( & casa_mutex );
+    casacore::ImageInfo info;
+    if ( m_shared-> hasBeam ) {
+        try {
+            info.setRestoringBeam( casacore::GaussianBeam(
+                                       casacore::Quantity( m_shared-> bmaj, "deg" ),
+                                       casacore::Quantity( m_shared-> bmin, "deg" ),
+                                       casacore::Quantity( m_shared-> bpa, "deg" ) ) );
+        }
+        catch ( const casacore::AipsError & err ) {
+            qWarning() << "Hdf5IdiaImage: invalid beam" << err.getMesg().c_str();
+        }
+    }
+    return info;
+}
+
+casacore::LatticeBase *
+Hdf5IdiaImage::getCasaImage()
+{
+    QMutexLocker locker( & m_casaImageMutex );
+    if ( ! m_casaImage && ! m_casaImageFailed ) {
+        m_casaImage = _makeCasaImage();
+        m_casaImageFailed = ! m_casaImage;
+    }
+    return m_casaImage.get();
+}
+
+std::unique_ptr < casacore::TempImage < float > >
+Hdf5IdiaImage::_makeCasaImage()
+{
+    int nDims = m_dims.size();
+    casacore::IPosition shape( nDims );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        shape( i ) = m_dims[i];
+    }
+    int64_t planePixels = int64_t( m_dims[0] ) * ( nDims > 1 ? m_dims[1] : 1 );
+    int64_t nPlanes = shape.product() / std::max < int64_t > ( 1, planePixels );
+    casacore::IPosition planeShape( shape );
+    for ( int i = 2 ; i < nDims ; i++ ) {
+        planeShape( i ) = 1;
+    }
+
+    std::unique_ptr < casacore::TempImage < float > > image;
+    std::unique_ptr < casacore::TempLattice < casacore::Bool > > mask;
+    bool hasNaN = false;
+    try {
+        // copying the coordinate system copies measures frames, which is not thread safe
+        std::unique_ptr < casacore::CoordinateSystem > coordSys;
+        {
+            QMutexLocker casaLocker( & casa_mutex );
+            coordSys.reset( new casacore::CoordinateSystem( * m_meta-> getCoordinateSystem() ) );
+        }
+        image.reset( new casacore::TempImage < float > ( casacore::TiledShape( shape ), * coordSys,
+                                                         CASA_COPY_MEMORY_MB ) );
+        mask.reset( new casacore::TempLattice < casacore::Bool > ( casacore::TiledShape( shape ),
+                                                                   CASA_COPY_MEMORY_MB ) );
+        casacore::Array < float > pixels( planeShape );
+        casacore::Array < casacore::Bool > valid( planeShape );
+
+        for ( int64_t plane = 0 ; plane < nPlanes ; plane++ ) {
+            // the position of the plane on the other axes
+            casacore::IPosition start( nDims, 0 );
+            SliceND slice;
+            int64_t rest = plane;
+            for ( int i = 2 ; i < nDims ; i++ ) {
+                start( i ) = rest % m_dims[i];
+                rest /= m_dims[i];
+                slice.slice( i ).start( start( i ) ).end( start( i ) + 1 );
+            }
+            std::unique_ptr < Carta::Lib::NdArray::RawViewInterface > view( getDataSlice( slice ) );
+            int64_t bytes = planePixels * sizeof( float );
+            if ( view-> read( bytes, reinterpret_cast < char * > ( pixels.data() ) ) != bytes ) {
+                qWarning() << "Hdf5IdiaImage: reading the pixels for the casacore copy failed";
+                return nullptr;
+            }
+            const float * values = pixels.data();
+            casacore::Bool * flags = valid.data();
+            for ( int64_t i = 0 ; i < planePixels ; i++ ) {
+                flags[i] = std::isfinite( values[i] );
+                hasNaN = hasNaN || ! flags[i];
+            }
+            image-> putSlice( pixels, start );
+            mask-> putSlice( valid, start );
+        }
+
+        if ( hasNaN ) {
+            image-> attachMask( * mask );
+        }
+        image-> setImageInfo( getImageInfo() );
+        casacore::String unit = m_shared-> unit.toStr().toStdString();
+        if ( casacore::UnitVal::check( unit ) ) {
+            image-> setUnits( casacore::Unit( unit ) );
+        }
+    }
+    catch ( const casacore::AipsError & err ) {
+        qWarning() << "Hdf5IdiaImage: no casacore copy of the image" << err.getMesg().c_str();
+        return nullptr;
+    }
+    return image;
+} // _makeCasaImage
@@ -0,0 +1,187 @@
+/**
+ * Image interface backed by an HDF5 file in the IDIA schema.
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IImage.h"
+#include "Hdf5IdiaFile.h"
+#include "plugins/CasaImageLoader/CCImage.h"
+#include "plugins/CasaImageLoader/CCMetaDataInterface.h"
+#include <casacore/images/Images/TempImage.h>
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+/// Image interface that reads a chunked HDF5 image directly with the HDF5 library.
+///
+/// Besides the cube itself the file may hold down sampled copies (exposed through
+/// mipLevels() and getMipSlice()) and a copy with the spectral axis first (used
+/// by readLine() along that axis, see hasFastLineAccess()). casacore is only used
+/// for the coordinate system, which is built from the header cards stored as
+/// attributes, and for getCasaImage(): the plugins that need a casacore image get
+/// a temporary copy of the pixels. It is a CCImageBase so that header export can
+/// find the cards.
+class Hdf5IdiaImage
+    : public CCImageBase
+      , public std::enable_shared_from_this < Hdf5IdiaImage >
+{
+    CLASS_BOILERPLATE( Hdf5IdiaImage );
+
+public:
+
+    /// Try to open the file. Returns nullptr if it is not an IDIA HDF5 image.
+    static Hdf5IdiaImage::SharedPtr
+    create( const QString & fname );
+
+    virtual const Carta::Lib::Unit &
+    getPixelUnit() const override
+    {
+        return m_shared-> unit;
+    }
+
+    virtual const QString &
+    getType() const override
+    {
+        return m_type;
+    }
+
+    virtual std::shared_ptr < Carta::Lib::Image::ImageInterface >
+    getPermuted( const std::vector < int > & indices ) override;
+
+    virtual const std::vector < int > &
+    dims() const override
+    {
+        return m_dims;
+    }
+
+    /// masked pixels are stored as NaN
+    virtual bool
+    hasMask() const override
+    {
+        return false;
+    }
+
+    virtual bool
+    hasBeam() const override
+    {
+        return m_shared-> hasBeam;
+    }
+
+    virtual bool
+    hasErrorsInfo() const override
+    {
+        return false;
+    }
+
+    virtual Carta::Lib::Image::PixelType
+    pixelType() const override
+    {
+        return Carta::Lib::Image::PixelType::Real32;
+    }
+
+    /// there are no errors
+    virtual Carta::Lib::Image::PixelType
+    errorType() const override
+    {
+        return Carta::Lib::Image::PixelType::Other;
+    }
+
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getDataSlice( const SliceND & sliceInfo ) override;
+
+    /// there is no mask, masked pixels are stored as NaN
+    virtual Carta::Lib::NdArray::Byte *
+    getMaskSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    /// there are no errors
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getErrorSlice( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    virtual Carta::Lib::Image::MetaDataInterface::SharedPtr
+    metaData() override
+    {
+        return m_meta;
+    }
+
+    /// the stored mips, only while the first two axes are those of the file
+    virtual std::vector < int >
+    mipLevels() const override;
+
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getMipSlice( int mip, const SliceND & sliceInfo ) override;
+
+    virtual bool
+    hasFastLineAccess( int axis ) const override;
+
+    /// A casacore copy of the image, made on the first call: the pixels are copied
+    /// plane by plane into a temporary image (on disk if it is large), the NaNs
+    /// become its mask. Returns nullptr if the copy fails.
+    virtual casacore::LatticeBase *
+    getCasaImage() override;
+
+    virtual casacore::ImageInfo
+    getImageInfo() const override;
+
+    virtual QStringList
+    getFitsHeaderCards() const override
+    {
+        return m_shared-> file-> cards;
+    }
+
+    /// do not use this, use create() instead
+    Hdf5IdiaImage() { }
+
+protected:
+
+    /// state shared between an image and its permuted versions
+    struct Shared
+    {
+        Hdf5IdiaFile::SharedPtr file;
+        Carta::Lib::Unit unit;
+        bool hasBeam = false;
+
+        /// restoring beam in degrees
+        double bmaj = 0;
+        double bmin = 0;
+        double bpa = 0;
+    };
+
+    std::shared_ptr < Shared > m_shared;
+
+    /// the file axis of each axis of this (possibly permuted) image
+    std::vector < int > m_order;
+
+    /// dimensions of this image
+    std::vector < int > m_dims;
+
+    CCMetaDataInterface::SharedPtr m_meta;
+    QString m_type = "HDF5Image";
+
+private:
+
+    /// Copy the pixels into a temporary casacore image.
+    std::unique_ptr < casacore::TempImage < float > >
+    _makeCasaImage();
+
+    /// the copy returned by getCasaImage()
+    std::unique_ptr < casacore::TempImage < float > > m_casaImage;
+
+    /// set once making the copy failed, so it is not tried again
+    bool m_casaImageFailed = false;
+
+    /// guards the creation of the copy
+    QMutex m_casaImageMutex;
+};
@@ -0,0 +1,42 @@
+#include "Hdf5IdiaLoader.h"
+#include "Hdf5IdiaImage.h"
+#include "CartaLib/Hooks/LoadAstroImage.h"
+#include <QDebug>
+#include <QFileInfo>
+
+Hdf5IdiaLoader::Hdf5IdiaLoader(QObject *parent) :
+    QObject(parent)
+{
+}
+
+bool Hdf5IdiaLoader::handleHook(BaseHook & hookData)
+{
+    if(hookData.is<Carta::Lib::Hooks::LoadAstroImage>()) {
+        Carta::Lib::Hooks::LoadAstroImage & hook
+                = static_cast<Carta::Lib::Hooks::LoadAstroImage &>(hookData);
+        auto fname = hook.paramsPtr->fileName;
+
+        // casa images are directories, leave those (and anything else that is
+        // not a plain file) to the other loaders
+        if( ! QFileInfo( fname).isFile()) {
+            return false;
+        }
+        hook.result = Hdf5IdiaImage::create( fname);
+        // returning false lets the next loader try the file
+        return hook.result != nullptr;
+    }
+
+    qWarning() << "Sorry, Hdf5IdiaLoader doesn't know how to handle this hook";
+    return false;
+}
+
+std::vector<HookId> Hdf5IdiaLoader::getInitialHookList()
+{
+    return {
+        Carta::Lib::Hooks::LoadAstroImage::staticId
+    };
+}
+
+Hdf5IdiaLoader::~Hdf5IdiaLoader()
+{
+}
@@ -0,0 +1,22 @@
+/// This plugin reads chunked HDF5 images in the IDIA schema, anything else is
+/// left to the other image loaders.
+
+#pragma once
+
+#include "CartaLib/IPlugin.h"
+#include <QObject>
+#include <QString>
+
+class Hdf5IdiaLoader : public QObject, public IPlugin
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID "org.cartaviewer.IPlugin")
+    Q_INTERFACES( IPlugin)
+
+public:
+
+    Hdf5IdiaLoader(QObject *parent = 0);
+    virtual bool handleHook(BaseHook & hookData) override;
+    virtual std::vector<HookId> getInitialHookList() override;
+    virtual ~Hdf5IdiaLoader();
+};
@@ -0,0 +1,301 @@
+#include "Hdf5IdiaRawView.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+/// approximate size of the bands read by _readRange()
+const int64_t BAND_BYTES = 16 * 1024 * 1024;
+}
+
+Hdf5IdiaRawView::Hdf5IdiaRawView( Hdf5IdiaFile::SharedPtr file,
+                                  const Hdf5IdiaDataset * dataset,
+                                  const VI & order,
+                                  const SliceND & sliceInfo )
+{
+    m_file = file;
+    m_dataset = dataset;
+    VI dims;
+    for ( int fileAxis : order ) {
+        dims.push_back( dataset-> dims[fileAxis] );
+    }
+    SliceND::ApplyResult ar = sliceInfo.apply( dims );
+    for ( size_t i = 0 ; i < dims.size() ; i++ ) {
+        const auto & slice1d = ar.dims()[i];
+        Axis axis;
+        axis.fileAxis = order[i];
+        axis.start = slice1d.start;
+        axis.step = slice1d.step;
+        axis.count = slice1d.count;
+        m_axes.push_back( axis );
+        m_viewDims.push_back( axis.count );
+    }
+}
+
+Hdf5IdiaRawView::Hdf5IdiaRawView( Hdf5IdiaFile::SharedPtr file,
+                                  const Hdf5IdiaDataset * dataset,
+                                  const std::vector < Axis > & axes )
+{
+    m_file = file;
+    m_dataset = dataset;
+    m_axes = axes;
+    for ( const Axis & axis : m_axes ) {
+        m_viewDims.push_back( axis.count );
+    }
+}
+
+const char *
+Hdf5IdiaRawView::get( const VI & pos )
+{
+    VI counts( m_viewDims.size(), 1 );
+    _readBlock( pos, counts, & m_buff );
+    return reinterpret_cast < const char * > ( & m_buff );
+}
+
+void
+Hdf5IdiaRawView::forEach( std::function < void (const char *) > func, Traversal traversal )
+{
+    // the position advances like an odometer, first axis fastest
+    m_currentPos.assign( m_viewDims.size(), 0 );
+    auto wrapper = [this, & func] ( const char * ptr, int64_t count ) {
+        const float * vals = reinterpret_cast < const float * > ( ptr );
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            func( reinterpret_cast < const char * > ( vals + i ) );
+            for ( size_t axis = 0 ; axis < m_currentPos.size() ; axis++ ) {
+                if ( ++m_currentPos[axis] < m_viewDims[axis] ) {
+                    break;
+                }
+                m_currentPos[axis] = 0;
+            }
+        }
+    };
+    forEach( BAND_BYTES, wrapper, nullptr, traversal );
+}
+
+Carta::Lib::NdArray::RawViewInterface *
+Hdf5IdiaRawView::getView( const SliceND & sliceInfo )
+{
+    SliceND::ApplyResult ar = sliceInfo.apply( m_viewDims );
+    std::vector < Axis > axes = m_axes;
+    for ( size_t i = 0 ; i < axes.size() ; i++ ) {
+        const auto & slice1d = ar.dims()[i];
+        axes[i].start += slice1d.start * axes[i].step;
+        axes[i].step *= slice1d.step;
+        axes[i].count = slice1d.count;
+    }
+    return new Hdf5IdiaRawView( m_file, m_dataset, axes );
+}
+
+int64_t
+Hdf5IdiaRawView::read( int64_t buffSize, char * buff, Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    CARTA_ASSERT( buff != nullptr );
+    int64_t count = std::min( int64_t( buffSize / sizeof( float ) ), _nPixels() - m_readPos );
+    if ( count <= 0 ) {
+        return 0;
+    }
+    _readRange( m_readPos, count, reinterpret_cast < float * > ( buff ) );
+    m_readPos += count;
+    return count * sizeof( float );
+}
+
+int64_t
+Hdf5IdiaRawView::read( int64_t chunk, int64_t buffSize, char * buff, Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    CARTA_ASSERT( buff != nullptr );
+    int64_t buffCount = buffSize / sizeof( float );
+    int64_t first = chunk * buffCount;
+    int64_t count = std::min( buffCount, _nPixels() - first );
+    if ( chunk < 0 || count <= 0 ) {
+        return 0;
+    }
+    _readRange( first, count, reinterpret_cast < float * > ( buff ) );
+    return count * sizeof( float );
+}
+
+void
+Hdf5IdiaRawView::forEach( int64_t buffSize,
+                          std::function < void (const char *, int64_t count) > func,
+                          char * buff,
+                          Traversal traversal )
+{
+    // reads are in bands of rows whatever the order, sequential is as good as any
+    Q_UNUSED( traversal );
+
+    int64_t buffCount = buffSize / sizeof( float );
+    if ( buffCount < 1 ) {
+        qWarning() << "Hdf5IdiaRawView::forEach buffer too small" << buffSize;
+        return;
+    }
+    std::vector < float > ownBuffer;
+    float * dst = reinterpret_cast < float * > ( buff );
+    if ( dst == nullptr ) {
+        ownBuffer.resize( buffCount );
+        dst = ownBuffer.data();
+    }
+
+    // whole rows per call keep the reads in bands
+    int64_t nPixels = _nPixels();
+    if ( nPixels > 0 && buffCount >= m_viewDims[0] ) {
+        buffCount -= buffCount % m_viewDims[0];
+    }
+    for ( int64_t first = 0 ; first < nPixels ; first += buffCount ) {
+        int64_t count = std::min( buffCount, nPixels - first );
+        _readRange( first, count, dst );
+        func( reinterpret_cast < const char * > ( dst ), count );
+    }
+}
+
+int64_t
+Hdf5IdiaRawView::readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff )
+{
+    count = _lineCount( pos, axis, count, step );
+    if ( count <= 0 ) {
+        return 0;
+    }
+    VI counts( m_viewDims.size(), 1 );
+    counts[axis] = count;
+    _readBlock( pos, counts, reinterpret_cast < float * > ( buff ), axis, step );
+    return count;
+}
+
+int64_t
+Hdf5IdiaRawView::_nPixels() const
+{
+    if ( m_viewDims.empty() ) {
+        return 0;
+    }
+    int64_t n = 1;
+    for ( auto d : m_viewDims ) {
+        n *= d;
+    }
+    return n;
+}
+
+int
+Hdf5IdiaRawView::_bandRows() const
+{
+    int64_t rows = std::max < int64_t > ( 1, BAND_BYTES / ( sizeof( float ) * std::max( 1, m_viewDims[0] ) ) );
+    if ( m_axes.size() > 1 && ! m_dataset-> chunk.empty() && m_axes[1].step == 1 ) {
+        int chunkRows = m_dataset-> chunk[m_axes[1].fileAxis];
+        if ( rows > chunkRows ) {
+            rows -= rows % chunkRows;
+        }
+    }
+    return std::min < int64_t > ( rows, std::numeric_limits < int >::max() );
+}
+
+void
+Hdf5IdiaRawView::_readRange( int64_t first, int64_t count, float * dst )
+{
+    int nDims = m_viewDims.size();
+    int64_t nx = m_viewDims[0];
+    int64_t ny = nDims > 1 ? m_viewDims[1] : 1;
+    int bandRows = _bandRows();
+    VI pos( nDims, 0 );
+    VI counts( nDims, 1 );
+    while ( count > 0 ) {
+        int64_t row = first / nx;
+        pos[0] = first % nx;
+        if ( nDims > 1 ) {
+            pos[1] = row % ny;
+        }
+        int64_t rest = row / ny;
+        for ( int i = 2 ; i < nDims ; i++ ) {
+            pos[i] = rest % m_viewDims[i];
+            rest /= m_viewDims[i];
+        }
+        std::fill( counts.begin(), counts.end(), 1 );
+
+        int64_t n;
+        if ( pos[0] != 0 || count < nx || nDims == 1 ) {
+            // part of a row
+            n = std::min( nx - pos[0], count );
+            counts[0] = n;
+        }
+        else {
+            // whole rows, the band ending on a chunk boundary unless it is the last
+            int64_t maxRows = std::min( ny - pos[1], count / nx );
+            int64_t rows = std::min < int64_t > ( maxRows, bandRows );
+            const Axis & axis1 = m_axes[1];
+            if ( rows < maxRows && ! m_dataset-> chunk.empty() && axis1.step == 1 ) {
+                int chunkRows = m_dataset-> chunk[axis1.fileAxis];
+                int64_t fileRow = axis1.start + pos[1];
+                int64_t alignedEnd = ( fileRow + rows ) / chunkRows * chunkRows;
+                if ( alignedEnd > fileRow ) {
+                    rows = alignedEnd - fileRow;
+                }
+            }
+            counts[0] = nx;
+            counts[1] = rows;
+            n = nx * rows;
+        }
+        _readBlock( pos, counts, dst );
+        dst += n;
+        first += n;
+        count -= n;
+    }
+} // _readRange
+
+bool
+Hdf5IdiaRawView::_readBlock( const VI & pos, const VI & counts, float * dst,
+                             int lineAxis, int64_t lineStep )
+{
+    int rank = m_axes.size();
+
+    // lines along the spectral axis of the cube come from the swizzled copy,
+    // whose first three axes are those of the cube reversed
+    bool swizzled = lineAxis >= 0 && m_file-> swizzled.id >= 0 &&
+                    m_dataset == & m_file-> data && m_axes[lineAxis].fileAxis == 2;
+
+    std::vector < int > start( rank ), count( rank ), stride( rank );
+    for ( int i = 0 ; i < rank ; i++ ) {
+        const Axis & axis = m_axes[i];
+        int fileAxis = axis.fileAxis;
+        if ( swizzled && fileAxis < 3 ) {
+            fileAxis = 2 - fileAxis;
+        }
+        start[fileAxis] = axis.start + pos[i] * axis.step;
+        count[fileAxis] = counts[i];
+        stride[fileAxis] = i == lineAxis ? axis.step * lineStep : axis.step;
+    }
+
+    // HDF5 returns the block in dataset axis order
+    bool transpose = rank > 1 && counts[0] > 1 && counts[1] > 1 &&
+                     m_axes[0].fileAxis > m_axes[1].fileAxis;
+    int64_t nPixels = 1;
+    for ( int c : counts ) {
+        nPixels *= c;
+    }
+    float * target = dst;
+    if ( transpose ) {
+        m_scratch.resize( nPixels );
+        target = m_scratch.data();
+    }
+
+    bool ok;
+    {
+        QMutexLocker locker( & hdf5Mutex() );
+        ok = Hdf5IdiaFile::readBlock( swizzled ? m_file-> swizzled : * m_dataset,
+                                      start, count, stride, target );
+    }
+    if ( ! ok ) {
+        std::fill( dst, dst + nPixels, std::numeric_limits < float >::quiet_NaN() );
+        return false;
+    }
+
+    if ( transpose ) {
+        int64_t n0 = counts[0];
+        int64_t n1 = counts[1];
+        for ( int64_t j = 0 ; j < n1 ; j++ ) {
+            for ( int64_t i = 0 ; i < n0 ; i++ ) {
+                dst[i + j * n0] = target[j + i * n1];
+            }
+        }
+    }
+    return true;
+} // _readBlock
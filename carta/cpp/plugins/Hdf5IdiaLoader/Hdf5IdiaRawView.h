@@ -0,0 +1,139 @@
+/**
+ * Raw view into a dataset of an IDIA HDF5 file.
+ **/
+
+#pragma once
+
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IImage.h"
+#include "Hdf5IdiaFile.h"
+
+#include <vector>
+
+/// Raw view into a dataset of an Hdf5IdiaFile.
+///
+/// Every axis of the view is an axis of the dataset (in any order) with a start,
+/// a step and a count, so slicing and permuting never touch the data. Pixels are
+/// read in bands of whole rows of the first two view axes, with the band edges on
+/// chunk boundaries so that each chunk is decompressed only once per pass.
+/// readLine() along the spectral axis uses the swizzled copy of the cube if the
+/// file has one.
+class Hdf5IdiaRawView
+    : public Carta::Lib::NdArray::RawViewInterface
+{
+public:
+
+    /// \param file the open file
+    /// \param dataset the dataset to read, owned by file
+    /// \param order the dataset axis of each parent axis
+    /// \param sliceInfo which part of the parent to view
+    Hdf5IdiaRawView( Hdf5IdiaFile::SharedPtr file,
+                     const Hdf5IdiaDataset * dataset,
+                     const VI & order,
+                     const SliceND & sliceInfo );
+
+    virtual PixelType
+    pixelType() override
+    {
+        return PixelType::Real32;
+    }
+
+    virtual const VI &
+    dims() override
+    {
+        return m_viewDims;
+    }
+
+    virtual const char *
+    get( const VI & pos ) override;
+
+    virtual void
+    forEach( std::function < void (const char *) > func, Traversal traversal ) override;
+
+    /// the position of the pixel passed to the per pixel forEach()
+    virtual const VI &
+    currentPos() override
+    {
+        return m_currentPos;
+    }
+
+    virtual RawViewInterface *
+    getView( const SliceND & sliceInfo ) override;
+
+    virtual int64_t
+    read( int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override;
+
+    virtual void
+    seek( int64_t ind ) override
+    {
+        CARTA_ASSERT( ind >= 0 );
+        m_readPos = ind;
+    }
+
+    virtual int64_t
+    read( int64_t chunk, int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override;
+
+    virtual void
+    forEach( int64_t buffSize,
+             std::function < void (const char *, int64_t count) > func,
+             char * buff = nullptr,
+             Traversal traversal = Traversal::Sequential ) override;
+
+    virtual int64_t
+    readLine( const VI & pos, int axis, int64_t count, int64_t step, char * buff ) override;
+
+protected:
+
+    /// one axis of the view
+    struct Axis
+    {
+        /// the dataset axis
+        int fileAxis = 0;
+        int start = 0;
+        int step = 1;
+        int count = 0;
+    };
+
+    Hdf5IdiaRawView( Hdf5IdiaFile::SharedPtr file,
+                     const Hdf5IdiaDataset * dataset,
+                     const std::vector < Axis > & axes );
+
+    /// total number of pixels in this view
+    int64_t
+    _nPixels() const;
+
+    /// number of rows of the first view axis to read at once
+    int
+    _bandRows() const;
+
+    /// copy count pixels starting at (c-order, first axis fastest) index first
+    /// into dst
+    void
+    _readRange( int64_t first, int64_t count, float * dst );
+
+    /// Read the block of the view that starts at pos and has counts pixels per
+    /// axis into dst, in view order. Only the first two axes may have more than
+    /// one pixel, except for lineAxis, whose step is multiplied by lineStep.
+    bool
+    _readBlock( const VI & pos, const VI & counts, float * dst,
+                int lineAxis = - 1, int64_t lineStep = 1 );
+
+    Hdf5IdiaFile::SharedPtr m_file;
+    const Hdf5IdiaDataset * m_dataset = nullptr;
+    std::vector < Axis > m_axes;
+    VI m_viewDims;
+
+    /// position of the next read()
+    int64_t m_readPos = 0;
+
+    /// position of the current pixel of the per pixel forEach()
+    VI m_currentPos;
+
+    /// scratch space for transposing blocks
+    std::vector < float > m_scratch;
+
+    /// buffer for get()
+    float m_buff = 0;
+};
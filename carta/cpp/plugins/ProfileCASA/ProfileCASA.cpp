@@ -420,14 +420,22 @@ bool ProfileCASA::handleHook(BaseHook & hookData){
             return false;
         }
 
-        casa_mutex.lock();
         casacore::ImageInterface < casacore::Float > * casaImage = cartaII2casaII_float( imagePtr );
         if( ! casaImage) {
             qWarning() << "Profile plugin: not an image created by casaimageloader...";
-            casa_mutex.unlock();
             return false;
         }
 
+        // lock only this image for reading, the global lock is still needed
+        // because the profile involves spectral/measures conversions
+        CCImageBase * ccImage = dynamic_cast<CCImageBase*>( imagePtr.get() );
+        if ( ! ccImage ) {
+            qWarning() << "Profile plugin: the image has no reader lock...";
+            return false;
+        }
+        QMutexLocker readLocker( & ccImage->readMutex() );
+        casa_mutex.lock();
+
         std::shared_ptr<Carta::Lib::Regions::RegionBase> regionInfo = hook.paramsPtr->m_regionInfo;
         Carta::Lib::ProfileInfo profileInfo = hook.paramsPtr->m_profileInfo;
         int x = hook.paramsPtr->m_x;
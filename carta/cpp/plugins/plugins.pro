@@ -3,6 +3,16 @@ TEMPLATE = subdirs
 
 SUBDIRS += casaCore
 SUBDIRS += CasaImageLoader
+SUBDIRS += FitsMmapLoader
 SUBDIRS += ImageAnalysis
 SUBDIRS += ProfileCASA
 SUBDIRS += PCacheSqlite3
+
+# the HDF5 image loader is only built if HDF5 is installed (see install3party.sh)
+include(../common_config.pri)
+exists($${HDF5DIR}/include/hdf5.h) {
+    SUBDIRS += Hdf5IdiaLoader
+}
+else {
+    message( "No HDF5 in $${HDF5DIR}, the Hdf5IdiaLoader plugin is not built" )
+}
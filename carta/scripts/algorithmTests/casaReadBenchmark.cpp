@@ -0,0 +1,199 @@
+/**
+ * Throughput of sessions reading casacore images in parallel through CCImage and
+ * CCRawView, the way DataSource scans channels for histograms and raster images.
+ * Every thread plays a session reading all the planes of a cube (each starting at a
+ * different plane), with 1, 2, 4, ... threads:
+ *
+ * - own images: every session has a cube of its own (N files), they only share what
+ *   casacore serializes with casa_mutex, so the throughput should grow with the threads;
+ * - one image: all sessions read the same cube, which ImageRegistry shares between
+ *   them as one CCImage, so their reads queue on its readMutex.
+ *
+ * The tile cache is disabled and the files are read once before the timing, so the
+ * numbers are those of casacore and the locks, not of the disk. The sums of the
+ * planes are checked against the values written.
+ *
+ * usage: casaReadBenchmark directory [width height planes maxThreads]
+ **/
+
+#include "plugins/CasaImageLoader/CCImage.h"
+#include "CartaLib/MemoryBudget.h"
+
+#include <casacore/coordinates/Coordinates/CoordinateUtil.h>
+#include <casacore/images/Images/PagedImage.h>
+
+#include <QMutex>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// defined in core/Data/Util.cpp for the server
+QMutex casa_mutex( QMutex::Recursive );
+
+namespace
+{
+/// the pixel of the cube at x, y, z
+float
+_value( int x, int y, int z )
+{
+    return std::sin( x * 0.01f + z ) * std::cos( y * 0.013f ) + z;
+}
+
+/// writes a width x height x planes cube as a casacore image
+void
+_write( const std::string & path, int width, int height, int planes )
+{
+    casacore::IPosition shape( 3, width, height, planes );
+    casacore::PagedImage < float > image( casacore::TiledShape( shape ),
+                                          casacore::CoordinateUtil::defaultCoords3D(), path );
+    casacore::Array < float > plane( casacore::IPosition( 3, width, height, 1 ) );
+    for ( int z = 0 ; z < planes ; z++ ) {
+        float * dst = plane.data();
+        for ( int y = 0 ; y < height ; y++ ) {
+            for ( int x = 0 ; x < width ; x++ ) {
+                * dst++ = _value( x, y, z );
+            }
+        }
+        image.putSlice( plane, casacore::IPosition( 3, 0, 0, z ) );
+    }
+}
+
+/// opens a cube as the CasaImageLoader does
+CCImage < float >::SharedPtr
+_open( const std::string & path )
+{
+    return CCImage < float >::create( new casacore::PagedImage < float > ( path ) );
+}
+
+/// the sum of a plane as written
+double
+_expectedSum( int width, int height, int z )
+{
+    double sum = 0;
+    for ( int y = 0 ; y < height ; y++ ) {
+        for ( int x = 0 ; x < width ; x++ ) {
+            sum += _value( x, y, z );
+        }
+    }
+    return sum;
+}
+
+/// reads all planes of the image starting at plane first, returns false if a sum is off
+bool
+_scan( CCImage < float > & image, int first, const std::vector < double > & expected )
+{
+    int planes = expected.size();
+    bool ok = true;
+    for ( int i = 0 ; i < planes ; i++ ) {
+        int z = ( first + i ) % planes;
+        SliceND slice;
+        slice.slice( 2 ).start( z ).end( z + 1 );
+        Carta::Lib::NdArray::RawViewInterface * view = image.getDataSlice( slice );
+        double sum = 0;
+        view-> forEach( 64 * 1024 * sizeof( float ), [& sum] ( const char * ptr, int64_t count ) {
+            const float * vals = reinterpret_cast < const float * > ( ptr );
+            for ( int64_t k = 0 ; k < count ; k++ ) {
+                sum += vals[k];
+            }
+        } );
+        delete view;
+        if ( std::abs( sum - expected[z] ) > 1e-6 * std::max( 1.0, std::abs( expected[z] ) ) ) {
+            printf( "plane %d sums to %g instead of %g\n", z, sum, expected[z] );
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/// the seconds the threads take to scan images[i % images.size()] each
+double
+_time( int threads, const std::vector < CCImage < float >::SharedPtr > & images,
+       const std::vector < double > & expected, std::atomic < bool > & ok )
+{
+    int planes = expected.size();
+    auto start = std::chrono::steady_clock::now();
+    std::vector < std::thread > sessions;
+    for ( int i = 0 ; i < threads ; i++ ) {
+        CCImage < float > & image = * images[i % images.size()];
+        int first = i * planes / threads;
+        sessions.emplace_back( [& image, first, & expected, & ok] () {
+            if ( ! _scan( image, first, expected ) ) {
+                ok = false;
+            }
+        } );
+    }
+    for ( auto & session : sessions ) {
+        session.join();
+    }
+    return std::chrono::duration < double > ( std::chrono::steady_clock::now() - start ).count();
+}
+}
+
+int
+main( int argc, char ** argv )
+{
+    if ( argc < 2 ) {
+        printf( "usage: casaReadBenchmark directory [width height planes maxThreads]\n" );
+        return 1;
+    }
+    std::string directory = argv[1];
+    int width = argc > 4 ? atoi( argv[2] ) : 1024;
+    int height = argc > 4 ? atoi( argv[3] ) : 1024;
+    int planes = argc > 4 ? atoi( argv[4] ) : 32;
+    int maxThreads = argc > 5 ? atoi( argv[5] ) : std::max( 1u, std::thread::hardware_concurrency() );
+
+    CCTileCache::instance().setMaxBytes( 0 );
+    Carta::Lib::MemoryBudget::instance().setMaxBytes( 0 );
+
+    std::vector < double > expected( planes );
+    for ( int z = 0 ; z < planes ; z++ ) {
+        expected[z] = _expectedSum( width, height, z );
+    }
+
+    // a cube per session, the first one is also the shared one
+    std::vector < CCImage < float >::SharedPtr > own;
+    std::atomic < bool > ok( true );
+    for ( int i = 0 ; i < maxThreads ; i++ ) {
+        std::string path = directory + "/cube" + std::to_string( i ) + ".image";
+        _write( path, width, height, planes );
+        own.push_back( _open( path ) );
+        if ( ! _scan( * own.back(), 0, expected ) ) {
+            ok = false;
+        }
+    }
+    std::vector < CCImage < float >::SharedPtr > shared( 1, own.front() );
+
+    double megabytes = double( width ) * height * planes * sizeof( float ) / ( 1024 * 1024 );
+    printf( "%d sessions reading %d x %d x %d cubes (%.0f MB each)\n", maxThreads, width, height, planes,
+            megabytes );
+    printf( "%8s %16s %8s %16s %8s\n", "threads", "own images MB/s", "scaling", "one image MB/s", "scaling" );
+    // 1, 2, 4, ... threads and maxThreads
+    std::vector < int > threadCounts;
+    for ( int threads = 1 ; threads < maxThreads ; threads *= 2 ) {
+        threadCounts.push_back( threads );
+    }
+    threadCounts.push_back( maxThreads );
+
+    double ownSingle = 0, sharedSingle = 0;
+    for ( int threads : threadCounts ) {
+        double ownRate = threads * megabytes / _time( threads, own, expected, ok );
+        double sharedRate = threads * megabytes / _time( threads, shared, expected, ok );
+        if ( threads == 1 ) {
+            ownSingle = ownRate;
+            sharedSingle = sharedRate;
+        }
+        printf( "%8d %16.0f %7.1fx %16.0f %7.1fx\n", threads, ownRate, ownRate / ownSingle,
+                sharedRate, sharedRate / sharedSingle );
+    }
+
+    if ( ! ok ) {
+        printf( "the planes read differ from the ones written\n" );
+        return 1;
+    }
+    return 0;
+} // main
@@ -0,0 +1,201 @@
+/**
+ * Round trips of the raster codecs without ZFP. The lossless one (shuffleDelta(),
+ * lz4Compress(), lz4Decompress(), unshuffleDelta()) has to give back the bit patterns
+ * of smooth, noisy, constant and NaN images of many sizes, and lz4Decompress() has to
+ * refuse blocks that are cut short or don't fit. The half floats have to give back
+ * every half exactly, round floats to the nearest half (ties to even) and keep NaNs.
+ *
+ * usage: compressionTest
+ **/
+
+#include "Algorithms/compressionAlgorithms.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Algorithms = Carta::Core::Algorithms;
+
+namespace
+{
+int failures = 0;
+
+void
+_fail( const std::string & what )
+{
+    printf( "%s\n", what.c_str() );
+    failures++;
+}
+
+/// count floats of the given kind
+std::vector < float >
+_values( const std::string & kind, size_t count )
+{
+    std::mt19937 random( 42 );
+    std::uniform_real_distribution < float > uniform( -1000, 1000 );
+    std::vector < float > values( count );
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        if ( kind == "smooth" ) {
+            values[i] = std::sin( i * 1e-3f ) * 100;
+        }
+        else if ( kind == "noise" ) {
+            values[i] = uniform( random );
+        }
+        else if ( kind == "constant" ) {
+            values[i] = 3.25f;
+        }
+        else {
+            // NaNs, infinities, subnormals and zeros among smooth values
+            const float special[] = { std::numeric_limits < float >::quiet_NaN(),
+                                      std::numeric_limits < float >::infinity(),
+                                      - std::numeric_limits < float >::infinity(),
+                                      std::numeric_limits < float >::denorm_min(), -0.0f, 0.0f };
+            values[i] = i % 3 == 0 ? special[( i / 3 ) % 6] : std::cos( i * 0.01f );
+        }
+    }
+    return values;
+}
+
+void
+_checkLossless( const std::string & kind, size_t count )
+{
+    std::vector < float > values = _values( kind, count );
+    size_t bytes = count * sizeof( float );
+    std::vector < uint8_t > planes( bytes );
+    Algorithms::shuffleDelta( values.data(), count, planes.data() );
+    std::vector < uint8_t > block( Algorithms::lz4CompressBound( bytes ) );
+    size_t blockSize = Algorithms::lz4Compress( planes.data(), bytes, block.data() );
+    std::string name = kind + " " + std::to_string( count );
+    if ( blockSize > block.size() ) {
+        _fail( name + ": the block is larger than the bound" );
+        return;
+    }
+
+    std::vector < uint8_t > unpacked( bytes );
+    int64_t unpackedSize = Algorithms::lz4Decompress( block.data(), blockSize, unpacked.data(), unpacked.size() );
+    if ( unpackedSize != int64_t( bytes ) ) {
+        _fail( name + ": decompressed " + std::to_string( unpackedSize ) + " bytes" );
+        return;
+    }
+    std::vector < float > decoded( count );
+    Algorithms::unshuffleDelta( unpacked.data(), count, decoded.data() );
+    if ( count > 0 && std::memcmp( decoded.data(), values.data(), bytes ) != 0 ) {
+        _fail( name + ": the values differ" );
+    }
+
+    // a block that does not fit or is cut short is refused
+    if ( bytes > 0 ) {
+        std::vector < uint8_t > small( bytes - 1 );
+        if ( Algorithms::lz4Decompress( block.data(), blockSize, small.data(), small.size() ) != -1 ) {
+            _fail( name + ": decompressed into too small a buffer" );
+        }
+    }
+    if ( blockSize > 1 &&
+         Algorithms::lz4Decompress( block.data(), blockSize - 1, unpacked.data(), unpacked.size() ) == int64_t( bytes ) ) {
+        _fail( name + ": decompressed a truncated block" );
+    }
+
+    if ( count == 1 << 20 ) {
+        printf( "lossless %-8s %7.1f%% of the raw size\n", kind.c_str(), 100.0 * blockSize / bytes );
+    }
+}
+
+float
+_float( uint32_t bits )
+{
+    float value;
+    std::memcpy( & value, & bits, sizeof( value ) );
+    return value;
+}
+
+void
+_checkHalf()
+{
+    // every half comes back unchanged, NaNs as some NaN
+    for ( uint32_t half = 0 ; half < 0x10000 ; half++ ) {
+        float value = Algorithms::halfToFloat( static_cast < uint16_t > ( half ) );
+        uint16_t back = Algorithms::floatToHalf( value );
+        bool nan = ( half & 0x7c00 ) == 0x7c00 && ( half & 0x03ff ) != 0;
+        if ( nan ? ! ( std::isnan( value ) && ( back & 0x7c00 ) == 0x7c00 && ( back & 0x03ff ) != 0 )
+                 : back != half ) {
+            _fail( "half " + std::to_string( half ) + " comes back as " + std::to_string( back ) );
+        }
+    }
+
+    // floats become the nearest half, ties to even
+    struct Case {
+        float value;
+        float expected;
+    };
+    const float inf = std::numeric_limits < float >::infinity();
+    const Case cases[] = {
+        { 1.0f, 1.0f },
+        { 1.0f + std::ldexp( 1.0f, -11 ), 1.0f },
+        { 1.0f + 3 * std::ldexp( 1.0f, -11 ), 1.0f + std::ldexp( 1.0f, -9 ) },
+        { 1.0f + std::ldexp( 1.0f, -11 ) + std::ldexp( 1.0f, -20 ), 1.0f + std::ldexp( 1.0f, -10 ) },
+        { 65504.0f, 65504.0f },
+        { 65519.0f, 65504.0f },
+        { 65520.0f, inf },
+        { 1e10f, inf },
+        { -1e10f, -inf },
+        { std::ldexp( 1.0f, -24 ), std::ldexp( 1.0f, -24 ) },
+        { std::ldexp( 1.0f, -25 ), 0.0f },
+        { 3 * std::ldexp( 1.0f, -26 ), std::ldexp( 1.0f, -24 ) },
+        { 1e-10f, 0.0f },
+        { -2.5f, -2.5f },
+        { _float( 0x3e2aaaab ), 0.1666259765625f },
+    };
+    for ( const Case & c : cases ) {
+        float result = Algorithms::halfToFloat( Algorithms::floatToHalf( c.value ) );
+        if ( result != c.expected ) {
+            char text[128];
+            snprintf( text, sizeof( text ), "%.9g becomes %.9g instead of %.9g", c.value, result, c.expected );
+            _fail( text );
+        }
+    }
+    if ( ! std::isnan( Algorithms::halfToFloat( Algorithms::floatToHalf( std::nanf( "" ) ) ) ) ) {
+        _fail( "NaN does not stay NaN" );
+    }
+    if ( std::signbit( Algorithms::halfToFloat( Algorithms::floatToHalf( -0.0f ) ) ) == false ) {
+        _fail( "-0 loses its sign" );
+    }
+
+    // any float in the half range is within half a unit in the last place
+    std::mt19937 random( 7 );
+    std::uniform_real_distribution < float > exponent( -14, 15.9f );
+    for ( int i = 0 ; i < 100000 ; i++ ) {
+        float value = std::exp2( exponent( random ) ) * ( i % 2 ? 1 : -1 );
+        float result = Algorithms::halfToFloat( Algorithms::floatToHalf( value ) );
+        int e;
+        std::frexp( value, & e );
+        if ( std::abs( result - value ) > std::ldexp( 1.0f, e - 12 ) ) {
+            char text[128];
+            snprintf( text, sizeof( text ), "%.9g becomes %.9g", value, result );
+            _fail( text );
+            break;
+        }
+    }
+}
+}
+
+int
+main()
+{
+    for ( const char * kind : { "smooth", "noise", "constant", "special" } ) {
+        for ( size_t count : { 0, 1, 2, 3, 4, 5, 16, 17, 100, 4099, 65536, 1 << 20 } ) {
+            _checkLossless( kind, count );
+        }
+    }
+    _checkHalf();
+    if ( failures > 0 ) {
+        printf( "%d failures\n", failures );
+        return 1;
+    }
+    printf( "all round trips agree\n" );
+    return 0;
+} // main
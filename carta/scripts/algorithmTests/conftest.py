@@ -0,0 +1,75 @@
+"""
+Builds the test and benchmark programs of this directory.
+
+The programs are compiled together with the sources of carta/cpp they test. The
+ones that need Qt link against the CartaLib of a CARTA build (--cartaBuild), they
+are skipped when Qt or the build can't be found.
+"""
+
+import os
+import shutil
+import subprocess
+
+import pytest
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+CPP_DIR = os.path.abspath(os.path.join(TESTS_DIR, '..', '..', 'cpp'))
+
+
+def pytest_addoption(parser):
+    parser.addoption('--cartaBuild', action='store', default='',
+                     help='build directory of carta/cpp, for the programs that link CartaLib')
+
+
+def _packageFlags(package):
+    try:
+        flags = subprocess.check_output(['pkg-config', '--cflags', '--libs', package])
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    return flags.decode().split()
+
+
+@pytest.fixture(scope='session')
+def build(request, tmp_path_factory):
+    """
+    Returns a function that compiles <program>.cpp of this directory together with
+    the given sources (relative to carta/cpp) and the libraries of the given pkg-config
+    packages, and returns the path of the executable.
+    """
+    compiler = os.environ.get('CXX', 'g++')
+    if shutil.which(compiler) is None:
+        pytest.skip('no C++ compiler ' + compiler)
+    outDir = tmp_path_factory.mktemp('algorithmTests')
+
+    def _build(program, sources=(), cartaLib=False, packages=()):
+        flags = []
+        for package in packages:
+            packageFlags = _packageFlags(package)
+            if packageFlags is None:
+                pytest.skip(package + ' not found by pkg-config')
+            flags += packageFlags
+        if cartaLib:
+            qtFlags = _packageFlags('Qt5Core')
+            libDir = os.path.join(request.config.getoption('--cartaBuild'), 'CartaLib')
+            if qtFlags is None:
+                pytest.skip('Qt5Core not found by pkg-config')
+            if not os.path.isdir(libDir):
+                pytest.skip('no CartaLib build in ' + libDir)
+            flags += qtFlags + ['-fPIC', '-L' + libDir, '-Wl,-rpath,' + libDir, '-lCartaLib']
+        executable = str(outDir / program)
+        command = [compiler, '-std=c++11', '-O2', '-I' + CPP_DIR, '-I' + os.path.join(CPP_DIR, 'core'),
+                   '-o', executable, os.path.join(TESTS_DIR, program + '.cpp')]
+        command += [os.path.join(CPP_DIR, source) for source in sources]
+        subprocess.check_call(command + flags + ['-lpthread'])
+        return executable
+
+    return _build
+
+
+def run(executable, *args):
+    """
+    Runs a program, prints its output and returns it.
+    """
+    output = subprocess.check_output([executable] + [str(arg) for arg in args]).decode()
+    print(output)
+    return output
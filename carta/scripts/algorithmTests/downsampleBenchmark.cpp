@@ -0,0 +1,127 @@
+/**
+ * Compares blockMeans() with the per pixel loop _getRasterImageData used before it,
+ * which did a division, a modulo and a finiteness branch for every pixel, for block
+ * sizes from 1 to 32. Both down sample the same image row of blocks by row of blocks
+ * and their means are checked against each other.
+ *
+ * usage: downsampleBenchmark [width height repeats]
+ **/
+
+#include "Algorithms/downsampleAlgorithms.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace Algorithms = Carta::Core::Algorithms;
+
+namespace
+{
+/// the block loop of _getRasterImageData before blockMeans(), for the rows in prepareArea
+void
+_perPixelMeans( const std::vector < float > & prepareArea, int prepareCols, int xMin, int mip, int nCols,
+                std::vector < float > & imageData )
+{
+    for ( int i = 0 ; i < nCols ; i++ ) {
+        float rawData = 0;
+        int elems = mip * mip;
+        float denominator = elems;
+        for ( int e = 0 ; e < elems ; e++ ) {
+            int row = e / mip;
+            int col = e % mip;
+            int index = ( ( row * prepareCols ) + ( col + ( xMin + ( i * mip ) ) ) );
+            if ( std::isfinite( prepareArea[index] ) ) {
+                rawData += prepareArea[index];
+            }
+            else {
+                denominator -= 1;
+            }
+        }
+        rawData = ( denominator < 1 ? NAN : rawData / denominator );
+        imageData.push_back( rawData );
+    }
+}
+
+template < class Downsample >
+double
+_time( int repeats, Downsample downsample )
+{
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0 ; i < repeats ; i++ ) {
+        downsample();
+    }
+    return std::chrono::duration < double > ( std::chrono::steady_clock::now() - start ).count() / repeats;
+}
+
+bool
+_same( const std::vector < float > & a, const std::vector < float > & b )
+{
+    if ( a.size() != b.size() ) {
+        return false;
+    }
+    for ( size_t i = 0 ; i < a.size() ; i++ ) {
+        if ( std::isnan( a[i] ) != std::isnan( b[i] ) ||
+             ( ! std::isnan( a[i] ) && std::abs( a[i] - b[i] ) > 1e-4f * std::max( 1.0f, std::abs( b[i] ) ) ) ) {
+            printf( "mean %zu differs: %g %g\n", i, a[i], b[i] );
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+int
+main( int argc, char ** argv )
+{
+    int width = argc > 2 ? atoi( argv[1] ) : 4096;
+    int height = argc > 2 ? atoi( argv[2] ) : 4096;
+    int repeats = argc > 3 ? atoi( argv[3] ) : 3;
+
+    // smooth data with a few NaNs, like a typical image
+    std::vector < float > pixels( int64_t( width ) * height );
+    for ( int64_t i = 0 ; i < int64_t( pixels.size() ) ; i++ ) {
+        pixels[i] = i % 1009 == 0 ? std::numeric_limits < float >::quiet_NaN() : std::sin( i * 1e-3f );
+    }
+
+    printf( "blockMeans uses %s\n", Algorithms::blockMeansImplementation() );
+    printf( "%4s %14s %14s %8s\n", "mip", "per pixel ms", "blockMeans ms", "speedup" );
+    for ( int mip : { 1, 2, 3, 4, 8, 16, 32 } ) {
+        int nCols = width / mip;
+        int nRows = height / mip;
+        int area = width * mip;
+
+        // the old loop copied the rows into prepareArea first, so does this one
+        std::vector < float > prepareArea( area );
+        std::vector < float > perPixel;
+        double perPixelSeconds = _time( repeats, [&] () {
+            perPixel.clear();
+            for ( int j = 0 ; j < nRows ; j++ ) {
+                std::copy( pixels.begin() + int64_t( j ) * area, pixels.begin() + int64_t( j + 1 ) * area,
+                           prepareArea.begin() );
+                _perPixelMeans( prepareArea, width, 0, mip, nCols, perPixel );
+            }
+        } );
+
+        std::vector < float > scratch( 2 * nCols * mip );
+        std::vector < float > blocks( int64_t( nRows ) * nCols );
+        double blockSeconds = _time( repeats, [&] () {
+            for ( int j = 0 ; j < nRows ; j++ ) {
+                std::copy( pixels.begin() + int64_t( j ) * area, pixels.begin() + int64_t( j + 1 ) * area,
+                           prepareArea.begin() );
+                Algorithms::blockMeans( prepareArea.data(), width, mip, nCols, scratch.data(),
+                                        blocks.data() + int64_t( j ) * nCols );
+            }
+        } );
+
+        printf( "%4d %14.2f %14.2f %8.1f\n", mip, 1000 * perPixelSeconds, 1000 * blockSeconds,
+                perPixelSeconds / blockSeconds );
+        if ( ! _same( blocks, perPixel ) ) {
+            printf( "the means of mip %d disagree\n", mip );
+            return 1;
+        }
+    }
+    return 0;
+} // main
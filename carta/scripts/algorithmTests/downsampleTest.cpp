@@ -0,0 +1,118 @@
+/**
+ * Checks blockMeans() against a plain scalar computation of the block means, on rows
+ * with NaNs, infinities, fully blank blocks and widths that don't fill the SIMD
+ * lanes, for block sizes from 1 to 33.
+ *
+ * usage: downsampleTest
+ **/
+
+#include "Algorithms/downsampleAlgorithms.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace Algorithms = Carta::Core::Algorithms;
+
+namespace
+{
+/// the means of the blocks summed in double precision, one pixel at a time
+int
+_referenceMeans( const float * rows, int64_t rowStride, int mip, int nCols, float * out )
+{
+    int nans = 0;
+    for ( int col = 0 ; col < nCols ; col++ ) {
+        double sum = 0;
+        int count = 0;
+        for ( int row = 0 ; row < mip ; row++ ) {
+            for ( int i = 0 ; i < mip ; i++ ) {
+                float value = rows[row * rowStride + col * mip + i];
+                if ( std::isfinite( value ) ) {
+                    sum += value;
+                    count++;
+                }
+            }
+        }
+        if ( count == 0 ) {
+            out[col] = std::numeric_limits < float >::quiet_NaN();
+            nans++;
+        }
+        else {
+            out[col] = static_cast < float > ( sum / count );
+        }
+    }
+    return nans;
+}
+
+/// mip rows of pixels, with a blank left border, scattered NaNs and infinities
+std::vector < float >
+_rows( int64_t rowStride, int mip, int blankColumns )
+{
+    std::vector < float > rows( rowStride * mip );
+    for ( int64_t i = 0 ; i < int64_t( rows.size() ) ; i++ ) {
+        int64_t x = i % rowStride;
+        if ( x < blankColumns || i % 97 == 5 ) {
+            rows[i] = std::numeric_limits < float >::quiet_NaN();
+        }
+        else if ( i % 389 == 7 ) {
+            rows[i] = i % 2 ? std::numeric_limits < float >::infinity() : - std::numeric_limits < float >::infinity();
+        }
+        else {
+            rows[i] = 100.0f * std::sin( i * 0.37f ) + 1000.0f;
+        }
+    }
+    return rows;
+}
+
+bool
+_same( float a, float b )
+{
+    if ( std::isnan( a ) || std::isnan( b ) ) {
+        return std::isnan( a ) && std::isnan( b );
+    }
+    return std::abs( a - b ) <= 1e-5f * std::max( 1.0f, std::abs( b ) );
+}
+}
+
+int
+main()
+{
+    printf( "blockMeans uses %s\n", Algorithms::blockMeansImplementation() );
+    int failures = 0;
+    for ( int mip = 1 ; mip <= 33 ; mip++ ) {
+        for ( int nCols : { 1, 3, 7, 64 } ) {
+            // the rows are wider than the blocks, like full image rows with xMin > 0
+            int offset = 3;
+            int64_t rowStride = int64_t( nCols ) * mip + offset + 5;
+            int blankColumns = offset + 2 * mip;
+            std::vector < float > rows = _rows( rowStride, mip, blankColumns );
+            std::vector < float > scratch( 2 * nCols * mip );
+            std::vector < float > means( nCols );
+            std::vector < float > expected( nCols );
+
+            int nans = Algorithms::blockMeans( rows.data() + offset, rowStride, mip, nCols,
+                                               scratch.data(), means.data() );
+            int expectedNans = _referenceMeans( rows.data() + offset, rowStride, mip, nCols, expected.data() );
+
+            if ( nans != expectedNans ) {
+                printf( "mip %d, %d blocks: %d NaN means instead of %d\n", mip, nCols, nans, expectedNans );
+                failures++;
+            }
+            for ( int col = 0 ; col < nCols ; col++ ) {
+                if ( ! _same( means[col], expected[col] ) ) {
+                    printf( "mip %d, %d blocks: block %d is %g instead of %g\n", mip, nCols, col,
+                            means[col], expected[col] );
+                    failures++;
+                }
+            }
+        }
+    }
+    if ( failures > 0 ) {
+        printf( "%d failures\n", failures );
+        return 1;
+    }
+    printf( "all block means agree\n" );
+    return 0;
+} // main
@@ -0,0 +1,312 @@
+/**
+ * Opens small synthetic HDF5 files in the IDIA schema with Hdf5IdiaFile and reads
+ * them through Hdf5IdiaRawView: planes of the cube, a permuted plane, a down
+ * sampled plane and spectra from the swizzled copy are compared with the values
+ * written. Files that are not IDIA images have to be refused (without hanging).
+ *
+ * usage: hdf5IdiaTest directory
+ **/
+
+#include "plugins/Hdf5IdiaLoader/Hdf5IdiaFile.h"
+#include "plugins/Hdf5IdiaLoader/Hdf5IdiaRawView.h"
+
+#include <hdf5.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+const int NX = 40;
+const int NY = 30;
+const int NZ = 8;
+
+/// the pixel of the cube at x, y, z; one of them is blank
+float
+_value( int x, int y, int z )
+{
+    if ( x == 3 && y == 4 && z == 5 ) {
+        return std::numeric_limits < float >::quiet_NaN();
+    }
+    return x + 100.0f * y + 10000.0f * z;
+}
+
+/// the pixel of the mip 2 copy
+float
+_mipValue( int x, int y, int z )
+{
+    return -( x + 100.0f * y + 10000.0f * z );
+}
+
+int failures = 0;
+
+void
+_check( bool ok, const std::string & what )
+{
+    if ( ! ok ) {
+        printf( "FAILED: %s\n", what.c_str() );
+        failures++;
+    }
+}
+
+bool
+_same( float a, float b )
+{
+    return a == b || ( std::isnan( a ) && std::isnan( b ) );
+}
+
+/// Write a float dataset; dims are in HDF5 order (slowest first).
+void
+_writeDataset( hid_t group, const char * name, const std::vector < hsize_t > & dims,
+               const std::vector < float > & values, const std::vector < hsize_t > & chunk = {} )
+{
+    hid_t space = H5Screate_simple( dims.size(), dims.data(), nullptr );
+    hid_t createList = H5Pcreate( H5P_DATASET_CREATE );
+    if ( ! chunk.empty() ) {
+        H5Pset_chunk( createList, chunk.size(), chunk.data() );
+        H5Pset_deflate( createList, 1 );
+    }
+    hid_t dataset = H5Dcreate2( group, name, H5T_NATIVE_FLOAT, space, H5P_DEFAULT, createList, H5P_DEFAULT );
+    H5Dwrite( dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data() );
+    H5Dclose( dataset );
+    H5Pclose( createList );
+    H5Sclose( space );
+}
+
+void
+_writeStringAttribute( hid_t location, const char * name, const char * value )
+{
+    hid_t type = H5Tcopy( H5T_C_S1 );
+    H5Tset_size( type, strlen( value ) );
+    hid_t space = H5Screate( H5S_SCALAR );
+    hid_t attr = H5Acreate2( location, name, type, space, H5P_DEFAULT, H5P_DEFAULT );
+    H5Awrite( attr, type, value );
+    H5Aclose( attr );
+    H5Sclose( space );
+    H5Tclose( type );
+}
+
+void
+_writeIntAttribute( hid_t location, const char * name, int value )
+{
+    hid_t space = H5Screate( H5S_SCALAR );
+    hid_t attr = H5Acreate2( location, name, H5T_NATIVE_INT, space, H5P_DEFAULT, H5P_DEFAULT );
+    H5Awrite( attr, H5T_NATIVE_INT, & value );
+    H5Aclose( attr );
+    H5Sclose( space );
+}
+
+/// An IDIA file with a chunked cube, a mip 2 copy and the swizzled copy.
+void
+_writeImage( const std::string & path )
+{
+    hid_t file = H5Fcreate( path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT );
+    hid_t group = H5Gcreate2( file, "0", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+    _writeStringAttribute( group, "BUNIT", "Jy/beam" );
+    _writeIntAttribute( group, "NAXIS", 3 );
+
+    std::vector < float > cube;
+    for ( int z = 0 ; z < NZ ; z++ ) {
+        for ( int y = 0 ; y < NY ; y++ ) {
+            for ( int x = 0 ; x < NX ; x++ ) {
+                cube.push_back( _value( x, y, z ) );
+            }
+        }
+    }
+    _writeDataset( group, "DATA", { NZ, NY, NX }, cube, { 2, 16, 16 } );
+
+    int mx = ( NX + 1 ) / 2;
+    int my = ( NY + 1 ) / 2;
+    std::vector < float > mip;
+    for ( int z = 0 ; z < NZ ; z++ ) {
+        for ( int y = 0 ; y < my ; y++ ) {
+            for ( int x = 0 ; x < mx ; x++ ) {
+                mip.push_back( _mipValue( x, y, z ) );
+            }
+        }
+    }
+    hid_t mipGroup = H5Gcreate2( group, "MipMaps", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+    hid_t mipDataGroup = H5Gcreate2( mipGroup, "DATA", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+    _writeDataset( mipDataGroup, "DATA_XY_2", { NZ, hsize_t( my ), hsize_t( mx ) }, mip );
+    H5Gclose( mipDataGroup );
+    H5Gclose( mipGroup );
+
+    // the spectral axis fastest
+    std::vector < float > swizzled;
+    for ( int x = 0 ; x < NX ; x++ ) {
+        for ( int y = 0 ; y < NY ; y++ ) {
+            for ( int z = 0 ; z < NZ ; z++ ) {
+                swizzled.push_back( _value( x, y, z ) );
+            }
+        }
+    }
+    hid_t swizzledGroup = H5Gcreate2( group, "SwizzledData", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+    _writeDataset( swizzledGroup, "ZYX", { NX, NY, NZ }, swizzled );
+    H5Gclose( swizzledGroup );
+
+    H5Gclose( group );
+    H5Fclose( file );
+}
+
+/// An HDF5 file with the given group, with an integer DATA in it if withData is set.
+void
+_writeOther( const std::string & path, const char * groupName, bool withData )
+{
+    hid_t file = H5Fcreate( path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT );
+    hid_t group = H5Gcreate2( file, groupName, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+    if ( withData ) {
+        hsize_t dims[2] = { 4, 4 };
+        std::vector < int > values( 16, 1 );
+        hid_t space = H5Screate_simple( 2, dims, nullptr );
+        hid_t dataset = H5Dcreate2( group, "DATA", H5T_NATIVE_INT, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT );
+        H5Dwrite( dataset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data() );
+        H5Dclose( dataset );
+        H5Sclose( space );
+    }
+    H5Gclose( group );
+    H5Fclose( file );
+}
+
+/// Read a whole view.
+std::vector < float >
+_read( Carta::Lib::NdArray::RawViewInterface & view )
+{
+    int64_t n = 1;
+    for ( int d : view.dims() ) {
+        n *= d;
+    }
+    std::vector < float > values( n );
+    int64_t bytes = view.read( n * sizeof( float ), reinterpret_cast < char * > ( values.data() ) );
+    _check( bytes == n * int64_t( sizeof( float ) ), "read() returns the whole view" );
+    return values;
+}
+
+void
+_testRefused( const std::string & directory )
+{
+    std::string text = directory + "/notHdf5.fits";
+    std::ofstream( text ) << "SIMPLE  =                    T";
+    _check( ! Hdf5IdiaFile::open( QString::fromStdString( text ) ), "a text file is refused" );
+
+    // these give up with the file open, which must not dead lock
+    std::string noGroup = directory + "/noGroup.hdf5";
+    _writeOther( noGroup, "1", true );
+    _check( ! Hdf5IdiaFile::open( QString::fromStdString( noGroup ) ), "a file without group 0 is refused" );
+
+    std::string noData = directory + "/noData.hdf5";
+    _writeOther( noData, "0", false );
+    _check( ! Hdf5IdiaFile::open( QString::fromStdString( noData ) ), "a file without DATA is refused" );
+
+    std::string intData = directory + "/intData.hdf5";
+    _writeOther( intData, "0", true );
+    _check( ! Hdf5IdiaFile::open( QString::fromStdString( intData ) ), "integer DATA is refused" );
+}
+
+void
+_testImage( const std::string & directory )
+{
+    std::string path = directory + "/image.hdf5";
+    _writeImage( path );
+    Hdf5IdiaFile::SharedPtr file = Hdf5IdiaFile::open( QString::fromStdString( path ) );
+    _check( file != nullptr, "the image is opened" );
+    if ( ! file ) {
+        return;
+    }
+    _check( file-> data.dims == std::vector < int > ( { NX, NY, NZ } ), "dimensions in FITS order" );
+    _check( file-> data.chunk == std::vector < int > ( { 16, 16, 2 } ), "chunk in FITS order" );
+    _check( file-> mips.size() == 1 && file-> mips.count( 2 ), "the mip 2 copy is found" );
+    _check( file-> swizzled.id >= 0, "the swizzled copy is found" );
+    _check( file-> cards.contains( QString( "BUNIT   = 'Jy/beam'" ).leftJustified( 80, ' ' ) ), "string card" );
+    _check( file-> cards.contains( QString( "NAXIS   = 3" ).leftJustified( 80, ' ' ) ), "integer card" );
+
+    // one channel of the cube
+    const std::vector < int > order = { 0, 1, 2 };
+    const int z = 5;
+    SliceND channel;
+    channel.slice( 2 ).start( z ).end( z + 1 );
+    {
+        Hdf5IdiaRawView view( file, & file-> data, order, channel );
+        std::vector < float > plane = _read( view );
+        bool ok = true;
+        for ( int y = 0 ; y < NY ; y++ ) {
+            for ( int x = 0 ; x < NX ; x++ ) {
+                ok = ok && _same( plane[x + y * NX], _value( x, y, z ) );
+            }
+        }
+        _check( ok, "a channel of the cube" );
+
+        // the positions of the per pixel scan
+        bool positions = true;
+        view.forEach( [&] ( const char * ptr ) {
+            float value = * reinterpret_cast < const float * > ( ptr );
+            const auto & pos = view.currentPos();
+            positions = positions && _same( value, _value( pos[0], pos[1], z ) );
+        } );
+        _check( positions, "currentPos() of the per pixel forEach" );
+    }
+
+    // the same channel with x and y swapped
+    {
+        Hdf5IdiaRawView view( file, & file-> data, { 1, 0, 2 }, channel );
+        std::vector < float > plane = _read( view );
+        bool ok = view.dims() == std::vector < int > ( { NY, NX, 1 } );
+        for ( int x = 0 ; ok && x < NX ; x++ ) {
+            for ( int y = 0 ; y < NY ; y++ ) {
+                ok = ok && _same( plane[y + x * NY], _value( x, y, z ) );
+            }
+        }
+        _check( ok, "a permuted channel" );
+    }
+
+    // the down sampled copy
+    {
+        Hdf5IdiaRawView view( file, & file-> mips[2], order, channel );
+        std::vector < float > plane = _read( view );
+        int mx = ( NX + 1 ) / 2;
+        int my = ( NY + 1 ) / 2;
+        bool ok = view.dims() == std::vector < int > ( { mx, my, 1 } );
+        for ( int y = 0 ; ok && y < my ; y++ ) {
+            for ( int x = 0 ; x < mx ; x++ ) {
+                ok = ok && plane[x + y * mx] == _mipValue( x, y, z );
+            }
+        }
+        _check( ok, "a channel of the mip 2 copy" );
+    }
+
+    // spectra, every other channel of a sub cube
+    {
+        Hdf5IdiaRawView cube( file, & file-> data, order, SliceND() );
+        bool ok = true;
+        for ( int y : { 0, 4, NY - 1 } ) {
+            for ( int x : { 0, 3, NX - 1 } ) {
+                std::vector < float > spectrum( NZ );
+                int64_t count = cube.readLine( { x, y, 1 }, 2, NZ, 2, reinterpret_cast < char * > ( spectrum.data() ) );
+                // channels 1, 3, 5 and 7
+                ok = ok && count == NZ / 2;
+                for ( int k = 0 ; k < count ; k++ ) {
+                    ok = ok && _same( spectrum[k], _value( x, y, 1 + 2 * k ) );
+                }
+            }
+        }
+        _check( ok, "spectra from the swizzled copy" );
+    }
+}
+}
+
+int
+main( int argc, char ** argv )
+{
+    if ( argc < 2 ) {
+        printf( "usage: hdf5IdiaTest directory\n" );
+        return 2;
+    }
+    std::string directory = argv[1];
+    _testRefused( directory );
+    _testImage( directory );
+    printf( "%d failures\n", failures );
+    return failures == 0 ? 0 : 1;
+}
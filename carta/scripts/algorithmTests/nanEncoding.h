@@ -0,0 +1,115 @@
+/**
+ * The NaN encoding of the raster images as DataSource::_getNanEncodingsBlock does it
+ * with NanRunEncoder and fillNanBlocks(), and as it did before, for the test and the
+ * benchmark.
+ **/
+
+#pragma once
+
+#include "Algorithms/downsampleAlgorithms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/// run lengths of the NaNs of the w x h image at offset, and NaNs of mixed 4 x 4 blocks
+/// replaced by the mean of the other values
+inline std::vector < int32_t >
+referenceNanEncodingsBlock( std::vector < float > & array, int offset, int w, int h )
+{
+    // Generate RLE NaN list
+    int length = w * h;
+    int32_t prevIndex = offset;
+    bool prev = false;
+    std::vector < int32_t > encodedArray;
+
+    for ( auto i = offset ; i < offset + length ; i++ ) {
+        bool current = std::isnan( array[i] );
+        if ( current != prev ) {
+            encodedArray.push_back( i - prevIndex );
+            prevIndex = i;
+            prev = current;
+        }
+    }
+    encodedArray.push_back( offset + length - prevIndex );
+
+    // Skip all-NaN images and NaN-free images
+    if ( encodedArray.size() > 1 ) {
+        // Calculate average of 4x4 blocks (matching blocks used in ZFP), and replace NaNs with block average
+        for ( auto i = 0 ; i < w ; i += 4 ) {
+            for ( auto j = 0 ; j < h ; j += 4 ) {
+                int blockStart = offset + j * w + i;
+                int validCount = 0;
+                float sum = 0;
+                // Limit the block size when at the edges of the image
+                int blockWidth = std::min( 4, w - i );
+                int blockHeight = std::min( 4, h - j );
+                for ( int x = 0 ; x < blockWidth ; x++ ) {
+                    for ( int y = 0 ; y < blockHeight ; y++ ) {
+                        float v = array[blockStart + ( y * w ) + x];
+                        if ( ! std::isnan( v ) ) {
+                            validCount++;
+                            sum += v;
+                        }
+                    }
+                }
+
+                // Only process blocks which have at least one valid value AND at least one NaN
+                if ( validCount && validCount != blockWidth * blockHeight ) {
+                    float average = sum / validCount;
+                    for ( int x = 0 ; x < blockWidth ; x++ ) {
+                        for ( int y = 0 ; y < blockHeight ; y++ ) {
+                            float v = array[blockStart + ( y * w ) + x];
+                            if ( std::isnan( v ) ) {
+                                array[blockStart + ( y * w ) + x] = average;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return encodedArray;
+}
+
+/// the NaN encoding of DataSource::_getNanEncodingsBlock, nanRows tells for each row
+/// whether it has NaNs or is nullptr
+inline std::vector < int32_t >
+nanEncodingsBlock( std::vector < float > & array, int offset, int w, int h, const char * nanRows )
+{
+    if ( nanRows && std::none_of( nanRows, nanRows + h, [] ( char nan ) { return nan; } ) ) {
+        return std::vector < int32_t > ( 1, w * h );
+    }
+    Carta::Core::Algorithms::NanRunEncoder encoder;
+    const float * values = array.data() + offset;
+    if ( nanRows ) {
+        for ( int row = 0 ; row < h ; row++ ) {
+            if ( nanRows[row] ) {
+                encoder.append( values + static_cast < size_t > ( row ) * w, w );
+            }
+            else {
+                encoder.appendValid( w );
+            }
+        }
+    }
+    else {
+        encoder.append( values, static_cast < int64_t > ( w ) * h );
+    }
+    std::vector < int32_t > encodedArray = encoder.finish();
+    Carta::Core::Algorithms::fillNanBlocks( array.data() + offset, w, h, encodedArray );
+    return encodedArray;
+}
+
+/// for each of the h rows of the w x h image at offset whether it has NaNs, as the
+/// down sampling reports them
+inline std::vector < char >
+nanRowsOf( const std::vector < float > & array, int offset, int w, int h )
+{
+    std::vector < char > nanRows( h, 0 );
+    for ( int row = 0 ; row < h ; row++ ) {
+        const float * values = array.data() + offset + static_cast < size_t > ( row ) * w;
+        nanRows[row] = std::any_of( values, values + w, [] ( float v ) { return std::isnan( v ); } );
+    }
+    return nanRows;
+}
@@ -0,0 +1,106 @@
+/**
+ * Compares the NaN encoding of the raster images (NanRunEncoder and fillNanBlocks())
+ * with the scalar one it replaced, on mosaics: a tilted footprint of data with blank
+ * borders around it and a few blank holes, as left by the mosaicking of several
+ * pointings. The new encoding is timed with and without the NaN rows the down sampling
+ * reports, and all of them are checked to give the same result.
+ *
+ * usage: nanEncodingBenchmark [width height repeats]
+ **/
+
+#include "nanEncoding.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace
+{
+/// a mosaic of width x height: the data covers a tilted square covering about half of
+/// the image, and the blank holes are circles inside it
+std::vector < float >
+_mosaic( int width, int height )
+{
+    std::vector < float > image( int64_t( width ) * height );
+    const double cx = width / 2.0;
+    const double cy = height / 2.0;
+    const double halfSide = 0.35 * std::min( width, height );
+    const double angle = 0.4;
+    for ( int y = 0 ; y < height ; y++ ) {
+        for ( int x = 0 ; x < width ; x++ ) {
+            double u = ( x - cx ) * std::cos( angle ) + ( y - cy ) * std::sin( angle );
+            double v = - ( x - cx ) * std::sin( angle ) + ( y - cy ) * std::cos( angle );
+            double hole = std::hypot( u - halfSide / 2, v ) - halfSide / 10;
+            bool blank = std::abs( u ) > halfSide || std::abs( v ) > halfSide || hole < 0;
+            image[int64_t( y ) * width + x] = blank ? std::numeric_limits < float >::quiet_NaN() :
+                                              static_cast < float > ( std::sin( x * 0.01 ) * std::cos( y * 0.013 ) );
+        }
+    }
+    return image;
+}
+
+template < class Encode >
+double
+_time( int repeats, const std::vector < float > & image, std::vector < float > & result,
+       std::vector < int32_t > & runs, Encode encode )
+{
+    double seconds = 0;
+    for ( int i = 0 ; i < repeats ; i++ ) {
+        result = image;
+        auto start = std::chrono::steady_clock::now();
+        runs = encode( result );
+        seconds += std::chrono::duration < double > ( std::chrono::steady_clock::now() - start ).count();
+    }
+    return seconds / repeats;
+}
+
+bool
+_same( const std::vector < float > & a, const std::vector < float > & b )
+{
+    for ( size_t i = 0 ; i < a.size() ; i++ ) {
+        if ( std::isnan( a[i] ) != std::isnan( b[i] ) ||
+             ( ! std::isnan( a[i] ) && std::abs( a[i] - b[i] ) > 1e-6f * std::max( 1.0f, std::abs( b[i] ) ) ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+int
+main( int argc, char ** argv )
+{
+    int width = argc > 2 ? atoi( argv[1] ) : 4096;
+    int height = argc > 2 ? atoi( argv[2] ) : 4096;
+    int repeats = argc > 3 ? atoi( argv[3] ) : 5;
+
+    std::vector < float > image = _mosaic( width, height );
+    std::vector < char > nanRows = nanRowsOf( image, 0, width, height );
+
+    std::vector < float > reference, plain, withRows;
+    std::vector < int32_t > referenceRuns, plainRuns, withRowsRuns;
+    double referenceSeconds = _time( repeats, image, reference, referenceRuns, [&] ( std::vector < float > & data ) {
+        return referenceNanEncodingsBlock( data, 0, width, height );
+    } );
+    double plainSeconds = _time( repeats, image, plain, plainRuns, [&] ( std::vector < float > & data ) {
+        return nanEncodingsBlock( data, 0, width, height, nullptr );
+    } );
+    double withRowsSeconds = _time( repeats, image, withRows, withRowsRuns, [&] ( std::vector < float > & data ) {
+        return nanEncodingsBlock( data, 0, width, height, nanRows.data() );
+    } );
+
+    printf( "mosaic %d x %d, %zu NaN runs\n", width, height, referenceRuns.size() / 2 );
+    printf( "%-28s %10.2f ms\n", "scalar (before)", 1000 * referenceSeconds );
+    printf( "%-28s %10.2f ms %6.1f x\n", "encoder", 1000 * plainSeconds, referenceSeconds / plainSeconds );
+    printf( "%-28s %10.2f ms %6.1f x\n", "encoder with NaN rows", 1000 * withRowsSeconds,
+            referenceSeconds / withRowsSeconds );
+
+    if ( plainRuns != referenceRuns || withRowsRuns != referenceRuns ||
+         ! _same( plain, reference ) || ! _same( withRows, reference ) ) {
+        printf( "the encodings disagree\n" );
+        return 1;
+    }
+    return 0;
+} // main
@@ -0,0 +1,127 @@
+/**
+ * Checks the NaN encoding of the raster images (NanRunEncoder and fillNanBlocks())
+ * against the scalar one it replaced: the run lengths have to be the same and so have
+ * the values ZFP gets, on images without NaNs, blank ones, ones with blank borders and
+ * scattered NaNs, of sizes that are no multiples of the 4 x 4 ZFP blocks or the SIMD
+ * lanes, encoded in subsets at an offset, with and without the NaN rows of the down
+ * sampling.
+ *
+ * usage: nanEncodingTest
+ **/
+
+#include "nanEncoding.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+const float NaN = std::numeric_limits < float >::quiet_NaN();
+
+/// w x h image of the given pattern
+std::vector < float >
+_image( const std::string & pattern, int w, int h )
+{
+    std::vector < float > image( int64_t( w ) * h );
+    for ( int y = 0 ; y < h ; y++ ) {
+        for ( int x = 0 ; x < w ; x++ ) {
+            int64_t i = int64_t( y ) * w + x;
+            float value = std::sin( i * 0.1f ) + 2;
+            if ( pattern == "blank" ) {
+                value = NaN;
+            }
+            else if ( pattern == "border" ) {
+                // a tilted footprint, like a mosaic, with a blank border around it
+                if ( x < 3 + y / 3 || x > w - 5 - y / 4 || y < 2 || y > h - 3 ) {
+                    value = NaN;
+                }
+            }
+            else if ( pattern == "scattered" ) {
+                if ( i % 7 == 3 || i % 11 == 0 ) {
+                    value = NaN;
+                }
+            }
+            else if ( pattern == "rows" ) {
+                // whole blank rows and runs crossing the ends of rows
+                if ( y % 5 == 1 || ( y % 5 == 3 && ( x < 6 || x > w - 4 ) ) ) {
+                    value = NaN;
+                }
+            }
+            image[i] = value;
+        }
+    }
+    return image;
+}
+
+bool
+_sameValues( const std::vector < float > & a, const std::vector < float > & b )
+{
+    for ( size_t i = 0 ; i < a.size() ; i++ ) {
+        if ( std::isnan( a[i] ) != std::isnan( b[i] ) ||
+             ( ! std::isnan( a[i] ) && std::abs( a[i] - b[i] ) > 1e-6f * std::abs( b[i] ) ) ) {
+            printf( "value %zu is %g instead of %g\n", i, a[i], b[i] );
+            return false;
+        }
+    }
+    return true;
+}
+
+/// encodes the image in subsets as _makeRasterImageData does, with both implementations
+bool
+_check( const std::string & pattern, int w, int h, int subsets, bool withNanRows )
+{
+    std::vector < float > expected = _image( pattern, w, h );
+    std::vector < float > actual = expected;
+    std::vector < char > nanRows = nanRowsOf( actual, 0, w, h );
+    bool ok = true;
+    for ( int i = 0 ; i < subsets ; i++ ) {
+        int rowStart = i * ( h / subsets );
+        int rowEnd = i == subsets - 1 ? h : ( i + 1 ) * ( h / subsets );
+        int offset = rowStart * w;
+        std::vector < int32_t > expectedRuns = referenceNanEncodingsBlock( expected, offset, w, rowEnd - rowStart );
+        std::vector < int32_t > actualRuns = nanEncodingsBlock( actual, offset, w, rowEnd - rowStart,
+                                                               withNanRows ? nanRows.data() + rowStart : nullptr );
+        if ( actualRuns != expectedRuns ) {
+            printf( "subset %d: %zu runs instead of %zu\n", i, actualRuns.size(), expectedRuns.size() );
+            ok = false;
+        }
+    }
+    if ( ! _sameValues( actual, expected ) ) {
+        ok = false;
+    }
+    if ( ! ok ) {
+        printf( "%s %d x %d in %d subsets%s differs\n", pattern.c_str(), w, h, subsets,
+                withNanRows ? " with NaN rows" : "" );
+    }
+    return ok;
+}
+}
+
+int
+main()
+{
+    int failures = 0;
+    for ( const char * pattern : { "finite", "blank", "border", "scattered", "rows" } ) {
+        for ( int w : { 1, 3, 4, 9, 17, 64, 131 } ) {
+            for ( int h : { 1, 4, 7, 16, 33 } ) {
+                for ( int subsets : { 1, 3 } ) {
+                    if ( subsets > h ) {
+                        continue;
+                    }
+                    for ( bool withNanRows : { false, true } ) {
+                        failures += _check( pattern, w, h, subsets, withNanRows ) ? 0 : 1;
+                    }
+                }
+            }
+        }
+    }
+    if ( failures > 0 ) {
+        printf( "%d failures\n", failures );
+        return 1;
+    }
+    printf( "all NaN encodings agree\n" );
+    return 0;
+} // main
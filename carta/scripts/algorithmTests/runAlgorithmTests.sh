@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Runs the tests and benchmarks of the algorithms of carta/cpp, the benchmark
+# timings are printed with -s. Extra arguments are passed to py.test, e.g.
+# --cartaBuild=<build directory of carta/cpp>
+
+cd "$(dirname "$0")"
+py.test -v -s "$@"
@@ -0,0 +1,201 @@
+/**
+ * Compares the ways of scanning a float image through NdArray: the per pixel
+ * TypedView<double>::forEach(), the block forEach() converting to double and
+ * forEachSpan() over the native floats. All of them compute the same sum and
+ * range, which are checked against each other.
+ *
+ * usage: spanVisitorBenchmark [width height repeats]
+ **/
+
+#include "CartaLib/IImage.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace NdArray = Carta::Lib::NdArray;
+
+namespace
+{
+/// two dimensional view of floats held in memory
+class MemoryRawView
+    : public NdArray::RawViewInterface
+{
+public:
+
+    MemoryRawView( const std::vector < float > & pixels, int width, int height )
+        : m_pixels( pixels ), m_dims { width, height }, m_pos( 2, 0 )
+    { }
+
+    virtual PixelType
+    pixelType() override
+    {
+        return PixelType::Real32;
+    }
+
+    virtual const VI &
+    dims() override
+    {
+        return m_dims;
+    }
+
+    virtual const char *
+    get( const VI & pos ) override
+    {
+        return reinterpret_cast < const char * > ( & m_pixels[pos[1] * int64_t( m_dims[0] ) + pos[0]] );
+    }
+
+    virtual void
+    forEach( std::function < void (const char *) > func, Traversal traversal ) override
+    {
+        Q_UNUSED( traversal );
+        for ( const float & value : m_pixels ) {
+            func( reinterpret_cast < const char * > ( & value ) );
+        }
+    }
+
+    virtual const VI &
+    currentPos() override
+    {
+        return m_pos;
+    }
+
+    virtual RawViewInterface *
+    getView( const SliceND & sliceInfo ) override
+    {
+        Q_UNUSED( sliceInfo );
+        return nullptr;
+    }
+
+    virtual int64_t
+    read( int64_t buffSize, char * buff, Traversal traversal ) override
+    {
+        int64_t bytes = read( 0, buffSize, buff, traversal );
+        return bytes;
+    }
+
+    virtual void
+    seek( int64_t ind ) override
+    {
+        Q_UNUSED( ind );
+    }
+
+    virtual int64_t
+    read( int64_t chunk, int64_t buffSize, char * buff, Traversal traversal ) override
+    {
+        Q_UNUSED( traversal );
+        int64_t count = buffSize / sizeof( float );
+        int64_t first = chunk * count;
+        count = std::max < int64_t > ( 0, std::min < int64_t > ( count, m_pixels.size() - first ) );
+        std::copy( m_pixels.begin() + first, m_pixels.begin() + first + count,
+                   reinterpret_cast < float * > ( buff ) );
+        return count * sizeof( float );
+    }
+
+    virtual void
+    forEach( int64_t buffSize, std::function < void (const char *, int64_t count) > func,
+             char * buff, Traversal traversal ) override
+    {
+        Q_UNUSED( buff );
+        Q_UNUSED( traversal );
+        int64_t blockSize = std::max < int64_t > ( 1, buffSize / sizeof( float ) );
+        for ( int64_t first = 0 ; first < int64_t( m_pixels.size() ) ; first += blockSize ) {
+            int64_t count = std::min < int64_t > ( blockSize, m_pixels.size() - first );
+            func( reinterpret_cast < const char * > ( m_pixels.data() + first ), count );
+        }
+    }
+
+private:
+
+    const std::vector < float > & m_pixels;
+    VI m_dims;
+    VI m_pos;
+};
+
+/// sum and range of the finite pixels
+struct Statistics
+{
+    double sum = 0;
+    double min = std::numeric_limits < double >::max();
+    double max = std::numeric_limits < double >::lowest();
+
+    void
+    add( double value )
+    {
+        if ( std::isfinite( value ) ) {
+            sum += value;
+            min = std::min( min, value );
+            max = std::max( max, value );
+        }
+    }
+
+    template < typename T >
+    void
+    operator() ( const T * values, int64_t count )
+    {
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            add( values[i] );
+        }
+    }
+};
+
+template < class Scan >
+Statistics
+_time( const char * name, int repeats, int64_t pixels, Scan scan )
+{
+    Statistics statistics;
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0 ; i < repeats ; i++ ) {
+        statistics = Statistics();
+        scan( statistics );
+    }
+    double seconds = std::chrono::duration < double > ( std::chrono::steady_clock::now() - start ).count();
+    printf( "%-28s %10.2f ms %10.1f Mpixel/s\n", name, 1000 * seconds / repeats,
+            pixels * double( repeats ) / seconds / 1e6 );
+    return statistics;
+}
+
+bool
+_same( const Statistics & a, const Statistics & b )
+{
+    return std::abs( a.sum - b.sum ) <= 1e-9 * std::abs( a.sum ) && a.min == b.min && a.max == b.max;
+}
+}
+
+int
+main( int argc, char ** argv )
+{
+    int width = argc > 2 ? atoi( argv[1] ) : 4096;
+    int height = argc > 2 ? atoi( argv[2] ) : 4096;
+    int repeats = argc > 3 ? atoi( argv[3] ) : 5;
+
+    // smooth data with a few NaNs, like a typical image
+    std::vector < float > pixels( int64_t( width ) * height );
+    for ( int64_t i = 0 ; i < int64_t( pixels.size() ) ; i++ ) {
+        pixels[i] = i % 1009 == 0 ? std::numeric_limits < float >::quiet_NaN() : std::sin( i * 1e-3f );
+    }
+    MemoryRawView rawView( pixels, width, height );
+    NdArray::Double doubleView( & rawView, false );
+    int64_t n = pixels.size();
+
+    Statistics perPixel = _time( "per pixel forEach", repeats, n, [&] ( Statistics & s ) {
+        doubleView.forEach( [&s] ( const double & value ) { s.add( value ); } );
+    } );
+    Statistics block = _time( "block forEach (double)", repeats, n, [&] ( Statistics & s ) {
+        doubleView.forEach( NdArray::Double::DEFAULT_BLOCK_SIZE, [&s] ( const double * values, int64_t count ) {
+            s( values, count );
+        } );
+    } );
+    Statistics span = _time( "forEachSpan (float)", repeats, n, [&] ( Statistics & s ) {
+        NdArray::forEachSpan( & rawView, s );
+    } );
+
+    if ( ! _same( perPixel, block ) || ! _same( perPixel, span ) ) {
+        printf( "the scans disagree: %g %g %g\n", perPixel.sum, block.sum, span.sum );
+        return 1;
+    }
+    return 0;
+} // main
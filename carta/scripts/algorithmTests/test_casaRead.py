@@ -0,0 +1,17 @@
+"""
+Throughput of sessions reading casacore images in parallel through the CasaImageLoader,
+with a cube per session and with one cube shared by all of them. The program fails if
+a plane read differs from the one written.
+"""
+
+from conftest import run
+
+
+def test_casaReadBenchmark(build, tmp_path):
+    benchmark = build('casaReadBenchmark', sources=['plugins/CasaImageLoader/CCImage.cpp',
+                                                    'plugins/CasaImageLoader/CCMetaDataInterface.cpp',
+                                                    'plugins/CasaImageLoader/CCCoordinateFormatter.cpp',
+                                                    'plugins/CasaImageLoader/CCRawView.cpp',
+                                                    'plugins/CasaImageLoader/CCTileCache.cpp'],
+                      cartaLib=True, packages=['casacore'])
+    run(benchmark, tmp_path, 1024, 1024, 32, 8)
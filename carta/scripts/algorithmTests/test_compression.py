@@ -0,0 +1,11 @@
+"""
+Round trips of the half float and lossless raster codecs, the program fails if a value
+does not come back as it should or a broken LZ4 block is accepted.
+"""
+
+from conftest import run
+
+
+def test_compression(build):
+    test = build('compressionTest', sources=['core/Algorithms/compressionAlgorithms.cpp'])
+    run(test)
@@ -0,0 +1,19 @@
+"""
+Block means of the raster down sampling: the test compares blockMeans() with a
+scalar reference, the benchmark times it against the per pixel loop it replaced for
+block sizes from 1 to 32. Both programs fail if the means disagree.
+"""
+
+from conftest import run
+
+SOURCES = ['core/Algorithms/downsampleAlgorithms.cpp']
+
+
+def test_downsample(build):
+    test = build('downsampleTest', sources=SOURCES)
+    run(test)
+
+
+def test_downsampleBenchmark(build):
+    benchmark = build('downsampleBenchmark', sources=SOURCES)
+    run(benchmark, 4096, 4096, 3)
@@ -0,0 +1,14 @@
+"""
+Opens and reads small synthetic files with the HDF5 image loader, the program fails
+if a value differs from the one written or a file that is not an IDIA image is
+accepted.
+"""
+
+from conftest import run
+
+
+def test_hdf5Idia(build, tmp_path):
+    test = build('hdf5IdiaTest', sources=['plugins/Hdf5IdiaLoader/Hdf5IdiaFile.cpp',
+                                          'plugins/Hdf5IdiaLoader/Hdf5IdiaRawView.cpp'],
+                 cartaLib=True, packages=['hdf5'])
+    run(test, tmp_path)
@@ -0,0 +1,19 @@
+"""
+NaN encoding of the raster images: the test compares NanRunEncoder and fillNanBlocks()
+with the scalar encoding they replaced, the benchmark times them on a mosaic with
+blank borders. Both programs fail if the encodings disagree.
+"""
+
+from conftest import run
+
+SOURCES = ['core/Algorithms/downsampleAlgorithms.cpp']
+
+
+def test_nanEncoding(build):
+    test = build('nanEncodingTest', sources=SOURCES)
+    run(test)
+
+
+def test_nanEncodingBenchmark(build):
+    benchmark = build('nanEncodingBenchmark', sources=SOURCES)
+    run(benchmark, 4096, 4096, 5)
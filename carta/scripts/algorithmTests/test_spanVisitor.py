@@ -0,0 +1,11 @@
+"""
+Microbenchmark of the NdArray span visitor against the per pixel and the block
+forEach, the program fails if the three scans disagree.
+"""
+
+from conftest import run
+
+
+def test_spanVisitorBenchmark(build):
+    benchmark = build('spanVisitorBenchmark', cartaLib=True)
+    run(benchmark, 4096, 4096, 5)
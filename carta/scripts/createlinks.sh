@@ -64,6 +64,20 @@ rmsymlink wcslib-shared/include
 ln -s $LIBWCS wcslib-shared/include
 ln -s $GNULIB  wcslib-shared/lib
 
+#
+# hdf5 installation location (libhdf5-dev), only needed by the HDF5 image loader
+# change this if you installed it in your own directory
+#
+export LIBHDF5=$GNULIB/hdf5/serial
+if [ -d $LIBHDF5 ]
+then
+	mkdir -p hdf5
+	rmsymlink hdf5/lib
+	rmsymlink hdf5/include
+	ln -s $LIBHDF5 hdf5/lib
+	ln -s /usr/include/hdf5/serial hdf5/include
+fi
+
 #
 #rapidjson installation location
 #
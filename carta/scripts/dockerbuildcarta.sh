@@ -11,6 +11,10 @@ ln -s $HOME/src/CARTAvis-externals/ThirdParty/ast-8.0.2 $HOME/src/CARTAvis-exter
 ln -s $HOME/src/CARTAvis-externals/ThirdParty/casaCore $HOME/src/CARTAvis-externals/ThirdParty/casacore
 ln -s $HOME/src/CARTAvis-externals/ThirdParty/cfitsio-shared $HOME/src/CARTAvis-externals/ThirdParty/cfitsio
 ln -s $HOME/src/CARTAvis-externals/ThirdParty/ImageAnalysis $HOME/src/CARTAvis-externals/ThirdParty/imageanalysis
+# the HDF5 image loader is skipped when the image has no hdf5
+if [ -d $HOME/src/CARTAvis-externals/ThirdParty/hdf5-shared ] ; then
+    ln -s $HOME/src/CARTAvis-externals/ThirdParty/hdf5-shared $HOME/src/CARTAvis-externals/ThirdParty/hdf5
+fi
 
 cp $HOME/src/CARTAvis/carta/scripts/runScriptedClientTests.sh $HOME
 # cp $HOME/src/CARTAvis/carta/scripts/startCARTAServer.sh $HOME
@@ -170,6 +170,18 @@ cd cfitsio-src
 make && make install
 cd ..
 
+## hdf5-1.10.1, only needed by the HDF5 image loader (Hdf5IdiaLoader), which is not
+## built without it
+echo "build hdf5"
+cd $cartawork/CARTAvis-externals/ThirdParty
+curl -O -L https://support.hdfgroup.org/ftp/HDF5/releases/hdf5-1.10/hdf5-1.10.1/src/hdf5-1.10.1.tar.gz
+tar xvfz hdf5-1.10.1.tar.gz > /dev/null
+mv hdf5-1.10.1 hdf5-1.10.1-src
+cd hdf5-1.10.1-src
+./configure --prefix=`pwd`/../hdf5/
+make && make install
+cd ..
+
 echo "build ast"
 cd $cartawork/CARTAvis-externals/ThirdParty
 ## ast: carta only, static linking with CARTA